@@ -137,6 +137,23 @@ namespace Invader {
          */
         void read_color_plate(GeneratedBitmapData &generated_bitmap, const Pixel *pixels, std::uint32_t width, bool reg_point_hack) const;
 
+        /** Bitmaps found in a sequence, or the first error found in it */
+        struct ScannedSequence {
+            std::vector<GeneratedBitmapDataBitmap> bitmaps;
+            const char *error = nullptr;
+            std::uint32_t error_value = 0;
+        };
+
+        /**
+         * Read the bitmaps in a sequence of the color plate
+         * @param sequence       sequence to read
+         * @param pixels         pixel input
+         * @param width          width of input
+         * @param reg_point_hack ignore sequence edges
+         * @return               bitmaps found
+         */
+        ScannedSequence read_color_plate_sequence(const GeneratedBitmapDataSequence &sequence, const Pixel *pixels, std::uint32_t width, bool reg_point_hack) const;
+
         /**
          * Read an unrolled cubemap
          * @param generated_bitmap bitmap data to write to (output)
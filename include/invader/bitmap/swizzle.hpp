@@ -18,6 +18,29 @@ namespace Invader::Swizzle {
      * @output               (de)swizzled data
      */
     std::vector<std::byte> swizzle(const std::byte *data, std::size_t bits_per_pixel, std::size_t width, std::size_t height, std::size_t depth, bool deswizzle);
+
+    /**
+     * Swizzle the pixel data into a buffer
+     * @param data           raw pixel data
+     * @param output         buffer to write (de)swizzled data to (must be width*height*depth*bits_per_pixel/8 bytes; can be the same as data)
+     * @param bits_per_pixel number of bits per pixel (can be 8, 16, 32, 64)
+     * @param width          width in pixels
+     * @param height         height in pixels
+     * @param depth          depth in bitmaps
+     * @param deswizzle      deswizzle instead of swizzle
+     */
+    void swizzle(const std::byte *data, std::byte *output, std::size_t bits_per_pixel, std::size_t width, std::size_t height, std::size_t depth, bool deswizzle);
+
+    /**
+     * Swizzle the pixel data in place without making a copy of it
+     * @param data           raw pixel data
+     * @param bits_per_pixel number of bits per pixel (can be 8, 16, 32, 64)
+     * @param width          width in pixels
+     * @param height         height in pixels
+     * @param depth          depth in bitmaps
+     * @param deswizzle      deswizzle instead of swizzle
+     */
+    void swizzle_in_place(std::byte *data, std::size_t bits_per_pixel, std::size_t width, std::size_t height, std::size_t depth, bool deswizzle);
 }
 
 #endif
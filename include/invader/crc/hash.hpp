@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef INVADER__CRC__HASH_HPP
+#define INVADER__CRC__HASH_HPP
+
+#include <compare>
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace Invader {
+    /**
+     * 128-bit non-cryptographic content hash (used for identifying file contents and cache keys)
+     */
+    struct ContentHash {
+        std::uint64_t low = 0;
+        std::uint64_t high = 0;
+
+        /**
+         * Get the hash as a 32 character lowercase hexadecimal string
+         * @return hexadecimal string
+         */
+        std::string to_string() const;
+
+        /**
+         * Parse a hash from a 32 character hexadecimal string
+         * @param  string string to parse
+         * @param  hash   hash to write to on success
+         * @return        true if the string was valid
+         */
+        static bool from_string(const char *string, ContentHash &hash) noexcept;
+
+        auto operator<=>(const ContentHash &) const noexcept = default;
+    };
+
+    /**
+     * Hash the data (MurmurHash3 x64 128-bit), optionally chaining from a previous hash
+     * @param  data pointer to data
+     * @param  size size of data
+     * @param  seed hash to continue from
+     * @return      hash of the data
+     */
+    ContentHash hash_data(const void *data, std::size_t size, const ContentHash &seed = ContentHash()) noexcept;
+
+    /**
+     * Hash the data, optionally chaining from a previous hash
+     * @param  data data to hash
+     * @param  seed hash to continue from
+     * @return      hash of the data
+     */
+    inline ContentHash hash_data(const std::vector<std::byte> &data, const ContentHash &seed = ContentHash()) noexcept {
+        return hash_data(data.data(), data.size(), seed);
+    }
+
+    /**
+     * Hash a string (including its length), optionally chaining from a previous hash
+     * @param  string string to hash
+     * @param  seed   hash to continue from
+     * @return        hash of the string
+     */
+    inline ContentHash hash_string(const std::string &string, const ContentHash &seed = ContentHash()) noexcept {
+        std::uint64_t length = string.size();
+        return hash_data(string.data(), string.size(), hash_data(&length, sizeof(length), seed));
+    }
+
+    /**
+     * Hash a value's object representation, optionally chaining from a previous hash
+     * @param  value value to hash (must not contain padding)
+     * @param  seed  hash to continue from
+     * @return       hash of the value
+     */
+    template <typename T> inline ContentHash hash_value(const T &value, const ContentHash &seed = ContentHash()) noexcept {
+        static_assert(std::is_trivially_copyable_v<T>);
+        return hash_data(&value, sizeof(value), seed);
+    }
+}
+
+#endif
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef INVADER__DEPENDENCY__DEPENDENCY_INDEX_HPP
+#define INVADER__DEPENDENCY__DEPENDENCY_INDEX_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <vector>
+
+#include "../file/file.hpp"
+
+namespace Invader {
+    /**
+     * Index of the dependencies of every tag in a set of tags directories, with reverse edges, which can be saved to a file
+     * and updated on later runs by only reading tags that changed
+     */
+    class DependencyIndex {
+    public:
+        /**
+         * Indexed tag
+         */
+        struct Entry {
+            /** Path to the tag file */
+            std::filesystem::path file_path;
+
+            /** Size of the tag file when it was read */
+            std::uintmax_t file_size = 0;
+
+            /** Modification time of the tag file when it was read */
+            std::int64_t file_time = 0;
+
+            /** Whether the tag could be read (if not, dependencies is empty) */
+            bool valid = false;
+
+            /** Tags referenced by this tag (Halo paths) */
+            std::vector<File::TagFilePath> dependencies;
+        };
+
+        /**
+         * Read the dependencies of a tag
+         * @param  tag_data        tag file data
+         * @param  tag_data_length length of the tag file data
+         * @return                 tags referenced by the tag (Halo paths)
+         * @throws                 if the tag could not be parsed
+         */
+        static std::vector<File::TagFilePath> read_dependencies(const std::byte *tag_data, std::size_t tag_data_length);
+
+        /**
+         * Load the index from a file (if it exists and is valid) and update it to match the tags directories, reading only
+         * tags that were added or changed since it was saved
+         * @param  index_file   path to the index file
+         * @param  tags         tags directories in order of precedence
+         * @param  thread_count number of threads to read tags with (0 to use the default)
+         * @return              up-to-date index
+         */
+        static DependencyIndex load(const std::filesystem::path &index_file, const std::vector<std::filesystem::path> &tags, std::size_t thread_count = 0);
+
+        /**
+         * Save the index to a file
+         * @param  index_file path to the index file
+         * @return            true on success; false on failure
+         */
+        bool save(const std::filesystem::path &index_file) const;
+
+        /**
+         * Get an indexed tag
+         * @param  tag path (Halo path) and class of the tag
+         * @return     indexed tag or nullptr if it isn't in any tags directory
+         */
+        const Entry *get_tag(const File::TagFilePath &tag) const;
+
+        /**
+         * Get the tags that reference a tag
+         * @param  tag path (Halo path) and class of the tag
+         * @return     tags that reference the tag, sorted by path
+         */
+        const std::vector<File::TagFilePath> &get_dependents(const File::TagFilePath &tag) const;
+
+        /**
+         * Get all indexed tags
+         * @return indexed tags, sorted by path
+         */
+        const std::map<File::TagFilePath, Entry> &get_tags() const noexcept {
+            return this->tags;
+        }
+
+        /**
+         * Get the number of tags that had to be read when loading the index
+         * @return number of tags read
+         */
+        std::size_t get_read_count() const noexcept {
+            return this->read_count;
+        }
+
+        /**
+         * Get whether the index is different from the index file it was loaded from (and thus needs to be saved)
+         * @return true if different
+         */
+        bool is_modified() const noexcept {
+            return this->modified;
+        }
+
+    private:
+        std::map<File::TagFilePath, Entry> tags;
+        std::map<File::TagFilePath, std::vector<File::TagFilePath>> dependents;
+        std::size_t read_count = 0;
+        bool modified = false;
+
+        void build_dependents();
+    };
+}
+
+#endif
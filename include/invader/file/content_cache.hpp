@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef INVADER__FILE__CONTENT_CACHE_HPP
+#define INVADER__FILE__CONTENT_CACHE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+#include "../crc/hash.hpp"
+
+namespace Invader::File {
+    /**
+     * Content-addressed on-disk cache of generated data, keyed by a hash of everything that went into making it
+     */
+    class ContentCache {
+    public:
+        /**
+         * Load a cached entry, marking it as recently used
+         * @param  key key of the entry
+         * @return     data of the entry or std::nullopt if not cached
+         */
+        std::optional<std::vector<std::byte>> load(const ContentHash &key) const;
+
+        /**
+         * Check if an entry is cached without loading it or marking it as recently used
+         * @param  key key of the entry
+         * @return     true if cached
+         */
+        bool contains(const ContentHash &key) const;
+
+        /**
+         * Store an entry in the cache, replacing any existing entry
+         * @param  key  key of the entry
+         * @param  data data to store
+         * @return      true on success; false on failure
+         */
+        bool store(const ContentHash &key, const std::vector<std::byte> &data) const;
+
+        /**
+         * Delete the least recently used entries until the total size of all entries is no more than the given size
+         * @param  max_size maximum total size in bytes
+         * @return          number of entries deleted
+         */
+        std::size_t trim(std::uintmax_t max_size) const;
+
+        /**
+         * Get the directory of the cache
+         * @return directory of the cache
+         */
+        const std::filesystem::path &get_directory() const noexcept {
+            return this->directory;
+        }
+
+        /**
+         * Instantiate a cache
+         * @param directory directory to hold the cache (created on first store)
+         * @param extension file extension for entries
+         */
+        ContentCache(const std::filesystem::path &directory, const char *extension = ".bin");
+
+    private:
+        std::filesystem::path directory;
+        const char *extension;
+
+        std::filesystem::path path_for_key(const ContentHash &key) const;
+    };
+}
+
+#endif
@@ -76,6 +76,15 @@ namespace Invader::File {
      */
     bool save_file(const std::filesystem::path &path, const std::vector<std::byte> &data);
 
+    /**
+     * Attempt to save the file by writing it to a temporary file next to it and then moving it in place, so the file
+     * is never left partially written if saving is interrupted
+     * @param  path path to the file
+     * @param  data data to write
+     * @return      true on success; false on failure
+     */
+    bool save_file_atomically(const std::filesystem::path &path, const std::vector<std::byte> &data);
+
     /**
      * Convert a tag path to a file path for one tags directory. The file must exist, or std::nullopt will be returned.
      * @param  tag_path   tag path to use
@@ -163,9 +172,10 @@ namespace Invader::File {
      * @param  filter_duplicates filter out duplicates (by default)
      * @param  status            optional pointer to a size_t to store the current number of tags loaded (for status messages)
      * @param  errors            optional pointer to hold the number of errors
-     * @return                   all tags in the folder
+     * @param  listing_cache     optional directory to cache directory listings in, so directories that weren't modified since the last time don't need to be listed again
+     * @return                   all tags in the folder, sorted by tag path within each tags directory
      */
-    std::vector<TagFile> load_virtual_tag_folder(const std::vector<std::filesystem::path> &tags, bool filter_duplicates = true, std::pair<std::mutex, std::size_t> *status = nullptr, std::size_t *errors = nullptr);
+    std::vector<TagFile> load_virtual_tag_folder(const std::vector<std::filesystem::path> &tags, bool filter_duplicates = true, std::pair<std::mutex, std::size_t> *status = nullptr, std::size_t *errors = nullptr, const std::optional<std::filesystem::path> &listing_cache = std::nullopt);
 
     /**
      * Convert the tag path to a path using the system's preferred separators
@@ -117,6 +117,78 @@ namespace Invader::HEK {
         }
     };
 
+    /**
+     * Get the size of a struct from its swap layout
+     * @param  layout swap layout (see swap_endian_struct_array())
+     * @return        size of the struct in bytes
+     */
+    template <std::size_t N> constexpr std::size_t swap_layout_size(const std::int16_t (&layout)[N]) noexcept {
+        std::size_t size = 0;
+        for(auto s : layout) {
+            size += s < 0 ? -s : s;
+        }
+        return size;
+    }
+
+    /**
+     * Swap the endianness of every field in an array of structs in place. If every field is the same size, the whole
+     * array is swapped as one run of integers so it can be vectorized.
+     * @param data   array of structs
+     * @param count  number of structs
+     * @param layout layout of each struct: a positive number is a field of that many bytes (2 or 4) to swap, and a
+     *               negative number is that many bytes (padding or single bytes) to leave alone
+     */
+    template <std::size_t N> inline void swap_endian_struct_array(std::byte *data, std::size_t count, const std::int16_t (&layout)[N]) noexcept {
+        constexpr auto swap_16 = [](std::byte *value) {
+            std::uint16_t v;
+            std::memcpy(&v, value, sizeof(v));
+            v = static_cast<std::uint16_t>((v >> 8) | (v << 8));
+            std::memcpy(value, &v, sizeof(v));
+        };
+        constexpr auto swap_32 = [](std::byte *value) {
+            std::uint32_t v;
+            std::memcpy(&v, value, sizeof(v));
+            v = (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24);
+            std::memcpy(value, &v, sizeof(v));
+        };
+
+        std::size_t struct_size = swap_layout_size(layout);
+        bool all_32 = true;
+        bool all_16 = true;
+        for(auto s : layout) {
+            all_32 = all_32 && s == 4;
+            all_16 = all_16 && s == 2;
+        }
+
+        if(all_32) {
+            std::size_t total = struct_size * count;
+            for(std::size_t i = 0; i < total; i += 4) {
+                swap_32(data + i);
+            }
+            return;
+        }
+        if(all_16) {
+            std::size_t total = struct_size * count;
+            for(std::size_t i = 0; i < total; i += 2) {
+                swap_16(data + i);
+            }
+            return;
+        }
+
+        for(std::size_t i = 0; i < count; i++) {
+            auto *field = data + i * struct_size;
+            for(auto s : layout) {
+                if(s == 4) {
+                    swap_32(field);
+                }
+                else if(s == 2) {
+                    swap_16(field);
+                }
+                field += s < 0 ? -s : s;
+            }
+        }
+    }
+
     #ifdef __BYTE_ORDER__
         #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
             #define LittleEndian NativeEndian
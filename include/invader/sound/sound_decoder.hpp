@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef INVADER__SOUND__SOUND_DECODER_HPP
+#define INVADER__SOUND__SOUND_DECODER_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../crc/hash.hpp"
+#include "../tag/hek/definition.hpp"
+#include "../thread/thread_pool.hpp"
+
+namespace Invader::SoundDecoder {
+    /**
+     * Part of a permutation to decode (split permutations have one part per permutation in the chain)
+     */
+    struct EncodedPart {
+        /** Format of the data */
+        HEK::SoundFormat format;
+
+        /** Pointer to the data (this is copied, so it only needs to be valid until decode() returns) */
+        const std::byte *data;
+
+        /** Size of the data in bytes */
+        std::size_t size;
+    };
+
+    /**
+     * Permutation that is being decoded or has been decoded to 16-bit PCM. Parts are decoded in parallel, and each
+     * part's PCM becomes available as soon as every part before it is done, so playback can start before the rest is
+     * decoded.
+     */
+    class DecodedSound {
+    public:
+        /**
+         * Get the number of channels
+         * @return number of channels
+         */
+        std::size_t get_channel_count() const noexcept {
+            return this->channel_count;
+        }
+
+        /**
+         * Get the sample rate
+         * @return sample rate in Hz
+         */
+        std::size_t get_sample_rate() const noexcept {
+            return this->sample_rate;
+        }
+
+        /**
+         * Get the number of parts decoded so far (including ones waiting on a previous part) and the total number of parts
+         * @param decoded number of parts decoded
+         * @param total   total number of parts
+         */
+        void get_progress(std::size_t &decoded, std::size_t &total) const;
+
+        /**
+         * Get whether everything has been decoded or decoding has failed
+         * @return true if finished or failed
+         */
+        bool is_finished() const;
+
+        /**
+         * Get the error if decoding failed
+         * @return error message or std::nullopt if it did not fail (yet)
+         */
+        std::optional<std::string> get_error() const;
+
+        /**
+         * Get the number of bytes of 16-bit PCM available so far
+         * @return number of bytes
+         */
+        std::size_t get_available_size() const;
+
+        /**
+         * Copy decoded 16-bit PCM that is available
+         * @param  offset offset in bytes
+         * @param  output buffer to copy to
+         * @param  size   maximum number of bytes to copy
+         * @return        number of bytes copied
+         */
+        std::size_t read(std::size_t offset, std::byte *output, std::size_t size) const;
+
+        /**
+         * Wait until everything is decoded
+         * @return 16-bit PCM of the whole permutation
+         * @throws InvalidInputSoundException if decoding failed
+         */
+        const std::vector<std::byte> &wait() const;
+
+        DecodedSound(std::size_t part_count, std::size_t channel_count, std::size_t sample_rate);
+
+    private:
+        friend class Decoder;
+
+        std::size_t channel_count;
+        std::size_t sample_rate;
+
+        mutable std::mutex mutex;
+        mutable std::condition_variable updated;
+
+        std::vector<std::byte> pcm;
+        std::vector<std::optional<std::vector<std::byte>>> parts;
+        std::size_t contiguous_parts = 0;
+        std::size_t decoded_parts = 0;
+        std::optional<std::string> error;
+
+        void finish_part(std::size_t part, std::vector<std::byte> &&part_pcm);
+        void fail(const std::string &error);
+    };
+
+    /**
+     * Decodes permutations on a background thread pool, keeping the most recently requested ones in memory
+     */
+    class Decoder {
+    public:
+        /**
+         * Start decoding a permutation, or get it from the cache if it was requested recently
+         * @param  parts         parts of the permutation, in order
+         * @param  channel_count number of channels
+         * @param  sample_rate   sample rate in Hz
+         * @return               permutation being decoded
+         */
+        std::shared_ptr<const DecodedSound> decode(const std::vector<EncodedPart> &parts, std::size_t channel_count, std::size_t sample_rate);
+
+        /**
+         * Instantiate a decoder
+         * @param max_cache_size maximum total size of decoded PCM in bytes to keep in memory after it's no longer in use (0 to not cache)
+         * @param thread_count   number of threads to decode with (0 to use the default)
+         */
+        Decoder(std::size_t max_cache_size = 64 * 1024 * 1024, std::size_t thread_count = 0);
+
+        /**
+         * Discard anything not yet decoded (failing it) and stop the threads
+         */
+        ~Decoder();
+
+        Decoder(const Decoder &) = delete;
+        Decoder &operator=(const Decoder &) = delete;
+
+    private:
+        std::size_t max_cache_size;
+
+        // Most recently used first
+        std::list<std::pair<ContentHash, std::shared_ptr<DecodedSound>>> cache;
+        std::map<ContentHash, decltype(cache)::iterator> cache_index;
+
+        std::vector<std::weak_ptr<DecodedSound>> in_progress;
+
+        ThreadPool pool;
+
+        void trim_cache();
+    };
+}
+
+#endif
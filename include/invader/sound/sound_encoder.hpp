@@ -57,9 +57,11 @@ namespace Invader::SoundEncoder {
      * @param pcm             PCM data
      * @param bits_per_sample bits per sample of the PCM data
      * @param channel_count   number of channels
+     * @param thread_count    maximum number of threads to encode long streams with (0 to use one per hardware thread)
+     * @param high_quality    look further ahead when picking each sample; this is slightly more accurate but much slower
      * @return                Xbox ADPCM data
      */
-    std::vector<std::byte> encode_to_xbox_adpcm(const std::vector<std::byte> &pcm, std::size_t bits_per_sample, std::size_t channel_count);
+    std::vector<std::byte> encode_to_xbox_adpcm(const std::vector<std::byte> &pcm, std::size_t bits_per_sample, std::size_t channel_count, std::size_t thread_count = 1, bool high_quality = false);
     
     /**
      * Calculate the PCM block size to use for encoding to ADPCM. Basically the number of samples must be a multiple of this.
@@ -93,6 +95,15 @@ namespace Invader::SoundEncoder {
      */
     std::vector<float> convert_int_to_float(const std::vector<std::byte> &pcm, std::size_t bits_per_sample);
 
+    /**
+     * Convert a block of integer PCM to float PCM.
+     * @param pcm             PCM data
+     * @param sample_count    number of samples (counting each channel) to convert
+     * @param bits_per_sample bits per sample
+     * @param output          pointer to write sample_count floats to
+     */
+    void convert_int_to_float(const std::byte *pcm, std::size_t sample_count, std::size_t bits_per_sample, float *output) noexcept;
+
     /**
      * Encode from one PCM size to another. This is lossy unless the PCM data was originally integer PCM of the same bitness or smaller.
      * @param pcm                 PCM data
@@ -100,6 +111,77 @@ namespace Invader::SoundEncoder {
      */
     std::vector<std::byte> convert_float_to_int(const std::vector<float> &pcm, std::size_t new_bits_per_sample);
 
+    /**
+     * Convert a block of float PCM to integer PCM.
+     * @param pcm                 PCM data
+     * @param sample_count        number of samples (counting each channel) to convert
+     * @param new_bits_per_sample new bits per sample
+     * @param output              pointer to write sample_count samples to
+     */
+    void convert_float_to_int(const float *pcm, std::size_t sample_count, std::size_t new_bits_per_sample, std::byte *output) noexcept;
+
+    /**
+     * Convert mono PCM to stereo PCM by duplicating the channel.
+     * @param pcm             PCM data
+     * @param bits_per_sample bits per sample
+     * @return                stereo PCM data
+     */
+    std::vector<std::byte> convert_mono_to_stereo(const std::vector<std::byte> &pcm, std::size_t bits_per_sample);
+
+    /**
+     * Convert stereo PCM to mono PCM by averaging the two channels.
+     * @param pcm             PCM data
+     * @param bits_per_sample bits per sample
+     * @return                mono PCM data
+     */
+    std::vector<std::byte> convert_stereo_to_mono(const std::vector<std::byte> &pcm, std::size_t bits_per_sample);
+
+    /**
+     * Streaming sample rate converter. Blocks of interleaved float samples go in, and resampled samples come out.
+     */
+    class Resampler {
+    public:
+        /**
+         * Resample a block of samples
+         * @param input        interleaved input samples
+         * @param frame_count  number of frames (one sample for each channel) in the input
+         * @param end_of_input this is the last block, so flush everything that is still buffered
+         * @param output       vector to append the resampled samples to
+         * @throws             SoundEncodeFailureException if resampling failed
+         */
+        void process(const float *input, std::size_t frame_count, bool end_of_input, std::vector<float> &output);
+
+        /**
+         * Instantiate a resampler
+         * @param channel_count number of channels
+         * @param ratio         output sample rate divided by input sample rate
+         */
+        Resampler(std::size_t channel_count, double ratio);
+        ~Resampler();
+
+        Resampler(const Resampler &) = delete;
+        Resampler &operator=(const Resampler &) = delete;
+
+    private:
+        void *state;
+        std::size_t channel_count;
+        double ratio;
+    };
+
+    /**
+     * Resample integer PCM. This is done block by block, so only one block is ever held as float PCM at once.
+     * @param pcm                 PCM data
+     * @param sample_count        number of samples (counting each channel)
+     * @param bits_per_sample     bits per sample of the PCM data
+     * @param new_bits_per_sample bits per sample of the output
+     * @param channel_count       channel count
+     * @param ratio               output sample rate divided by input sample rate
+     * @param max_sample_count    stop once this many samples (counting each channel) have been output
+     * @return                    resampled PCM data
+     * @throws                    SoundEncodeFailureException if resampling failed
+     */
+    std::vector<std::byte> resample_int(const std::byte *pcm, std::size_t sample_count, std::size_t bits_per_sample, std::size_t new_bits_per_sample, std::size_t channel_count, double ratio, std::size_t max_sample_count = SIZE_MAX);
+
     /**
      * Read the little sample as an int.
      * @param  pcm             pointer to sample
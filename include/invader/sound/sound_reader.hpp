@@ -90,9 +90,10 @@ namespace Invader::SoundReader {
      * @param  data_length   data size
      * @param  channel_count number of channels
      * @param  sample_rate   sample rate in Hz
+     * @param  thread_count  maximum number of threads to decode long streams with (0 to use one per hardware thread)
      * @return               sound
      */
-    Sound sound_from_xbox_adpcm(const std::byte *data, std::size_t data_length, std::size_t channel_count, std::size_t sample_rate);
+    Sound sound_from_xbox_adpcm(const std::byte *data, std::size_t data_length, std::size_t channel_count, std::size_t sample_rate, std::size_t thread_count = 0);
 
     /**
      * Get the sound from 16-bit big endian PCM
@@ -0,0 +1,101 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef INVADER__TAG__PARSER__ALLOCATOR_HPP
+#define INVADER__TAG__PARSER__ALLOCATOR_HPP
+
+#include <cstddef>
+#include <memory_resource>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Allocation of the reflexive arrays in Parser structs.
+ *
+ * By default, reflexives are allocated on the heap like any other vector. While a ScopedAllocationResource is active on
+ * a thread, reflexives constructed on that thread (including the reflexives of every struct in them) are allocated from
+ * its memory resource instead, so a whole parsed tag can be allocated from a std::pmr::monotonic_buffer_resource and
+ * released in one shot. Each reflexive remembers the resource it was constructed with, so the resource must outlive
+ * every struct parsed with it, while copies of those structs made outside of the scope go back to the heap.
+ */
+namespace Invader::Parser {
+    /**
+     * Get the memory resource that reflexives constructed on this thread are allocated from
+     * @return memory resource
+     */
+    std::pmr::memory_resource *get_allocation_resource() noexcept;
+
+    /**
+     * Allocate reflexives constructed on this thread from a memory resource until this is destroyed
+     */
+    class ScopedAllocationResource {
+    public:
+        /**
+         * Start allocating reflexives from a memory resource
+         * @param resource resource to allocate from; if nullptr, the current resource is kept
+         */
+        ScopedAllocationResource(std::pmr::memory_resource *resource) noexcept;
+        ~ScopedAllocationResource() noexcept;
+
+        ScopedAllocationResource(const ScopedAllocationResource &) = delete;
+        ScopedAllocationResource &operator=(const ScopedAllocationResource &) = delete;
+
+    private:
+        std::pmr::memory_resource *previous;
+    };
+
+    /**
+     * Allocator for reflexives which allocates from the memory resource that was active on the thread when it was
+     * constructed
+     */
+    template <typename T> class Allocator {
+    public:
+        using value_type = T;
+
+        /** Keep the resource when moving or swapping reflexives, but copy into the destination's own resource */
+        using propagate_on_container_copy_assignment = std::false_type;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+
+        Allocator() noexcept : resource(get_allocation_resource()) {}
+        Allocator(std::pmr::memory_resource *resource) noexcept : resource(resource) {}
+        template <typename U> Allocator(const Allocator<U> &other) noexcept : resource(other.get_resource()) {}
+
+        T *allocate(std::size_t n) {
+            return static_cast<T *>(this->resource->allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T *p, std::size_t n) noexcept {
+            this->resource->deallocate(p, n * sizeof(T), alignof(T));
+        }
+
+        /**
+         * Copies of reflexives are allocated from the resource active on the thread making the copy
+         * @return allocator for the copy
+         */
+        Allocator select_on_container_copy_construction() const noexcept {
+            return Allocator();
+        }
+
+        /**
+         * Get the memory resource this allocates from
+         * @return memory resource
+         */
+        std::pmr::memory_resource *get_resource() const noexcept {
+            return this->resource;
+        }
+
+        template <typename U> bool operator==(const Allocator<U> &other) const noexcept {
+            return this->resource == other.get_resource() || this->resource->is_equal(*other.get_resource());
+        }
+
+    private:
+        std::pmr::memory_resource *resource;
+    };
+
+    /**
+     * Array of structs in a reflexive
+     */
+    template <typename T> using Vector = std::vector<T, Allocator<T>>;
+}
+
+#endif
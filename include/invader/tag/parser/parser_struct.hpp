@@ -11,6 +11,7 @@
 #include <variant>
 #include <memory>
 #include "../hek/definition.hpp"
+#include "allocator.hpp"
 
 namespace Invader {
     class BuildWorkload;
@@ -951,9 +952,10 @@ namespace Invader::Parser {
          * @param  data        Tag file data to read from
          * @param  data_size   Size of the tag file
          * @param  postprocess Do post-processing on data, such as default values
+         * @param  resource    if set, allocate the tag's reflexives from this (see ScopedAllocationResource)
          * @return             parsed tag data
          */
-        static std::unique_ptr<ParserStruct> parse_hek_tag_file(const std::byte *data, std::size_t data_size, bool postprocess = false);
+        static std::unique_ptr<ParserStruct> parse_hek_tag_file(const std::byte *data, std::size_t data_size, bool postprocess = false, std::pmr::memory_resource *resource = nullptr);
 
         /**
          * Generate a tag base struct
@@ -1036,6 +1038,20 @@ namespace Invader::Parser {
          */
         virtual std::vector<std::byte> generate_hek_tag_data(std::optional<TagFourCC> generate_header_class = std::nullopt, bool clear_on_save = false) = 0;
 
+        /**
+         * Get the size of the struct as HEK tag data, including everything it points to. This also deformats it if needed.
+         * @return size in bytes (not including a tag file header)
+         */
+        virtual std::size_t hek_tag_data_size() = 0;
+
+        /**
+         * Write the struct as HEK tag data. There must be room for hek_tag_data_size() bytes.
+         * @param struct_output where to write the struct
+         * @param data_output   where to write everything the struct points to (advanced past everything written)
+         * @param clear_on_save clear data as it's being saved (reduces memory usage but you can't work on the tag anymore)
+         */
+        virtual void write_hek_tag_data(std::byte *struct_output, std::byte *&data_output, bool clear_on_save = false) = 0;
+
         /**
          * Refactor the tag reference, replacing all references with the given reference. Paths must use Halo path separators.
          * @param from_path  Path to look for
@@ -0,0 +1,222 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef INVADER__TAG__PARSER__VIEW_STRUCT_HPP
+#define INVADER__TAG__PARSER__VIEW_STRUCT_HPP
+
+#include <cstddef>
+#include <functional>
+#include <span>
+#include <string_view>
+#include "../hek/definition.hpp"
+
+/**
+ * Read-only views over HEK tag data. Unlike the Parser structs, nothing is copied: fields are converted from big endian
+ * when they're read, reflexives are iterated lazily, and dependency paths point into the tag data, so the tag data must
+ * outlive any views of it.
+ *
+ * Everything after a struct is laid out in the order of its fields, so finding a field's data means walking the data of
+ * every field before it. Bounds are checked while walking, throwing OutOfBoundsException or InvalidTagDataException like
+ * the parser does.
+ */
+namespace Invader::Parser::View {
+    /**
+     * Tag reference
+     */
+    struct Dependency {
+        /** Class of the referenced tag */
+        TagFourCC tag_fourcc;
+
+        /** Path of the referenced tag (Halo path separators, as stored in the tag); empty if null */
+        std::string_view path;
+    };
+
+    /**
+     * Function called for each dependency found
+     */
+    using DependencyCallback = std::function<void (const Dependency &dependency)>;
+
+    /**
+     * Base class of every view
+     */
+    class ViewStruct {
+    protected:
+        /** Struct being viewed */
+        const std::byte *struct_data;
+
+        /** Data after the struct (everything it points to) */
+        const std::byte *data;
+
+        /** Size of the data available after the struct, which may extend past the struct's own data */
+        std::size_t data_size;
+
+        ViewStruct(const std::byte *struct_data, const std::byte *data, std::size_t data_size) noexcept : struct_data(struct_data), data(data), data_size(data_size) {}
+
+        /**
+         * Get the size of a dependency's path, checking that it's in bounds and valid
+         * @param  tag_fourcc class of the dependency
+         * @param  path_size  path size of the dependency
+         * @param  offset     offset of the path in the data
+         * @param  callback   if set, called with the dependency (if it isn't null)
+         * @param  name       name of the field for error messages
+         * @return            size of the path in the data, including its null terminator
+         */
+        std::size_t walk_dependency(TagFourCC tag_fourcc, std::size_t path_size, std::size_t offset, const DependencyCallback *callback, const char *name) const;
+
+        /**
+         * Get the size of a data block, checking that it's in bounds
+         * @param  size   size of the data block
+         * @param  offset offset of the data block in the data
+         * @param  name   name of the field for error messages
+         * @return        size of the data block
+         */
+        std::size_t walk_data(std::size_t size, std::size_t offset, const char *name) const;
+
+        /**
+         * Get the size of a reflexive's structs and everything they point to, checking that it's in bounds
+         * @param  count    number of structs
+         * @param  offset   offset of the first struct in the data
+         * @param  callback if set, called with every dependency in the structs
+         * @param  name     name of the field for error messages
+         * @return          size of the reflexive in the data
+         */
+        template <typename T> std::size_t walk_reflexive(std::size_t count, std::size_t offset, const DependencyCallback *callback, const char *name) const {
+            std::size_t struct_size = sizeof(typename T::struct_big);
+            std::size_t array_size = check_array(count, struct_size, offset, name);
+            std::size_t size = array_size;
+            for(std::size_t i = 0; i < count; i++) {
+                T element(this->data + offset + i * struct_size, this->data + offset + size, this->data_size - offset - size);
+                size += callback == nullptr ? element.get_data_size() : element.for_each_dependency(*callback);
+            }
+            return size;
+        }
+
+        /**
+         * Get a dependency
+         * @param  tag_fourcc class of the dependency
+         * @param  path_size  path size of the dependency
+         * @param  offset     offset of the path in the data
+         * @param  name       name of the field for error messages
+         * @return            dependency
+         */
+        Dependency get_dependency(TagFourCC tag_fourcc, std::size_t path_size, std::size_t offset, const char *name) const;
+
+        /**
+         * Get a data block
+         * @param  size   size of the data block
+         * @param  offset offset of the data block in the data
+         * @param  name   name of the field for error messages
+         * @return        data block
+         */
+        std::span<const std::byte> get_data(std::size_t size, std::size_t offset, const char *name) const;
+
+        /**
+         * Check that an array of structs is in bounds
+         * @param  count       number of structs
+         * @param  struct_size size of each struct
+         * @param  offset      offset of the first struct in the data
+         * @param  name        name of the field for error messages
+         * @return             size of the array
+         */
+        std::size_t check_array(std::size_t count, std::size_t struct_size, std::size_t offset, const char *name) const;
+    };
+
+    /**
+     * Reflexive of views. Iterating walks each struct's data once to find the next one.
+     */
+    template <typename T> class Reflexive {
+    public:
+        class Iterator {
+        public:
+            T operator*() const noexcept {
+                return T(this->struct_data, this->data, this->data_size);
+            }
+
+            Iterator &operator++() {
+                std::size_t size = T(this->struct_data, this->data, this->data_size).get_data_size();
+                this->struct_data += sizeof(typename T::struct_big);
+                this->data += size;
+                this->data_size -= size;
+                this->index++;
+                return *this;
+            }
+
+            bool operator==(const Iterator &other) const noexcept {
+                return this->index == other.index;
+            }
+
+            Iterator(const std::byte *struct_data, const std::byte *data, std::size_t data_size, std::size_t index) noexcept : struct_data(struct_data), data(data), data_size(data_size), index(index) {}
+
+        private:
+            const std::byte *struct_data;
+            const std::byte *data;
+            std::size_t data_size;
+            std::size_t index;
+        };
+
+        /**
+         * Get the number of structs
+         * @return number of structs
+         */
+        std::size_t size() const noexcept {
+            return this->count;
+        }
+
+        /**
+         * Get whether there are no structs
+         * @return true if empty
+         */
+        bool empty() const noexcept {
+            return this->count == 0;
+        }
+
+        Iterator begin() const noexcept {
+            auto array_size = this->count * sizeof(typename T::struct_big);
+            return Iterator(this->array, this->array + array_size, this->data_size - array_size, 0);
+        }
+
+        Iterator end() const noexcept {
+            return Iterator(nullptr, nullptr, 0, this->count);
+        }
+
+        /**
+         * Get a struct (this walks every struct before it)
+         * @param  index index of the struct
+         * @return       struct
+         * @throws       OutOfBoundsException if index is out of bounds
+         */
+        T at(std::size_t index) const {
+            if(index >= this->count) {
+                throw OutOfBoundsException();
+            }
+            auto i = this->begin();
+            while(index-- > 0) {
+                ++i;
+            }
+            return *i;
+        }
+
+        /**
+         * View a reflexive whose bounds have already been checked
+         * @param array     pointer to the first struct
+         * @param data_size size of the data available from the first struct
+         * @param count     number of structs
+         */
+        Reflexive(const std::byte *array, std::size_t data_size, std::size_t count) noexcept : array(array), data_size(data_size), count(count) {}
+
+    private:
+        const std::byte *array;
+        std::size_t data_size;
+        std::size_t count;
+    };
+
+    /**
+     * Call a function for every dependency in a tag file
+     * @param  data      tag file data
+     * @param  data_size size of the tag file data
+     * @param  callback  function to call for each non-null dependency
+     * @throws           if the tag file is invalid
+     */
+    void for_each_dependency_in_tag_file(const std::byte *data, std::size_t data_size, const DependencyCallback &callback);
+}
+
+#endif
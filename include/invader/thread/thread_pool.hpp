@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef INVADER__THREAD__THREAD_POOL_HPP
+#define INVADER__THREAD__THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Invader {
+    /**
+     * Fixed-size pool of worker threads that runs submitted tasks in the order they were submitted
+     */
+    class ThreadPool {
+    public:
+        /**
+         * Function called with the number of tasks finished and submitted since the last wait
+         */
+        using ProgressFunction = std::function<void (std::size_t finished, std::size_t submitted)>;
+
+        /**
+         * Submit a task to be run on the pool. If the queue is full, this blocks until there is room.
+         * @param  task task to run
+         * @return      future holding the result of the task (or the exception it threw)
+         */
+        template <typename F> std::future<std::invoke_result_t<std::decay_t<F>>> submit(F &&task) {
+            using R = std::invoke_result_t<std::decay_t<F>>;
+            auto packaged_task = std::make_shared<std::packaged_task<R ()>>(std::forward<F>(task));
+            auto future = packaged_task->get_future();
+            this->enqueue([packaged_task]() { (*packaged_task)(); });
+            return future;
+        }
+
+        /**
+         * Wait until every submitted task has finished, and then reset the finished/submitted counts (so each wait can be used as a phase)
+         * @param progress if set, this is called on this thread each time a task finishes
+         */
+        void wait(const ProgressFunction &progress = nullptr);
+
+        /**
+         * Discard all tasks that have not started yet (their futures will throw std::future_error) and mark the pool as cancelled
+         */
+        void cancel();
+
+        /**
+         * Get whether cancel() has been called; long-running tasks can check this to stop early
+         * @return true if cancelled
+         */
+        bool is_cancelled() const noexcept {
+            return this->cancelled.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Get the number of worker threads
+         * @return number of worker threads
+         */
+        std::size_t get_thread_count() const noexcept {
+            return this->threads.size();
+        }
+
+        /**
+         * Get the default number of threads (the number of hardware threads, or 1 if that can't be determined)
+         * @return default number of threads
+         */
+        static std::size_t default_thread_count() noexcept;
+
+        /**
+         * Start a thread pool
+         * @param thread_count number of worker threads (0 to use the default)
+         * @param max_queued   maximum number of tasks waiting to run before submit() blocks (0 for no limit)
+         */
+        ThreadPool(std::size_t thread_count = 0, std::size_t max_queued = 0);
+
+        /**
+         * Finish all remaining tasks and stop the threads
+         */
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+    private:
+        std::vector<std::thread> threads;
+        std::deque<std::function<void ()>> queue;
+        std::size_t max_queued;
+
+        std::mutex mutex;
+        std::condition_variable task_available;
+        std::condition_variable task_finished;
+        std::condition_variable queue_not_full;
+
+        std::size_t submitted = 0;
+        std::size_t finished = 0;
+        bool stopping = false;
+        std::atomic<bool> cancelled = false;
+
+        void enqueue(std::function<void ()> &&task);
+        void work();
+    };
+}
+
+#endif
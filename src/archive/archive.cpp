@@ -2,7 +2,9 @@
 
 #include <vector>
 #include <string>
+#include <deque>
 #include <filesystem>
+#include <future>
 #include <archive.h>
 #include <archive_entry.h>
 #include <invader/version.hpp>
@@ -12,22 +14,44 @@
 #include <invader/dependency/found_tag_dependency.hpp>
 #include "../command_line_option.hpp"
 #include <invader/file/file.hpp>
+#include <invader/file/content_cache.hpp>
+#include <invader/thread/thread_pool.hpp>
 
 struct Format {
     const char *name;
     const char *extension;
     int (*filter)(archive *a);
     int (*format)(archive *a);
+
+    /** libarchive module that takes the compression options */
+    const char *option_module;
+
+    /** The compressor can use multiple threads */
+    bool threads;
 };
 
 static const constexpr Format formats[] = {
-    {"7z", ".7z", nullptr, archive_write_set_format_7zip},
-    {"tar-gz", ".tar.xz", archive_write_add_filter_gzip, archive_write_set_format_pax_restricted},
-    {"tar-xz", ".tar.xz", archive_write_add_filter_xz, archive_write_set_format_pax_restricted},
-    {"tar-zst", ".tar.zst", archive_write_add_filter_zstd, archive_write_set_format_pax_restricted},
-    {"zip", ".zip", nullptr, archive_write_set_format_zip}
+    {"7z", ".7z", nullptr, archive_write_set_format_7zip, "7zip", false},
+    {"tar-gz", ".tar.xz", archive_write_add_filter_gzip, archive_write_set_format_pax_restricted, "gzip", false},
+    {"tar-xz", ".tar.xz", archive_write_add_filter_xz, archive_write_set_format_pax_restricted, "xz", true},
+    {"tar-zst", ".tar.zst", archive_write_add_filter_zstd, archive_write_set_format_pax_restricted, "zstd", true},
+    {"zip", ".zip", nullptr, archive_write_set_format_zip, "zip", false}
 };
 
+// Tags are read this far ahead of the one being compressed
+static constexpr std::size_t READ_THREAD_COUNT = 4;
+static constexpr std::size_t MAX_READ_AHEAD = READ_THREAD_COUNT * 4;
+
+// libarchive and packs always use POSIX paths
+static std::string to_archive_path(std::string path) {
+    for(char &c : path) {
+        if(c == std::filesystem::path::preferred_separator) {
+            c = '/';
+        }
+    }
+    return path;
+}
+
 static std::string list_formats() {
     std::string f;
     for(auto &format : formats) {
@@ -56,6 +80,10 @@ int main(int argc, const char **argv) {
         bool overwrite = false;
         std::optional<HEK::GameEngine> engine;
         const Format *format = &formats[0];
+        std::optional<unsigned int> compression_level;
+        std::size_t thread_count = 0;
+        std::optional<std::filesystem::path> pack;
+        std::optional<std::filesystem::path> base_pack;
     } archive_options;
 
     static constexpr char DESCRIPTION[] = "Generate .tar.xz archives of the tags required to build a cache file.";
@@ -75,7 +103,11 @@ int main(int argc, const char **argv) {
         CommandLineOption("output", 'o', 1, "Output to a specific file. Extension must be .tar.xz unless using --copy which then it's a directory.", "<file>"),
         CommandLineOption("fs-path", 'P', 0, "Use a filesystem path for the tag."),
         CommandLineOption("copy", 'C', 0, "Copy instead of making an archive."),
-        CommandLineOption("verbose", 'v', 0, "Print whether or not tags are omitted. Do verbose comparisons.")
+        CommandLineOption("verbose", 'v', 0, "Print whether or not tags are omitted. Do verbose comparisons."),
+        CommandLineOption("level", 'l', 1, "Set the compression level. The range depends on the format (0-9 for most, 1-19 for tar-zst). Default: format default", "<level>"),
+        CommandLineOption("threads", 'j', 1, "Set the number of threads to compress with if using tar-xz or tar-zst, or to read and hash tags with if using --pack. Default: CPU thread count", "<count>"),
+        CommandLineOption("pack", 'k', 1, "Store the tags in a content-addressed pack directory instead of making an archive. Each unique tag is stored once in blobs/ by the hash of its contents, and <name>.index lists the hash, size, and path of every tag of this map or tag tree. Packing more maps into the same directory only adds the tags it doesn't already have.", "<dir>"),
+        CommandLineOption("base-pack", 'B', 1, "If using --pack, don't store tags that are already in this pack, so the new pack only holds what changed since it. The index still lists every tag.", "<dir>")
     };
 
     auto remaining_arguments = CommandLineOption::parse_arguments<ArchiveOptions &>(argc, argv, options, USAGE, DESCRIPTION, 1, 1, archive_options, [](char opt, const auto &arguments, auto &archive_options) {
@@ -136,6 +168,33 @@ int main(int argc, const char **argv) {
             case 'C':
                 archive_options.copy = true;
                 break;
+            case 'l':
+                try {
+                    archive_options.compression_level = static_cast<unsigned int>(std::stoul(arguments[0]));
+                }
+                catch(std::exception &) {
+                    eprintf_error("Invalid compression level %s", arguments[0]);
+                    std::exit(EXIT_FAILURE);
+                }
+                break;
+            case 'k':
+                archive_options.pack = arguments[0];
+                break;
+            case 'B':
+                archive_options.base_pack = arguments[0];
+                break;
+            case 'j':
+                try {
+                    archive_options.thread_count = std::stoul(arguments[0]);
+                    if(archive_options.thread_count < 1) {
+                        throw std::exception();
+                    }
+                }
+                catch(std::exception &) {
+                    eprintf_error("Invalid number of threads %s", arguments[0]);
+                    std::exit(EXIT_FAILURE);
+                }
+                break;
         }
     });
 
@@ -145,6 +204,21 @@ int main(int argc, const char **argv) {
         return EXIT_FAILURE;
     }
 
+    if(archive_options.pack.has_value()) {
+        if(archive_options.copy) {
+            eprintf_error("--pack and --copy cannot be used at the same time");
+            return EXIT_FAILURE;
+        }
+        if(!archive_options.output.empty()) {
+            eprintf_error("--output cannot be used with --pack");
+            return EXIT_FAILURE;
+        }
+    }
+    else if(archive_options.base_pack.has_value()) {
+        eprintf_error("--base-pack can only be used with --pack");
+        return EXIT_FAILURE;
+    }
+
     // No tags folder? Use tags in current directory
     if(archive_options.tags.size() == 0) {
         archive_options.tags.emplace_back("tags");
@@ -184,7 +258,7 @@ int main(int argc, const char **argv) {
     std::vector<std::pair<std::filesystem::path, std::string>> archive_list;
 
     // If no output filename was given, make one
-    const char *extension = archive_options.format->extension;
+    const char *extension = archive_options.pack.has_value() ? ".index" : archive_options.format->extension;
     if(archive_options.output.size() == 0) {
         // Set output
         archive_options.output = File::base_name(base_tag.data()) + ((archive_options.copy) ? "" : extension);
@@ -400,8 +474,78 @@ int main(int argc, const char **argv) {
         return EXIT_SUCCESS;
     }
 
+    // Pack
+    if(archive_options.pack.has_value()) {
+        File::ContentCache pack(*archive_options.pack / "blobs", ".tag");
+        std::optional<File::ContentCache> base_pack;
+        if(archive_options.base_pack.has_value()) {
+            base_pack.emplace(*archive_options.base_pack / "blobs", ".tag");
+        }
+
+        // Hash every tag, storing the ones neither pack has yet
+        struct PackedTag {
+            ContentHash hash;
+            std::size_t size = 0;
+            bool stored = false;
+            const char *error = nullptr;
+        };
+        std::vector<PackedTag> packed_tags(archive_list.size());
+        {
+            ThreadPool pool(archive_options.thread_count);
+            for(std::size_t t = 0; t < archive_list.size(); t++) {
+                pool.submit([&archive_list, &packed_tags, &pack, &base_pack, t]() {
+                    auto &packed_tag = packed_tags[t];
+                    auto data = File::open_file(archive_list[t].first);
+                    if(!data.has_value()) {
+                        packed_tag.error = "Failed to open";
+                        return;
+                    }
+
+                    packed_tag.hash = hash_data(*data);
+                    packed_tag.size = data->size();
+                    if((base_pack.has_value() && base_pack->contains(packed_tag.hash)) || pack.contains(packed_tag.hash)) {
+                        return;
+                    }
+
+                    if(!pack.store(packed_tag.hash, *data)) {
+                        packed_tag.error = "Failed to store";
+                        return;
+                    }
+                    packed_tag.stored = true;
+                });
+            }
+            pool.wait();
+        }
+
+        // Then list them all in the index
+        std::string index;
+        std::size_t stored_count = 0;
+        std::size_t stored_size = 0;
+        for(std::size_t t = 0; t < archive_list.size(); t++) {
+            auto &packed_tag = packed_tags[t];
+            if(packed_tag.error) {
+                eprintf_error("%s %s", packed_tag.error, archive_list[t].first.string().c_str());
+                return EXIT_FAILURE;
+            }
+            if(packed_tag.stored) {
+                stored_count++;
+                stored_size += packed_tag.size;
+            }
+            index += packed_tag.hash.to_string() + " " + std::to_string(packed_tag.size) + " " + to_archive_path(archive_list[t].second) + "\n";
+        }
+
+        auto index_path = *archive_options.pack / archive_options.output;
+        auto *index_data = reinterpret_cast<const std::byte *>(index.data());
+        if(!File::save_file_atomically(index_path, std::vector<std::byte>(index_data, index_data + index.size()))) {
+            eprintf_error("Failed to save %s", index_path.string().c_str());
+            return EXIT_FAILURE;
+        }
+
+        oprintf("Stored %zu of %zu tag%s (%.02f MiB) in %s\n", stored_count, archive_list.size(), archive_list.size() == 1 ? "" : "s", stored_size / 1024.0 / 1024.0, archive_options.pack->string().c_str());
+        oprintf("Saved %s\n", index_path.string().c_str());
+    }
     // Archive
-    if(!archive_options.copy) {
+    else if(!archive_options.copy) {
         // Begin making the archive
         auto *archive = archive_write_new();
         if(archive_options.format->filter) {
@@ -410,20 +554,69 @@ int main(int argc, const char **argv) {
         if(archive_options.format->format) {
             archive_options.format->format(archive);
         }
-        archive_write_open_filename(archive, archive_options.output.c_str());
+
+        // Set compression options
+        auto set_option = [&archive, &archive_options](const char *option, std::size_t value) -> bool {
+            return archive_write_set_option(archive, archive_options.format->option_module, option, std::to_string(value).c_str()) == ARCHIVE_OK;
+        };
+        if(archive_options.compression_level.has_value() && !set_option("compression-level", *archive_options.compression_level)) {
+            eprintf_error("Failed to set the compression level to %u: %s", *archive_options.compression_level, archive_error_string(archive));
+            return EXIT_FAILURE;
+        }
+        if(archive_options.format->threads) {
+            // Older versions of libarchive (or ones built without threading support in liblzma) can't do this
+            if(!set_option("threads", archive_options.thread_count == 0 ? ThreadPool::default_thread_count() : archive_options.thread_count)) {
+                eprintf_warn("Failed to enable multithreaded compression, so only one thread will be used: %s", archive_error_string(archive));
+            }
+        }
+        else if(archive_options.thread_count != 0) {
+            eprintf_warn("%s is always compressed with one thread", archive_options.format->name);
+        }
+
+        if(archive_write_open_filename(archive, archive_options.output.c_str()) != ARCHIVE_OK) {
+            eprintf_error("Failed to open %s for writing: %s", archive_options.output.c_str(), archive_error_string(archive));
+            return EXIT_FAILURE;
+        }
+
+        // Read the tags on a pool ahead of the compressor so it isn't left waiting on the disk
+        struct TagFileData {
+            std::optional<std::vector<std::byte>> data;
+            std::time_t modified_time;
+        };
+        ThreadPool read_pool(READ_THREAD_COUNT);
+        std::deque<std::future<TagFileData>> reads;
+        std::size_t next_read = 0;
 
         // Go through each tag path we got
         for(std::size_t i = 0; i < archive_list.size(); i++) {
+            for(; next_read < archive_list.size() && reads.size() < MAX_READ_AHEAD; next_read++) {
+                reads.emplace_back(read_pool.submit([path = archive_list[next_read].first.string()]() {
+                    TagFileData file;
+                    file.data = File::open_file(path);
+
+                    // Get the modified time
+                    struct stat s;
+                    stat(path.c_str(), &s);
+
+                    // Windows uses mtime which is a time_t rather than a struct with nanoseconds
+                    #ifdef _WIN32
+                    file.modified_time = s.st_mtime;
+                    #else
+                    file.modified_time = s.st_mtim.tv_sec;
+                    #endif
+
+                    return file;
+                }));
+            }
+
+            auto file = reads.front().get();
+            reads.pop_front();
+
             auto str_path = archive_list[i].first.string();
             const char *path = str_path.c_str();
 
             // libarchive always needs POSIX paths.
-            auto archive_path = archive_list[i].second;
-            for(char &c : archive_path) {
-                if(c == std::filesystem::path::preferred_separator) {
-                    c = '/';
-                }
-            }
+            auto archive_path = to_archive_path(archive_list[i].second);
 
             // Begin
             auto *entry = archive_entry_new();
@@ -431,31 +624,19 @@ int main(int argc, const char **argv) {
             archive_entry_set_perm(entry, 0644);
             archive_entry_set_filetype(entry, AE_IFREG);
 
-            auto data_maybe = File::open_file(path);
-            if(!data_maybe.has_value()) {
+            if(!file.data.has_value()) {
                 eprintf_error("Failed to open %s\n", path);
                 return EXIT_FAILURE;
             }
-            auto &data = data_maybe.value();
-
-            // Get the filesystem path and write time
-            std::filesystem::path path_path = path;
-
-            // Get the modified time
-            struct stat s;
-            stat(path, &s);
-
-            // Windows uses mtime which is a time_t rather than a struct with nanoseconds
-            #ifdef _WIN32
-            archive_entry_set_mtime(entry, s.st_mtime, 0);
-            #else
-            archive_entry_set_mtime(entry, s.st_mtim.tv_sec, 0);
-            #endif
+            auto &data = file.data.value();
+            archive_entry_set_mtime(entry, file.modified_time, 0);
 
             // Archive that bastard
             archive_entry_set_size(entry, data.size());
-            archive_write_header(archive, entry);
-            archive_write_data(archive, data.data(), data.size());
+            if(archive_write_header(archive, entry) != ARCHIVE_OK || archive_write_data(archive, data.data(), data.size()) < 0) {
+                eprintf_error("Failed to archive %s: %s", path, archive_error_string(archive));
+                return EXIT_FAILURE;
+            }
 
             // Close it
             archive_entry_free(entry);
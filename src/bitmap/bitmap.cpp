@@ -1,7 +1,12 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
 #include <zlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <filesystem>
+#include <map>
+#include <mutex>
 #include <optional>
 
 #include <invader/printf.hpp>
@@ -14,6 +19,9 @@
 #include "bitmap_data_writer.hpp"
 #include "../command_line_option.hpp"
 #include <invader/file/file.hpp>
+#include <invader/file/content_cache.hpp>
+#include <invader/crc/hash.hpp>
+#include <invader/thread/thread_pool.hpp>
 #include <invader/tag/parser/parser.hpp>
 
 enum SupportedFormatsInt {
@@ -102,8 +110,50 @@ struct BitmapOptions {
 
     // Regenerate?
     bool regenerate = false;
+
+    // Cache generated bitmap data here
+    std::optional<std::filesystem::path> cache;
+
+    // Batch options
+    std::vector<std::string> search;
+    std::vector<std::string> search_exclude;
+    std::size_t max_threads = ThreadPool::default_thread_count();
+    bool batch = false;
 };
 
+// Hash everything that affects the generated bitmap data (call after all defaults are resolved)
+static ContentHash hash_bitmap_options(const BitmapOptions &bitmap_options, const ContentHash &seed) {
+    auto hash = hash_string(full_version(), seed);
+
+    auto hash_optional = [&hash](const auto &value) {
+        hash = hash_value(value.has_value(), hash);
+        hash = hash_value(value.value_or(0), hash);
+    };
+
+    hash = hash_value(bitmap_options.allow_non_power_of_two, hash);
+    hash = hash_value(bitmap_options.force_square_sprite_sheets, hash);
+    hash = hash_value(*bitmap_options.auto_format, hash);
+    hash = hash_value(*bitmap_options.auto_format ? BitmapFormat::BITMAP_FORMAT_ENUM_COUNT : bitmap_options.format.value_or(BitmapFormat::BITMAP_FORMAT_ENUM_COUNT), hash);
+    hash = hash_value(*bitmap_options.mipmap_scale_type, hash);
+    hash = hash_value(*bitmap_options.usage, hash);
+    hash = hash_value(*bitmap_options.bump_height, hash);
+    hash = hash_value(*bitmap_options.palettize, hash);
+    hash = hash_value(*bitmap_options.mipmap_fade, hash);
+    hash = hash_value(*bitmap_options.bitmap_type, hash);
+    hash = hash_value(*bitmap_options.sprite_usage, hash);
+    hash = hash_value(*bitmap_options.sprite_budget, hash);
+    hash = hash_value(*bitmap_options.sprite_budget_count, hash);
+    hash = hash_value(*bitmap_options.sprite_spacing, hash);
+    hash = hash_value(*bitmap_options.dithering, hash);
+    hash_optional(bitmap_options.sharpen);
+    hash_optional(bitmap_options.blur);
+    hash = hash_value(*bitmap_options.alpha_bias, hash);
+    hash = hash_value(*bitmap_options.max_mipmap_count, hash);
+    hash = hash_value(*bitmap_options.filthy_sprite_bug_fix, hash);
+
+    return hash;
+}
+
 template <typename T> static int perform_the_ritual(const std::string &bitmap_tag, const std::filesystem::path &tag_path, const std::filesystem::path &final_path, BitmapOptions &bitmap_options, TagFourCC tag_fourcc) {
     // Let's begin
     std::filesystem::path data_path = bitmap_options.data;
@@ -120,15 +170,15 @@ template <typename T> static int perform_the_ritual(const std::string &bitmap_ta
         // These are available in the Rust implementation instead.
         if(bitmap_tag_data.flags & HEK::BitmapFlagsFlag::BITMAP_FLAGS_FLAG_INVERT_DETAIL_FADE) {
             eprintf_error("The \"invert detail fade\" option is not supported by this implementation of invader-bitmap");
-            std::exit(EXIT_FAILURE);
+            return EXIT_FAILURE;
         }
         if(bitmap_tag_data.flags & HEK::BitmapFlagsFlag::BITMAP_FLAGS_FLAG_USE_AVERAGE_COLOR_FOR_DETAIL_FADE) {
             eprintf_error("The \"use average color for detail fade\" option is not supported by this implementation of invader-bitmap");
-            std::exit(EXIT_FAILURE);
+            return EXIT_FAILURE;
         }
         if((bitmap_tag_data.encoding_format == HEK::BitmapFormat::BITMAP_FORMAT_BC7 && !bitmap_options.format.has_value()) || bitmap_options.format == HEK::BitmapFormat::BITMAP_FORMAT_BC7) {
             eprintf_error("BC7 bitmap encoding is not supported by this implementation of invader-bitmap");
-            std::exit(EXIT_FAILURE);
+            return EXIT_FAILURE;
         }
 
         // Set some default values
@@ -195,7 +245,7 @@ template <typename T> static int perform_the_ritual(const std::string &bitmap_ta
     }
     else if(bitmap_options.regenerate) {
         eprintf_error("Cannot regenerate. No bitmap tag exists at %s", final_path.string().c_str());
-        std::exit(EXIT_FAILURE);
+        return EXIT_FAILURE;
     }
 
     // If these values weren't set, set them
@@ -228,6 +278,10 @@ template <typename T> static int perform_the_ritual(const std::string &bitmap_ta
     std::size_t image_size = 0;
     std::vector<Pixel> image_pixels;
 
+    // Cache key and cached bitmap (if caching)
+    std::optional<ContentHash> cache_key;
+    std::optional<T> cached_bitmap_tag_data;
+
     // If we're regenerating, our color plate data is in the tag
     if(bitmap_options.regenerate) {
         // Check to see if we have data
@@ -270,28 +324,58 @@ template <typename T> static int perform_the_ritual(const std::string &bitmap_ta
     else {
         // Try to figure out the extension
         auto bitmap_data_path = (data_path / bitmap_tag).string();
+        std::string image_path;
+        auto image_format = SUPPORTED_FORMATS_INT_COUNT;
         for(auto i = static_cast<SupportedFormatsInt>(0); i < SUPPORTED_FORMATS_INT_COUNT; i = static_cast<SupportedFormatsInt>(i + 1)) {
-            std::string image_path = bitmap_data_path + SUPPORTED_FORMATS[i];
+            image_path = bitmap_data_path + SUPPORTED_FORMATS[i];
             if(std::filesystem::exists(image_path)) {
-                switch(i) {
-                    case SUPPORTED_FORMATS_TIF:
-                    case SUPPORTED_FORMATS_TIFF:
-                        image_pixels = load_tiff(image_path.c_str(), image_width, image_height, image_size);
-                        break;
-                    case SUPPORTED_FORMATS_PNG:
-                    case SUPPORTED_FORMATS_TGA:
-                    case SUPPORTED_FORMATS_BMP:
-                        image_pixels = load_image(image_path.c_str(), image_width, image_height, image_size);
-                        break;
-                    default:
-                        std::terminate();
-                        break;
-                }
+                image_format = i;
                 break;
             }
         }
 
-        if(image_pixels.empty()) {
+        // If we're caching, see if we already made this exact bitmap from this exact image
+        if(image_format != SUPPORTED_FORMATS_INT_COUNT && bitmap_options.cache.has_value()) {
+            auto image_file = File::open_file(image_path);
+            if(!image_file.has_value()) {
+                return EXIT_FAILURE;
+            }
+            cache_key = hash_bitmap_options(bitmap_options, hash_data(*image_file));
+
+            auto cached_tag = File::ContentCache(*bitmap_options.cache, ".bitmap").load(*cache_key);
+            if(cached_tag.has_value()) {
+                try {
+                    cached_bitmap_tag_data = T::parse_hek_tag_file(cached_tag->data(), cached_tag->size());
+                }
+                catch(std::exception &e) {
+                    eprintf_warn("Ignoring unreadable cache entry for %s: %s", bitmap_tag.c_str(), e.what());
+                }
+            }
+        }
+
+        // Load the image unless we have it cached
+        if(!cached_bitmap_tag_data.has_value()) {
+            switch(image_format) {
+                case SUPPORTED_FORMATS_TIF:
+                case SUPPORTED_FORMATS_TIFF:
+                    image_pixels = load_tiff(image_path.c_str(), image_width, image_height, image_size);
+                    break;
+                case SUPPORTED_FORMATS_PNG:
+                case SUPPORTED_FORMATS_TGA:
+                case SUPPORTED_FORMATS_BMP:
+                    image_pixels = load_image(image_path.c_str(), image_width, image_height, image_size);
+                    break;
+                default:
+                    break;
+            }
+
+            // The loader already said why
+            if(image_pixels.empty() && image_format != SUPPORTED_FORMATS_INT_COUNT) {
+                return EXIT_FAILURE;
+            }
+        }
+
+        if(image_pixels.empty() && !cached_bitmap_tag_data.has_value()) {
             eprintf_error("Failed to find %s in %s", bitmap_tag.c_str(), bitmap_options.data.string().c_str());
             eprintf("Valid formats are:\n");
             for(auto *format : SUPPORTED_FORMATS) {
@@ -301,126 +385,146 @@ template <typename T> static int perform_the_ritual(const std::string &bitmap_ta
         }
     }
 
-    // Set up sprite parameters
-    std::optional<BitmapProcessorSpriteParameters> sprite_parameters;
-    if(bitmap_options.bitmap_type.value() == BitmapType::BITMAP_TYPE_SPRITES) {
-        sprite_parameters.emplace();
-        auto &p = sprite_parameters.value();
-        p.sprite_budget = bitmap_options.sprite_budget.value();
-        p.sprite_budget_count = bitmap_options.sprite_budget_count.value();
-        p.sprite_usage = bitmap_options.sprite_usage.value();
-        p.sprite_spacing = bitmap_options.sprite_spacing.value();
-        p.force_square_sprite_sheets = bitmap_options.force_square_sprite_sheets;
-    }
+    #define BYTES_TO_MIB(bytes) (bytes / 1024.0F / 1024.0F)
 
-    // Do it!
-    auto try_to_scan_color_plate = [&image_pixels, &image_width, &image_height, &bitmap_options, &sprite_parameters]() {
-        try {
-            auto scanned_data = ColorPlateScanner::scan_color_plate(image_pixels.data(), image_width, image_height, bitmap_options.bitmap_type.value(), bitmap_options.usage.value(), *bitmap_options.filthy_sprite_bug_fix, bitmap_options.allow_non_power_of_two);
-            BitmapProcessor::process_bitmap_data(scanned_data, bitmap_options.bitmap_type.value(), bitmap_options.usage.value(), bitmap_options.bump_height.value(), sprite_parameters, bitmap_options.max_mipmap_count.value(), bitmap_options.mipmap_scale_type.value(), bitmap_options.usage == BitmapUsage::BITMAP_USAGE_DETAIL_MAP ? bitmap_options.mipmap_fade : std::nullopt, bitmap_options.sharpen, bitmap_options.blur, bitmap_options.alpha_bias);
-            return scanned_data;
-        }
-        catch (std::exception &e) {
-            eprintf_error("Failed to process the image: %s", e.what());
-            std::exit(1);
+    // Say which bitmap this is for if we're making several at once
+    auto output_prefix = bitmap_options.batch ? bitmap_tag + ": " : std::string();
+
+    // Reuse the cached bitmap data if we have it
+    if(cached_bitmap_tag_data.has_value()) {
+        auto &cached = *cached_bitmap_tag_data;
+        bitmap_tag_data.compressed_color_plate_data = std::move(cached.compressed_color_plate_data);
+        bitmap_tag_data.color_plate_width = cached.color_plate_width;
+        bitmap_tag_data.color_plate_height = cached.color_plate_height;
+        bitmap_tag_data.processed_pixel_data = std::move(cached.processed_pixel_data);
+        bitmap_tag_data.bitmap_data = std::move(cached.bitmap_data);
+        bitmap_tag_data.bitmap_group_sequence = std::move(cached.bitmap_group_sequence);
+        bitmap_options.format = cached.encoding_format;
+        oprintf("%sTotal: %.03f MiB (cached)\n", output_prefix.c_str(), BYTES_TO_MIB(bitmap_tag_data.processed_pixel_data.size()));
+    }
+    else {
+        // Set up sprite parameters
+        std::optional<BitmapProcessorSpriteParameters> sprite_parameters;
+        if(bitmap_options.bitmap_type.value() == BitmapType::BITMAP_TYPE_SPRITES) {
+            sprite_parameters.emplace();
+            auto &p = sprite_parameters.value();
+            p.sprite_budget = bitmap_options.sprite_budget.value();
+            p.sprite_budget_count = bitmap_options.sprite_budget_count.value();
+            p.sprite_usage = bitmap_options.sprite_usage.value();
+            p.sprite_spacing = bitmap_options.sprite_spacing.value();
+            p.force_square_sprite_sheets = bitmap_options.force_square_sprite_sheets;
+        }
+
+        // Do it!
+        auto try_to_scan_color_plate = [&image_pixels, &image_width, &image_height, &bitmap_options, &sprite_parameters]() -> std::optional<GeneratedBitmapData> {
+            try {
+                auto scanned_data = ColorPlateScanner::scan_color_plate(image_pixels.data(), image_width, image_height, bitmap_options.bitmap_type.value(), bitmap_options.usage.value(), *bitmap_options.filthy_sprite_bug_fix, bitmap_options.allow_non_power_of_two);
+                BitmapProcessor::process_bitmap_data(scanned_data, bitmap_options.bitmap_type.value(), bitmap_options.usage.value(), bitmap_options.bump_height.value(), sprite_parameters, bitmap_options.max_mipmap_count.value(), bitmap_options.mipmap_scale_type.value(), bitmap_options.usage == BitmapUsage::BITMAP_USAGE_DETAIL_MAP ? bitmap_options.mipmap_fade : std::nullopt, bitmap_options.sharpen, bitmap_options.blur, bitmap_options.alpha_bias);
+                return scanned_data;
+            }
+            catch (std::exception &e) {
+                eprintf_error("Failed to process the image: %s", e.what());
+                return std::nullopt;
+            };
         };
-    };
 
-    auto scanned_color_plate = try_to_scan_color_plate();
-
-    // Compress the original input blob
-    if(!bitmap_options.regenerate) {
-        if(image_width > static_cast<std::uint16_t>(INT16_MAX) || image_height > static_cast<std::uint16_t>(INT16_MAX)) {
-            eprintf_warn("Color plate dimensions exceed %zux%zu\nThe bitmap can still be made, but it cannot be regenerated.", static_cast<std::size_t>(INT16_MAX),  static_cast<std::size_t>(INT16_MAX));
-            bitmap_tag_data.color_plate_width = 0;
-            bitmap_tag_data.color_plate_height = 0;
-        }
-        else {
-            // Get ready
-            bitmap_tag_data.compressed_color_plate_data.clear();
-            std::vector<std::byte> compressed_data(image_size * 4);
-            BigEndian<std::uint32_t> decompressed_size;
-            decompressed_size = static_cast<std::uint32_t>(image_size);
-            bitmap_tag_data.color_plate_width = image_width;
-            bitmap_tag_data.color_plate_height = image_height;
-
-            // Set compressed size
-            bitmap_tag_data.compressed_color_plate_data.resize(sizeof(decompressed_size));
-            *reinterpret_cast<BigEndian<std::uint32_t> *>(bitmap_tag_data.compressed_color_plate_data.data()) = decompressed_size;
-
-            // Deflate color plate data
-            compressed_data.resize(image_size * 4);
-            z_stream deflate_stream;
-            deflate_stream.zalloc = Z_NULL;
-            deflate_stream.zfree = Z_NULL;
-            deflate_stream.opaque = Z_NULL;
-            deflate_stream.avail_in = image_size;
-            deflate_stream.next_in = const_cast<Bytef *>(reinterpret_cast<const Bytef *>(image_pixels.data()));
-            deflate_stream.avail_out = compressed_data.size();
-            deflate_stream.next_out = reinterpret_cast<Bytef *>(compressed_data.data());
-
-            // Do it
-            deflateInit(&deflate_stream, Z_BEST_COMPRESSION);
-            deflate(&deflate_stream, Z_FINISH);
-            deflateEnd(&deflate_stream);
-            bitmap_tag_data.compressed_color_plate_data.insert(bitmap_tag_data.compressed_color_plate_data.end(), compressed_data.data(), compressed_data.data() + deflate_stream.total_out);
+        auto scanned_color_plate_maybe = try_to_scan_color_plate();
+        if(!scanned_color_plate_maybe.has_value()) {
+            return EXIT_FAILURE;
         }
-    }
-
-    // Now let's add the actual bitmap data
-    #define BYTES_TO_MIB(bytes) (bytes / 1024.0F / 1024.0F)
+        auto &scanned_color_plate = *scanned_color_plate_maybe;
 
-    // Add our bitmap data
-    try {
-        // If we don't have a format, set it to null (it will determine it instead)
-        if(*bitmap_options.auto_format) {
-            bitmap_options.format = std::nullopt;
+        // Compress the original input blob
+        if(!bitmap_options.regenerate) {
+            if(image_width > static_cast<std::uint16_t>(INT16_MAX) || image_height > static_cast<std::uint16_t>(INT16_MAX)) {
+                eprintf_warn("Color plate dimensions exceed %zux%zu\nThe bitmap can still be made, but it cannot be regenerated.", static_cast<std::size_t>(INT16_MAX),  static_cast<std::size_t>(INT16_MAX));
+                bitmap_tag_data.color_plate_width = 0;
+                bitmap_tag_data.color_plate_height = 0;
+            }
+            else {
+                // Get ready
+                bitmap_tag_data.compressed_color_plate_data.clear();
+                std::vector<std::byte> compressed_data(image_size * 4);
+                BigEndian<std::uint32_t> decompressed_size;
+                decompressed_size = static_cast<std::uint32_t>(image_size);
+                bitmap_tag_data.color_plate_width = image_width;
+                bitmap_tag_data.color_plate_height = image_height;
+
+                // Set compressed size
+                bitmap_tag_data.compressed_color_plate_data.resize(sizeof(decompressed_size));
+                *reinterpret_cast<BigEndian<std::uint32_t> *>(bitmap_tag_data.compressed_color_plate_data.data()) = decompressed_size;
+
+                // Deflate color plate data
+                compressed_data.resize(image_size * 4);
+                z_stream deflate_stream;
+                deflate_stream.zalloc = Z_NULL;
+                deflate_stream.zfree = Z_NULL;
+                deflate_stream.opaque = Z_NULL;
+                deflate_stream.avail_in = image_size;
+                deflate_stream.next_in = const_cast<Bytef *>(reinterpret_cast<const Bytef *>(image_pixels.data()));
+                deflate_stream.avail_out = compressed_data.size();
+                deflate_stream.next_out = reinterpret_cast<Bytef *>(compressed_data.data());
+
+                // Do it
+                deflateInit(&deflate_stream, Z_BEST_COMPRESSION);
+                deflate(&deflate_stream, Z_FINISH);
+                deflateEnd(&deflate_stream);
+                bitmap_tag_data.compressed_color_plate_data.insert(bitmap_tag_data.compressed_color_plate_data.end(), compressed_data.data(), compressed_data.data() + deflate_stream.total_out);
+            }
         }
 
-        write_bitmap_data(scanned_color_plate, bitmap_tag_data.processed_pixel_data, bitmap_tag_data.bitmap_data, bitmap_options.usage.value(), bitmap_options.format, bitmap_options.bitmap_type.value(), bitmap_options.palettize.value(), bitmap_options.dithering.value());
-    }
-    catch (std::exception &e) {
-        eprintf_error("Failed to generate bitmap data: %s", e.what());
-        std::exit(1);
-    }
-    oprintf("Total: %.03f MiB\n", BYTES_TO_MIB(bitmap_tag_data.processed_pixel_data.size()));
-
-    // Add all sequences
-    for(auto &sequence : scanned_color_plate.sequences) {
-        auto &bgs = bitmap_tag_data.bitmap_group_sequence.emplace_back();
+        // Add our bitmap data
+        try {
+            // If we don't have a format, set it to null (it will determine it instead)
+            if(*bitmap_options.auto_format) {
+                bitmap_options.format = std::nullopt;
+            }
 
-        if(bitmap_options.bitmap_type.value() == BitmapType::BITMAP_TYPE_SPRITES) {
-            bgs.bitmap_count = sequence.sprites.size() == 1 ? 1 : 0;
-            bgs.first_bitmap_index = NULL_INDEX;
+            write_bitmap_data(scanned_color_plate, bitmap_tag_data.processed_pixel_data, bitmap_tag_data.bitmap_data, bitmap_options.usage.value(), bitmap_options.format, bitmap_options.bitmap_type.value(), bitmap_options.palettize.value(), bitmap_options.dithering.value());
         }
-        else {
-            bgs.bitmap_count = sequence.bitmap_count;
-            bgs.first_bitmap_index = sequence.first_bitmap;
+        catch (std::exception &e) {
+            eprintf_error("Failed to generate bitmap data: %s", e.what());
+            return EXIT_FAILURE;
         }
+        oprintf("%sTotal: %.03f MiB\n", output_prefix.c_str(), BYTES_TO_MIB(bitmap_tag_data.processed_pixel_data.size()));
+
+        // Add all sequences
+        for(auto &sequence : scanned_color_plate.sequences) {
+            auto &bgs = bitmap_tag_data.bitmap_group_sequence.emplace_back();
+
+            if(bitmap_options.bitmap_type.value() == BitmapType::BITMAP_TYPE_SPRITES) {
+                bgs.bitmap_count = sequence.sprites.size() == 1 ? 1 : 0;
+                bgs.first_bitmap_index = NULL_INDEX;
+            }
+            else {
+                bgs.bitmap_count = sequence.bitmap_count;
+                bgs.first_bitmap_index = sequence.first_bitmap;
+            }
 
-        // Add the sprites in the sequence
-        for(auto &sprite : sequence.sprites) {
-            auto &bgss = bgs.sprites.emplace_back();
-            auto &bitmap = scanned_color_plate.bitmaps[sprite.bitmap_index];
-            bgss.bitmap_index = sprite.bitmap_index;
+            // Add the sprites in the sequence
+            for(auto &sprite : sequence.sprites) {
+                auto &bgss = bgs.sprites.emplace_back();
+                auto &bitmap = scanned_color_plate.bitmaps[sprite.bitmap_index];
+                bgss.bitmap_index = sprite.bitmap_index;
 
-            bgss.bottom = static_cast<float>(sprite.bottom) / bitmap.height;
-            bgss.top = static_cast<float>(sprite.top) / bitmap.height;
-            bgss.registration_point.y = static_cast<float>(sprite.registration_point_y) / bitmap.height;
+                bgss.bottom = static_cast<float>(sprite.bottom) / bitmap.height;
+                bgss.top = static_cast<float>(sprite.top) / bitmap.height;
+                bgss.registration_point.y = static_cast<float>(sprite.registration_point_y) / bitmap.height;
 
-            bgss.left = static_cast<float>(sprite.left) / bitmap.width;
-            bgss.right = static_cast<float>(sprite.right) / bitmap.width;
-            bgss.registration_point.x = static_cast<float>(sprite.registration_point_x) / bitmap.width;
+                bgss.left = static_cast<float>(sprite.left) / bitmap.width;
+                bgss.right = static_cast<float>(sprite.right) / bitmap.width;
+                bgss.registration_point.x = static_cast<float>(sprite.registration_point_x) / bitmap.width;
 
-            // Set the first bitmap index here
-            if(bgss.bitmap_index < bgs.first_bitmap_index) {
-                bgs.first_bitmap_index = bgss.bitmap_index;
+                // Set the first bitmap index here
+                if(bgss.bitmap_index < bgs.first_bitmap_index) {
+                    bgs.first_bitmap_index = bgss.bitmap_index;
+                }
             }
-        }
 
-        // If we never set it, set it to 0
-        if(bgs.first_bitmap_index == NULL_INDEX) {
-            bgs.first_bitmap_index = 0;
+            // If we never set it, set it to 0
+            if(bgs.first_bitmap_index == NULL_INDEX) {
+                bgs.first_bitmap_index = 0;
+            }
         }
     }
 
@@ -477,14 +581,129 @@ template <typename T> static int perform_the_ritual(const std::string &bitmap_ta
     std::error_code ec;
     std::filesystem::create_directories(tag_path.parent_path(), ec);
 
-    if(!File::save_file(final_path.c_str(), bitmap_tag_data.generate_hek_tag_data(tag_fourcc, true))) {
+    auto final_tag_data = bitmap_tag_data.generate_hek_tag_data(tag_fourcc, true);
+    if(!File::save_file(final_path.c_str(), final_tag_data)) {
         eprintf_error("Error: Failed to write to %s.", final_path.string().c_str());
         return EXIT_FAILURE;
     }
 
+    // Cache it for next time (failing to do so is not fatal)
+    if(cache_key.has_value() && !cached_bitmap_tag_data.has_value()) {
+        File::ContentCache(*bitmap_options.cache, ".bitmap").store(*cache_key, final_tag_data);
+    }
+
     return EXIT_SUCCESS;
 }
 
+static int generate_bitmap(const std::string &bitmap_tag, BitmapOptions &bitmap_options) {
+    auto tag_path = bitmap_options.tags / bitmap_tag;
+    auto final_path_bitmap = std::filesystem::path(tag_path) += ".bitmap";
+    return perform_the_ritual<Invader::Parser::Bitmap>(bitmap_tag, tag_path, final_path_bitmap, bitmap_options, TagFourCC::TAG_FOURCC_BITMAP);
+}
+
+static int perform_batch(const BitmapOptions &bitmap_options) {
+    struct BatchBitmap {
+        std::string bitmap_tag;
+        SupportedFormatsInt image_format;
+        std::uintmax_t image_size;
+    };
+
+    // Find every image in the data directory that matches. If there is more than one image for a tag, use the one perform_the_ritual would use.
+    std::map<std::string, BatchBitmap> found_bitmaps;
+    try {
+        for(auto &entry : std::filesystem::recursive_directory_iterator(bitmap_options.data)) {
+            if(!entry.is_regular_file()) {
+                continue;
+            }
+
+            auto extension = entry.path().extension().string();
+            auto image_format = SUPPORTED_FORMATS_INT_COUNT;
+            for(auto i = static_cast<SupportedFormatsInt>(0); i < SUPPORTED_FORMATS_INT_COUNT; i = static_cast<SupportedFormatsInt>(i + 1)) {
+                if(extension == SUPPORTED_FORMATS[i]) {
+                    image_format = i;
+                    break;
+                }
+            }
+            if(image_format == SUPPORTED_FORMATS_INT_COUNT) {
+                continue;
+            }
+
+            auto bitmap_tag = entry.path().lexically_relative(bitmap_options.data).replace_extension().string();
+            if(!File::path_matches(bitmap_tag.c_str(), bitmap_options.search, bitmap_options.search_exclude)) {
+                continue;
+            }
+
+            auto existing = found_bitmaps.find(bitmap_tag);
+            if(existing == found_bitmaps.end() || existing->second.image_format > image_format) {
+                found_bitmaps[bitmap_tag] = BatchBitmap { bitmap_tag, image_format, entry.file_size() };
+            }
+        }
+    }
+    catch(std::filesystem::filesystem_error &e) {
+        eprintf_error("Failed to search %s: %s", bitmap_options.data.string().c_str(), e.what());
+        return EXIT_FAILURE;
+    }
+
+    if(found_bitmaps.empty()) {
+        eprintf_error("No images in %s matched", bitmap_options.data.string().c_str());
+        return EXIT_FAILURE;
+    }
+
+    // Do the biggest images (usually cube maps) first so one doesn't end up running by itself at the end
+    std::vector<BatchBitmap> all_bitmaps;
+    all_bitmaps.reserve(found_bitmaps.size());
+    for(auto &i : found_bitmaps) {
+        all_bitmaps.emplace_back(std::move(i.second));
+    }
+    std::stable_sort(all_bitmaps.begin(), all_bitmaps.end(), [](const BatchBitmap &a, const BatchBitmap &b) { return a.image_size > b.image_size; });
+
+    std::atomic<std::size_t> success = 0;
+    std::mutex failed_mutex;
+    std::vector<std::string> failed;
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Threads take the next bitmap when they finish one, so they stay busy no matter how long each bitmap takes
+    ThreadPool pool(std::min(bitmap_options.max_threads, all_bitmaps.size()));
+    for(auto &bitmap : all_bitmaps) {
+        pool.submit([&bitmap_tag = bitmap.bitmap_tag, &success, &failed_mutex, &failed, &bitmap_options]() {
+            // Each bitmap gets its own options since the existing tag fills in anything not set on the command line
+            auto this_bitmap_options = bitmap_options;
+            int result;
+            try {
+                result = generate_bitmap(bitmap_tag, this_bitmap_options);
+            }
+            catch(std::exception &e) {
+                eprintf_error("Failed to generate %s: %s", bitmap_tag.c_str(), e.what());
+                result = EXIT_FAILURE;
+            }
+
+            if(result == EXIT_SUCCESS) {
+                success++;
+            }
+            else {
+                std::scoped_lock lock(failed_mutex);
+                failed.emplace_back(bitmap_tag);
+            }
+        });
+    }
+    pool.wait();
+
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if(!failed.empty()) {
+        std::sort(failed.begin(), failed.end());
+        eprintf_error("Failed to generate %zu bitmap%s:", failed.size(), failed.size() == 1 ? "" : "s");
+        for(auto &i : failed) {
+            eprintf("    %s\n", i.c_str());
+        }
+    }
+
+    oprintf("Generated %zu out of %zu bitmap%s in %.03f seconds\n", success.load(), all_bitmaps.size(), all_bitmaps.size() == 1 ? "" : "s", seconds);
+
+    return failed.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int main(int argc, char *argv[]) {
     set_up_color_term();
 
@@ -495,6 +714,9 @@ int main(int argc, char *argv[]) {
         CommandLineOption::from_preset(CommandLineOption::PRESET_COMMAND_LINE_OPTION_TAGS),
         CommandLineOption::from_preset(CommandLineOption::PRESET_COMMAND_LINE_OPTION_DATA),
         CommandLineOption::from_preset(CommandLineOption::PRESET_COMMAND_LINE_OPTION_FS_PATH),
+        CommandLineOption::from_preset(CommandLineOption::PRESET_COMMAND_LINE_OPTION_BATCH),
+        CommandLineOption::from_preset(CommandLineOption::PRESET_COMMAND_LINE_OPTION_BATCH_EXCLUDE),
+        CommandLineOption("threads", 'j', 1, "Set the number of threads to use for generating bitmaps when using --batch. Default: CPU thread count", "<count>"),
         CommandLineOption("ignore-tag", 'I', 0, "Ignore the tag data if the tag exists."),
         CommandLineOption("dithering", 'D', 1, "Apply dithering to 16-bit or p8 bitmaps. Can be: off or on. Default (new tag): off", "<val>"),
         CommandLineOption("format", 'F', 1, "Pixel format. Can be: 32-bit, 16-bit, monochrome, dxt5, dxt3, dxt1, or auto. 'auto' will be replaced with the best lossless format. Default (new tag): auto", "<type>"),
@@ -511,14 +733,15 @@ int main(int argc, char *argv[]) {
         CommandLineOption("usage", 'u', 1, "Set the bitmap usage. Can be: alpha_blend, default, height_map, detail_map, light_map, vector_map. Default: default", "<usage>"),
         CommandLineOption("reg-point-hack", 'r', 1, "Ignore sequence borders when calculating registration point (AKA 'filthy sprite bug fix'). Can be: off or on. Default (new tag): off", "<val>"),
         CommandLineOption("regenerate", 'R', 0, "Use the bitmap tag's compressed color plate data as data."),
-        CommandLineOption("allow-non-power-of-two", 'n', 0, "Allow color plates with non-power-of-two, non-interface bitmaps.")
+        CommandLineOption("allow-non-power-of-two", 'n', 0, "Allow color plates with non-power-of-two, non-interface bitmaps."),
+        CommandLineOption("cache", 'c', 1, "Cache generated bitmap data in this directory, keyed by the source image and all options, and reuse it if nothing changed.", "<dir>")
     };
 
     static constexpr char DESCRIPTION[] = "Create or modify a bitmap tag.";
-    static constexpr char USAGE[] = "[options] <bitmap-tag>";
+    static constexpr char USAGE[] = "[options] <-b [expr] | <bitmap-tag>>";
 
     // Go through each argument
-    auto remaining_arguments = CommandLineOption::parse_arguments<BitmapOptions &>(argc, argv, options, USAGE, DESCRIPTION, 1, 1, bitmap_options, [](char opt, const std::vector<const char *> &arguments, auto &bitmap_options) {
+    auto remaining_arguments = CommandLineOption::parse_arguments<BitmapOptions &>(argc, argv, options, USAGE, DESCRIPTION, 0, 1, bitmap_options, [](char opt, const std::vector<const char *> &arguments, auto &bitmap_options) {
         switch(opt) {
             case 'd':
                 bitmap_options.data = arguments[0];
@@ -688,9 +911,54 @@ int main(int argc, char *argv[]) {
             case 'P':
                 bitmap_options.filesystem_path = true;
                 break;
+
+            case 'c':
+                bitmap_options.cache = arguments[0];
+                break;
+
+            case 'b':
+                bitmap_options.search.emplace_back(File::preferred_path_to_halo_path(arguments[0]));
+                bitmap_options.batch = true;
+                break;
+
+            case 'e':
+                bitmap_options.search_exclude.emplace_back(File::preferred_path_to_halo_path(arguments[0]));
+                bitmap_options.batch = true;
+                break;
+
+            case 'j':
+                try {
+                    bitmap_options.max_threads = std::stoi(arguments[0]);
+                    if(bitmap_options.max_threads < 1) {
+                        throw std::exception();
+                    }
+                }
+                catch(std::exception &) {
+                    eprintf_error("Invalid number of threads %s\n", arguments[0]);
+                    std::exit(EXIT_FAILURE);
+                }
+                break;
         }
     });
 
+    // Check if the tags directory exists
+    if(!std::filesystem::is_directory(bitmap_options.tags)) {
+        eprintf_error("Directory %s was not found or is not a directory", bitmap_options.tags.string().c_str());
+        return EXIT_FAILURE;
+    }
+
+    if(bitmap_options.batch) {
+        if(!remaining_arguments.empty()) {
+            eprintf_error("Can't use an extra bitmap tag and -b. Use -h for more information.");
+            return EXIT_FAILURE;
+        }
+        return perform_batch(bitmap_options);
+    }
+    else if(remaining_arguments.size() != 1) {
+        eprintf_error("A bitmap tag was expected. Use -h for more information.");
+        return EXIT_FAILURE;
+    }
+
     // Resolve the bitmap tag
     std::string bitmap_tag;
     if(bitmap_options.filesystem_path) {
@@ -708,13 +976,5 @@ int main(int argc, char *argv[]) {
         bitmap_tag = remaining_arguments[0];
     }
 
-    // Check if the tags directory exists
-    if(!std::filesystem::is_directory(bitmap_options.tags)) {
-        eprintf_error("Directory %s was not found or is not a directory", bitmap_options.tags.string().c_str());
-        return EXIT_FAILURE;
-    }
-
-    auto tag_path = bitmap_options.tags / bitmap_tag;
-    auto final_path_bitmap = std::filesystem::path(tag_path) += ".bitmap";
-    return perform_the_ritual<Invader::Parser::Bitmap>(bitmap_tag, tag_path, final_path_bitmap, bitmap_options, TagFourCC::TAG_FOURCC_BITMAP);
+    return generate_bitmap(bitmap_tag, bitmap_options);
 }
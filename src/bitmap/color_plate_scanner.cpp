@@ -1,8 +1,12 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
 #include <cassert>
+#include <cstring>
 #include <optional>
 #include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <thread>
 
 #include <invader/hek/data_type.hpp>
 #include <invader/bitmap/color_plate_scanner.hpp>
@@ -20,6 +24,41 @@ namespace Invader {
         return color_a.red == color_b.red && color_a.blue == color_b.blue && color_a.green == color_b.green;
     }
 
+    // Compare pixels as 32-bit integers with the alpha channel masked off so rows can be compared without branching per channel
+    static inline std::uint32_t pixel_bits(const Pixel &pixel) noexcept {
+        std::uint32_t bits;
+        std::memcpy(&bits, &pixel, sizeof(bits));
+        return bits;
+    }
+
+    static const std::uint32_t COLOR_MASK = pixel_bits(Pixel { 0xFF, 0xFF, 0xFF, 0x00 });
+
+    static inline std::uint32_t color_key(const std::optional<Pixel> &color) noexcept {
+        // Only alpha bits are set if there is no color, and a masked pixel never has those set, so this never matches anything
+        return color.has_value() ? (pixel_bits(*color) & COLOR_MASK) : ~COLOR_MASK;
+    }
+
+    // Find the first pixel in a row that does not match the key (or return the width if they all do). Blocks are compared without branching so they can be vectorized while still stopping early.
+    static std::size_t find_mismatched_pixel(const Pixel *row, std::size_t width, std::uint32_t key) noexcept {
+        static constexpr std::size_t BLOCK_SIZE = 32;
+        std::size_t x = 0;
+        for(; x + BLOCK_SIZE <= width; x += BLOCK_SIZE) {
+            std::uint32_t mismatched = 0;
+            for(std::size_t i = 0; i < BLOCK_SIZE; i++) {
+                mismatched |= (pixel_bits(row[x + i]) & COLOR_MASK) ^ key;
+            }
+            if(mismatched) {
+                break;
+            }
+        }
+        for(; x < width; x++) {
+            if((pixel_bits(row[x]) & COLOR_MASK) != key) {
+                return x;
+            }
+        }
+        return width;
+    }
+
     #define GET_PIXEL(x,y) (pixels[y * width + x])
 
     GeneratedBitmapData ColorPlateScanner::scan_color_plate(const Pixel *pixels, std::uint32_t width, std::uint32_t height, BitmapType type, BitmapUsage usage, bool reg_point_hack, bool allow_non_power_of_two) {
@@ -48,11 +87,8 @@ namespace Invader {
             const auto &spacing_candidate = pixels[2];
             
             // First, check to see if everything on the top row except the first three pixels is transparency
-            for(std::uint32_t x = 3; x < width; x++) {
-                if(!same_color_ignore_opacity(GET_PIXEL(x, 0), transparency_candidate)) {
-                    valid_color_plate_key = false;
-                    break;
-                }
+            if(find_mismatched_pixel(pixels + 3, width - 3, pixel_bits(transparency_candidate) & COLOR_MASK) != width - 3) {
+                valid_color_plate_key = false;
             }
             
             // The key is valid maybe?
@@ -88,14 +124,9 @@ namespace Invader {
                         }
                     };
                     
+                    auto transparency_key = color_key(scanner.transparency_color);
                     for(std::size_t y = 1; y < height; y++) {
-                        bool all_blue = true;
-                        for(std::size_t x = 0; x < width; x++) {
-                            if(!scanner.is_transparency_color(GET_PIXEL(x,y))) {
-                                all_blue = false;
-                                break;
-                            }
-                        }
+                        bool all_blue = find_mismatched_pixel(pixels + y * width, width, transparency_key) == width;
                         
                         // If it's all blue and we're in a sequence, then the sequence has ended
                         if(all_blue == start_y.has_value()) {
@@ -119,13 +150,13 @@ namespace Invader {
                 // Generate sequences
                 auto *sequence = &generated_bitmap.sequences.emplace_back();
                 
-                auto is_horizontal_bar = [&scanner, &width, &pixels](std::size_t y) {
+                auto sequence_divider_key = color_key(scanner.sequence_divider_color);
+                auto is_horizontal_bar = [&scanner, &width, &pixels, &sequence_divider_key](std::size_t y) {
                     if(scanner.is_sequence_divider_color(GET_PIXEL(0,y))) {
-                        for(std::size_t x = 1; x < width; x++) {
-                            if(!scanner.is_sequence_divider_color(GET_PIXEL(x,y))) {
-                                eprintf_error("Sequence divider broken at (%zu,%zu)", x, y);
-                                throw InvalidInputBitmapException();
-                            }
+                        auto x = find_mismatched_pixel(pixels + y * width, width, sequence_divider_key);
+                        if(x != width) {
+                            eprintf_error("Sequence divider broken at (%zu,%zu)", x, y);
+                            throw InvalidInputBitmapException();
                         }
                         return true;
                     }
@@ -189,186 +220,200 @@ namespace Invader {
     }
 
     void ColorPlateScanner::read_color_plate(GeneratedBitmapData &generated_bitmap, const Pixel *pixels, std::uint32_t width, bool reg_point_hack) const {
-        for(auto &sequence : generated_bitmap.sequences) {
-            sequence.first_bitmap = generated_bitmap.bitmaps.size();
-            sequence.bitmap_count = 0;
+        auto &sequences = generated_bitmap.sequences;
+        std::vector<ScannedSequence> scanned(sequences.size());
+
+        // Sequences don't depend on each other, so large color plates can have them scanned in parallel
+        static constexpr std::size_t PARALLEL_PIXEL_COUNT = 1024 * 1024;
+        std::size_t thread_count = 1;
+        if(sequences.size() > 1 && static_cast<std::size_t>(width) * sequences.back().y_end >= PARALLEL_PIXEL_COUNT) {
+            thread_count = std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1U), sequences.size());
+        }
+
+        std::atomic<std::size_t> sequence_index = 0;
+        auto scan_worker = [this, &sequences, &scanned, &sequence_index, &pixels, &width, &reg_point_hack]() {
+            while(true) {
+                auto this_index = sequence_index++;
+                if(this_index >= sequences.size()) {
+                    return;
+                }
+                scanned[this_index] = this->read_color_plate_sequence(sequences[this_index], pixels, width, reg_point_hack);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for(std::size_t i = 1; i < thread_count; i++) {
+            threads.emplace_back(scan_worker);
+        }
+        scan_worker();
+        for(auto &i : threads) {
+            i.join();
+        }
 
-            // Search left and right for bitmap borders
-            const std::uint32_t X_END = width;
-            const std::uint32_t Y_START = sequence.y_start;
-            const std::uint32_t Y_END = sequence.y_end;
+        // Put everything together in order (and if anything failed, fail on the first one like we would have if we did it one at a time)
+        for(std::size_t s = 0; s < sequences.size(); s++) {
+            auto &sequence = sequences[s];
+            auto &scanned_sequence = scanned[s];
 
-            // This is used for the registration point
-            const double MID_Y = (static_cast<double>(Y_START) + static_cast<double>(Y_END)) / 2.0;
+            if(scanned_sequence.error) {
+                eprintf(scanned_sequence.error, scanned_sequence.error_value);
+                throw InvalidInputBitmapException();
+            }
+
+            sequence.first_bitmap = generated_bitmap.bitmaps.size();
+            sequence.bitmap_count = scanned_sequence.bitmaps.size();
+            std::move(scanned_sequence.bitmaps.begin(), scanned_sequence.bitmaps.end(), std::back_inserter(generated_bitmap.bitmaps));
+        }
+    }
 
-            // Go through each pixel
+    ColorPlateScanner::ScannedSequence ColorPlateScanner::read_color_plate_sequence(const GeneratedBitmapDataSequence &sequence, const Pixel *pixels, std::uint32_t width, bool reg_point_hack) const {
+        ScannedSequence scanned;
+
+        const std::uint32_t X_END = width;
+        const std::uint32_t Y_START = sequence.y_start;
+        const std::uint32_t Y_END = sequence.y_end;
+
+        // This is used for the registration point
+        const double MID_Y = (static_cast<double>(Y_START) + static_cast<double>(Y_END)) / 2.0;
+
+        auto transparency_key = color_key(this->transparency_color);
+        auto sequence_divider_key = color_key(this->sequence_divider_color);
+        auto spacing_key = color_key(this->spacing_color);
+
+        // First, get the vertical extents of each column in one pass over the rows.
+        //
+        // "Virtual" pixels are anything that isn't transparency or a sequence divider (so they include spacing), and they're what separate bitmaps from each other.
+        // The bitmap itself is made from the pixels that aren't spacing, either.
+        static constexpr std::uint32_t NONE = UINT32_MAX;
+        std::vector<std::uint32_t> column_min_y(X_END, NONE), column_max_y(X_END, 0), column_virtual_min_y(X_END, NONE), column_virtual_max_y(X_END, 0);
+        auto *min_y_data = column_min_y.data();
+        auto *max_y_data = column_max_y.data();
+        auto *virtual_min_y_data = column_virtual_min_y.data();
+        auto *virtual_max_y_data = column_virtual_max_y.data();
+
+        for(std::uint32_t y = Y_START; y < Y_END; y++) {
+            const auto *row = pixels + static_cast<std::size_t>(y) * width;
             for(std::uint32_t x = 0; x < X_END; x++) {
-                for(std::uint32_t y = Y_START; y < Y_END; y++) {
-                    auto &pixel = GET_PIXEL(x,y);
+                // Use masks instead of branches here so this can be vectorized
+                auto bits = pixel_bits(row[x]) & COLOR_MASK;
+                std::uint32_t virtual_mask = 0 - static_cast<std::uint32_t>((bits != transparency_key) & (bits != sequence_divider_key));
+                std::uint32_t real_mask = virtual_mask & (0 - static_cast<std::uint32_t>(bits != spacing_key));
+
+                // Rows go top to bottom, so the first y we see is the minimum and the last is the maximum
+                virtual_min_y_data[x] = std::min(virtual_min_y_data[x], y | ~virtual_mask);
+                virtual_max_y_data[x] = (y & virtual_mask) | (virtual_max_y_data[x] & ~virtual_mask);
+                min_y_data[x] = std::min(min_y_data[x], y | ~real_mask);
+                max_y_data[x] = (y & real_mask) | (max_y_data[x] & ~real_mask);
+            }
+        }
 
-                    // Ignore? Okay.
-                    if(this->is_transparency_color(pixel) || this->is_sequence_divider_color(pixel)) {
-                        continue;
-                    }
+        // Next, go through each run of columns that have something in them. Each one is a bitmap unless it's only spacing.
+        std::uint32_t x = 0;
+        while(x < X_END) {
+            if(column_virtual_min_y[x] == NONE) {
+                x++;
+                continue;
+            }
 
-                    // Begin.
-                    std::optional<std::uint32_t> min_x;
-                    std::optional<std::uint32_t> max_x;
-                    std::optional<std::uint32_t> min_y;
-                    std::optional<std::uint32_t> max_y;
-
-                    std::optional<std::uint32_t> virtual_min_x;
-                    std::optional<std::uint32_t> virtual_max_x;
-                    std::optional<std::uint32_t> virtual_min_y;
-                    std::optional<std::uint32_t> virtual_max_y;
-
-                    // Find the minimum x, y, max x, and max y stuff
-                    for(std::uint32_t xb = x; xb < X_END; xb++) {
-                        // Set this to false if we got something this column
-                        bool ignored_this_x = true;
-
-                        for(std::uint32_t yb = Y_START; yb < Y_END; yb++) {
-                            auto &pixel = GET_PIXEL(xb, yb);
-
-                            // This is for anything that's not a cyan/magenta/blue pixel
-                            if(!this->is_ignored(pixel)) {
-                                if(min_x.has_value()) {
-                                    if(min_x.value() > xb) {
-                                        min_x = xb;
-                                    }
-                                    if(min_y.value() > yb) {
-                                        min_y = yb;
-                                    }
-                                    if(max_x.value() < xb) {
-                                        max_x = xb;
-                                    }
-                                    if(max_y.value() < yb) {
-                                        max_y = yb;
-                                    }
-                                }
-                                else {
-                                    min_x = xb;
-                                    min_y = yb;
-                                    max_x = xb;
-                                    max_y = yb;
-                                }
-                            }
-
-                            // Anything that's not a magenta/blue pixel then
-                            if(!this->is_transparency_color(pixel) && !this->is_sequence_divider_color(pixel)) {
-                                ignored_this_x = false;
-
-                                if(virtual_min_x.has_value()) {
-                                    if(virtual_min_x.value() > xb) {
-                                        virtual_min_x = xb;
-                                    }
-                                    if(virtual_min_y.value() > yb) {
-                                        virtual_min_y = yb;
-                                    }
-                                    if(virtual_max_x.value() < xb) {
-                                        virtual_max_x = xb;
-                                    }
-                                    if(virtual_max_y.value() < yb) {
-                                        virtual_max_y = yb;
-                                    }
-                                }
-                                else {
-                                    virtual_min_x = xb;
-                                    virtual_min_y = yb;
-                                    virtual_max_x = xb;
-                                    virtual_max_y = yb;
-                                }
-                            }
-                        }
+            std::uint32_t virtual_min_x = x;
+            std::uint32_t virtual_max_x = x;
+            while(virtual_max_x + 1 < X_END && column_virtual_min_y[virtual_max_x + 1] != NONE) {
+                virtual_max_x++;
+            }
 
-                        if(ignored_this_x) {
-                            break;
-                        }
-                    }
+            std::optional<std::uint32_t> min_x;
+            std::uint32_t max_x = 0;
+            std::uint32_t min_y = NONE;
+            std::uint32_t max_y = 0;
+            std::uint32_t virtual_min_y = NONE;
+            std::uint32_t virtual_max_y = 0;
 
-                    // If we never got a minimum x, then continue on
+            for(std::uint32_t xb = virtual_min_x; xb <= virtual_max_x; xb++) {
+                virtual_min_y = std::min(virtual_min_y, column_virtual_min_y[xb]);
+                virtual_max_y = std::max(virtual_max_y, column_virtual_max_y[xb]);
+
+                if(column_min_y[xb] != NONE) {
                     if(!min_x.has_value()) {
-                        continue;
+                        min_x = xb;
                     }
+                    max_x = xb;
+                    min_y = std::min(min_y, column_min_y[xb]);
+                    max_y = std::max(max_y, column_max_y[xb]);
+                }
+            }
 
-                    // Get the width and height
-                    std::uint32_t bitmap_width = max_x.value() - min_x.value() + 1;
-                    std::uint32_t bitmap_height = max_y.value() - min_y.value() + 1;
+            // If it's only spacing, then continue on
+            if(!min_x.has_value()) {
+                x = virtual_max_x + 1;
+                continue;
+            }
 
-                    // If we require power-of-two, check
-                    if(power_of_two) {
-                        if(!HEK::is_power_of_two(bitmap_width)) {
-                            eprintf(ERROR_INVALID_BITMAP_WIDTH, bitmap_width);
-                            throw InvalidInputBitmapException();
-                        }
-                        if(!HEK::is_power_of_two(bitmap_height)) {
-                            eprintf(ERROR_INVALID_BITMAP_HEIGHT, bitmap_height);
-                            throw InvalidInputBitmapException();
-                        }
-                    }
+            // Get the width and height
+            std::uint32_t bitmap_width = max_x - min_x.value() + 1;
+            std::uint32_t bitmap_height = max_y - min_y + 1;
 
-                    // Add the bitmap
-                    auto &bitmap = generated_bitmap.bitmaps.emplace_back();
-                    bitmap.width = bitmap_width;
-                    bitmap.height = bitmap_height;
-                    bitmap.color_plate_x = min_x.value();
-                    bitmap.color_plate_y = min_y.value();
-                    
-                    assert(min_x.has_value());
-                    assert(min_y.has_value());
-                    assert(virtual_min_x.has_value());
-                    assert(virtual_min_y.has_value());
-                    
-                    assert(max_x.has_value());
-                    assert(max_y.has_value());
-                    assert(virtual_max_x.has_value());
-                    assert(virtual_max_y.has_value());
-                    
-                    auto min_x_f = static_cast<double>(*min_x);
-                    auto min_y_f = static_cast<double>(*min_y);
-                    auto virtual_min_x_f = static_cast<double>(*virtual_min_x);
-                    auto virtual_min_y_f = static_cast<double>(*virtual_min_y);
-                    
-                    //auto max_x_f = static_cast<double>(*max_x);
-                    //auto max_y_f = static_cast<double>(*max_y);
-                    auto virtual_max_x_f = static_cast<double>(*virtual_max_x);
-                    auto virtual_max_y_f = static_cast<double>(*virtual_max_y);
+            // If we require power-of-two, check
+            if(power_of_two) {
+                if(!HEK::is_power_of_two(bitmap_width)) {
+                    scanned.error = ERROR_INVALID_BITMAP_WIDTH;
+                    scanned.error_value = bitmap_width;
+                    return scanned;
+                }
+                if(!HEK::is_power_of_two(bitmap_height)) {
+                    scanned.error = ERROR_INVALID_BITMAP_HEIGHT;
+                    scanned.error_value = bitmap_height;
+                    return scanned;
+                }
+            }
 
-                    // Calculate registration point.
-                    const double MID_X = (virtual_max_x_f + virtual_min_x_f) / 2.0;
+            // Add the bitmap
+            auto &bitmap = scanned.bitmaps.emplace_back();
+            bitmap.width = bitmap_width;
+            bitmap.height = bitmap_height;
+            bitmap.color_plate_x = min_x.value();
+            bitmap.color_plate_y = min_y;
 
-                    // The x point is the midpoint of the width of the bitmap and cyan stuff relative to the left
-                    bitmap.registration_point_x = MID_X - min_x_f + 0.5;
+            auto min_x_f = static_cast<double>(*min_x);
+            auto min_y_f = static_cast<double>(min_y);
+            auto virtual_min_x_f = static_cast<double>(virtual_min_x);
+            auto virtual_min_y_f = static_cast<double>(virtual_min_y);
 
-                    // The y point is the midpoint of the height of the entire sequence relative to the top (or if we have the reg point hack, relative to the top of the bitmap itself)
-                    if(!reg_point_hack) {
-                        bitmap.registration_point_y = MID_Y - min_y_f + 0.5;
-                    }
-                    else {
-                        bitmap.registration_point_y = virtual_min_y_f - min_y_f + (virtual_max_y_f - virtual_min_y_f) / 2.0 + 0.5;
-                    }
+            auto virtual_max_x_f = static_cast<double>(virtual_max_x);
+            auto virtual_max_y_f = static_cast<double>(virtual_max_y);
 
-                    // Load the pixels
-                    for(std::uint32_t by = min_y.value(); by <= max_y.value(); by++) {
-                        for(std::uint32_t bx = min_x.value(); bx <= max_x.value(); bx++) {
-                            auto &pixel = GET_PIXEL(bx, by);
-                            if(this->is_ignored(pixel)) {
-                                bitmap.pixels.push_back(Pixel {});
-                            }
-                            else {
-                                bitmap.pixels.push_back(pixel);
-                            }
-                        }
-                    }
+            // Calculate registration point.
+            const double MID_X = (virtual_max_x_f + virtual_min_x_f) / 2.0;
 
-                    sequence.bitmap_count++;
+            // The x point is the midpoint of the width of the bitmap and cyan stuff relative to the left
+            bitmap.registration_point_x = MID_X - min_x_f + 0.5;
+
+            // The y point is the midpoint of the height of the entire sequence relative to the top (or if we have the reg point hack, relative to the top of the bitmap itself)
+            if(!reg_point_hack) {
+                bitmap.registration_point_y = MID_Y - min_y_f + 0.5;
+            }
+            else {
+                bitmap.registration_point_y = virtual_min_y_f - min_y_f + (virtual_max_y_f - virtual_min_y_f) / 2.0 + 0.5;
+            }
 
-                    // Set it to the max value. Add 1 since sprites can't possibly be adjacent to each other. Then, the for loop will add 1 again to get to the minimum possible x value.
-                    x = virtual_max_x.value() + 1;
-                    break;
+            // Load the pixels
+            bitmap.pixels.resize(static_cast<std::size_t>(bitmap_width) * bitmap_height);
+            auto *bitmap_row = bitmap.pixels.data();
+            for(std::uint32_t by = min_y; by <= max_y; by++, bitmap_row += bitmap_width) {
+                const auto *row = pixels + static_cast<std::size_t>(by) * width + *min_x;
+                for(std::uint32_t bx = 0; bx < bitmap_width; bx++) {
+                    // Ignored pixels become 0 (again, masks instead of branches so this can be vectorized)
+                    auto bits = pixel_bits(row[bx]);
+                    auto color = bits & COLOR_MASK;
+                    bits &= 0 - static_cast<std::uint32_t>((color != transparency_key) & (color != sequence_divider_key) & (color != spacing_key));
+                    std::memcpy(bitmap_row + bx, &bits, sizeof(bits));
                 }
             }
+
+            // Skip past this bitmap. Add 1 since sprites can't possibly be adjacent to each other.
+            x = virtual_max_x + 2;
         }
+
+        return scanned;
     }
 
     void ColorPlateScanner::read_unrolled_cubemap(GeneratedBitmapData &generated_bitmap, const Pixel *pixels, std::uint32_t width, std::uint32_t height) const {
@@ -28,7 +28,7 @@ namespace Invader {
         auto *image_buffer = stbi_load(path, &x, &y, &channels, 4);
         if(!image_buffer) {
             eprintf_error("Failed to load %s. Error was: %s", path, stbi_failure_reason());
-            exit(EXIT_FAILURE);
+            return {};
         }
 
         // Get the width and height
@@ -49,7 +49,7 @@ namespace Invader {
         TIFF *image_tiff = TIFFOpen(path, "r");
         if(!image_tiff) {
             eprintf_error("Cannot open %s", path);
-            exit(EXIT_FAILURE);
+            return {};
         }
         TIFFGetField(image_tiff, TIFFTAG_IMAGEWIDTH, &image_width);
         TIFFGetField(image_tiff, TIFFTAG_IMAGELENGTH, &image_height);
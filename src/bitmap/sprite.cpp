@@ -1,5 +1,6 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <algorithm>
 #include <cassert>
 
 #include <invader/bitmap/bitmap_processor.hpp>
@@ -40,142 +41,133 @@ namespace Invader {
             Sprite(const Sprite &) = default;
             Sprite &operator =(const Sprite &a) = default;
             
-            bool overlaps(const Sprite &other) const noexcept {
-                auto overlap = [](const Sprite &a, const Sprite &b) -> bool {
-                    // Get edges
-                    auto a_end_x = a.x + a.effective_width();
-                    auto a_end_y = a.y + a.effective_height();
-                    auto b_end_x = b.x + b.effective_width();
-                    auto b_end_y = b.y + b.effective_height();
-                    
-                    // Left and top
-                    auto l_border_inside = a.x >= b.x && a.x < b_end_x;
-                    auto t_border_inside = a.y >= b.y && a.y < b_end_y;
-                    
-                    // Right and bottom
-                    auto r_border_inside = a_end_x > b.x && a_end_x < b_end_x; // the "end" is actually the pixel after the last pixel and not technically inside
-                    auto b_border_inside = a_end_y > b.y && a_end_y < b_end_y;
-                    
-                    // If both a horizontal and vertical border are inside, then it's overlapping
-                    if((l_border_inside || r_border_inside) && (t_border_inside || b_border_inside)) {
-                        return true;
-                    }
-                    
-                    // Get borders that are outside
-                    auto l_border_left = a.x <= b.x;
-                    auto r_border_right = a_end_x >= b_end_x;
-                    auto t_border_up = a.y <= b.y;
-                    auto b_border_bottom = a_end_y >= b_end_y;
-                    
-                    // If either a horizontal or vertical border is inside and we're within the two other borders, then it's overlapping
-                    if((l_border_inside || r_border_inside) && (t_border_up && b_border_bottom)) {
-                        return true;
-                    }
-                    if((t_border_inside || b_border_inside) && (l_border_left && r_border_right)) {
-                        return true;
-                    }
-                    
-                    // If we're within all borders, we're overlapping
-                    if(l_border_left && r_border_right && t_border_up && b_border_bottom) {
-                        return true;
-                    }
-                    
-                    return false;
-                };
-                
-                return overlap(*this, other) || overlap(other, *this);
-            }
-            
             unsigned int effective_width() const noexcept {
                 return bitmap_data->width + sheet->spacing * 2;
             }
             unsigned int effective_height() const noexcept {
                 return bitmap_data->height + sheet->spacing * 2;
             }
+        };
+        
+        std::vector<Sprite> sprites;
+        
+        // Skyline (the top edge of everything placed so far, split into horizontal segments sorted by x)
+        struct SkylineNode {
+            unsigned int x;
+            unsigned int y;
+            unsigned int width;
+        };
+        std::vector<SkylineNode> skyline;
+        
+        // Remove all sprites and reset the skyline to a flat line at y = 0
+        void clear_sprites() {
+            this->sprites.clear();
+            this->skyline.clear();
+            this->skyline.push_back(SkylineNode { 0, 0, this->max_length });
+        }
+        
+        // Get the y coordinate a rectangle would rest at if its left edge is at skyline node i (if it fits at all)
+        std::optional<unsigned int> skyline_fit(std::size_t i, unsigned int width, unsigned int height) const noexcept {
+            auto x = this->skyline[i].x;
+            if(x + width > this->max_length) {
+                return std::nullopt;
+            }
             
-            bool place_in_sheet() {
-                auto max_length = this->sheet->max_length;
-                
-                auto width = this->effective_width();
-                auto height = this->effective_height();
-                
-                // If the sprite is too big, fail
-                if(width > max_length || height > max_length) {
-                    return false;
+            // Find the highest node we'd be sitting on
+            unsigned int y = 0;
+            auto width_left = width;
+            for(auto node_count = this->skyline.size(); width_left > 0 && i < node_count; i++) {
+                auto &node = this->skyline[i];
+                y = std::max(y, node.y);
+                if(y + height > this->max_length) {
+                    return std::nullopt;
                 }
-                
-                auto y_end = max_length - height;
-                auto x_end = max_length - width;
-                
-                // Otherwise, begin placing
-                auto old_x = this->x;
-                auto old_y = this->y;
-                
-                // 0 sprites always succeeds
-                if(this->sheet->sprites.empty()) {
-                    this->x = 0;
-                    this->y = 0;
-                    return true;
+                width_left -= std::min(width_left, node.width);
+            }
+            
+            return y;
+        }
+        
+        // Find the best place for the sprite (lowest resulting top edge, then leftmost) and set its coordinates if it fits
+        bool find_place_for_sprite(Sprite &sprite) const noexcept {
+            auto width = sprite.effective_width();
+            auto height = sprite.effective_height();
+            
+            // If the sprite is too big, fail
+            if(width > this->max_length || height > this->max_length) {
+                return false;
+            }
+            
+            std::optional<unsigned int> best_bottom;
+            for(std::size_t i = 0; i < this->skyline.size(); i++) {
+                auto y = this->skyline_fit(i, width, height);
+                if(!y.has_value()) {
+                    continue;
                 }
                 
-                this->y = 0;
-                
-                auto sprites_level = this->sheet->sprites.begin();
-                auto sprites_end = this->sheet->sprites.end();
-                
-                auto &sprite = *this;
-                
-                auto search_row = [&x_end, &sprite]() {
-                    // Scan left to right
-                    for(sprite.x = 0; sprite.x <= x_end; sprite.x++) {
-                        bool overlap_fail = false;
-                        for(auto &s : sprite.sheet->sprites) {
-                            if(s.overlaps(sprite)) {
-                                overlap_fail = true;
-                                break;
-                            }
-                        }
-                        
-                        // Success
-                        if(!overlap_fail) {
-                            return true;
-                        }
-                    }
-                    
-                    // Fail
-                    return false;
-                };
-                
-                // Try packing it nicely
-                while(true) {
-                    // Scan left to right
-                    if(search_row()) {
-                        return true;
-                    }
-                    
-                    // Find the next y "level"
-                    for(auto &l = sprites_level; l != sprites_end; l++) {
-                        if(l->y == this->y) {
-                            this->y += l->effective_height();
-                            sprites_level = l;
-                            break;
-                        }
-                    }
-                    
-                    // If we could not find one or it won't fit, break
-                    if(this->y > y_end) {
-                        break;
-                    }
+                auto bottom = *y + height;
+                if(!best_bottom.has_value() || bottom < *best_bottom) {
+                    best_bottom = bottom;
+                    sprite.x = this->skyline[i].x;
+                    sprite.y = *y;
+                }
+            }
+            
+            return best_bottom.has_value();
+        }
+        
+        // Raise the skyline over a sprite that was positioned with find_place_for_sprite()
+        void add_sprite_to_skyline(const Sprite &sprite) {
+            auto width = sprite.effective_width();
+            auto height = sprite.effective_height();
+            
+            // Sprites are always placed at the start of a node
+            auto i = static_cast<std::size_t>(std::lower_bound(this->skyline.begin(), this->skyline.end(), sprite.x, [](const SkylineNode &node, unsigned int x) { return node.x < x; }) - this->skyline.begin());
+            assert(i < this->skyline.size() && this->skyline[i].x == sprite.x);
+            this->skyline.insert(this->skyline.begin() + i, SkylineNode { sprite.x, sprite.y + height, width });
+            
+            // Shrink or remove whatever nodes are now underneath it
+            for(std::size_t j = i + 1; j < this->skyline.size();) {
+                auto &previous = this->skyline[j - 1];
+                auto &node = this->skyline[j];
+                auto previous_end = previous.x + previous.width;
+                if(node.x >= previous_end) {
+                    break;
                 }
                 
-                this->x = old_x;
-                this->y = old_y;
+                auto shrink = previous_end - node.x;
+                if(node.width <= shrink) {
+                    this->skyline.erase(this->skyline.begin() + j);
+                    continue;
+                }
                 
-                return false;
+                node.x += shrink;
+                node.width -= shrink;
+                break;
             }
-        };
+            
+            // Merge neighboring nodes at the same height
+            for(std::size_t j = 1; j < this->skyline.size();) {
+                auto &previous = this->skyline[j - 1];
+                if(previous.y == this->skyline[j].y) {
+                    previous.width += this->skyline[j].width;
+                    this->skyline.erase(this->skyline.begin() + j);
+                }
+                else {
+                    j++;
+                }
+            }
+        }
         
-        std::vector<Sprite> sprites;
+        // Place the sprite and add it to the sheet if it fits
+        bool place_sprite(Sprite sprite) {
+            if(!this->find_place_for_sprite(sprite)) {
+                return false;
+            }
+            this->add_sprite_to_skyline(sprite);
+            this->sprites.emplace_back(sprite).sheet = this;
+            return true;
+        }
         
         std::vector<Pixel> bake_sprite_sheet(HEK::BitmapSpriteUsage sprite_usage) const {
             Pixel background_color;
@@ -237,7 +229,7 @@ namespace Invader {
             Sprite sprite_candidate(bitmap_data->bitmaps[bitmap_index], *this, sprite, sequence);
             
             // Attempt to place it in the sheet
-            if(sprite_candidate.place_in_sheet()) {
+            if(this->find_place_for_sprite(sprite_candidate)) {
                 return sprite_candidate;
             }
             else {
@@ -258,6 +250,7 @@ namespace Invader {
             
             auto s = this->best_place_to_add_sprite(sprite, sequence);
             if(s.has_value()) {
+                this->add_sprite_to_skyline(*s);
                 this->sprites.emplace_back(*s);
                 return true;
             }
@@ -326,9 +319,11 @@ namespace Invader {
                 // Try adding everything.
                 else {
                     auto sprite_data_backup = this->sprites;
+                    auto skyline_backup = this->skyline;
                     for(auto sprite : sprite_indices) {
                         if(!this->add_sprite_to_sheet(sprite, sequence)) {
                             this->sprites = sprite_data_backup;
+                            this->skyline = skyline_backup;
                             return false;
                         }
                     }
@@ -354,63 +349,25 @@ namespace Invader {
                     return bd.bitmaps[bd.sequences[sequence].sprites[sprite].bitmap_index].height;
                 };
                 
-                // Get the height of the sprite at index n
-                auto sorted_sprite_height = [&sorted, &sprite_height](std::size_t n) {
-                    auto [sprite, sequence] = sorted[n];
-                    return sprite_height(sprite, sequence);
-                };
-                
-                // Sort the sprites of the new sequence into these sprites (binary sorting will make it faster - O(n log n))
+                // Merge the sprites of the new sequence into these sprites, keeping the existing order for equal heights
                 for(auto sprite : sprite_indices) {
-                    auto height = sprite_height(sprite, sequence);
-                    
-                    // Set our search parameters (start is 0, end is the index of the last element)
-                    std::size_t start = 0;
-                    std::size_t end = sorted.size();
-                    
-                    while(true) {
-                        std::size_t i = (start + end) / 2;
-                        
-                        auto height_other = sorted_sprite_height(i);
-                        
-                        auto add_to_i = [&i, &sorted, &sprite, &sequence] {
-                            sorted.emplace(sorted.begin() + i, sprite, sequence);
-                        };
-                        
-                        // If it equals, add at this index then
-                        if(height == height_other) {
-                            add_to_i();
-                            break;
-                        }
-                        
-                        // If it's greater, search before
-                        else if(height > height_other) {
-                            end = i;
-                        }
-                        
-                        // If it's less, search after
-                        else if(height < height_other) {
-                            start = i + 1;
-                        }
-                        
-                        // If start and end are equal, place it here then
-                        if(start == end) {
-                            i = start;
-                            add_to_i();
-                            break;
-                        }
-                    }
+                    sorted.emplace_back(sprite, sequence);
                 }
-            
+                std::stable_sort(sorted.begin(), sorted.end(), [&sprite_height](const auto &a, const auto &b) {
+                    return sprite_height(a.first, a.second) > sprite_height(b.first, b.second);
+                });
+                
                 // Let's try adding everything
                 auto sprite_data_backup = this->sprites;
-                this->sprites.clear();
+                auto skyline_backup = this->skyline;
+                this->clear_sprites();
                 
                 for(auto &s : sorted) {
                     auto [sprite, sequence] = s;
                     if(!this->add_sprite_to_sheet(sprite, sequence)) {
                         // Nope
                         this->sprites = sprite_data_backup;
+                        this->skyline = skyline_backup;
                         return false;
                     }
                 }
@@ -447,22 +404,21 @@ namespace Invader {
                     // Copy the old values
                     auto old_max_length = this->max_length;
                     auto old_sprites = this->sprites;
+                    auto old_skyline = this->skyline;
                     
                     // Halve max length, clear sprites
                     this->max_length >>= 1;
-                    this->sprites.clear();
+                    this->clear_sprites();
                     
                     // Go through each sprite and see if we can re-add all of them again
                     for(auto s : old_sprites) {
                         // Fail - copy back in old values
-                        if(!s.place_in_sheet()) {
+                        if(!this->place_sprite(s)) {
                             this->max_length = old_max_length;
                             this->sprites = old_sprites;
+                            this->skyline = old_skyline;
                             goto done_brute_forcing_sprites;
                         }
-                        
-                        // Success - added!
-                        this->sprites.emplace_back(s);
                     }
                 }
             }
@@ -482,7 +438,9 @@ namespace Invader {
             }
         }
         
-        SpriteSheet(unsigned int spacing, const GeneratedBitmapData &bitmap_data, unsigned max_length) : spacing(spacing), max_length(max_length), bitmap_data(&bitmap_data) {}
+        SpriteSheet(unsigned int spacing, const GeneratedBitmapData &bitmap_data, unsigned max_length) : spacing(spacing), max_length(max_length), bitmap_data(&bitmap_data) {
+            this->clear_sprites();
+        }
         
         SpriteSheet(const SpriteSheet &other) {
             *this = other;
@@ -494,6 +452,8 @@ namespace Invader {
             this->max_height = other.max_height;
             this->bitmap_data = other.bitmap_data;
             this->locked = other.locked;
+            this->skyline = other.skyline;
+            this->sprites.clear();
             for(auto &s : other.sprites) {
                 this->sprites.emplace_back(s).sheet = this;
             }
@@ -525,24 +485,11 @@ namespace Invader {
             sorted.reserve(sprite_count);
             
             for(std::size_t s = 0; s < sprite_count; s++) {
-                bool added = false;
-                auto &sprite = seq.sprites[s];
-                auto height = bitmap.bitmaps[sprite.original_bitmap_index].height;
-                
-                for(auto &s_other : sorted) {
-                    auto index_other = &s_other - sorted.data();
-                    
-                    auto height_other = bitmap.bitmaps[seq.sprites[s_other].original_bitmap_index].height;
-                    if(height > height_other) {
-                        added = true;
-                        sorted.insert(sorted.begin() + index_other, s);
-                        break;
-                    }
-                }
-                if(!added) {
-                    sorted.emplace_back(s);
-                }
+                sorted.emplace_back(s);
             }
+            std::stable_sort(sorted.begin(), sorted.end(), [&bitmap, &seq](std::size_t a, std::size_t b) {
+                return bitmap.bitmaps[seq.sprites[a].original_bitmap_index].height > bitmap.bitmaps[seq.sprites[b].original_bitmap_index].height;
+            });
         }
         
         // Number of split across sprite sequences (hopefully zero but entirely possible)
@@ -573,23 +520,22 @@ namespace Invader {
             else {
                 split_across++;
                 
-                auto sprite_count = sorted.size();
-                auto make_new_sheet = [&spacing, &bitmap, &max_length, &sprite_sheets]() {
-                    return &sprite_sheets.emplace_back(spacing, bitmap, max_length);
-                };
-                auto *next_sheet = make_new_sheet();
+                // Sheets made for this sequence (earlier sheets already failed to fit the whole sequence)
+                auto first_split_sheet = sprite_sheets.size();
                 
-                // Go through each sprite
-                for(std::size_t i = 0; i < sprite_count; i++) {
-                    auto sprite = sorted[i];
+                // Go through each sprite, putting it in the first sheet it fits in
+                for(auto sprite : sorted) {
+                    bool placed = false;
+                    for(auto j = first_split_sheet; j < sprite_sheets.size() && !placed; j++) {
+                        placed = sprite_sheets[j].add_sprite_to_sheet_and_lock_if_needed(sprite, si);
+                    }
                     
-                    // Attempt to add it to this sheet
-                    if(!next_sheet->add_sprite_to_sheet_and_lock_if_needed(sprite, si)) {
-                        // If we fail, move onto the next sheet                        
-                        next_sheet = make_new_sheet();
+                    // If we fail, move onto a new sheet
+                    if(!placed) {
+                        auto &next_sheet = sprite_sheets.emplace_back(spacing, bitmap, max_length);
                         
                         // If we can't even fit it in a sheet by itself, then get rekt
-                        if(!next_sheet->add_sprite_to_sheet_and_lock_if_needed(sprite, si)) {
+                        if(!next_sheet.add_sprite_to_sheet_and_lock_if_needed(sprite, si)) {
                             eprintf_error("Could not fit all sprites in sequence %zu in %zux%zu sprite sheets", si, max_length, max_length);
                             throw InvalidTagDataException();
                         }
@@ -2,180 +2,204 @@
 
 #include <invader/bitmap/swizzle.hpp>
 #include <vector>
+#include <bit>
 #include <cstdint>
 #include <cstring>
 #include <cstdlib>
+#include <utility>
 #include <invader/printf.hpp>
 #include <invader/hek/data_type.hpp>
 
 namespace Invader::Swizzle {
-    template<typename Pixel> static std::size_t swizzle_block_2x2(const Pixel *values_in, Pixel *values_out, std::size_t stride, std::size_t counter, bool deswizzle) {
-        if(!deswizzle) {
-            // values_in  = unswizzled
-            // values_out = swizzled
-            values_out[counter++] = values_in[0];
-            values_out[counter++] = values_in[1];
-            values_out[counter++] = values_in[0 + stride];
-            values_out[counter++] = values_in[1 + stride];
+    // Spread the bits of a coordinate out so that there are (dimensions - 1) zero bits between each bit (i.e. 0b111 -> 0b10101 for 2D)
+    static std::size_t spread_bits(std::size_t value, std::size_t dimensions) noexcept {
+        std::size_t answer = 0;
+        for(std::size_t i = 0; value != 0; i++, value >>= 1) {
+            answer |= (value & 1) << (i * dimensions);
         }
-        else {
-            // values_in  = swizzled
-            // values_out = unswizzled
-            values_out[0] = values_in[counter++];
-            values_out[1] = values_in[counter++];
-            values_out[0 + stride] = values_in[counter++];
-            values_out[1 + stride] = values_in[counter++];
-        }
-        return counter;
+        return answer;
     }
 
-    template<typename Pixel> static std::size_t swizzle_block(const Pixel *values_in, Pixel *values_out, std::size_t width, std::size_t stride, std::size_t counter, bool deswizzle) {
-        if(width == 2) {
-            return swizzle_block_2x2(values_in, values_out, stride, counter, deswizzle);
-        }
+    // Swizzled offsets are separable (offset = x_offsets[x] + y_offsets[y] + z_offsets[z]), so we can build one table per axis once and then do rows with a lookup per pixel
+    struct SwizzleTable {
+        std::vector<std::size_t> x_offsets;
+        std::vector<std::size_t> y_offsets;
+        std::vector<std::size_t> z_offsets;
 
-        std::size_t new_width = width / 2;
+        SwizzleTable(std::size_t width, std::size_t height, std::size_t depth) : x_offsets(width), y_offsets(height), z_offsets(depth) {
+            // 3D textures are cubes, so this is just a 3D morton code
+            if(depth > 1) {
+                for(std::size_t x = 0; x < width; x++) {
+                    x_offsets[x] = spread_bits(x, 3);
+                }
+                for(std::size_t y = 0; y < height; y++) {
+                    y_offsets[y] = spread_bits(y, 3) << 1;
+                }
+                for(std::size_t z = 0; z < depth; z++) {
+                    z_offsets[z] = spread_bits(z, 3) << 2;
+                }
+                return;
+            }
 
-        if(!deswizzle) {
-            counter = swizzle_block(values_in, values_out                                 , new_width, stride, counter, deswizzle);
-            counter = swizzle_block(values_in + new_width                                 , values_out, new_width, stride, counter, deswizzle);
-            counter = swizzle_block(values_in + stride * new_width                        , values_out, new_width, stride, counter, deswizzle);
-            counter = swizzle_block(values_in + stride * new_width + new_width, values_out, new_width, stride, counter, deswizzle);
+            // 2D textures are split into squares along the longest axis, and each square is a 2D morton code
+            auto square = std::min(width, height);
+            auto square_size = square * square;
+            for(std::size_t x = 0; x < width; x++) {
+                x_offsets[x] = spread_bits(x % square, 2) + (width > height ? (x / square) * square_size : 0);
+            }
+            for(std::size_t y = 0; y < height; y++) {
+                y_offsets[y] = (spread_bits(y % square, 2) << 1) + (height > width ? (y / square) * square_size : 0);
+            }
+            z_offsets[0] = 0;
         }
-        else {
-            counter = swizzle_block(values_in, values_out                                 , new_width, stride, counter, deswizzle);
-            counter = swizzle_block(values_in, values_out + new_width                     , new_width, stride, counter, deswizzle);
-            counter = swizzle_block(values_in, values_out + stride * new_width            , new_width, stride, counter, deswizzle);
-            counter = swizzle_block(values_in, values_out + stride * new_width + new_width, new_width, stride, counter, deswizzle);
+
+        std::size_t offset(std::size_t x, std::size_t y, std::size_t z) const noexcept {
+            return x_offsets[x] + y_offsets[y] + z_offsets[z];
         }
+    };
 
-        return counter;
-    }
+    template <typename Pixel> static void perform_swizzle(const Pixel *values_in, Pixel *values_out, const SwizzleTable &table, bool deswizzle) {
+        auto width = table.x_offsets.size();
+        auto height = table.y_offsets.size();
+        auto depth = table.z_offsets.size();
+        const auto *x_offsets = table.x_offsets.data();
 
-    template <typename Pixel> static void perform_swizzle_2d(const Pixel *values_in, Pixel *values_out, std::size_t width, std::size_t height, bool deswizzle) {
-        // If height is <= 1 or width is <= 2, it's just a straight copy
-        if(width <= 2 || height <= 1) {
-            std::memcpy(values_out, values_in, width * height * sizeof(*values_in));
-            return;
-        }
+        for(std::size_t z = 0; z < depth; z++) {
+            for(std::size_t y = 0; y < height; y++) {
+                auto row_offset = table.y_offsets[y] + table.z_offsets[z];
 
-        // Also, if width is less than the height, we can subdivide
-        if(width < height) {
-            for(std::size_t y = 0; y < height; y += width) {
-                perform_swizzle_2d(values_in + y * width, values_out + y * width, width, width, deswizzle);
-            }
-            return;
-        }
+                if(deswizzle) {
+                    const auto *swizzled = values_in + row_offset;
+                    for(std::size_t x = 0; x < width; x++) {
+                        values_out[x] = swizzled[x_offsets[x]];
+                    }
+                }
+                else {
+                    auto *swizzled = values_out + row_offset;
+                    for(std::size_t x = 0; x < width; x++) {
+                        swizzled[x_offsets[x]] = values_in[x];
+                    }
+                }
 
-        std::size_t counter = 0;
-        for(std::size_t x = 0; x < width; x+=height) {
-            if(!deswizzle) {
-                counter = swizzle_block(values_in + x, values_out, height, width, counter, deswizzle);
-            }
-            else {
-                counter = swizzle_block(values_in, values_out + x, height, width, counter, deswizzle);
+                if(deswizzle) {
+                    values_out += width;
+                }
+                else {
+                    values_in += width;
+                }
             }
         }
     }
-    
-    // From https://www.forceflow.be/2013/10/07/morton-encodingdecoding-through-bit-interleaving-implementations/
-    static constexpr std::uint64_t morton_encode_3d(unsigned int x, unsigned int y, unsigned int z) {
-        std::uint64_t answer = 0;
-        for (std::uint64_t i = 0; i < (sizeof(std::uint64_t) * 8)/3; ++i) {
-            std::uint64_t bit = static_cast<std::uint64_t>(1) << i;
-            answer |= ((x & bit) << 2*i) | ((y & bit) << (2*i + 1)) | ((z & bit) << (2*i + 2));
-        }
-        return answer;
-    }
-    
-    /*static constexpr std::uint64_t morton_encode_2d(unsigned int x, unsigned int y) {
-        std::uint64_t answer = 0;
-        for (std::uint64_t i = 0; i < (sizeof(std::uint64_t) * 8)/3; ++i) {
-            std::uint64_t bit = static_cast<std::uint64_t>(1) << i;
-            answer |= ((x & bit) << i) | ((y & bit) << (i + 1));
-        }
-        return answer;
-    }*/
-    
-    template <typename Pixel> static void perform_swizzle_3d(const Pixel *values_in, Pixel *values_out, std::size_t width, std::size_t height, std::size_t depth, bool deswizzle) {
-        // Subdivide
-        if(height > width) {
-            auto size = width * width * depth;
-            for(std::size_t i = 0; i < height / width; i++) {
-                perform_swizzle_3d(values_in + size * i, values_out + size * i, width, width, depth, deswizzle);
+
+    template <typename Pixel> static void perform_swizzle_in_place(Pixel *values, const SwizzleTable &table, bool deswizzle) {
+        auto width = table.x_offsets.size();
+        auto height = table.y_offsets.size();
+        auto pixel_count = width * height * table.z_offsets.size();
+
+        // Everything is a power of two, so these are just masks and shifts
+        auto width_bits = std::countr_zero(width);
+        auto height_bits = std::countr_zero(height);
+        auto swizzled_offset = [&table, &width, &height, &width_bits, &height_bits](std::size_t linear) {
+            return table.offset(linear & (width - 1), (linear >> width_bits) & (height - 1), linear >> (width_bits + height_bits));
+        };
+
+        // Follow each cycle of the permutation, marking off pixels as they are moved
+        std::vector<bool> moved(pixel_count);
+        for(std::size_t i = 0; i < pixel_count; i++) {
+            if(moved[i]) {
+                continue;
             }
-            return;
-        }
-        
-        auto size = (width * height * depth);
-        
-        if(size == 0) {
-            return;
-        }
-        
-        for(std::size_t z = 0; z < depth; z++) {
-            for(std::size_t y = 0; y < height; y++) {
-                for(std::size_t x = 0; x < width; x++) {
-                    std::uint64_t m = morton_encode_3d(x,y,z) % size;
-                    
-                    auto offset = (x + y * width + z * width * height) % size;
-                    
-                    if(deswizzle) {
-                        values_out[offset] = values_in[m];
-                    }
-                    else {
-                        values_out[m] = values_in[offset];
+
+            if(deswizzle) {
+                // Pull: values[j] = values[swizzled_offset(j)]
+                auto first = values[i];
+                std::size_t j = i;
+                while(true) {
+                    moved[j] = true;
+                    auto k = swizzled_offset(j);
+                    if(k == i) {
+                        values[j] = first;
+                        break;
                     }
+                    values[j] = values[k];
+                    j = k;
+                }
+            }
+            else {
+                // Push: values[swizzled_offset(j)] = values[j]
+                auto carry = values[i];
+                std::size_t j = i;
+                do {
+                    j = swizzled_offset(j);
+                    std::swap(carry, values[j]);
+                    moved[j] = true;
                 }
+                while(j != i);
             }
         }
     }
 
-    std::vector<std::byte> swizzle(const std::byte *data, std::size_t bits_per_pixel, std::size_t width, std::size_t height, std::size_t depth, bool deswizzle) {
-        std::vector<std::byte> output(width*height*depth*(bits_per_pixel/8));
-        
+    static void check_dimensions(std::size_t width, std::size_t height, std::size_t depth) {
         if(!HEK::is_power_of_two(width) || !HEK::is_power_of_two(height) || !HEK::is_power_of_two(depth)) {
             eprintf_error("Cannot (de)swizzle non-power-of-two texture");
             throw std::exception();
         }
 
-        if(depth > 1) {
-            if(height != width || height != depth) {
-                eprintf_error("Cannot (de)swizzle a 3D texture that isn't 1x1x1");
-                throw std::exception();
-            }
-            
-            switch(bits_per_pixel) {
-                case 8:
-                    perform_swizzle_3d(reinterpret_cast<const std::uint8_t *>(data), reinterpret_cast<std::uint8_t *>(output.data()), width, height, depth, deswizzle);
-                    break;
-                case 16:
-                    perform_swizzle_3d(reinterpret_cast<const std::uint16_t *>(data), reinterpret_cast<std::uint16_t *>(output.data()), width, height, depth, deswizzle);
-                    break;
-                case 32:
-                    perform_swizzle_3d(reinterpret_cast<const std::uint32_t *>(data), reinterpret_cast<std::uint32_t *>(output.data()), width, height, depth, deswizzle);
-                    break;
-                case 64:
-                    perform_swizzle_3d(reinterpret_cast<const std::uint64_t *>(data), reinterpret_cast<std::uint64_t *>(output.data()), width, height, depth, deswizzle);
-                    break;
-            }
+        if(depth > 1 && (height != width || height != depth)) {
+            eprintf_error("Cannot (de)swizzle a 3D texture that isn't 1x1x1");
+            throw std::exception();
         }
-        else {
-            switch(bits_per_pixel) {
-                case 8:
-                    perform_swizzle_2d(reinterpret_cast<const std::uint8_t *>(data), reinterpret_cast<std::uint8_t *>(output.data()), width, height, deswizzle);
-                    break;
-                case 16:
-                    perform_swizzle_2d(reinterpret_cast<const std::uint16_t *>(data), reinterpret_cast<std::uint16_t *>(output.data()), width, height, deswizzle);
-                    break;
-                case 32:
-                    perform_swizzle_2d(reinterpret_cast<const std::uint32_t *>(data), reinterpret_cast<std::uint32_t *>(output.data()), width, height, deswizzle);
-                    break;
-                case 64:
-                    perform_swizzle_2d(reinterpret_cast<const std::uint64_t *>(data), reinterpret_cast<std::uint64_t *>(output.data()), width, height, deswizzle);
-                    break;
-            }
+    }
+
+    void swizzle(const std::byte *data, std::byte *output, std::size_t bits_per_pixel, std::size_t width, std::size_t height, std::size_t depth, bool deswizzle) {
+        check_dimensions(width, height, depth);
+
+        // Swizzling in place needs to follow the permutation instead
+        if(data == output) {
+            swizzle_in_place(output, bits_per_pixel, width, height, depth, deswizzle);
+            return;
+        }
+
+        SwizzleTable table(width, height, depth);
+        switch(bits_per_pixel) {
+            case 8:
+                perform_swizzle(reinterpret_cast<const std::uint8_t *>(data), reinterpret_cast<std::uint8_t *>(output), table, deswizzle);
+                break;
+            case 16:
+                perform_swizzle(reinterpret_cast<const std::uint16_t *>(data), reinterpret_cast<std::uint16_t *>(output), table, deswizzle);
+                break;
+            case 32:
+                perform_swizzle(reinterpret_cast<const std::uint32_t *>(data), reinterpret_cast<std::uint32_t *>(output), table, deswizzle);
+                break;
+            case 64:
+                perform_swizzle(reinterpret_cast<const std::uint64_t *>(data), reinterpret_cast<std::uint64_t *>(output), table, deswizzle);
+                break;
         }
+    }
+
+    void swizzle_in_place(std::byte *data, std::size_t bits_per_pixel, std::size_t width, std::size_t height, std::size_t depth, bool deswizzle) {
+        check_dimensions(width, height, depth);
+
+        SwizzleTable table(width, height, depth);
+        switch(bits_per_pixel) {
+            case 8:
+                perform_swizzle_in_place(reinterpret_cast<std::uint8_t *>(data), table, deswizzle);
+                break;
+            case 16:
+                perform_swizzle_in_place(reinterpret_cast<std::uint16_t *>(data), table, deswizzle);
+                break;
+            case 32:
+                perform_swizzle_in_place(reinterpret_cast<std::uint32_t *>(data), table, deswizzle);
+                break;
+            case 64:
+                perform_swizzle_in_place(reinterpret_cast<std::uint64_t *>(data), table, deswizzle);
+                break;
+        }
+    }
+
+    std::vector<std::byte> swizzle(const std::byte *data, std::size_t bits_per_pixel, std::size_t width, std::size_t height, std::size_t depth, bool deswizzle) {
+        std::vector<std::byte> output(width*height*depth*(bits_per_pixel/8));
+        swizzle(data, output.data(), bits_per_pixel, width, height, depth, deswizzle);
         return output;
     }
 }
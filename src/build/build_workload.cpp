@@ -2,6 +2,7 @@
 
 #include <ctime>
 #include <cstdio>
+#include <memory_resource>
 
 #include <invader/build/build_workload.hpp>
 #include <invader/hek/map.hpp>
@@ -652,6 +653,10 @@ namespace Invader {
         // TODO: Although it accomplishes the same task, this is NOT the algorithm tool.exe uses.
         this->tag_file_checksums = crc32(this->tag_file_checksums, &expected_crc, sizeof(expected_crc));
 
+        // Allocate the parsed tag (and anything else parsed while compiling it) from an arena released once it's compiled
+        std::pmr::monotonic_buffer_resource tag_arena;
+        Parser::ScopedAllocationResource tag_arena_scope(&tag_arena);
+
         auto &structs = this->structs;
         auto &tags = this->tags;
         auto &workload = *this;
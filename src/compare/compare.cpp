@@ -1,7 +1,10 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <atomic>
 #include <thread>
 #include <mutex>
+#include <set>
+#include <unordered_map>
 #include <vector>
 #include <cstring>
 #include <regex>
@@ -12,8 +15,11 @@
 #include <invader/version.hpp>
 #include <invader/printf.hpp>
 #include <invader/file/file.hpp>
+#include <invader/file/content_cache.hpp>
+#include <invader/crc/hash.hpp>
 #include <invader/tag/parser/parser.hpp>
 #include <invader/extract/extraction.hpp>
+#include <invader/thread/thread_pool.hpp>
 #include "../command_line_option.hpp"
 
 using namespace Invader;
@@ -24,6 +30,77 @@ enum Show : std::uint8_t {
     SHOW_ALL = 0xFF
 };
 
+enum ByPath {
+    BY_PATH_SAME = 0,
+    BY_PATH_ANY = 1,
+    BY_PATH_DIFFERENT = 2
+};
+
+// Tags of an input hashed by class and path so we don't have to go through every tag to find the ones we can compare
+struct TagIndex {
+    // Paths and indices of each tag, in order, by class
+    std::unordered_map<HEK::TagFourCC, std::vector<std::pair<std::string, std::size_t>>> by_fourcc;
+
+    // Index of the first tag with each path, by class
+    std::unordered_map<HEK::TagFourCC, std::unordered_map<std::string, std::size_t>> by_path;
+
+    void add(const std::string &path, HEK::TagFourCC fourcc, std::size_t index) {
+        this->by_fourcc[fourcc].emplace_back(path, index);
+        this->by_path[fourcc].emplace(path, index);
+    }
+
+    /**
+     * Find the indices of the tags that can be compared against a tag, in order
+     * @param path    path of the tag (Halo path without an extension)
+     * @param fourcc  class of the tag
+     * @param by_path what tags can be compared
+     * @param limit   maximum number of indices to find
+     * @return        indices of the tags
+     */
+    std::vector<std::size_t> find(const std::string &path, HEK::TagFourCC fourcc, ByPath by_path, std::size_t limit = SIZE_MAX) const {
+        std::vector<std::size_t> indices;
+        if(limit == 0) {
+            return indices;
+        }
+
+        if(by_path == ByPath::BY_PATH_SAME) {
+            auto paths = this->by_path.find(fourcc);
+            if(paths != this->by_path.end()) {
+                auto tag = paths->second.find(path);
+                if(tag != paths->second.end()) {
+                    indices.emplace_back(tag->second);
+                }
+            }
+            return indices;
+        }
+
+        auto tags = this->by_fourcc.find(fourcc);
+        if(tags != this->by_fourcc.end()) {
+            for(auto &t : tags->second) {
+                if(by_path == ByPath::BY_PATH_DIFFERENT && t.first == path) {
+                    continue;
+                }
+                indices.emplace_back(t.second);
+                if(indices.size() == limit) {
+                    break;
+                }
+            }
+        }
+        return indices;
+    }
+
+    /**
+     * Get whether any tag can be compared against a tag
+     * @param path    path of the tag (Halo path without an extension)
+     * @param fourcc  class of the tag
+     * @param by_path what tags can be compared
+     * @return        true if there is one
+     */
+    bool contains(const std::string &path, HEK::TagFourCC fourcc, ByPath by_path) const {
+        return !this->find(path, fourcc, by_path, 1).empty();
+    }
+};
+
 struct Input {
     std::optional<std::filesystem::path> map;
     std::optional<std::filesystem::path> maps;
@@ -33,6 +110,12 @@ struct Input {
     std::vector<File::TagFilePath> tag_paths;
     std::vector<File::TagFile> virtual_directory;
     std::unique_ptr<Map> map_data;
+
+    // Index of tag_paths (for finding tags in common)
+    TagIndex tag_paths_index;
+
+    // Index of every tag in map_data or virtual_directory (for finding tags to compare against)
+    TagIndex all_tags_index;
 };
 
 template <typename T> static void close_input(T &options) {
@@ -43,13 +126,7 @@ template <typename T> static void close_input(T &options) {
     options.top_input = nullptr;
 }
 
-enum ByPath {
-    BY_PATH_SAME = 0,
-    BY_PATH_ANY = 1,
-    BY_PATH_DIFFERENT = 2
-};
-
-static void regular_comparison(const std::vector<Input> &inputs, bool precision, Show show, bool match_all, bool functional, ByPath by_path, bool verbose, std::size_t job_count);
+static void regular_comparison(const std::vector<Input> &inputs, bool precision, Show show, bool match_all, bool functional, ByPath by_path, bool verbose, std::size_t job_count, const std::optional<std::filesystem::path> &cache);
 
 int main(int argc, const char **argv) {
     set_up_color_term();
@@ -69,6 +146,7 @@ int main(int argc, const char **argv) {
         std::optional<std::size_t> job_count;
         std::vector<std::string> search;
         std::vector<std::string> search_exclude;
+        std::optional<std::filesystem::path> cache;
     } compare_options;
 
     const CommandLineOption options[] = {
@@ -78,7 +156,8 @@ int main(int argc, const char **argv) {
         CommandLineOption("maps", 'm', 1, "Add a maps directory to the input to specify where to find resource files for a map. This option must be used after --input."),
         CommandLineOption("map", 'M', 1, "Add a map to the input. Only one map can be specified per input. If a maps directory isn't specified, then the map's directory will be used. This option must be used after --input."),
         CommandLineOption("precision", 'p', 0, "Allow for slight differences in floats to account for precision loss."),
-        CommandLineOption("functional", 'f', 0, "Precompile the tags before comparison to check for only functional differences."),
+        CommandLineOption("functional", 'f', 0, "Precompile the tags before comparison to check for only functional differences. Tags with identical data are not precompiled."),
+        CommandLineOption("cache", 'c', 1, "Cache hashes of precompiled tags for --functional in this directory, keyed by the tag data, so unchanged tags are not precompiled again.", "<dir>"),
         CommandLineOption("search", 's', 1, "Search for tags (* and ? are wildcards) and compare these. Use multiple times for multiple queries. If unspecified, all tags will be compared.", "<expr>"),
         CommandLineOption("search-exclude", 'e', 1, "Search for tags (* and ? are wildcards) and ignore these. Use multiple times for multiple queries. This takes precedence over --search.", "<expr>"),
         CommandLineOption("by-path", 'B', 1, "Set what tags get compared against other tags. By default, only tags with the same relative path are checked. Using \"any\" ignores paths completely (useful for finding duplicates when both inputs are different) while \"different\" only checks tags with different paths (useful for finding duplicates when both inputs are the same). Can be: any, different, or same (default)", "<path-type>"),
@@ -86,7 +165,7 @@ int main(int argc, const char **argv) {
         CommandLineOption("ignore-resources", 'G', 0, "Ignore resource maps for the current map input. This option must be used after --input."),
         CommandLineOption("verbose", 'v', 0, "Output more information on the differences between tags to standard output. This will not work with --functional."),
         CommandLineOption("all", 'a', 0, "Only match if tags are in all inputs."),
-        CommandLineOption("threads", 'j', 1, "Set the number of threads to use for comparison. Default: 1")
+        CommandLineOption("threads", 'j', 1, "Set the number of threads to use for comparison. Default: CPU thread count")
     };
 
     static constexpr char DESCRIPTION[] = "Compare tags against other tags.";
@@ -172,6 +251,10 @@ int main(int argc, const char **argv) {
                 compare_options.functional = true;
                 break;
 
+            case 'c':
+                compare_options.cache = args[0];
+                break;
+
             case 's':
                 compare_options.search.emplace_back(File::preferred_path_to_halo_path(args[0]));
                 break;
@@ -240,9 +323,9 @@ int main(int argc, const char **argv) {
         return EXIT_FAILURE;
     }
 
-    // Default 0 to 1
-    if(!compare_options.job_count.has_value()) {
-        compare_options.job_count = 1;
+    // Default to the number of CPU threads
+    if(!compare_options.job_count.has_value() || *compare_options.job_count == 0) {
+        compare_options.job_count = ThreadPool::default_thread_count();
     }
 
     // Can we close it?
@@ -313,6 +396,7 @@ int main(int argc, const char **argv) {
             for(std::size_t t = 0; t < tag_count; t++) {
                 auto &tag = map.get_tag(t);
                 auto tag_fourcc = tag.get_tag_fourcc();
+                i.all_tags_index.add(tag.get_path(), tag_fourcc, t);
                 if(!tag.data_is_available() || std::strcmp(tag_fourcc_to_extension(tag_fourcc), "unknown") == 0) {
                     continue;
                 }
@@ -328,23 +412,28 @@ int main(int argc, const char **argv) {
                 return EXIT_FAILURE;
             }
             i.tag_paths.reserve(i.virtual_directory.size());
-            for(auto &t : i.virtual_directory) {
-                add_if_matched(File::split_tag_class_extension(File::preferred_path_to_halo_path(t.tag_path)).value());
+            auto tag_count = i.virtual_directory.size();
+            for(std::size_t t = 0; t < tag_count; t++) {
+                auto path = File::split_tag_class_extension(File::preferred_path_to_halo_path(i.virtual_directory[t].tag_path)).value();
+                i.all_tags_index.add(path.path, path.fourcc, t);
+                add_if_matched(std::move(path));
             }
         }
         i.tag_paths.shrink_to_fit();
+
+        for(std::size_t t = 0; t < i.tag_paths.size(); t++) {
+            i.tag_paths_index.add(i.tag_paths[t].path, i.tag_paths[t].fourcc, t);
+        }
     }
 
-    regular_comparison(compare_options.inputs, compare_options.precision, compare_options.show, compare_options.match_all, compare_options.functional, compare_options.by_path, compare_options.verbose, *compare_options.job_count);
+    regular_comparison(compare_options.inputs, compare_options.precision, compare_options.show, compare_options.match_all, compare_options.functional, compare_options.by_path, compare_options.verbose, *compare_options.job_count, compare_options.cache);
 }
 
-static void regular_comparison(const std::vector<Input> &inputs, bool precision, Show show, bool match_all, bool functional, ByPath by_path, bool verbose, std::size_t job_count) {
+static void regular_comparison(const std::vector<Input> &inputs, bool precision, Show show, bool match_all, bool functional, ByPath by_path, bool verbose, std::size_t job_count, const std::optional<std::filesystem::path> &cache) {
     // Find all tags we have in common first
     auto input_count = inputs.size();
     std::vector<File::TagFilePath> tags;
 
-    #define CAN_COMPARE(by_path, path1, path2) ((by_path == ByPath::BY_PATH_SAME && path1 == path2) || (by_path == ByPath::BY_PATH_DIFFERENT && path1 != path2) || (by_path == ByPath::BY_PATH_ANY))
-
     // Do this thing
     if(match_all) {
         auto &first_input = inputs[0];
@@ -353,17 +442,7 @@ static void regular_comparison(const std::vector<Input> &inputs, bool precision,
         for(auto &tag : first_input.tag_paths) {
             bool not_found = false;
             for(std::size_t i = 1; i < input_count; i++) {
-                bool found = false;
-                for(auto &tag2 : inputs[i].tag_paths) {
-                    if(tag2.fourcc != tag.fourcc) {
-                        continue;
-                    }
-                    if(CAN_COMPARE(by_path, tag.path, tag2.path)) {
-                        found = true;
-                        break;
-                    }
-                }
-                if(!found) {
+                if(!inputs[i].tag_paths_index.contains(tag.path, tag.fourcc, by_path)) {
                     not_found = true;
                     break;
                 }
@@ -375,33 +454,21 @@ static void regular_comparison(const std::vector<Input> &inputs, bool precision,
         }
     }
     else {
+        std::set<File::TagFilePath> tags_added;
         for(std::size_t i = 0; i < input_count; i++) {
             auto &input = inputs[i];
             for(std::size_t j = i + 1; j < input_count; j++) {
                 auto &input2 = inputs[j];
                 for(auto &tag : input.tag_paths) {
                     // Make sure we don't add any duplicates
-                    bool found = false;
-                    for(auto &otag : tags) {
-                        if(otag == tag) {
-                            found = true;
-                            break;
-                        }
-                    }
-                    if(found) {
+                    if(tags_added.contains(tag)) {
                         continue;
                     }
 
                     // Add it if it's present!
-                    for(auto &tag2 : input2.tag_paths) {
-                        if(tag2.fourcc != tag.fourcc) {
-                            continue;
-                        }
-                        if(CAN_COMPARE(by_path, tag.path, tag2.path)) {
-                            found = true;
-                            tags.push_back(tag);
-                            break;
-                        }
+                    if(input2.tag_paths_index.contains(tag.path, tag.fourcc, by_path)) {
+                        tags_added.insert(tag);
+                        tags.push_back(tag);
                     }
                 }
             }
@@ -413,34 +480,32 @@ static void regular_comparison(const std::vector<Input> &inputs, bool precision,
     bool show_all = (show & Show::SHOW_ALL) == Show::SHOW_ALL;
 
     // Next, compare each tag
-    std::size_t matched_count = 0;
-    std::size_t mismatched_count = 0;
+    std::atomic<std::size_t> matched_count = 0;
+    std::atomic<std::size_t> mismatched_count = 0;
 
-    std::mutex tag_mutex;
+    // Each thread takes the next tag by incrementing this, so they never wait on each other for work
+    std::atomic<std::size_t> next_tag = 0;
     std::mutex log_mutex;
-    std::size_t tag_index = 0;
 
+    job_count = std::min(job_count, tags.size());
     std::vector<std::thread> threads;
     threads.reserve(job_count);
     for(std::size_t t = 0; t < job_count; t++) {
-        auto perform_comparison_thread = [](auto *inputs, auto *tags, auto by_path, auto show_all, auto show, auto *matched_count, auto *mismatched_count, auto functional, auto precision, auto verbose, auto *tag_mutex, auto *tag_index, auto *log_mutex) {
+        auto perform_comparison_thread = [](auto *inputs, auto *tags, auto by_path, auto show_all, auto show, auto *matched_count, auto *mismatched_count, auto functional, auto precision, auto verbose, auto *next_tag, auto *log_mutex, auto *cache) {
             reset_loop: while(true) {
-                tag_mutex->lock();
-                if(*tag_index >= tags->size()) {
-                    tag_mutex->unlock();
+                auto tag_index = next_tag->fetch_add(1, std::memory_order_relaxed);
+                if(tag_index >= tags->size()) {
                     return;
                 }
-                auto &tag = (*tags)[*tag_index];
-                (*tag_index)++;
-                tag_mutex->unlock();
+                auto &tag = (*tags)[tag_index];
 
                 std::vector<std::unique_ptr<Parser::ParserStruct>> structs;
                 std::vector<std::string> struct_paths;
                 std::vector<const Input *> struct_inputs;
+                std::vector<ContentHash> struct_hashes;
 
                 bool first_input = true;
                 bool only_finding_same_tag = true;
-                auto path_unsplit = File::halo_path_to_preferred_path(tag.path + "." + HEK::tag_fourcc_to_extension(tag.fourcc)); // combine this
 
                 try {
                     // Go through each input
@@ -455,66 +520,55 @@ static void regular_comparison(const std::vector<Input> &inputs, bool precision,
 
                         only_finding_same_tag = by_path_copy == ByPath::BY_PATH_SAME;
 
+                        auto matches = i.all_tags_index.find(tag.path, tag.fourcc, by_path_copy, only_finding_same_tag ? 1 : SIZE_MAX);
+
                         // If it's a map, do this
                         if(i.map.has_value()) {
                             // First, extract it
-                            auto tag_count = i.map_data->get_tag_count();
-                            for(std::size_t t = 0; t < tag_count; t++) {
+                            for(auto t : matches) {
                                 auto &map_tag = i.map_data->get_tag(t);
                                 auto &map_tag_path = map_tag.get_path();
-                                if(map_tag.get_tag_fourcc() == tag.fourcc && CAN_COMPARE(by_path_copy, tag.path, map_tag_path)) {
-                                    // Lock the lock mutex in case issues arise when extracting the tag. This may slow down throughput a bit, but it's better than clobbering standard error while other stuff is logging.
-                                    log_mutex->lock();
-
-                                    bool successful = false;
-                                    try {
-                                        auto extracted_data = Invader::ExtractionWorkload::extract_single_tag(i.map_data->get_tag(t));
-                                        structs.emplace_back(Parser::ParserStruct::parse_hek_tag_file(extracted_data.data(), extracted_data.size(), true));
-                                        struct_paths.emplace_back(map_tag_path);
-                                        struct_inputs.emplace_back(&i);
-                                        successful = true;
-                                    }
-                                    catch(std::exception &e) {
-                                        eprintf_error("Cannot compare %s.%s due to an error: %s", File::halo_path_to_preferred_path(tag.path).c_str(), HEK::tag_fourcc_to_extension(tag.fourcc), e.what());
-                                        successful = false;
-                                    }
-
-                                    // We can now unlock the mutex
-                                    log_mutex->unlock();
-
-                                    // And if we failed, restart the whole loop
-                                    if(!successful) {
-                                        goto reset_loop;
-                                    }
-
-                                    if(only_finding_same_tag) {
-                                        break;
-                                    }
+
+                                // Lock the lock mutex in case issues arise when extracting the tag. This may slow down throughput a bit, but it's better than clobbering standard error while other stuff is logging.
+                                log_mutex->lock();
+
+                                bool successful = false;
+                                try {
+                                    auto extracted_data = Invader::ExtractionWorkload::extract_single_tag(map_tag);
+                                    structs.emplace_back(Parser::ParserStruct::parse_hek_tag_file(extracted_data.data(), extracted_data.size(), true));
+                                    struct_paths.emplace_back(map_tag_path);
+                                    struct_inputs.emplace_back(&i);
+                                    struct_hashes.emplace_back(hash_data(extracted_data));
+                                    successful = true;
+                                }
+                                catch(std::exception &e) {
+                                    eprintf_error("Cannot compare %s.%s due to an error: %s", File::halo_path_to_preferred_path(tag.path).c_str(), HEK::tag_fourcc_to_extension(tag.fourcc), e.what());
+                                    successful = false;
+                                }
+
+                                // We can now unlock the mutex
+                                log_mutex->unlock();
+
+                                // And if we failed, restart the whole loop
+                                if(!successful) {
+                                    goto reset_loop;
                                 }
                             }
                         }
 
                         // If it's a tag, do this
                         else {
-                            for(auto &vd : i.virtual_directory) {
-                                // Skip if the FourCC is different
-                                if(vd.tag_fourcc != tag.fourcc) {
-                                    continue;
-                                }
+                            for(auto t : matches) {
+                                auto &vd = i.virtual_directory[t];
 
-                                if(CAN_COMPARE(by_path_copy, path_unsplit, vd.tag_path)) {
-                                    // Open it
-                                    auto file = Invader::File::open_file(vd.full_path).value();
+                                // Open it
+                                auto file = Invader::File::open_file(vd.full_path).value();
 
-                                    // Parse it
-                                    structs.emplace_back(Parser::ParserStruct::parse_hek_tag_file(file.data(), file.size(), true));
-                                    struct_paths.emplace_back(File::split_tag_class_extension(File::preferred_path_to_halo_path(vd.tag_path)).value().path);
-                                    struct_inputs.emplace_back(&i);
-
-                                    if(only_finding_same_tag) {
-                                        break;
-                                    }
-                                }
+                                // Parse it
+                                structs.emplace_back(Parser::ParserStruct::parse_hek_tag_file(file.data(), file.size(), true));
+                                struct_paths.emplace_back(File::split_tag_class_extension(File::preferred_path_to_halo_path(vd.tag_path)).value().path);
+                                struct_inputs.emplace_back(&i);
+                                struct_hashes.emplace_back(hash_data(file));
                             }
                         }
                     }
@@ -650,10 +704,44 @@ static void regular_comparison(const std::vector<Input> &inputs, bool precision,
                             return meme_data;
                         };
 
-                        auto first_meme = meme_up_struct(*first_struct);
+                        // Hash the precompiled tag, using the cache if we can
+                        auto hash_compiled_struct = [&tag, &structs, &struct_hashes, &meme_up_struct, &cache](std::size_t s) -> ContentHash {
+                            std::optional<File::ContentCache> compiled_cache;
+                            ContentHash key;
+                            if(cache->has_value()) {
+                                compiled_cache.emplace(**cache, ".compiled");
+                                key = hash_value(tag.fourcc, hash_string(full_version(), struct_hashes[s]));
+                                auto cached = compiled_cache->load(key);
+                                if(cached.has_value() && cached->size() == sizeof(ContentHash)) {
+                                    ContentHash hash;
+                                    std::memcpy(&hash, cached->data(), sizeof(hash));
+                                    return hash;
+                                }
+                            }
+
+                            auto meme = meme_up_struct(*structs[s]);
+                            auto hash = hash_data(meme.data(), meme.size());
+
+                            // Failing to cache it is not fatal
+                            if(compiled_cache.has_value()) {
+                                std::vector<std::byte> data(sizeof(hash));
+                                std::memcpy(data.data(), &hash, sizeof(hash));
+                                compiled_cache->store(key, data);
+                            }
+                            return hash;
+                        };
+
+                        // Tags with the same data are always functionally the same, so only precompile ones that differ
+                        std::optional<ContentHash> first_compiled_hash;
                         for(std::size_t i = 1; i < found_count; i++) {
-                            auto mms = meme_up_struct(*structs[i]);
-                            match_log(first_meme == mms, i);
+                            if(struct_hashes[i] == struct_hashes[0]) {
+                                match_log(true, i);
+                                continue;
+                            }
+                            if(!first_compiled_hash.has_value()) {
+                                first_compiled_hash = hash_compiled_struct(0);
+                            }
+                            match_log(*first_compiled_hash == hash_compiled_struct(i), i);
                         }
                     }
                     catch(std::exception &e) {
@@ -690,7 +778,7 @@ static void regular_comparison(const std::vector<Input> &inputs, bool precision,
             }
         };
 
-        threads.emplace_back(perform_comparison_thread, &inputs, &tags, by_path, show_all, show, &matched_count, &mismatched_count, functional, precision, verbose, &tag_mutex, &tag_index, &log_mutex);
+        threads.emplace_back(perform_comparison_thread, &inputs, &tags, by_path, show_all, show, &matched_count, &mismatched_count, functional, precision, verbose, &next_tag, &log_mutex, &cache);
     }
 
     // Wait for threads to finish
@@ -700,7 +788,8 @@ static void regular_comparison(const std::vector<Input> &inputs, bool precision,
 
     // Show the total matched if we are showing both
     if(show_all) {
-        auto total = matched_count + mismatched_count;
-        oprintf("Matched %zu / %zu tag%s\n", matched_count, total, total == 1 ? "" : "s");
+        std::size_t matched = matched_count;
+        auto total = matched + mismatched_count;
+        oprintf("Matched %zu / %zu tag%s\n", matched, total, total == 1 ? "" : "s");
     }
 }
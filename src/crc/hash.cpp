@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cstring>
+#include <invader/crc/hash.hpp>
+
+namespace Invader {
+    // Based on MurmurHash3 by Austin Appleby (public domain), with the 32-bit seed replaced by a full 128-bit starting state
+    static inline std::uint64_t rotl64(std::uint64_t x, int r) noexcept {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    static inline std::uint64_t fmix64(std::uint64_t k) noexcept {
+        k ^= k >> 33;
+        k *= 0xFF51AFD7ED558CCDULL;
+        k ^= k >> 33;
+        k *= 0xC4CEB9FE1A85EC53ULL;
+        k ^= k >> 33;
+        return k;
+    }
+
+    static inline std::uint64_t read_u64_le(const std::uint8_t *data) noexcept {
+        std::uint64_t value = 0;
+        for(int i = 7; i >= 0; i--) {
+            value = (value << 8) | data[i];
+        }
+        return value;
+    }
+
+    ContentHash hash_data(const void *data, std::size_t size, const ContentHash &seed) noexcept {
+        static constexpr std::uint64_t C1 = 0x87C37B91114253D5ULL;
+        static constexpr std::uint64_t C2 = 0x4CF5AD432745937FULL;
+
+        const auto *bytes = reinterpret_cast<const std::uint8_t *>(data);
+        auto h1 = seed.low;
+        auto h2 = seed.high;
+
+        // Body
+        auto block_count = size / 16;
+        for(std::size_t i = 0; i < block_count; i++) {
+            auto k1 = read_u64_le(bytes + i * 16);
+            auto k2 = read_u64_le(bytes + i * 16 + 8);
+
+            k1 *= C1; k1 = rotl64(k1, 31); k1 *= C2; h1 ^= k1;
+            h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52DCE729;
+
+            k2 *= C2; k2 = rotl64(k2, 33); k2 *= C1; h2 ^= k2;
+            h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495AB5;
+        }
+
+        // Tail
+        const auto *tail = bytes + block_count * 16;
+        std::uint64_t k1 = 0;
+        std::uint64_t k2 = 0;
+        auto tail_size = size & 15;
+        for(std::size_t i = tail_size; i > 8; i--) {
+            k2 ^= static_cast<std::uint64_t>(tail[i - 1]) << ((i - 9) * 8);
+        }
+        if(tail_size > 8) {
+            k2 *= C2; k2 = rotl64(k2, 33); k2 *= C1; h2 ^= k2;
+        }
+        for(std::size_t i = std::min<std::size_t>(tail_size, 8); i > 0; i--) {
+            k1 ^= static_cast<std::uint64_t>(tail[i - 1]) << ((i - 1) * 8);
+        }
+        if(tail_size > 0) {
+            k1 *= C1; k1 = rotl64(k1, 31); k1 *= C2; h1 ^= k1;
+        }
+
+        // Finalization
+        h1 ^= size;
+        h2 ^= size;
+        h1 += h2;
+        h2 += h1;
+        h1 = fmix64(h1);
+        h2 = fmix64(h2);
+        h1 += h2;
+        h2 += h1;
+
+        return ContentHash { h1, h2 };
+    }
+
+    std::string ContentHash::to_string() const {
+        static constexpr char HEX[] = "0123456789abcdef";
+        std::string output(32, '0');
+        for(std::size_t i = 0; i < 16; i++) {
+            auto value = this->high >> ((15 - i) * 4);
+            output[i] = HEX[value & 0xF];
+            output[i + 16] = HEX[(this->low >> ((15 - i) * 4)) & 0xF];
+        }
+        return output;
+    }
+
+    bool ContentHash::from_string(const char *string, ContentHash &hash) noexcept {
+        if(std::strlen(string) != 32) {
+            return false;
+        }
+
+        ContentHash result;
+        for(std::size_t i = 0; i < 32; i++) {
+            std::uint64_t nibble;
+            char c = string[i];
+            if(c >= '0' && c <= '9') {
+                nibble = c - '0';
+            }
+            else if(c >= 'a' && c <= 'f') {
+                nibble = c - 'a' + 10;
+            }
+            else if(c >= 'A' && c <= 'F') {
+                nibble = c - 'A' + 10;
+            }
+            else {
+                return false;
+            }
+
+            auto &half = i < 16 ? result.high : result.low;
+            half = (half << 4) | nibble;
+        }
+
+        hash = result;
+        return true;
+    }
+}
@@ -0,0 +1,292 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <invader/dependency/dependency_index.hpp>
+#include <invader/tag/parser/view.hpp>
+#include <invader/thread/thread_pool.hpp>
+#include <invader/version.hpp>
+#include <invader/printf.hpp>
+
+namespace Invader {
+    static constexpr char INDEX_MAGIC[8] = { 'I', 'N', 'V', 'D', 'E', 'P', 'S', '\0' };
+    static constexpr std::uint32_t INDEX_FORMAT_VERSION = 1;
+
+    namespace {
+        class IndexWriter {
+        public:
+            std::vector<std::byte> data;
+
+            void write(const void *value, std::size_t size) {
+                auto *bytes = reinterpret_cast<const std::byte *>(value);
+                this->data.insert(this->data.end(), bytes, bytes + size);
+            }
+
+            template <typename T> void write_value(T value) {
+                this->write(&value, sizeof(value));
+            }
+
+            void write_string(const std::string &string) {
+                this->write_value<std::uint64_t>(string.size());
+                this->write(string.data(), string.size());
+            }
+        };
+
+        class IndexReader {
+        public:
+            IndexReader(const std::vector<std::byte> &data) : data(data) {}
+
+            void read(void *value, std::size_t size) {
+                if(size > this->data.size() - this->offset) {
+                    throw std::out_of_range("index is truncated");
+                }
+                std::memcpy(value, this->data.data() + this->offset, size);
+                this->offset += size;
+            }
+
+            template <typename T> T read_value() {
+                T value;
+                this->read(&value, sizeof(value));
+                return value;
+            }
+
+            std::string read_string() {
+                auto size = this->read_value<std::uint64_t>();
+                if(size > this->data.size() - this->offset) {
+                    throw std::out_of_range("index is truncated");
+                }
+                std::string string(reinterpret_cast<const char *>(this->data.data() + this->offset), size);
+                this->offset += size;
+                return string;
+            }
+
+            bool at_end() const noexcept {
+                return this->offset == this->data.size();
+            }
+
+        private:
+            const std::vector<std::byte> &data;
+            std::size_t offset = 0;
+        };
+    }
+
+    // Read a previously saved index; anything unreadable (or from a different version of Invader, which may parse tags
+    // differently) is thrown out so everything is read again
+    static std::map<File::TagFilePath, DependencyIndex::Entry> read_index_file(const std::filesystem::path &index_file) {
+        std::map<File::TagFilePath, DependencyIndex::Entry> tags;
+
+        std::error_code ec;
+        if(!std::filesystem::is_regular_file(index_file, ec)) {
+            return tags;
+        }
+
+        auto data = File::open_file(index_file);
+        if(!data.has_value()) {
+            eprintf_warn("Failed to read %s; rebuilding it", index_file.string().c_str());
+            return tags;
+        }
+
+        try {
+            IndexReader reader(*data);
+
+            char magic[sizeof(INDEX_MAGIC)];
+            reader.read(magic, sizeof(magic));
+            if(std::memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0 || reader.read_value<std::uint32_t>() != INDEX_FORMAT_VERSION || reader.read_string() != full_version()) {
+                return tags;
+            }
+
+            auto tag_count = reader.read_value<std::uint64_t>();
+            for(std::uint64_t t = 0; t < tag_count; t++) {
+                File::TagFilePath path;
+                path.path = reader.read_string();
+                path.fourcc = reader.read_value<TagFourCC>();
+
+                DependencyIndex::Entry entry;
+                entry.file_path = reader.read_string();
+                entry.file_size = reader.read_value<std::uint64_t>();
+                entry.file_time = reader.read_value<std::int64_t>();
+                entry.valid = reader.read_value<std::uint8_t>() != 0;
+
+                auto dependency_count = reader.read_value<std::uint64_t>();
+                for(std::uint64_t d = 0; d < dependency_count; d++) {
+                    auto &dependency = entry.dependencies.emplace_back();
+                    dependency.path = reader.read_string();
+                    dependency.fourcc = reader.read_value<TagFourCC>();
+                }
+
+                tags.emplace(std::move(path), std::move(entry));
+            }
+
+            if(!reader.at_end()) {
+                throw std::out_of_range("index has trailing data");
+            }
+        }
+        catch(std::exception &e) {
+            eprintf_warn("Failed to read %s (%s); rebuilding it", index_file.string().c_str(), e.what());
+            tags.clear();
+        }
+
+        return tags;
+    }
+
+    // Tags of these classes cannot reference anything, so there's no need to read them
+    static bool can_have_dependencies(TagFourCC fourcc) noexcept {
+        switch(fourcc) {
+            case TagFourCC::TAG_FOURCC_BITMAP:
+            case TagFourCC::TAG_FOURCC_CAMERA_TRACK:
+            case TagFourCC::TAG_FOURCC_HUD_MESSAGE_TEXT:
+            case TagFourCC::TAG_FOURCC_PHYSICS:
+            case TagFourCC::TAG_FOURCC_SOUND_ENVIRONMENT:
+            case TagFourCC::TAG_FOURCC_STRING_LIST:
+            case TagFourCC::TAG_FOURCC_UNICODE_STRING_LIST:
+            case TagFourCC::TAG_FOURCC_WIND:
+                return false;
+            default:
+                return true;
+        }
+    }
+
+    std::vector<File::TagFilePath> DependencyIndex::read_dependencies(const std::byte *tag_data, std::size_t tag_data_length) {
+        std::vector<File::TagFilePath> dependencies;
+
+        // Read them straight out of the tag data rather than parsing the whole tag
+        Parser::View::for_each_dependency_in_tag_file(tag_data, tag_data_length, [&dependencies](const Parser::View::Dependency &dependency) {
+            dependencies.emplace_back(File::remove_duplicate_slashes(std::string(dependency.path)), dependency.tag_fourcc);
+        });
+
+        return dependencies;
+    }
+
+    DependencyIndex DependencyIndex::load(const std::filesystem::path &index_file, const std::vector<std::filesystem::path> &tags, std::size_t thread_count) {
+        auto previous_tags = read_index_file(index_file);
+
+        // Reuse anything whose file hasn't changed since it was indexed
+        DependencyIndex index;
+        std::vector<Entry *> tags_to_read;
+        std::size_t reused_count = 0;
+        for(auto &t : File::load_virtual_tag_folder(tags)) {
+            auto path = File::split_tag_class_extension(File::preferred_path_to_halo_path(t.tag_path));
+            if(!path.has_value()) {
+                continue;
+            }
+
+            Entry entry;
+            entry.file_path = t.full_path;
+
+            std::error_code ec;
+            entry.file_size = std::filesystem::file_size(t.full_path, ec);
+            if(!ec) {
+                entry.file_time = std::filesystem::last_write_time(t.full_path, ec).time_since_epoch().count();
+            }
+
+            auto previous = previous_tags.find(*path);
+            bool changed = ec || previous == previous_tags.end() || previous->second.file_path != entry.file_path || previous->second.file_size != entry.file_size || previous->second.file_time != entry.file_time;
+            if(!changed) {
+                entry = std::move(previous->second);
+                reused_count++;
+            }
+            else if(!can_have_dependencies(path->fourcc)) {
+                entry.valid = true;
+                changed = false;
+            }
+
+            auto [inserted, added] = index.tags.emplace(std::move(*path), std::move(entry));
+            if(added && changed) {
+                tags_to_read.emplace_back(&inserted->second);
+            }
+        }
+
+        // Read everything else in parallel, largest first so one big tag doesn't hold up the end
+        std::sort(tags_to_read.begin(), tags_to_read.end(), [](const Entry *a, const Entry *b) { return a->file_size > b->file_size; });
+
+        std::vector<std::string> errors(tags_to_read.size());
+        {
+            ThreadPool pool(thread_count);
+            for(std::size_t t = 0; t < tags_to_read.size(); t++) {
+                pool.submit([&tags_to_read, &errors, t]() {
+                    auto &entry = *tags_to_read[t];
+                    auto tag_data = File::open_file(entry.file_path);
+                    if(!tag_data.has_value()) {
+                        errors[t] = "failed to read the file";
+                        return;
+                    }
+
+                    try {
+                        entry.dependencies = read_dependencies(tag_data->data(), tag_data->size());
+                        entry.valid = true;
+                    }
+                    catch(std::exception &e) {
+                        errors[t] = e.what();
+                    }
+                });
+            }
+            pool.wait();
+        }
+
+        for(std::size_t t = 0; t < tags_to_read.size(); t++) {
+            if(!tags_to_read[t]->valid) {
+                eprintf_warn("Failed to read dependencies of %s: %s", tags_to_read[t]->file_path.string().c_str(), errors[t].c_str());
+            }
+        }
+
+        index.read_count = tags_to_read.size();
+        index.modified = reused_count != index.tags.size() || reused_count != previous_tags.size();
+        index.build_dependents();
+
+        return index;
+    }
+
+    bool DependencyIndex::save(const std::filesystem::path &index_file) const {
+        IndexWriter writer;
+        writer.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        writer.write_value<std::uint32_t>(INDEX_FORMAT_VERSION);
+        writer.write_string(full_version());
+
+        writer.write_value<std::uint64_t>(this->tags.size());
+        for(auto &[path, entry] : this->tags) {
+            writer.write_string(path.path);
+            writer.write_value(path.fourcc);
+            writer.write_string(entry.file_path.string());
+            writer.write_value<std::uint64_t>(entry.file_size);
+            writer.write_value<std::int64_t>(entry.file_time);
+            writer.write_value<std::uint8_t>(entry.valid);
+            writer.write_value<std::uint64_t>(entry.dependencies.size());
+            for(auto &dependency : entry.dependencies) {
+                writer.write_string(dependency.path);
+                writer.write_value(dependency.fourcc);
+            }
+        }
+
+        // Move it in place once it's written so an interrupted save doesn't leave a broken index
+        return File::save_file_atomically(index_file, writer.data);
+    }
+
+    const DependencyIndex::Entry *DependencyIndex::get_tag(const File::TagFilePath &tag) const {
+        auto entry = this->tags.find(tag);
+        return entry == this->tags.end() ? nullptr : &entry->second;
+    }
+
+    const std::vector<File::TagFilePath> &DependencyIndex::get_dependents(const File::TagFilePath &tag) const {
+        static const std::vector<File::TagFilePath> none;
+        auto dependents = this->dependents.find(tag);
+        return dependents == this->dependents.end() ? none : dependents->second;
+    }
+
+    void DependencyIndex::build_dependents() {
+        this->dependents.clear();
+
+        // Tags are iterated in order, so each list of dependents ends up sorted, and a tag that references the same tag
+        // more than once is always at the end of the list
+        for(auto &[path, entry] : this->tags) {
+            for(auto &dependency : entry.dependencies) {
+                auto &dependents = this->dependents[dependency];
+                if(dependents.empty() || dependents.back() != path) {
+                    dependents.emplace_back(path);
+                }
+            }
+        }
+    }
+}
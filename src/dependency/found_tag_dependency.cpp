@@ -1,44 +1,75 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
 #include <invader/dependency/found_tag_dependency.hpp>
+#include <invader/dependency/dependency_index.hpp>
 #include <invader/printf.hpp>
 #include <invader/file/file.hpp>
 #include <invader/tag/parser/parser_struct.hpp>
 
 #include <filesystem>
+#include <set>
 
 namespace Invader {
     static std::vector<File::TagFilePath> get_dependencies(const std::byte *tag_data, std::size_t tag_data_length) {
-        std::vector<File::TagFilePath> dependencies;
-
-        auto recursively_get_dependencies = [&dependencies](const Parser::ParserStruct &st, auto &recursively_get_dependencies) -> void {
-            for(auto &v : st.get_values()) {
-                switch(v.get_type()) {
-                    case Parser::ParserStructValue::ValueType::VALUE_TYPE_REFLEXIVE: {
-                        auto count = v.get_array_size();
-                        for(std::size_t i = 0; i < count; i++) {
-                            recursively_get_dependencies(v.get_object_in_array(i), recursively_get_dependencies);
-                        }
-                        break;
-                    }
-                    case Parser::ParserStructValue::ValueType::VALUE_TYPE_DEPENDENCY: {
-                        auto &dep = v.get_dependency();
-                        if(!dep.path.empty()) {
-                            dependencies.emplace_back(File::halo_path_to_preferred_path(dep.path), dep.tag_fourcc);
-                        }
-                        break;
+        auto dependencies = DependencyIndex::read_dependencies(tag_data, tag_data_length);
+        for(auto &dependency : dependencies) {
+            dependency.path = File::halo_path_to_preferred_path(dependency.path);
+        }
+        return dependencies;
+    }
+
+    static std::vector<FoundTagDependency> find_dependencies_in_index(const DependencyIndex &index, const File::TagFilePath &tag_to_find, bool reverse, bool recursive, bool &success) {
+        std::vector<FoundTagDependency> found_tags;
+        success = true;
+
+        if(reverse) {
+            for(auto &dependent : index.get_dependents(tag_to_find)) {
+                found_tags.emplace_back(File::halo_path_to_preferred_path(dependent.path), dependent.fourcc, false, index.get_tag(dependent)->file_path);
+            }
+            return found_tags;
+        }
+
+        std::set<File::TagFilePath> found;
+        auto find_dependencies_in_tag = [&index, &found_tags, &found, &recursive, &success](const File::TagFilePath &tag, auto &recursion) -> void {
+            auto *entry = index.get_tag(tag);
+            if(entry == nullptr) {
+                eprintf_error("Failed to open tag %s.%s.", File::halo_path_to_preferred_path(tag.path).c_str(), tag_fourcc_to_extension(tag.fourcc));
+                success = false;
+                return;
+            }
+            if(!entry->valid) {
+                eprintf_error("Failed to compile tag %s", entry->file_path.string().c_str());
+                throw InvalidTagDataException();
+            }
+
+            for(auto &dependency : entry->dependencies) {
+                // Make sure it's not in found_tags
+                if(!found.insert(dependency).second) {
+                    continue;
+                }
+
+                auto *dependency_entry = index.get_tag(dependency);
+                if(dependency_entry == nullptr) {
+                    found_tags.emplace_back(File::halo_path_to_preferred_path(dependency.path), dependency.fourcc, true, std::nullopt);
+                }
+                else {
+                    found_tags.emplace_back(File::halo_path_to_preferred_path(dependency.path), dependency.fourcc, false, dependency_entry->file_path);
+                    if(recursive) {
+                        recursion(dependency, recursion);
                     }
-                    default: break;
                 }
             }
         };
 
-        recursively_get_dependencies(*Parser::ParserStruct::parse_hek_tag_file(tag_data, tag_data_length), recursively_get_dependencies);
-
-        return dependencies;
+        find_dependencies_in_tag(tag_to_find, find_dependencies_in_tag);
+        return found_tags;
     }
 
-    std::vector<FoundTagDependency> FoundTagDependency::find_dependencies(const char *tag_path_to_find, Invader::TagFourCC tag_int_to_find, std::vector<std::filesystem::path> tags, bool reverse, bool recursive, bool &success) {
+    std::vector<FoundTagDependency> FoundTagDependency::find_dependencies(const char *tag_path_to_find, Invader::TagFourCC tag_int_to_find, std::vector<std::filesystem::path> tags, bool reverse, bool recursive, bool &success, const DependencyIndex *index) {
+        if(index) {
+            return find_dependencies_in_index(*index, File::TagFilePath(File::preferred_path_to_halo_path(tag_path_to_find), tag_int_to_find), reverse, recursive, success);
+        }
+
         std::vector<FoundTagDependency> found_tags;
         success = true;
 
@@ -7,6 +7,12 @@
 #include <invader/file/file.hpp>
 #include <invader/tag/hek/header.hpp>
 #include "../crc/crc32.h"
+#include <cstdarg>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
 #include <string>
 
 #include "expression.hpp"
@@ -22,6 +28,21 @@
 
 using namespace Invader;
 
+// Error in a key, value, or action, reported by whatever gives up on the action
+class EditError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+[[noreturn]] static void throw_error(const char *format, ...) {
+    char message[1024];
+    std::va_list args;
+    va_start(args, format);
+    std::vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    throw EditError(message);
+}
+
 enum ActionType {
     ACTION_TYPE_CHECKSUM,
     ACTION_TYPE_GET,
@@ -49,8 +70,7 @@ static std::string get_top_member_name(const std::string &key, std::string &afte
     for(; *c != 0 && *c != '.' && *c != '[' && *c != ']'; c++);
     
     if(c == key_str) {
-        eprintf_error("Invalid key %s", key.c_str());
-        throw std::exception();
+        throw_error("Invalid key %s", key.c_str());
     }
     
     auto return_value = std::string(key_str, c);
@@ -63,20 +83,17 @@ static std::pair<std::size_t, std::size_t> get_range(const std::string &key, std
     auto *key_end = key_str;
     
     if(key_str[0] == 0) {
-        eprintf_error("Expected range at end of key");
-        throw std::exception();
+        throw_error("Expected range at end of key");
     }
     
     if(key_str[0] != '[') {
-        eprintf_error("Invalid range in key %s", key.c_str());
-        throw std::exception();
+        throw_error("Invalid range in key %s", key.c_str());
     }
     
     for(; *key_end != ']'; key_end++) {
         // Unexpected end?
         if(*key_end == 0) {
-            eprintf_error("Invalid range in key %s", key.c_str());
-            throw std::exception();
+            throw_error("Invalid range in key %s", key.c_str());
         }
     }
     
@@ -103,8 +120,7 @@ static std::pair<std::size_t, std::size_t> get_range(const std::string &key, std
     
     // Okay
     if(hyphens > 1) {
-        eprintf_error("Invalid range %s", range_str.c_str());
-        throw std::exception();
+        throw_error("Invalid range %s", range_str.c_str());
     }
     
     if(hyphens == 0) {
@@ -132,16 +148,17 @@ static std::pair<std::size_t, std::size_t> get_range(const std::string &key, std
                 max = std::stoul(range_str.c_str() + v, nullptr, 10);
             }
         }
-        catch (std::exception &) {
-            eprintf_error("Invalid range %s", range_str.c_str());
-            throw;
+        catch (std::invalid_argument &) {
+            throw_error("Invalid range %s", range_str.c_str());
+        }
+        catch (std::out_of_range &) {
+            throw_error("Invalid range %s", range_str.c_str());
         }
     }
     
     // Did we exceed things?
     if(min > max) {
-        eprintf_error("Invalid range %s", range_str.c_str());
-        throw std::exception();
+        throw_error("Invalid range %s", range_str.c_str());
     }
     
     return { min, max };
@@ -149,22 +166,19 @@ static std::pair<std::size_t, std::size_t> get_range(const std::string &key, std
 
 static void build_array(Parser::ParserStruct *ps, std::string key, std::vector<Parser::ParserStructValue> &array, std::string *bitfield, std::pair<std::size_t, std::size_t> *range) {
     if(key == "") {
-        eprintf_error("Expected value name");
-        throw std::exception();
+        throw_error("Expected value name");
     }
     
     if(key[0] == '.') {
         key = std::string(key.begin() + 1, key.end());
     }
     else {
-        eprintf_error("Expected a dot before key %s", key.c_str());
-        throw std::exception();
+        throw_error("Expected a dot before key %s", key.c_str());
     }
     
     auto member = get_top_member_name(key, key);
     if(member == "") {
-        eprintf_error("No member name given for array");
-        throw std::exception();
+        throw_error("No member name given for array");
     }
     
     auto &values = ps->get_values();
@@ -191,8 +205,7 @@ static void build_array(Parser::ParserStruct *ps, std::string key, std::vector<P
                         return;
                     }
                     
-                    eprintf_error("%s::%s is empty", ps->struct_name(), member.c_str());
-                    throw std::exception();
+                    throw_error("%s::%s is empty", ps->struct_name(), member.c_str());
                 }
                 
                 if(access_range.first == SIZE_MAX) {
@@ -204,8 +217,7 @@ static void build_array(Parser::ParserStruct *ps, std::string key, std::vector<P
                 }
                 
                 if(count < access_range.first || count <= access_range.second) {
-                    eprintf_error("%zu-%zu is out of bounds for %s::%s (%zu element%s)", access_range.first, access_range.second, ps->struct_name(), member.c_str(), count, count == 1 ? "" : "s");
-                    throw std::exception();
+                    throw_error("%zu-%zu is out of bounds for %s::%s (%zu element%s)", access_range.first, access_range.second, ps->struct_name(), member.c_str(), count, count == 1 ? "" : "s");
                 }
                 
                 // Are we returning a range?
@@ -227,18 +239,15 @@ static void build_array(Parser::ParserStruct *ps, std::string key, std::vector<P
                 // Is this a bitfield? If so, set it!
                 if(i.get_type() == Parser::ParserStructValue::ValueType::VALUE_TYPE_BITMASK) {
                     if(key.size() == 0) {
-                        eprintf_error("Expected bitfield but got the end of the key");
-                        throw std::exception();
+                        throw_error("Expected bitfield but got the end of the key");
                     }
                     else if(key[0] != '.') {
-                        eprintf_error("Expected bitfield but got %s", key.c_str());
-                        throw std::exception();
+                        throw_error("Expected bitfield but got %s", key.c_str());
                     }
                     *bitfield = key.substr(1);
                 }
                 else if(key.size() != 0) {
-                    eprintf_error("Expected end of key but got %s", key.c_str());
-                    throw std::exception();
+                    throw_error("Expected end of key but got %s", key.c_str());
                 }
                 
                 return;
@@ -246,16 +255,14 @@ static void build_array(Parser::ParserStruct *ps, std::string key, std::vector<P
         }
     }
     
-    eprintf_error("%s::%s does not exist", ps->struct_name(), member.c_str());
-    throw std::exception();
+    throw_error("%s::%s does not exist", ps->struct_name(), member.c_str());
 }
 
 static void require_writable_only(const std::vector<Parser::ParserStructValue> &values, bool writable_only) {
     if(writable_only) {
         for(auto &i : values) {
             if(i.is_read_only()) {
-                eprintf_error("%s is read-only", i.get_member_name());
-                throw std::exception();
+                throw_error("%s is read-only", i.get_member_name());
             }
         }
     }
@@ -296,8 +303,7 @@ static std::string get_value(const Parser::ParserStructValue &value, const std::
             case Parser::ParserStructValue::ValueType::VALUE_TYPE_BITMASK:
                 return std::to_string(value.read_bitfield(bitmask.c_str()) ? 1 : 0);
             default:
-                eprintf_error("Unsupported value type for this operation");
-                throw std::exception();
+                throw_error("Unsupported value type for this operation");
         }
     }
     
@@ -336,6 +342,78 @@ static std::string get_value(const Parser::ParserStructValue &value, const std::
     }
 }
 
+// Set every selected numeric value, compiling each comma-separated expression once and evaluating it for all of them
+static void set_numeric_values(std::vector<Parser::ParserStructValue> &values, const std::string &new_value) {
+    if(values.empty()) {
+        return;
+    }
+    
+    auto expected_value_count = values[0].get_value_count();
+    auto format = values[0].get_number_format();
+    
+    std::vector<std::string> expressions;
+    expressions.reserve(expected_value_count);
+    
+    const char *start = new_value.c_str();
+    const char *cursor;
+    for(cursor = start; *cursor != 0; cursor++) {
+        if(*cursor == ',') {
+            expressions.emplace_back(start, cursor);
+            start = ++cursor;
+            continue;
+        }
+    }
+    expressions.emplace_back(start, cursor);
+    
+    if(expressions.size() != expected_value_count) {
+        throw_error("Expected %zu comma-separated value%s but only got %zu", expected_value_count, expected_value_count == 1 ? "" : "s", expressions.size());
+    }
+    
+    // Gather each component of every value so each expression runs over all of them at once
+    std::vector<std::vector<Parser::ParserStructValue::Number>> all_values;
+    all_values.reserve(values.size());
+    for(auto &v : values) {
+        all_values.emplace_back(v.get_values());
+    }
+    
+    auto evaluate_all = [&all_values, &expressions]<typename Number>(std::size_t component) {
+        std::vector<Number> numbers;
+        numbers.reserve(all_values.size());
+        for(auto &v : all_values) {
+            numbers.emplace_back(std::get<Number>(v[component]));
+        }
+        
+        auto *e = expressions[component].c_str();
+        try {
+            Edit::Expression<Number>(e).evaluate(numbers.data(), numbers.size());
+        }
+        catch (std::exception &) {
+            throw_error("Invalid expression %s", e);
+        }
+        
+        for(std::size_t i = 0; i < numbers.size(); i++) {
+            all_values[i][component] = numbers[i];
+        }
+    };
+    
+    for(std::size_t c = 0; c < expected_value_count; c++) {
+        switch(format) {
+            case Parser::ParserStructValue::NumberFormat::NUMBER_FORMAT_INT:
+                evaluate_all.template operator()<std::int64_t>(c);
+                break;
+            case Parser::ParserStructValue::NumberFormat::NUMBER_FORMAT_FLOAT:
+                evaluate_all.template operator()<double>(c);
+                break;
+            default:
+                std::terminate();
+        }
+    }
+    
+    for(std::size_t i = 0; i < values.size(); i++) {
+        values[i].set_values(all_values[i]);
+    }
+}
+
 static void set_value(Parser::ParserStructValue &value, const std::string &new_value, const std::optional<std::string> bitfield = std::nullopt) {
     auto format = value.get_number_format();
     auto type = value.get_type();
@@ -345,8 +423,7 @@ static void set_value(Parser::ParserStructValue &value, const std::string &new_v
         switch(type) {
             case Parser::ParserStructValue::ValueType::VALUE_TYPE_TAGSTRING:
                 if(new_value.size() > 31) {
-                    eprintf_error("String exceeds maximum length (%zu > 31)", new_value.size());
-                    throw std::exception();
+                    throw_error("String exceeds maximum length (%zu > 31)", new_value.size());
                 }
                 return value.set_string(new_value.c_str());
             case Parser::ParserStructValue::ValueType::VALUE_TYPE_DEPENDENCY: {
@@ -375,15 +452,13 @@ static void set_value(Parser::ParserStructValue &value, const std::string &new_v
                         dep.tag_fourcc = new_path.fourcc;
                     }
                     else {
-                        eprintf_error("%s tags cannot be referenced here", tag_fourcc_to_extension(new_path.fourcc));
-                        throw std::exception();
+                        throw_error("%s tags cannot be referenced here", tag_fourcc_to_extension(new_path.fourcc));
                     }
                 }
                 
                 // Hopefully no one comments on the fact I wrote "else try" a few lines up as if it was something equivalent to "else if".
-                catch (std::exception &) {
-                    eprintf_error("Invalid tag path %s", new_value.c_str());
-                    throw std::exception();
+                catch (std::bad_optional_access &) {
+                    throw_error("Invalid tag path %s", new_value.c_str());
                 }
                 
                 return;
@@ -393,8 +468,7 @@ static void set_value(Parser::ParserStructValue &value, const std::string &new_v
                     return value.write_enum(new_value.c_str());
                 }
                 catch (std::exception &) {
-                    eprintf_error("Invalid enum value %s", new_value.c_str());
-                    throw std::exception();
+                    throw_error("Invalid enum value %s", new_value.c_str());
                 }
             case Parser::ParserStructValue::ValueType::VALUE_TYPE_BITMASK:
                 try {
@@ -405,59 +479,24 @@ static void set_value(Parser::ParserStructValue &value, const std::string &new_v
                         case 1:
                             return value.write_bitfield(bitfield.value().c_str(), true);
                         default:
-                            eprintf_error("Bitfields can only be set to 0 or 1");
-                            throw std::exception();
+                            throw_error("Bitfields can only be set to 0 or 1");
                     }
                 }
+                catch (EditError &) {
+                    throw;
+                }
                 catch (std::exception &) {
-                    eprintf_error("Invalid bitmask/value %s => %s", bitfield.value().c_str(), new_value.c_str());
-                    throw std::exception();
+                    throw_error("Invalid bitmask/value %s => %s", bitfield.value().c_str(), new_value.c_str());
                 }
             default:
-                eprintf_error("Unsupported value type");
-                throw std::exception();
+                throw_error("Unsupported value type");
         }
     }
     
     // Numeric value?
     else {
-        auto expected_value_count = value.get_value_count();
-        
-        std::vector<std::string> expressions;
-        expressions.reserve(expected_value_count);
-        
-        const char *start = new_value.c_str();
-        const char *cursor;
-        for(cursor = start; *cursor != 0; cursor++) {
-            if(*cursor == ',') {
-                expressions.emplace_back(start, cursor);
-                start = ++cursor;
-                continue;
-            }
-        }
-        expressions.emplace_back(start, cursor);
-        
-        if(expressions.size() != expected_value_count) {
-            eprintf_error("Expected %zu comma-separated value%s but only got %zu", expected_value_count, expected_value_count == 1 ? "" : "s", expressions.size());
-            throw std::exception();
-        }
-        
-        auto all_values = value.get_values();
-        for(std::size_t i = 0; i < expected_value_count; i++) {
-            auto &v = all_values[i];
-            auto *e = expressions[i].c_str();
-            switch(value.get_number_format()) {
-                case Parser::ParserStructValue::NumberFormat::NUMBER_FORMAT_INT:
-                    v = Edit::evaluate_expression(e, std::get<std::int64_t>(v));
-                    break;
-                case Parser::ParserStructValue::NumberFormat::NUMBER_FORMAT_FLOAT:
-                    v = Edit::evaluate_expression(e, std::get<double>(v));
-                    break;
-                default:
-                    std::terminate();
-            }
-        }
-        value.set_values(all_values);
+        std::vector<Parser::ParserStructValue> values = { value };
+        set_numeric_values(values, new_value);
     }
 }
 
@@ -756,6 +795,427 @@ static void list_everything(Parser::ParserStruct &ps, std::vector<std::string> &
     }
 }
 
+// Perform an action on a tag, adding anything it prints to the output and setting modified once it changes the tag
+static void perform_action(Parser::ParserStruct &tag_struct, HEK::TagFourCC tag_class, const Actions &action, bool check_read_only, std::vector<std::string> &output, bool &modified) {
+    switch(action.type) {
+        case ActionType::ACTION_TYPE_LIST: {
+            list_everything(populate_struct(*Parser::ParserStruct::generate_base_struct(tag_class)), output, false);
+            break;
+        }
+        case ActionType::ACTION_TYPE_LIST_ALL_VALUES: {
+            list_everything(tag_struct, output, true);
+            break;
+        }
+        case ActionType::ACTION_TYPE_GET: {
+            std::string bitfield;
+            auto arr = get_values_for_key(&tag_struct, action.key == "" ? "" : (std::string(".") + action.key), bitfield, false);
+            for(auto &k : arr) {
+                output.emplace_back(get_value(k, bitfield));
+            }
+            break;
+        }
+        case ActionType::ACTION_TYPE_SET: {
+            std::string bitfield;
+            auto arr = get_values_for_key(&tag_struct, action.key == "" ? "" : (std::string(".") + action.key), bitfield, check_read_only);
+            
+            // Numeric values (such as every vertex in an array) are all set in one go
+            if(!arr.empty() && arr[0].get_number_format() != Parser::ParserStructValue::NumberFormat::NUMBER_FORMAT_NONE) {
+                set_numeric_values(arr, action.value);
+                modified = true;
+                break;
+            }
+            
+            for(auto &k : arr) {
+                set_value(k, action.value, bitfield);
+                modified = true;
+            }
+            break;
+        }
+        case ActionType::ACTION_TYPE_COUNT: {
+            auto arr = get_values_for_key(&tag_struct, action.key == "" ? "" : (std::string(".") + action.key), false);
+            for(auto &k : arr) {
+                if(k.get_type() == Parser::ParserStructValue::ValueType::VALUE_TYPE_REFLEXIVE) {
+                    output.emplace_back(std::to_string(k.get_array_size()));
+                }
+                else {
+                    throw_error("%s is not an array", k.get_member_name());
+                }
+            }
+            break;
+        }
+        case ActionType::ACTION_TYPE_INSERT: {
+            auto arr = get_values_for_key(&tag_struct, action.key == "" ? "" : (std::string(".") + action.key), check_read_only);
+            for(auto &k : arr) {
+                if(k.get_type() != Parser::ParserStructValue::ValueType::VALUE_TYPE_REFLEXIVE) {
+                    throw_error("%s is not an array", k.get_member_name());
+                }
+                
+                if(action.count + k.get_array_size() > k.get_array_maximum_size()) {
+                    throw_error("%s's maximum size of %zu exceeded", k.get_member_name(), k.get_array_maximum_size());
+                }
+                k.insert_objects_in_array(action.position == SIZE_MAX ? k.get_array_size() : action.position, action.count);
+                modified = true;
+            }
+            break;
+        }
+        case ActionType::ACTION_TYPE_DELETE: {
+            std::pair<std::size_t, std::size_t> range;
+            auto arr = get_values_for_key(&tag_struct, action.key == "" ? "" : (std::string(".") + action.key), range, check_read_only);
+            for(auto &k : arr) {
+                if(k.get_type() != Parser::ParserStructValue::ValueType::VALUE_TYPE_REFLEXIVE) {
+                    throw_error("%s is not an array", k.get_member_name());
+                }
+                
+                std::size_t iterations = range.second - range.first + 1;
+                if(k.get_array_size() - iterations < k.get_array_minimum_size()) {
+                    throw_error("%s's minimum size of %zu exceeded", k.get_member_name(), k.get_array_maximum_size());
+                }
+                k.delete_objects_in_array(range.first, iterations);
+                modified = true;
+            }
+            break;
+        }
+        case ActionType::ACTION_TYPE_MOVE: {
+            std::pair<std::size_t, std::size_t> range;
+            auto arr = get_values_for_key(&tag_struct, action.key == "" ? "" : (std::string(".") + action.key), range, check_read_only);
+            for(auto &k : arr) {
+                if(k.get_type() != Parser::ParserStructValue::ValueType::VALUE_TYPE_REFLEXIVE) {
+                    throw_error("%s is not an array", k.get_member_name());
+                }
+                
+                std::size_t to = action.position == SIZE_MAX ? k.get_array_size() : action.position;
+                std::size_t iterations = range.second - range.first + 1;
+                if(to == range.first) {
+                    continue; // we can ignore if it's trying to swap itself
+                }
+                k.swap_objects_in_array(range.first, to, iterations);
+                modified = true;
+            }
+            break;
+        }
+        case ActionType::ACTION_TYPE_COPY: {
+            std::pair<std::size_t, std::size_t> range;
+            auto arr = get_values_for_key(&tag_struct, action.key == "" ? "" : (std::string(".") + action.key), range, check_read_only);
+            for(auto &k : arr) {
+                if(k.get_type() != Parser::ParserStructValue::ValueType::VALUE_TYPE_REFLEXIVE) {
+                    throw_error("%s is not an array", k.get_member_name());
+                }
+                
+                std::size_t to = action.position == SIZE_MAX ? k.get_array_size() : action.position;
+                std::size_t iterations = range.second - range.first + 1;
+                
+                if(iterations + k.get_array_size() > k.get_array_maximum_size()) {
+                    throw_error("%s's maximum size of %zu exceeded", k.get_member_name(), k.get_array_maximum_size());
+                }
+                
+                k.duplicate_objects_in_array(range.first, to, iterations);
+                modified = true;
+            }
+            break;
+        }
+        default:
+            throw_error("Unimplemented");
+    }
+}
+
+// Escape a string for use in a JSON response
+static std::string json_string(const std::string &string) {
+    std::string escaped = "\"";
+    for(char c : string) {
+        switch(c) {
+            case '"':
+                escaped += "\\\"";
+                break;
+            case '\\':
+                escaped += "\\\\";
+                break;
+            case '\n':
+                escaped += "\\n";
+                break;
+            case '\r':
+                escaped += "\\r";
+                break;
+            case '\t':
+                escaped += "\\t";
+                break;
+            default:
+                if(static_cast<unsigned char>(c) < 0x20) {
+                    char code[7];
+                    std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned int>(c));
+                    escaped += code;
+                }
+                else {
+                    escaped += c;
+                }
+                break;
+        }
+    }
+    return escaped + "\"";
+}
+
+// Split a script line into words; words with spaces can be put in double quotes, where \" and \\ are escaped
+static std::vector<std::string> split_script_line(const std::string &line) {
+    std::vector<std::string> words;
+    const char *c = line.c_str();
+    
+    while(true) {
+        for(; *c == ' ' || *c == '\t'; c++);
+        if(*c == 0) {
+            return words;
+        }
+        
+        auto &word = words.emplace_back();
+        if(*c == '"') {
+            for(c++; *c != '"'; c++) {
+                if(*c == 0) {
+                    throw_error("Expected a closing quote");
+                }
+                if(*c == '\\' && (c[1] == '"' || c[1] == '\\')) {
+                    c++;
+                }
+                word += *c;
+            }
+            c++;
+        }
+        else {
+            for(; *c != 0 && *c != ' ' && *c != '\t'; c++) {
+                word += *c;
+            }
+        }
+    }
+}
+
+static std::size_t get_script_position(const std::string &position) {
+    if(position == "end") {
+        return SIZE_MAX;
+    }
+    try {
+        return std::stoul(position);
+    }
+    catch(std::exception &) {
+        throw_error("Expected a valid position but got %s", position.c_str());
+    }
+}
+
+/**
+ * Run a script of commands, one per line, keeping every tag it touches open until it's saved. Each command gets a
+ * JSON response on its own line with the line number, whether it succeeded, and any values or error it returned. Tags
+ * are saved with "save" or "close" and once the script ends.
+ * @param  script         script to read
+ * @param  tags           tags directory
+ * @param  check_read_only whether to refuse to edit read-only values
+ * @return                true if every command succeeded
+ */
+static bool run_script(std::istream &script, const std::filesystem::path &tags, bool check_read_only) {
+    struct OpenTag {
+        std::unique_ptr<Parser::ParserStruct> tag_struct;
+        HEK::TagFourCC tag_class;
+        std::filesystem::path file_path;
+        bool modified = false;
+    };
+    std::map<std::string, OpenTag> open_tags;
+    
+    auto open_tag = [&open_tags, &tags](const std::string &tag_path, bool new_tag) -> OpenTag & {
+        auto preferred_path = File::halo_path_to_preferred_path(tag_path);
+        auto existing = open_tags.find(preferred_path);
+        if(existing != open_tags.end() && !new_tag) {
+            return existing->second;
+        }
+        
+        OpenTag tag;
+        tag.file_path = tags / preferred_path;
+        if(new_tag) {
+            auto split = File::split_tag_class_extension(tag_path);
+            if(!split.has_value()) {
+                throw_error("Failed to create a new tag %s. Make sure the extension is correct.", tag_path.c_str());
+            }
+            tag.tag_class = split->fourcc;
+            tag.tag_struct = Parser::ParserStruct::generate_base_struct(tag.tag_class);
+            tag.modified = true;
+        }
+        else {
+            auto value = File::open_file(tag.file_path);
+            if(!value.has_value()) {
+                throw_error("Failed to read %s", tag.file_path.string().c_str());
+            }
+            try {
+                tag.tag_struct = Parser::ParserStruct::parse_hek_tag_file(value->data(), value->size());
+            }
+            catch(std::exception &e) {
+                throw_error("Failed to parse %s: %s", tag.file_path.string().c_str(), e.what());
+            }
+            tag.tag_class = reinterpret_cast<const HEK::TagFileHeader *>(value->data())->tag_fourcc;
+        }
+        
+        return open_tags.insert_or_assign(preferred_path, std::move(tag)).first->second;
+    };
+    
+    auto save_tag = [](OpenTag &tag) {
+        if(!tag.modified) {
+            return;
+        }
+        
+        auto split = File::split_tag_class_extension(tag.file_path.string());
+        if(!split.has_value() || split->fourcc != tag.tag_class) {
+            throw_error("Cannot save: %s does not have the correct .%s extension", tag.file_path.string().c_str(), HEK::tag_fourcc_to_extension(tag.tag_class));
+        }
+        
+        std::error_code ec;
+        std::filesystem::create_directories(tag.file_path.parent_path(), ec);
+        if(!File::save_file_atomically(tag.file_path, tag.tag_struct->generate_hek_tag_data(tag.tag_class))) {
+            throw_error("Unable to write to %s", tag.file_path.string().c_str());
+        }
+        tag.modified = false;
+    };
+    
+    auto save_all = [&open_tags, &save_tag](std::vector<std::string> &output) {
+        for(auto &[path, tag] : open_tags) {
+            if(tag.modified) {
+                save_tag(tag);
+                output.emplace_back(path);
+            }
+        }
+    };
+    
+    auto respond = [](std::size_t line_number, const std::vector<std::string> &output, const char *error) {
+        std::string response = "{\"line\":" + std::to_string(line_number);
+        if(error) {
+            response += ",\"ok\":false,\"error\":" + json_string(error);
+        }
+        else {
+            response += ",\"ok\":true,\"values\":[";
+            for(std::size_t o = 0; o < output.size(); o++) {
+                response += (o ? "," : "") + json_string(output[o]);
+            }
+            response += "]";
+        }
+        response += "}\n";
+        
+        // Flush so whatever is driving this can read each response as soon as it's ready
+        std::fputs(response.c_str(), stdout);
+        std::fflush(stdout);
+    };
+    
+    bool success = true;
+    std::size_t line_number = 0;
+    std::string line;
+    
+    while(std::getline(script, line)) {
+        line_number++;
+        if(!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        
+        std::vector<std::string> output;
+        try {
+            auto words = split_script_line(line);
+            if(words.empty() || words[0][0] == '#') {
+                continue;
+            }
+            
+            auto &command = words[0];
+            auto expect_arguments = [&words, &command](std::size_t count) {
+                if(words.size() != count + 1) {
+                    throw_error("%s expects %zu argument%s but got %zu", command.c_str(), count, count == 1 ? "" : "s", words.size() - 1);
+                }
+            };
+            
+            // Commands that work on a tag as a whole
+            if(command == "save") {
+                if(words.size() == 1) {
+                    save_all(output);
+                }
+                else {
+                    expect_arguments(1);
+                    auto tag = open_tags.find(File::halo_path_to_preferred_path(words[1]));
+                    if(tag != open_tags.end() && tag->second.modified) {
+                        save_tag(tag->second);
+                        output.emplace_back(tag->first);
+                    }
+                }
+            }
+            else if(command == "close") {
+                expect_arguments(1);
+                auto tag = open_tags.find(File::halo_path_to_preferred_path(words[1]));
+                if(tag != open_tags.end()) {
+                    if(tag->second.modified) {
+                        save_tag(tag->second);
+                        output.emplace_back(tag->first);
+                    }
+                    open_tags.erase(tag);
+                }
+            }
+            else if(command == "new") {
+                expect_arguments(1);
+                open_tag(words[1], true);
+            }
+            
+            // Everything else is an action on a value in a tag
+            else {
+                Actions action = {};
+                if(command == "get" || command == "count" || command == "erase") {
+                    expect_arguments(2);
+                    action.type = command == "get" ? ActionType::ACTION_TYPE_GET : command == "count" ? ActionType::ACTION_TYPE_COUNT : ActionType::ACTION_TYPE_DELETE;
+                    action.key = words[2];
+                }
+                else if(command == "set") {
+                    expect_arguments(3);
+                    action.type = ActionType::ACTION_TYPE_SET;
+                    action.key = words[2];
+                    action.value = words[3];
+                }
+                else if(command == "insert") {
+                    expect_arguments(4);
+                    action.type = ActionType::ACTION_TYPE_INSERT;
+                    action.key = words[2];
+                    try {
+                        action.count = std::stoul(words[3]);
+                    }
+                    catch(std::exception &) {
+                        throw_error("Expected a valid count but got %s", words[3].c_str());
+                    }
+                    action.position = get_script_position(words[4]);
+                }
+                else if(command == "copy" || command == "move") {
+                    expect_arguments(3);
+                    action.type = command == "copy" ? ActionType::ACTION_TYPE_COPY : ActionType::ACTION_TYPE_MOVE;
+                    action.key = words[2];
+                    action.position = get_script_position(words[3]);
+                }
+                else if(command == "list-values") {
+                    expect_arguments(1);
+                    action.type = ActionType::ACTION_TYPE_LIST_ALL_VALUES;
+                }
+                else {
+                    throw_error("Unknown command %s", command.c_str());
+                }
+                
+                auto &tag = open_tag(words[1], false);
+                perform_action(*tag.tag_struct, tag.tag_class, action, check_read_only, output, tag.modified);
+            }
+            
+            respond(line_number, output, nullptr);
+        }
+        catch(std::exception &e) {
+            respond(line_number, {}, e.what());
+            success = false;
+        }
+    }
+    
+    // Save whatever is left once the script ends
+    std::vector<std::string> output;
+    try {
+        save_all(output);
+        respond(line_number + 1, output, nullptr);
+    }
+    catch(std::exception &e) {
+        respond(line_number + 1, {}, e.what());
+        success = false;
+    }
+    
+    return success;
+}
+
 int main(int argc, char * const *argv) {
     set_up_color_term();
     
@@ -782,11 +1242,12 @@ int main(int argc, char * const *argv) {
         CommandLineOption("move", 'M', 2, "Swap the selected structs with the structs at the given index or \"end\" if the end of the array. The regions must not intersect.", "<key> <pos>"),
         CommandLineOption("erase", 'E', 1, "Delete the selected struct(s).", "<key>"),
         CommandLineOption("copy", 'c', 2, "Copy the selected struct(s) to the given index or \"end\" if the end of the array.", "<key> <pos>"),
-        CommandLineOption("no-safeguards", 'n', 0, "Allow all tag data to be edited (proceed at your own risk)")
+        CommandLineOption("no-safeguards", 'n', 0, "Allow all tag data to be edited (proceed at your own risk)"),
+        CommandLineOption("script", 'x', 1, "Run newline-delimited commands from a file (or - for stdin), keeping tags open between them. Commands are: get <tag> <key>, set <tag> <key> <val>, count <tag> <key>, insert <tag> <key> <#> <pos>, erase <tag> <key>, copy <tag> <key> <pos>, move <tag> <key> <pos>, list-values <tag>, new <tag>, save [tag], and close <tag>. Modified tags are saved on save, close, and at the end. Each command gets a JSON response line.", "<file>")
     };
 
     static constexpr char DESCRIPTION[] = "Edit tags via command-line.";
-    static constexpr char USAGE[] = "[options] <-b <expr>|tag.class>";
+    static constexpr char USAGE[] = "[options] <-b <expr>|-x <file>|tag.class>";
 
     struct EditOptions {
         std::filesystem::path tags = "tags";
@@ -798,6 +1259,7 @@ int main(int argc, char * const *argv) {
         bool view_checksum = false;
         std::vector<std::string> batch, batch_exclude;
         std::optional<std::variant<std::string, std::filesystem::path>> overwrite_path;
+        std::optional<std::string> script;
     } edit_options;
 
     auto remaining_arguments = CommandLineOption::parse_arguments<EditOptions &>(argc, argv, options, USAGE, DESCRIPTION, 0, 1, edit_options, [](char opt, const std::vector<const char *> &arguments, auto &edit_options) {
@@ -865,6 +1327,9 @@ int main(int argc, char * const *argv) {
             case 'o':
                 edit_options.overwrite_path = std::filesystem::path(arguments[0]);
                 break;
+            case 'x':
+                edit_options.script = arguments[0];
+                break;
             case 'O':
                 edit_options.overwrite_path = std::string(arguments[0]);
                 break;
@@ -881,6 +1346,26 @@ int main(int argc, char * const *argv) {
     });
     
     auto use_batching = !(edit_options.batch.empty() && edit_options.batch_exclude.empty());
+    
+    // Scripts do everything themselves
+    if(edit_options.script.has_value()) {
+        if(use_batching || !remaining_arguments.empty() || !edit_options.actions.empty() || edit_options.new_tag || edit_options.overwrite_path.has_value() || edit_options.verify_checksum || edit_options.view_checksum) {
+            eprintf_error("--script cannot be used with a tag path or any other action");
+            return EXIT_FAILURE;
+        }
+        
+        if(*edit_options.script == "-") {
+            return run_script(std::cin, edit_options.tags, edit_options.check_read_only) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        
+        std::ifstream script(*edit_options.script);
+        if(!script.is_open()) {
+            eprintf_error("Failed to open %s", edit_options.script->c_str());
+            return EXIT_FAILURE;
+        }
+        return run_script(script, edit_options.tags, edit_options.check_read_only) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    
     if(use_batching != remaining_arguments.empty()) {
         eprintf_error("Expected batching or a tag path but not both.");
         return EXIT_FAILURE;
@@ -956,128 +1441,15 @@ int main(int argc, char * const *argv) {
         std::vector<std::string> output;
         bool should_save = edit_options.new_tag; // by default only save if making a new tag. this will be set to true if --set, --insert, --copy, --move, or --delete are used too
         
-        for(auto &i : edit_options.actions) {
-            switch(i.type) {
-                case ActionType::ACTION_TYPE_LIST: {
-                    list_everything(populate_struct(*Parser::ParserStruct::generate_base_struct(tag_class)), output, false);
-                    break;
-                }
-                case ActionType::ACTION_TYPE_LIST_ALL_VALUES: {
-                    list_everything(*tag_struct, output, true);
-                    break;
-                }
-                case ActionType::ACTION_TYPE_GET: {
-                    std::string bitfield;
-                    auto arr = get_values_for_key(tag_struct.get(), i.key == "" ? "" : (std::string(".") + i.key), bitfield, false);
-                    for(auto &k : arr) {
-                        output.emplace_back(get_value(k, bitfield));
-                    }
-                    break;
-                }
-                case ActionType::ACTION_TYPE_SET: {
-                    std::string bitfield;
-                    should_save = true;
-                    auto arr = get_values_for_key(tag_struct.get(), i.key == "" ? "" : (std::string(".") + i.key), bitfield, edit_options.check_read_only);
-                    for(auto &k : arr) {
-                        set_value(k, i.value, bitfield);
-                    }
-                    break;
-                }
-                case ActionType::ACTION_TYPE_COUNT: {
-                    auto arr = get_values_for_key(tag_struct.get(), i.key == "" ? "" : (std::string(".") + i.key), false);
-                    for(auto &k : arr) {
-                        if(k.get_type() == Parser::ParserStructValue::ValueType::VALUE_TYPE_REFLEXIVE) {
-                            output.emplace_back(std::to_string(k.get_array_size()));
-                        }
-                        else {
-                            eprintf_error("%s is not an array", k.get_member_name());
-                            throw std::exception();
-                        }
-                    }
-                    break;
-                }
-                case ActionType::ACTION_TYPE_INSERT: {
-                    should_save = true;
-                    auto arr = get_values_for_key(tag_struct.get(), i.key == "" ? "" : (std::string(".") + i.key), edit_options.check_read_only);
-                    for(auto &k : arr) {
-                        if(k.get_type() != Parser::ParserStructValue::ValueType::VALUE_TYPE_REFLEXIVE) {
-                            eprintf_error("%s is not an array", k.get_member_name());
-                            throw std::exception();
-                        }
-                        
-                        if(i.count + k.get_array_size() > k.get_array_maximum_size()) {
-                            eprintf_error("%s's maximum size of %zu exceeded", k.get_member_name(), k.get_array_maximum_size());
-                            throw std::exception();
-                        }
-                        k.insert_objects_in_array(i.position == SIZE_MAX ? k.get_array_size() : i.position, i.count);
-                    }
-                    break;
-                }
-                case ActionType::ACTION_TYPE_DELETE: {
-                    should_save = true;
-                    std::pair<std::size_t, std::size_t> range;
-                    auto arr = get_values_for_key(tag_struct.get(), i.key == "" ? "" : (std::string(".") + i.key), range, edit_options.check_read_only);
-                    for(auto &k : arr) {
-                        if(k.get_type() != Parser::ParserStructValue::ValueType::VALUE_TYPE_REFLEXIVE) {
-                            eprintf_error("%s is not an array", k.get_member_name());
-                            throw std::exception();
-                        }
-                        
-                        std::size_t iterations = range.second - range.first + 1;
-                        if(k.get_array_size() - iterations < k.get_array_minimum_size()) {
-                            eprintf_error("%s's minimum size of %zu exceeded", k.get_member_name(), k.get_array_maximum_size());
-                            throw std::exception();
-                        }
-                        k.delete_objects_in_array(range.first, iterations);
-                    }
-                    break;
-                }
-                case ActionType::ACTION_TYPE_MOVE: {
-                    should_save = true;
-                    std::pair<std::size_t, std::size_t> range;
-                    auto arr = get_values_for_key(tag_struct.get(), i.key == "" ? "" : (std::string(".") + i.key), range, edit_options.check_read_only);
-                    for(auto &k : arr) {
-                        if(k.get_type() != Parser::ParserStructValue::ValueType::VALUE_TYPE_REFLEXIVE) {
-                            eprintf_error("%s is not an array", k.get_member_name());
-                            throw std::exception();
-                        }
-                        
-                        std::size_t to = i.position == SIZE_MAX ? k.get_array_size() : i.position;
-                        std::size_t iterations = range.second - range.first + 1;
-                        if(to == range.first) {
-                            continue; // we can ignore if it's trying to swap itself
-                        }
-                        k.swap_objects_in_array(range.first, to, iterations);
-                    }
-                    break;
-                }
-                case ActionType::ACTION_TYPE_COPY: {
-                    should_save = true;
-                    std::pair<std::size_t, std::size_t> range;
-                    auto arr = get_values_for_key(tag_struct.get(), i.key == "" ? "" : (std::string(".") + i.key), range, edit_options.check_read_only);
-                    for(auto &k : arr) {
-                        if(k.get_type() != Parser::ParserStructValue::ValueType::VALUE_TYPE_REFLEXIVE) {
-                            eprintf_error("%s is not an array", k.get_member_name());
-                            throw std::exception();
-                        }
-                        
-                        std::size_t to = i.position == SIZE_MAX ? k.get_array_size() : i.position;
-                        std::size_t iterations = range.second - range.first + 1;
-                        
-                        if(iterations + k.get_array_size() > k.get_array_maximum_size()) {
-                            eprintf_error("%s's maximum size of %zu exceeded", k.get_member_name(), k.get_array_maximum_size());
-                            throw std::exception();
-                        }
-                        
-                        k.duplicate_objects_in_array(range.first, to, iterations);
-                    }
-                    break;
-                }
-                default:
-                    eprintf_error("Unimplemented");
-                    std::exit(EXIT_FAILURE);
+        try {
+            for(auto &i : edit_options.actions) {
+                perform_action(*tag_struct, tag_class, i, edit_options.check_read_only, output, should_save);
             }
         }
+        catch(EditError &e) {
+            eprintf_error("%s", e.what());
+            return false;
+        }
         
         for(auto &i : output) {
             std::puts(i.c_str());
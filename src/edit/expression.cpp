@@ -8,59 +8,63 @@
 #include <cassert>
 #include <optional>
 #include <cmath>
-
-template <typename Number, Number number_from_value(const std::string &what)> static Number evaluate_expression_of_type(const char *expression, Number input) {
-    struct ParsedToken {
-        enum Type {
-            GROUP,
-            NUMBER,
-            INPUT,
-            POWER,
-            ADD,
-            SUBTRACT,
-            MULTIPLY,
-            DIVIDE
-        } type;
-
-        bool is_operator() const noexcept {
-            switch(this->type) {
-                case Type::ADD:
-                case Type::SUBTRACT:
-                case Type::MULTIPLY:
-                case Type::DIVIDE:
-                case Type::POWER:
-                    return true;
-                default:
-                    return false;
-            }
+#include <algorithm>
+#include <stdexcept>
+
+template <typename Number> struct ParsedToken {
+    enum Type {
+        GROUP,
+        NUMBER,
+        INPUT,
+        POWER,
+        ADD,
+        SUBTRACT,
+        MULTIPLY,
+        DIVIDE
+    } type;
+
+    bool is_operator() const noexcept {
+        switch(this->type) {
+            case Type::ADD:
+            case Type::SUBTRACT:
+            case Type::MULTIPLY:
+            case Type::DIVIDE:
+            case Type::POWER:
+                return true;
+            default:
+                return false;
         }
+    }
 
-        int operator_priority() noexcept {
-            assert(this->is_operator());
-
-            switch(this->type) {
-                case Type::ADD:
-                case Type::SUBTRACT:
-                    return 1;
-                case Type::MULTIPLY:
-                case Type::DIVIDE:
-                    return 2;
-                case Type::POWER:
-                    return 3;
-                default:
-                    std::terminate();
-            }
+    int operator_priority() noexcept {
+        assert(this->is_operator());
+
+        switch(this->type) {
+            case Type::ADD:
+            case Type::SUBTRACT:
+                return 1;
+            case Type::MULTIPLY:
+            case Type::DIVIDE:
+                return 2;
+            case Type::POWER:
+                return 3;
+            default:
+                std::terminate();
         }
+    }
 
-        std::vector<ParsedToken> group;
-        Number number = 1.0; // multiplier if group/input. number if number
+    std::vector<ParsedToken> group;
+    Number number = 1.0; // multiplier if group/input. number if number
 
-        // These next four lines somehow make GCC not scream at me for use-after-free warnings
-        ParsedToken() = default;
-        ParsedToken(ParsedToken &&moving) = default;
-        ParsedToken(const ParsedToken &moving) = default;
-        ParsedToken &operator=(const ParsedToken &moving) = default;
-    };
+    // These next four lines somehow make GCC not scream at me for use-after-free warnings
+    ParsedToken() = default;
+    ParsedToken(ParsedToken &&moving) = default;
+    ParsedToken(const ParsedToken &moving) = default;
+    ParsedToken &operator=(const ParsedToken &moving) = default;
+};
+
+template <typename Number, Number number_from_value(const std::string &what)> static ParsedToken<Number> parse_expression(const char *expression) {
+    using ParsedToken = ::ParsedToken<Number>;
 
     // Get tokens
     std::vector<std::string> tokens;
@@ -291,56 +295,7 @@ template <typename Number, Number number_from_value(const std::string &what)> st
 
     recursively_sort_group(main_group, recursively_sort_group);
 
-    // Now we can evaluate it!
-    auto recursively_evaluate_token = [](const ParsedToken &token, Number input, auto &recursively_evaluate_token) -> Number {
-        switch(token.type) {
-            case ParsedToken::Type::INPUT:
-                return input * token.number;
-            case ParsedToken::Type::NUMBER:
-                return token.number;
-            case ParsedToken::Type::GROUP: {
-                Number value = 0.0;
-                auto op = ParsedToken::Type::ADD;
-                auto length = token.group.size();
-                for(std::size_t i = 0; i < length; i+=2) {
-                    auto last = i + 1 == length;
-                    auto next_value = recursively_evaluate_token(token.group[i], input, recursively_evaluate_token);
-                    switch(op) {
-                        case ParsedToken::Type::ADD:
-                            value += next_value;
-                            break;
-                        case ParsedToken::Type::SUBTRACT:
-                            value -= next_value;
-                            break;
-                        case ParsedToken::Type::MULTIPLY:
-                            value *= next_value;
-                            break;
-                        case ParsedToken::Type::DIVIDE:
-                            if(next_value == 0) {
-                                std::fputs("Division by zero!\n", stderr);
-                                throw std::exception();
-                            }
-                            value /= next_value;
-                            break;
-                        case ParsedToken::Type::POWER:
-                            value = std::pow(value, next_value);
-                            break;
-                        default:
-                            assert(false);
-                    }
-                    if(!last) {
-                        op = token.group[i+1].type;
-                    }
-                }
-                return value;
-            }
-            default:
-                assert(false);
-                std::terminate();
-        }
-    };
-
-    return recursively_evaluate_token(main_group, input, recursively_evaluate_token);
+    return main_group;
 }
 
 static double string_to_double(const std::string &what) {
@@ -351,11 +306,167 @@ static std::int64_t string_to_int(const std::string &what) {
     return std::stoll(what);
 }
 
+// Values are evaluated in blocks of this many at a time so each instruction runs in a loop that can be vectorized
+static constexpr std::size_t EVALUATION_BLOCK_SIZE = 256;
+
 namespace Invader::Edit {
+    template <typename Number> Expression<Number>::Expression(const char *expression) {
+        ParsedToken<Number> parsed;
+        if constexpr(std::is_floating_point_v<Number>) {
+            parsed = parse_expression<Number, string_to_double>(expression);
+        }
+        else {
+            parsed = parse_expression<Number, string_to_int>(expression);
+        }
+
+        // Each group starts at 0 and applies its operations from left to right, just like the parse tree is read
+        auto recursively_compile_token = [this](const ParsedToken<Number> &token, auto &recursively_compile_token) -> void {
+            switch(token.type) {
+                case ParsedToken<Number>::Type::INPUT:
+                    this->program.emplace_back(Instruction { Instruction::PUSH_INPUT, token.number });
+                    this->constant = false;
+                    break;
+                case ParsedToken<Number>::Type::NUMBER:
+                    this->program.emplace_back(Instruction { Instruction::PUSH_NUMBER, token.number });
+                    break;
+                case ParsedToken<Number>::Type::GROUP: {
+                    this->program.emplace_back(Instruction { Instruction::PUSH_NUMBER, 0 });
+                    auto op = Instruction::ADD;
+                    auto length = token.group.size();
+                    for(std::size_t i = 0; i < length; i+=2) {
+                        recursively_compile_token(token.group[i], recursively_compile_token);
+                        this->program.emplace_back(Instruction { op, 0 });
+                        if(i + 1 != length) {
+                            switch(token.group[i+1].type) {
+                                case ParsedToken<Number>::Type::ADD:
+                                    op = Instruction::ADD;
+                                    break;
+                                case ParsedToken<Number>::Type::SUBTRACT:
+                                    op = Instruction::SUBTRACT;
+                                    break;
+                                case ParsedToken<Number>::Type::MULTIPLY:
+                                    op = Instruction::MULTIPLY;
+                                    break;
+                                case ParsedToken<Number>::Type::DIVIDE:
+                                    op = Instruction::DIVIDE;
+                                    break;
+                                case ParsedToken<Number>::Type::POWER:
+                                    op = Instruction::POWER;
+                                    break;
+                                default:
+                                    std::terminate();
+                            }
+                        }
+                    }
+                    break;
+                }
+                default:
+                    std::terminate();
+            }
+        };
+        recursively_compile_token(parsed, recursively_compile_token);
+
+        std::size_t depth = 0;
+        for(auto &i : this->program) {
+            if(i.operation == Instruction::PUSH_NUMBER || i.operation == Instruction::PUSH_INPUT) {
+                this->stack_size = std::max(this->stack_size, ++depth);
+            }
+            else {
+                depth--;
+            }
+        }
+    }
+
+    template <typename Number> Number Expression<Number>::evaluate(Number input) const {
+        this->evaluate(&input, 1);
+        return input;
+    }
+
+    template <typename Number> void Expression<Number>::evaluate(Number *values, std::size_t count) const {
+        if(count == 0) {
+            return;
+        }
+
+        // If n isn't used, we only need to do it once
+        if(this->constant && count > 1) {
+            Number result = values[0];
+            this->evaluate(&result, 1);
+            std::fill_n(values, count, result);
+            return;
+        }
+
+        std::vector<Number> stack(this->stack_size * EVALUATION_BLOCK_SIZE);
+
+        for(std::size_t offset = 0; offset < count; offset += EVALUATION_BLOCK_SIZE) {
+            auto *input = values + offset;
+            auto block_size = std::min(count - offset, EVALUATION_BLOCK_SIZE);
+            auto *top = stack.data();
+
+            for(auto &i : this->program) {
+                if(i.operation == Instruction::PUSH_NUMBER) {
+                    std::fill_n(top, block_size, i.number);
+                    top += EVALUATION_BLOCK_SIZE;
+                    continue;
+                }
+                if(i.operation == Instruction::PUSH_INPUT) {
+                    for(std::size_t v = 0; v < block_size; v++) {
+                        top[v] = input[v] * i.number;
+                    }
+                    top += EVALUATION_BLOCK_SIZE;
+                    continue;
+                }
+
+                // Everything else pops the top two blocks and pushes the result
+                top -= EVALUATION_BLOCK_SIZE;
+                auto *b = top;
+                auto *a = top - EVALUATION_BLOCK_SIZE;
+
+                switch(i.operation) {
+                    case Instruction::ADD:
+                        for(std::size_t v = 0; v < block_size; v++) {
+                            a[v] += b[v];
+                        }
+                        break;
+                    case Instruction::SUBTRACT:
+                        for(std::size_t v = 0; v < block_size; v++) {
+                            a[v] -= b[v];
+                        }
+                        break;
+                    case Instruction::MULTIPLY:
+                        for(std::size_t v = 0; v < block_size; v++) {
+                            a[v] *= b[v];
+                        }
+                        break;
+                    case Instruction::DIVIDE:
+                        if(std::find(b, b + block_size, static_cast<Number>(0)) != b + block_size) {
+                            std::fputs("Division by zero!\n", stderr);
+                            throw std::exception();
+                        }
+                        for(std::size_t v = 0; v < block_size; v++) {
+                            a[v] /= b[v];
+                        }
+                        break;
+                    case Instruction::POWER:
+                        for(std::size_t v = 0; v < block_size; v++) {
+                            a[v] = std::pow(a[v], b[v]);
+                        }
+                        break;
+                    default:
+                        std::terminate();
+                }
+            }
+
+            std::copy_n(stack.data(), block_size, input);
+        }
+    }
+
+    template class Expression<double>;
+    template class Expression<std::int64_t>;
+
     double evaluate_expression(const char *expression, double input) {
-        return evaluate_expression_of_type<double, string_to_double>(expression, input);
+        return Expression<double>(expression).evaluate(input);
     }
     std::int64_t evaluate_expression(const char *expression, std::int64_t input) {
-        return evaluate_expression_of_type<std::int64_t, string_to_int>(expression, input);
+        return Expression<std::int64_t>(expression).evaluate(input);
     }
 }
@@ -3,9 +3,66 @@
 #ifndef INVADER__EDIT__EXPRESSION_HPP
 #define INVADER__EDIT__EXPRESSION_HPP
 
+#include <cstddef>
 #include <cstdint>
+#include <vector>
 
 namespace Invader::Edit {
+    /**
+     * Arithmetic expression of the current value (n), compiled once so it can be evaluated for any number of values
+     */
+    template <typename Number> class Expression {
+    public:
+        /**
+         * Evaluate the expression for one value
+         * @param  input value of n
+         * @return       result
+         */
+        Number evaluate(Number input) const;
+
+        /**
+         * Evaluate the expression for every value in an array, replacing each value with its result
+         * @param values values of n
+         * @param count  number of values
+         */
+        void evaluate(Number *values, std::size_t count) const;
+
+        /**
+         * Compile an expression
+         * @param expression expression to compile
+         * @throws std::exception if the expression is invalid
+         */
+        Expression(const char *expression);
+
+    private:
+        struct Instruction {
+            enum Operation {
+                PUSH_NUMBER,
+                PUSH_INPUT,
+                ADD,
+                SUBTRACT,
+                MULTIPLY,
+                DIVIDE,
+                POWER
+            } operation;
+
+            /** Number to push, or what to multiply the input by */
+            Number number;
+        };
+
+        /** Instructions for a stack machine, in postfix order */
+        std::vector<Instruction> program;
+
+        /** Maximum depth of the stack when running the program */
+        std::size_t stack_size = 0;
+
+        /** The program doesn't use n, so every value gets the same result */
+        bool constant = true;
+    };
+
+    extern template class Expression<double>;
+    extern template class Expression<std::int64_t>;
+
     double evaluate_expression(const char *expression, double input);
     std::int64_t evaluate_expression(const char *expression, std::int64_t input);
 }
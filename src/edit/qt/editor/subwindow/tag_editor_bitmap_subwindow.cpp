@@ -23,7 +23,7 @@
 #define GET_PIXEL(x,y) (x + y * real_width)
 
 namespace Invader::EditQt {
-    void TagEditorBitmapSubwindow::set_values(TagEditorBitmapSubwindow *what, QComboBox *bitmaps, QComboBox *mipmaps, QComboBox *colors, QComboBox *scale, QComboBox *sequence, QComboBox *sprite, QScrollArea *images, std::vector<Parser::BitmapGroupSequence> *all_sequences) {
+    void TagEditorBitmapSubwindow::set_values(TagEditorBitmapSubwindow *what, QComboBox *bitmaps, QComboBox *mipmaps, QComboBox *colors, QComboBox *scale, QComboBox *sequence, QComboBox *sprite, QScrollArea *images, Parser::Vector<Parser::BitmapGroupSequence> *all_sequences) {
         what->mipmaps = mipmaps;
         what->colors = colors;
         what->bitmaps = bitmaps;
@@ -99,7 +99,7 @@ namespace Invader::EditQt {
         colors->blockSignals(false);
     }
 
-    template<typename T> static void generate_main_widget(TagEditorBitmapSubwindow *subwindow, T *bitmap_data, void (*set_values)(TagEditorBitmapSubwindow *, QComboBox *, QComboBox *, QComboBox *, QComboBox *, QComboBox *, QComboBox *, QScrollArea *, std::vector<Parser::BitmapGroupSequence> *)) {
+    template<typename T> static void generate_main_widget(TagEditorBitmapSubwindow *subwindow, T *bitmap_data, void (*set_values)(TagEditorBitmapSubwindow *, QComboBox *, QComboBox *, QComboBox *, QComboBox *, QComboBox *, QComboBox *, QScrollArea *, Parser::Vector<Parser::BitmapGroupSequence> *)) {
         // Set up the main widget
         auto *main_widget = new QWidget();
         subwindow->setCentralWidget(main_widget);
@@ -811,7 +811,7 @@ namespace Invader::EditQt {
                 std::size_t height = 0;
                 std::size_t width = 0;
                 auto &sprite = sequence.sprites[i];
-                std::vector<Parser::BitmapData> *bitmap_data;
+                Parser::Vector<Parser::BitmapData> *bitmap_data;
                 auto *parent_window = this->get_parent_window();
                 switch(parent_window->get_file().tag_fourcc) {
                     case TagFourCC::TAG_FOURCC_BITMAP:
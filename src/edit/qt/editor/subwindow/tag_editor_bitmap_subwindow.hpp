@@ -56,9 +56,9 @@ namespace Invader::EditQt {
             COLOR_BLUE
         };
 
-        std::vector<Parser::BitmapGroupSequence> *all_sequences;
+        Parser::Vector<Parser::BitmapGroupSequence> *all_sequences;
 
-        static void set_values(TagEditorBitmapSubwindow *what, QComboBox *bitmaps, QComboBox *mipmaps, QComboBox *colors, QComboBox *scale, QComboBox *sequence, QComboBox *sprite, QScrollArea *images, std::vector<Parser::BitmapGroupSequence> *all_sequences);
+        static void set_values(TagEditorBitmapSubwindow *what, QComboBox *bitmaps, QComboBox *mipmaps, QComboBox *colors, QComboBox *scale, QComboBox *sequence, QComboBox *sprite, QScrollArea *images, Parser::Vector<Parser::BitmapGroupSequence> *all_sequences);
         void refresh_data();
         void reload_view();
         
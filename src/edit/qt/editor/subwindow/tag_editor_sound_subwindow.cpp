@@ -12,8 +12,8 @@
 #include "../tag_editor_window.hpp"
 #include <invader/tag/parser/parser.hpp>
 #include "tag_editor_sound_subwindow.hpp"
-#include <invader/sound/sound_encoder.hpp>
-#include <invader/sound/sound_reader.hpp>
+#include <invader/sound/sound_decoder.hpp>
+#include <cstring>
 
 #undef LittleEndian
 #undef BigEndian
@@ -222,6 +222,7 @@ namespace Invader::EditQt {
         this->center_window();
         
         this->sample_timer.callOnTimeout(this, &TagEditorSoundSubwindow::play_sample);
+        this->decode_timer.callOnTimeout(this, &TagEditorSoundSubwindow::update_decode_progress);
     }
 
     void TagEditorSoundSubwindow::update_permutation_list() {
@@ -293,54 +294,63 @@ namespace Invader::EditQt {
         }
 
         auto &permutations = this->get_pitch_range()->permutations;
-        std::vector<std::byte> pcm;
-
-        auto add_to_pcm = [&pcm](const SoundReader::Sound &what) {
-            std::vector<std::byte> new_pcm;
-            const auto *pcm_data = &what.pcm;
-            if(what.bits_per_sample != CONVERSION_BITS_PER_SAMPLE) {
-                new_pcm = SoundEncoder::convert_int_to_int(what.pcm, what.bits_per_sample, CONVERSION_BITS_PER_SAMPLE);
-                pcm_data = &new_pcm;
-            }
-            pcm.insert(pcm.end(), pcm_data->begin(), pcm_data->end());
-        };
+        std::vector<SoundDecoder::EncodedPart> parts;
 
         // Do it!
         for(auto p : permutations_to_play) {
             auto &permutation = permutations[p];
-            auto *sound_data = permutation.samples.data();
-            auto sound_size = permutation.samples.size();
-            try {
-                switch(permutation.format) {
-                    case HEK::SoundFormat::SOUND_FORMAT_16_BIT_PCM:
-                        add_to_pcm(SoundReader::sound_from_16_bit_pcm_big_endian(sound_data, sound_size, this->channel_count, this->sample_rate));
-                        break;
-                    case HEK::SoundFormat::SOUND_FORMAT_OGG_VORBIS:
-                        add_to_pcm(SoundReader::sound_from_ogg(sound_data, sound_size));
-                        break;
-                    case HEK::SoundFormat::SOUND_FORMAT_XBOX_ADPCM:
-                        add_to_pcm(SoundReader::sound_from_xbox_adpcm(sound_data, sound_size, this->channel_count, this->sample_rate));
-                        break;
-                    default:
-                        return;
-                }
-            }
-            catch(Invader::InvalidInputSoundException &) {
-                pcm.clear();
-                QMessageBox(QMessageBox::Icon::Critical, "Error", "Failed to load all data.\n\nThe tag may be corrupt.", QMessageBox::Ok).exec();
+            switch(permutation.format) {
+                case HEK::SoundFormat::SOUND_FORMAT_16_BIT_PCM:
+                case HEK::SoundFormat::SOUND_FORMAT_OGG_VORBIS:
+                case HEK::SoundFormat::SOUND_FORMAT_XBOX_ADPCM:
+                    parts.emplace_back(SoundDecoder::EncodedPart { permutation.format, permutation.samples.data(), permutation.samples.size() });
+                    break;
+                default:
+                    return;
             }
         }
-        
-        this->all_pcm = pcm;
+
+        this->decoding = this->decoder.decode(parts, this->channel_count, this->sample_rate);
         this->sample = 0;
         this->slider->blockSignals(true);
         this->slider->setValue(0);
         this->sample_granularity = this->channel_count * (CONVERSION_BITS_PER_SAMPLE / 8);
-        this->slider->setMaximum(this->all_pcm.size() / this->sample_granularity);
         this->slider->blockSignals(false);
-        this->update_time_label();
 
         this->stop_sound();
+
+        // Keep checking on it until it's done
+        this->update_decode_progress();
+        if(this->decoding != nullptr) {
+            this->decode_timer.start(50);
+        }
+    }
+
+    void TagEditorSoundSubwindow::update_decode_progress() {
+        if(this->decoding != nullptr && this->decoding->get_error().has_value()) {
+            this->decoding = nullptr;
+            this->decode_timer.stop();
+            this->stop_sound();
+            this->sample = 0;
+            QMessageBox(QMessageBox::Icon::Critical, "Error", "Failed to load all data.\n\nThe tag may be corrupt.", QMessageBox::Ok).exec();
+        }
+
+        this->slider->blockSignals(true);
+        this->slider->setMaximum(this->get_available_size() / this->sample_granularity);
+        this->slider->blockSignals(false);
+        this->update_time_label();
+
+        if(this->is_fully_decoded()) {
+            this->decode_timer.stop();
+        }
+    }
+
+    std::size_t TagEditorSoundSubwindow::get_available_size() const {
+        return this->decoding != nullptr ? this->decoding->get_available_size() : 0;
+    }
+
+    bool TagEditorSoundSubwindow::is_fully_decoded() const {
+        return this->decoding == nullptr || this->decoding->is_finished();
     }
 
     Parser::SoundPitchRange *TagEditorSoundSubwindow::get_pitch_range() noexcept {
@@ -371,7 +381,7 @@ namespace Invader::EditQt {
     void TagEditorSoundSubwindow::play_sound() {
         this->stop_button->setEnabled(true);
         this->play_button->setEnabled(false);
-        if(this->sample >= this->all_pcm.size()) {
+        if(this->sample >= this->get_available_size() && this->is_fully_decoded()) {
             this->sample = 0;
         }
         this->update_time_label();
@@ -386,11 +396,11 @@ namespace Invader::EditQt {
     }
 
     void TagEditorSoundSubwindow::play_sample() {
-        const auto *data = this->all_pcm.data();
-        auto end = this->all_pcm.size();
+        auto end = this->get_available_size();
+        bool fully_decoded = this->is_fully_decoded();
         
         // If we're done, stop
-        if(end == 0) {
+        if(end == 0 && fully_decoded) {
             this->stop_sound();
             return;
         }
@@ -413,8 +423,8 @@ namespace Invader::EditQt {
                 break;
             }
             
-            // Have we reached the end?
-            if(this->sample == end) {
+            // Have we reached the end? (if we're still decoding, we'll just wait for more)
+            if(this->sample == end && fully_decoded) {
                 // Loop!
                 if(play_in_loop) {
                     this->sample = 0;
@@ -455,12 +465,17 @@ namespace Invader::EditQt {
                 }
             }
             
+            // Still waiting on the decoder
+            else if(this->sample >= end) {
+                break;
+            }
+            
             // No audio left. We have to get more
             else {
-                auto *cursor = data + this->sample;
-                auto remainder = std::min(end - this->sample, static_cast<std::size_t>(512));
+                std::byte pcm_buffer[512];
+                auto remainder = this->decoding->read(this->sample, pcm_buffer, sizeof(pcm_buffer));
                 
-                int result = SDL_AudioStreamPut(this->stream, cursor, remainder);
+                int result = SDL_AudioStreamPut(this->stream, pcm_buffer, remainder);
                 if(result != 0) {
                     std::printf("%zu %zu\n", this->sample, remainder);
                     
@@ -500,11 +515,18 @@ namespace Invader::EditQt {
         std::size_t seconds = centiseconds / 100;
         std::size_t minutes = seconds / 60;
 
-        std::size_t total_centiseconds = (this->all_pcm.size() / this->sample_granularity * 100) / this->sample_rate;
+        std::size_t total_centiseconds = (this->get_available_size() / this->sample_granularity * 100) / this->sample_rate;
         std::size_t total_seconds = total_centiseconds / 100;
         std::size_t total_minutes = total_seconds / 60;
 
         std::snprintf(format, sizeof(format), "%02zu:%02zu.%02zu / %02zu:%02zu.%02zu", minutes % 100, seconds % 60, centiseconds % 100, total_minutes % 100, total_seconds % 60, total_centiseconds % 100);
+
+        // Show how far along we are if we're still decoding
+        if(!this->is_fully_decoded()) {
+            std::size_t decoded, total;
+            this->decoding->get_progress(decoded, total);
+            std::snprintf(format + std::strlen(format), sizeof(format) - std::strlen(format), " (%zu%%)", total > 0 ? decoded * 100 / total : 0);
+        }
         this->time->setText(format);
     }
     
@@ -3,11 +3,14 @@
 #ifndef INVADER__EDIT__QT__TAG_EDITOR_SOUND_SUBWINDOW_HPP
 #define INVADER__EDIT__QT__TAG_EDITOR_SOUND_SUBWINDOW_HPP
 
+#include <memory>
 #include <optional>
 #include <QTimer>
 
 #include <SDL2/SDL.h>
 
+#include <invader/sound/sound_decoder.hpp>
+
 #include "tag_editor_subwindow.hpp"
 
 class QComboBox;
@@ -65,7 +68,11 @@ namespace Invader::EditQt {
         std::uint32_t channel_count;
         std::vector<std::byte> silence;
 
-        std::vector<std::byte> all_pcm;
+        // Permutations are decoded in the background, and playback can start once the first part is decoded
+        SoundDecoder::Decoder decoder;
+        std::shared_ptr<const SoundDecoder::DecodedSound> decoding;
+        QTimer decode_timer;
+
         std::size_t sample = 0;
         std::uint32_t sample_granularity = 0;
 
@@ -88,6 +95,9 @@ namespace Invader::EditQt {
         void play_sample();
         void change_sample();
         void update_time_label();
+        void update_decode_progress();
+        std::size_t get_available_size() const;
+        bool is_fully_decoded() const;
         void update_pitch_range_permutations();
 
         void closeEvent(QCloseEvent *) override;
@@ -15,6 +15,7 @@
 #include <QInputDialog>
 #include <SDL2/SDL.h>
 #include <QThread>
+#include <QStandardPaths>
 #include "tag_tree_window.hpp"
 #include "tag_tree_widget.hpp"
 #include "tag_tree_dialog.hpp"
@@ -291,8 +292,16 @@ namespace Invader::EditQt {
     void TagFetcherThread::run() {
         // Function for loading it
         std::size_t error_count;
-        auto load_it = [&error_count](std::vector<File::TagFile> *to, std::vector<std::filesystem::path> *all_paths, std::pair<std::mutex, std::size_t> *statuser) {
-            *to = Invader::File::load_virtual_tag_folder(*all_paths, false, statuser, &error_count);
+
+        // Cache directory listings so reopening large tags directories is fast
+        std::optional<std::filesystem::path> listing_cache;
+        auto cache_location = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+        if(!cache_location.isEmpty()) {
+            listing_cache = std::filesystem::path(cache_location.toStdString()) / "tag-listings";
+        }
+
+        auto load_it = [&error_count, &listing_cache](std::vector<File::TagFile> *to, std::vector<std::filesystem::path> *all_paths, std::pair<std::mutex, std::size_t> *statuser) {
+            *to = Invader::File::load_virtual_tag_folder(*all_paths, false, statuser, &error_count, listing_cache);
         };
 
         // Run this in parallel
@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
 #include <regex>
+#include <memory_resource>
 #include <invader/build/build_workload.hpp>
 #include <invader/extract/extraction.hpp>
 #include <invader/tag/hek/header.hpp>
@@ -334,6 +335,10 @@ namespace Invader {
     }
 
     std::vector<std::byte> ExtractionWorkload::extract_single_tag(const Tag &tag, ReportingLevel reporting_level) {
+        // The parsed tag is thrown away once it's converted, so allocate it from an arena
+        std::pmr::monotonic_buffer_resource tag_arena;
+        Parser::ScopedAllocationResource tag_arena_scope(&tag_arena);
+
         ExtractionWorkload workload(tag.get_map(), reporting_level);
         auto result = workload.extract_tag(tag.get_tag_index());
         if(result.has_value()) {
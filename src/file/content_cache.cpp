@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <string>
+
+#include <invader/file/content_cache.hpp>
+#include <invader/file/file.hpp>
+
+namespace Invader::File {
+    ContentCache::ContentCache(const std::filesystem::path &directory, const char *extension) : directory(directory), extension(extension) {}
+
+    std::filesystem::path ContentCache::path_for_key(const ContentHash &key) const {
+        // Split into subdirectories by the first byte so no single directory gets too large
+        auto key_string = key.to_string();
+        return this->directory / key_string.substr(0, 2) / (key_string + this->extension);
+    }
+
+    std::optional<std::vector<std::byte>> ContentCache::load(const ContentHash &key) const {
+        auto path = this->path_for_key(key);
+
+        std::error_code ec;
+        if(!std::filesystem::is_regular_file(path, ec)) {
+            return std::nullopt;
+        }
+
+        auto data = open_file(path);
+
+        // Entries are trimmed by modification time, so touch it to keep it around
+        if(data.has_value()) {
+            std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+        }
+
+        return data;
+    }
+
+    bool ContentCache::contains(const ContentHash &key) const {
+        std::error_code ec;
+        return std::filesystem::is_regular_file(this->path_for_key(key), ec);
+    }
+
+    bool ContentCache::store(const ContentHash &key, const std::vector<std::byte> &data) const {
+        auto path = this->path_for_key(key);
+
+        std::error_code ec;
+        std::filesystem::create_directories(path.parent_path(), ec);
+
+        // Entries are moved in place once written, so a reader never sees a half-written one
+        return save_file_atomically(path, data);
+    }
+
+    std::size_t ContentCache::trim(std::uintmax_t max_size) const {
+        struct Entry {
+            std::filesystem::path path;
+            std::uintmax_t size;
+            std::filesystem::file_time_type last_used;
+        };
+
+        std::vector<Entry> entries;
+        std::uintmax_t total_size = 0;
+
+        std::error_code ec;
+        for(auto i = std::filesystem::recursive_directory_iterator(this->directory, ec); !ec && i != std::filesystem::recursive_directory_iterator(); i.increment(ec)) {
+            auto &path = i->path();
+            if(!i->is_regular_file(ec) || path.extension() != this->extension) {
+                continue;
+            }
+
+            std::error_code entry_ec;
+            auto size = i->file_size(entry_ec);
+            auto last_used = i->last_write_time(entry_ec);
+            if(entry_ec) {
+                continue;
+            }
+
+            entries.emplace_back(Entry { path, size, last_used });
+            total_size += size;
+        }
+
+        if(total_size <= max_size) {
+            return 0;
+        }
+
+        // Delete the oldest first
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.last_used < b.last_used; });
+
+        std::size_t deleted = 0;
+        for(auto &e : entries) {
+            if(total_size <= max_size) {
+                break;
+            }
+            if(std::filesystem::remove(e.path, ec)) {
+                total_size -= e.size;
+                deleted++;
+            }
+        }
+
+        return deleted;
+    }
+}
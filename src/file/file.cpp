@@ -2,16 +2,28 @@
 
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #endif
 
 #include <invader/file/file.hpp>
+#include <invader/file/content_cache.hpp>
+#include <invader/thread/thread_pool.hpp>
 #include <invader/error.hpp>
 #include <invader/printf.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <filesystem>
+#include <functional>
+#include <map>
+#include <random>
 #include <cstring>
 #include <climits>
+#include <unordered_set>
 
 namespace Invader::File {
     std::optional<std::vector<std::byte>> open_file(const std::filesystem::path &path) {
@@ -92,6 +104,24 @@ namespace Invader::File {
         std::fclose(f);
         return true;
     }
+
+    bool save_file_atomically(const std::filesystem::path &path, const std::vector<std::byte> &data) {
+        auto temp_path = path;
+        temp_path += std::string(".") + std::to_string(std::random_device()()) + ".tmp";
+        if(!save_file(temp_path, data)) {
+            return false;
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(temp_path, path, ec);
+        if(ec) {
+            eprintf("Error: Failed to move %s to %s.\n", temp_path.string().c_str(), path.string().c_str());
+            std::filesystem::remove(temp_path, ec);
+            return false;
+        }
+
+        return true;
+    }
     
     std::optional<std::filesystem::path> tag_path_to_file_path(const std::string &tag_path, const std::vector<std::filesystem::path> &tags) {
         for(auto &i : tags) {
@@ -289,9 +319,199 @@ namespace Invader::File {
         }
     }
 
-    std::vector<TagFile> load_virtual_tag_folder(const std::vector<std::filesystem::path> &tags, bool filter_duplicates, std::pair<std::mutex, std::size_t> *status, std::size_t *errors) {
-        std::vector<TagFile> all_tags;
-        
+    namespace {
+        // Tag files and subdirectories in a directory
+        struct DirectoryListing {
+            // Modification time of the directory when it was listed (0 if it shouldn't be reused)
+            std::int64_t modified = 0;
+
+            std::vector<std::string> tag_files;
+            std::vector<std::string> directories;
+        };
+
+        using TagsDirectoryListing = std::map<std::string, DirectoryListing>;
+
+        // Directories modified this recently are listed again next time, since their modification time may not change if
+        // something else is added within the timestamp granularity of the filesystem
+        constexpr auto LISTING_CACHE_SETTLE_TIME = std::chrono::seconds(2);
+
+        // Listing is mostly waiting on the filesystem (especially network filesystems), so use more threads than cores
+        constexpr std::size_t MIN_LISTING_THREAD_COUNT = 8;
+
+        constexpr std::uint32_t LISTING_CACHE_VERSION = 1;
+    }
+
+    static bool is_tag_file_name(const char *name) noexcept {
+        auto *extension = std::strrchr(name, '.');
+        if(extension == nullptr || extension == name) {
+            return false;
+        }
+        auto tag_fourcc = HEK::tag_extension_to_fourcc(extension + 1);
+        return tag_fourcc != HEK::TagFourCC::TAG_FOURCC_NULL && tag_fourcc != HEK::TagFourCC::TAG_FOURCC_NONE;
+    }
+
+    // List the tag files and subdirectories of a directory. Symlinks are followed.
+    static void list_directory(const std::filesystem::path &dir, DirectoryListing &listing) {
+        // win32 implementation because Windows I/O is AWFUL
+        #ifdef _WIN32
+        WIN32_FIND_DATA find_data;
+        HANDLE file = FindFirstFileA((dir / "*").string().c_str(), &find_data);
+        if(file == INVALID_HANDLE_VALUE) {
+            return;
+        }
+
+        do {
+            if(std::strcmp(find_data.cFileName, ".") == 0 || std::strcmp(find_data.cFileName, "..") == 0) {
+                continue;
+            }
+            if(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                listing.directories.emplace_back(find_data.cFileName);
+            }
+            else if(is_tag_file_name(find_data.cFileName)) {
+                listing.tag_files.emplace_back(find_data.cFileName);
+            }
+        }
+        while(FindNextFileA(file, &find_data));
+
+        FindClose(file);
+        #else
+        auto *directory = opendir(dir.c_str());
+        if(directory == nullptr) {
+            throw std::filesystem::filesystem_error("failed to open directory", dir, std::error_code(errno, std::generic_category()));
+        }
+
+        while(auto *entry = readdir(directory)) {
+            auto *name = entry->d_name;
+            if(std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) {
+                continue;
+            }
+
+            // Most filesystems tell us what it is, so we only need to stat symlinks and filesystems that don't
+            bool is_directory = false;
+            bool is_regular_file = false;
+            bool need_stat = true;
+            #ifdef _DIRENT_HAVE_D_TYPE
+            is_directory = entry->d_type == DT_DIR;
+            is_regular_file = entry->d_type == DT_REG;
+            need_stat = entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN;
+            #endif
+
+            struct stat s;
+            if(need_stat && fstatat(dirfd(directory), name, &s, 0) == 0) {
+                is_directory = S_ISDIR(s.st_mode);
+                is_regular_file = S_ISREG(s.st_mode);
+            }
+
+            if(is_directory) {
+                listing.directories.emplace_back(name);
+            }
+            else if(is_regular_file && is_tag_file_name(name)) {
+                listing.tag_files.emplace_back(name);
+            }
+        }
+
+        closedir(directory);
+        #endif
+    }
+
+    static std::filesystem::path listing_path(const std::filesystem::path &root, const std::string &relative) {
+        return relative.empty() ? root : root / relative;
+    }
+
+    static std::string join_listing_path(const std::string &relative, const std::string &name) {
+        return relative.empty() ? name : relative + INVADER_PREFERRED_PATH_SEPARATOR + name;
+    }
+
+    static ContentHash listing_cache_key(const std::filesystem::path &root) {
+        std::error_code ec;
+        auto absolute = std::filesystem::absolute(root, ec);
+        return hash_string((ec ? root : absolute).string(), hash_value(LISTING_CACHE_VERSION));
+    }
+
+    static TagsDirectoryListing read_listing_cache(const ContentCache &cache, const ContentHash &key) {
+        TagsDirectoryListing listings;
+
+        auto data = cache.load(key);
+        if(!data.has_value()) {
+            return listings;
+        }
+
+        std::size_t offset = 0;
+        auto read = [&data, &offset](void *output, std::size_t size) {
+            if(size > data->size() - offset) {
+                throw std::out_of_range("listing cache entry is truncated");
+            }
+            std::memcpy(output, data->data() + offset, size);
+            offset += size;
+        };
+        auto read_u64 = [&read]() {
+            std::uint64_t value;
+            read(&value, sizeof(value));
+            return value;
+        };
+        auto read_string = [&read, &read_u64]() {
+            std::string string(read_u64(), '\0');
+            read(string.data(), string.size());
+            return string;
+        };
+        auto read_strings = [&read_u64, &read_string](std::vector<std::string> &strings) {
+            auto count = read_u64();
+            for(std::uint64_t i = 0; i < count; i++) {
+                strings.emplace_back(read_string());
+            }
+        };
+
+        // If it's bad, just list everything again
+        try {
+            auto count = read_u64();
+            for(std::uint64_t i = 0; i < count; i++) {
+                auto relative = read_string();
+                DirectoryListing listing;
+                listing.modified = static_cast<std::int64_t>(read_u64());
+                read_strings(listing.tag_files);
+                read_strings(listing.directories);
+                listings.emplace(std::move(relative), std::move(listing));
+            }
+        }
+        catch(std::exception &) {
+            listings.clear();
+        }
+
+        return listings;
+    }
+
+    static void write_listing_cache(const ContentCache &cache, const ContentHash &key, const TagsDirectoryListing &listings) {
+        std::vector<std::byte> data;
+        auto write = [&data](const void *input, std::size_t size) {
+            data.insert(data.end(), reinterpret_cast<const std::byte *>(input), reinterpret_cast<const std::byte *>(input) + size);
+        };
+        auto write_u64 = [&write](std::uint64_t value) {
+            write(&value, sizeof(value));
+        };
+        auto write_string = [&write, &write_u64](const std::string &string) {
+            write_u64(string.size());
+            write(string.data(), string.size());
+        };
+        auto write_strings = [&write_u64, &write_string](const std::vector<std::string> &strings) {
+            write_u64(strings.size());
+            for(auto &s : strings) {
+                write_string(s);
+            }
+        };
+
+        write_u64(listings.size());
+        for(auto &[relative, listing] : listings) {
+            write_string(relative);
+            write_u64(static_cast<std::uint64_t>(listing.modified));
+            write_strings(listing.tag_files);
+            write_strings(listing.directories);
+        }
+
+        // Failing to cache it is not fatal
+        cache.store(key, data);
+    }
+
+    std::vector<TagFile> load_virtual_tag_folder(const std::vector<std::filesystem::path> &tags, bool filter_duplicates, std::pair<std::mutex, std::size_t> *status, std::size_t *errors, const std::optional<std::filesystem::path> &listing_cache) {
         std::size_t new_errors = 0;
 
         std::pair<std::mutex, std::size_t> status_r;
@@ -301,138 +521,135 @@ namespace Invader::File {
         status->first.lock();
         status->second = 0;
         status->first.unlock();
-        
-        #define maybe_iterate_directories(file_path, ...) try { \
-            iterate_directories(__VA_ARGS__); \
-        } \
-        catch(std::exception &e) { \
-            eprintf_error("Error listing %s: %s", file_path.string().c_str(), e.what()); \
-            new_errors++; \
+
+        std::size_t dir_count = tags.size();
+        std::vector<std::filesystem::path> roots;
+        roots.reserve(dir_count);
+        for(auto &t : tags) {
+            roots.emplace_back(remove_trailing_slashes(t.string()));
+        }
+
+        // Load what we listed last time, if we're using the cache
+        std::optional<ContentCache> cache;
+        std::vector<ContentHash> cache_keys(dir_count);
+        std::vector<TagsDirectoryListing> cached_listings(dir_count);
+        std::vector<TagsDirectoryListing> new_listings(dir_count);
+        std::vector<bool> relisted(dir_count, false);
+        if(listing_cache.has_value()) {
+            cache.emplace(*listing_cache, ".listing");
+            for(std::size_t i = 0; i < dir_count; i++) {
+                cache_keys[i] = listing_cache_key(roots[i]);
+                cached_listings[i] = read_listing_cache(*cache, cache_keys[i]);
+            }
         }
-        
-        // win32 implementation because Windows I/O is AWFUL
-        #ifdef _WIN32
-        auto iterate_directories = [&all_tags, &status, &new_errors](const std::filesystem::path &dir, auto &iterate_directories, int depth, std::size_t priority, const std::vector<std::filesystem::path> &main_dir) -> void {
+
+        // Each directory is listed in its own task, which queues its subdirectories
+        std::vector<std::vector<TagFile>> found_tags(dir_count);
+        std::mutex found_mutex;
+        auto now = std::filesystem::file_time_type::clock::now();
+
+        ThreadPool pool(std::max(ThreadPool::default_thread_count(), MIN_LISTING_THREAD_COUNT));
+        std::function<void (std::size_t, const std::string &, int)> iterate_directory = [&](std::size_t priority, const std::string &relative, int depth) {
             if(++depth == 256) {
                 return;
             }
-            
-            WIN32_FIND_DATA find_data;
-            HANDLE file = FindFirstFileA((dir / "*").string().c_str(), &find_data);
-            bool found = file != nullptr;
-            
-            std::size_t tags_found = 0;
-            
-            while(found) {
-                if(std::strcmp(find_data.cFileName, ".") != 0 && std::strcmp(find_data.cFileName, "..") != 0) {
-                    auto file_path = dir / find_data.cFileName;
-                    if(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-                        maybe_iterate_directories(file_path, file_path, iterate_directories, depth, priority, main_dir);
+
+            auto dir = listing_path(roots[priority], relative);
+            DirectoryListing listing;
+            bool listed = false;
+
+            try {
+                // Reuse the cached listing if the directory hasn't been modified since
+                if(cache.has_value()) {
+                    std::error_code ec;
+                    auto modified = std::filesystem::last_write_time(dir, ec);
+                    if(!ec && now - modified >= LISTING_CACHE_SETTLE_TIME) {
+                        listing.modified = modified.time_since_epoch().count();
                     }
-                    else {
-                        auto extension = file_path.extension().string();
-                        auto tag_fourcc = HEK::tag_extension_to_fourcc(extension.c_str() + 1);
-
-                        // First, make sure it's valid
-                        if(tag_fourcc == HEK::TagFourCC::TAG_FOURCC_NULL || tag_fourcc == HEK::TagFourCC::TAG_FOURCC_NONE) {
-                            goto spaghetti_next_tag;
-                        }
-
-                        // Next, add it
-                        TagFile file;
-                        file.full_path = file_path;
-                        file.tag_fourcc = tag_fourcc;
-                        file.tag_directory = priority;
-                        file.tag_path = Invader::File::file_path_to_tag_path(file_path.string(), main_dir).value();
-                        all_tags.emplace_back(std::move(file));
-                        
-                        tags_found++;
+
+                    auto cached = cached_listings[priority].find(relative);
+                    if(listing.modified != 0 && cached != cached_listings[priority].end() && cached->second.modified == listing.modified) {
+                        listing = cached->second;
+                        listed = true;
                     }
                 }
-                
-                spaghetti_next_tag:
-                found = FindNextFileA(file, &find_data);
-            }
-            
-            // Update the find count
-            if(tags_found) {
-                status->first.lock();
-                status->second += tags_found;
-                status->first.unlock();
+
+                if(!listed) {
+                    list_directory(dir, listing);
+                }
             }
-        };
-        #else
-        auto iterate_directories = [&all_tags, &status, &new_errors](const std::filesystem::path &dir, auto &iterate_directories, int depth, std::size_t priority, const std::vector<std::filesystem::path> &main_dir) -> void {
-            if(++depth == 256) {
+            catch(std::exception &e) {
+                std::scoped_lock lock(found_mutex);
+                eprintf_error("Error listing %s: %s", dir.string().c_str(), e.what());
+                new_errors++;
                 return;
             }
-            
-            std::size_t tags_found = 0;
 
-            for(auto &d : std::filesystem::directory_iterator(dir)) {
-                auto file_path = d.path();
-                
-                if(d.is_directory()) {
-                    maybe_iterate_directories(file_path, d, iterate_directories, depth, priority, main_dir);
-                }
-                else if(file_path.has_extension() && std::filesystem::is_regular_file(file_path)) {
-                    auto extension = file_path.extension().string();
-                    auto tag_fourcc = HEK::tag_extension_to_fourcc(extension.c_str() + 1);
+            for(auto &d : listing.directories) {
+                pool.submit([&iterate_directory, priority, directory = join_listing_path(relative, d), depth]() {
+                    iterate_directory(priority, directory, depth);
+                });
+            }
 
-                    // First, make sure it's valid
-                    if(tag_fourcc == HEK::TagFourCC::TAG_FOURCC_NULL || tag_fourcc == HEK::TagFourCC::TAG_FOURCC_NONE) {
-                        continue;
-                    }
+            std::vector<TagFile> tag_files;
+            tag_files.reserve(listing.tag_files.size());
+            for(auto &f : listing.tag_files) {
+                auto &file = tag_files.emplace_back();
+                file.full_path = dir / f;
+                file.tag_path = join_listing_path(relative, f);
+                file.tag_directory = priority;
+                file.tag_fourcc = HEK::tag_extension_to_fourcc(std::strrchr(f.c_str(), '.') + 1);
+            }
 
-                    // Next, add it
-                    TagFile file;
-                    file.full_path = file_path;
-                    file.tag_fourcc = tag_fourcc;
-                    file.tag_directory = priority;
-                    file.tag_path = Invader::File::file_path_to_tag_path(file_path.string(), main_dir).value();
-                    all_tags.emplace_back(std::move(file));
-                    tags_found++;
+            {
+                std::scoped_lock lock(found_mutex);
+                auto &found = found_tags[priority];
+                found.insert(found.end(), std::make_move_iterator(tag_files.begin()), std::make_move_iterator(tag_files.end()));
+                if(cache.has_value()) {
+                    relisted[priority] = relisted[priority] || !listed;
+                    new_listings[priority].emplace(relative, std::move(listing));
                 }
             }
-            
+
             // Update the find count
-            if(tags_found) {
+            if(!tag_files.empty()) {
                 status->first.lock();
-                status->second += tags_found;
+                status->second += tag_files.size();
                 status->first.unlock();
             }
         };
-        #endif
 
         // Go through each directory
-        std::size_t dir_count = tags.size();
         for(std::size_t i = 0; i < dir_count; i++) {
-            auto d = std::filesystem::path(remove_trailing_slashes(tags[i].string()));
-            maybe_iterate_directories(d, d, iterate_directories, 0, i, std::vector<std::filesystem::path>(&d, &d + 1));
+            pool.submit([&iterate_directory, i]() {
+                iterate_directory(i, std::string(), 0);
+            });
         }
-        
-        // Remove duplicates
-        if(filter_duplicates) {
-            for(std::size_t i = 0; i < all_tags.size(); i++) {
-                for(std::size_t j = 0; j < i; j++) {
-                    auto &tagi = all_tags[i];
-                    auto &tagj = all_tags[j];
-                    
-                    if(tagi.tag_fourcc == tagj.tag_fourcc && tagi.tag_path == tagj.tag_path) {
-                        if(tagi.tag_directory > tagj.tag_directory) {
-                            all_tags.erase(all_tags.begin() + i);
-                        }
-                        else {
-                            all_tags.erase(all_tags.begin() + j);
-                        }
-                        
-                        i--;
-                        break;
-                    }
+        pool.wait();
+
+        // Save the listings for next time if anything changed
+        if(cache.has_value()) {
+            for(std::size_t i = 0; i < dir_count; i++) {
+                if(relisted[i] || new_listings[i].size() != cached_listings[i].size()) {
+                    write_listing_cache(*cache, cache_keys[i], new_listings[i]);
                 }
             }
         }
-        
+
+        // Put everything together in order of precedence (sorting since the order things get listed in isn't consistent),
+        // removing duplicates if needed
+        std::vector<TagFile> all_tags;
+        std::unordered_set<std::string> tag_paths_found;
+        for(auto &found : found_tags) {
+            std::sort(found.begin(), found.end(), [](const TagFile &a, const TagFile &b) { return a.tag_path < b.tag_path; });
+            for(auto &tag : found) {
+                if(filter_duplicates && !tag_paths_found.insert(tag.tag_path).second) {
+                    continue;
+                }
+                all_tags.emplace_back(std::move(tag));
+            }
+        }
+
         // Change error count if errors was specified
         if(errors) {
             *errors = new_errors;
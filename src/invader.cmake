@@ -16,6 +16,8 @@ set(INVADER_PARSER_FILES
     "${CMAKE_CURRENT_BINARY_DIR}/parser-normalize.cpp"
     "${CMAKE_CURRENT_BINARY_DIR}/parser-read-hek-file.cpp"
     "${CMAKE_CURRENT_BINARY_DIR}/parser-scan-padding.cpp"
+    "${CMAKE_CURRENT_SOURCE_DIR}/include/invader/tag/parser/view.hpp"
+    "${CMAKE_CURRENT_BINARY_DIR}/parser-view.cpp"
     "${CMAKE_CURRENT_BINARY_DIR}/bitfield.cpp"
     "${CMAKE_CURRENT_BINARY_DIR}/enum.cpp"
 )
@@ -42,9 +44,11 @@ set(INVADER_SOURCE_FILES
     "${CMAKE_CURRENT_BINARY_DIR}/parser-normalize.cpp"
     "${CMAKE_CURRENT_BINARY_DIR}/parser-read-hek-file.cpp"
     "${CMAKE_CURRENT_BINARY_DIR}/parser-scan-padding.cpp"
+    "${CMAKE_CURRENT_BINARY_DIR}/parser-view.cpp"
     "${CMAKE_CURRENT_BINARY_DIR}/bitfield.cpp"
     "${CMAKE_CURRENT_BINARY_DIR}/enum.cpp"
 
+    src/sound/sound_decoder.cpp
     src/sound/sound_encoder_flac.cpp
     src/sound/sound_encoder_ogg_vorbis.cpp
     src/sound/sound_encoder_wav.cpp
@@ -63,9 +67,12 @@ set(INVADER_SOURCE_FILES
     src/hek/map.cpp
     src/resource/resource_map.cpp
     src/dependency/found_tag_dependency.cpp
+    src/dependency/dependency_index.cpp
     src/map/map.cpp
     src/map/tag.cpp
     src/file/file.cpp
+    src/file/content_cache.cpp
+    src/thread/thread_pool.cpp
     src/build/build_workload.cpp
     src/build/build_workload_dedupe.cpp
     src/bitmap/bcdec/bcdec.c
@@ -82,8 +89,10 @@ set(INVADER_SOURCE_FILES
     src/tag/hek/class/model_collision_geometry/intersection_check.cpp
     src/tag/hek/class/model_collision_geometry/model_collision_geometry.cpp
     src/extract/extraction.cpp
+    src/tag/parser/allocator.cpp
     src/tag/parser/parser_struct.cpp
     src/tag/parser/post_cache_deformat.cpp
+    src/tag/parser/view_struct.cpp
     src/tag/parser/compile/actor.cpp
     src/tag/parser/compile/antenna.cpp
     src/tag/parser/compile/bitmap/compile.cpp
@@ -122,6 +131,7 @@ set(INVADER_SOURCE_FILES
     src/crc/crc32.c
     src/crc/crc_spoof.c
     src/crc/hek/crc.cpp
+    src/crc/hash.cpp
 
     src/version.cpp
 )
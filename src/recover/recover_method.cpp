@@ -7,6 +7,8 @@
 #include <invader/tag/parser/parser.hpp>
 #include <invader/model/jms.hpp>
 #include <invader/tag/parser/compile/string_list.hpp>
+#include <invader/sound/sound_decoder.hpp>
+#include <invader/sound/sound_encoder.hpp>
 #include "recover_method.hpp"
 #include "../string/button_type.hpp"
 
@@ -675,6 +677,87 @@ namespace Invader::Recover {
         }
     }
 
+    static std::optional<bool> recover_sound(const Parser::ParserStruct &tag, const std::string &path, const std::filesystem::path &data, bool overwrite) {
+        auto *sound = dynamic_cast<const Parser::Sound *>(&tag);
+        if(!sound) {
+            return std::nullopt;
+        }
+
+        auto sound_path = data / path;
+        if(std::filesystem::exists(sound_path) && !overwrite) {
+            oprintf_success_warn("%s already exists", sound_path.string().c_str());
+            return false;
+        }
+
+        std::size_t sample_rate = sound->sample_rate == HEK::SoundSampleRate::SOUND_SAMPLE_RATE_44100_HZ ? 44100 : 22050;
+        std::size_t channel_count = sound->channel_count == HEK::SoundChannelCount::SOUND_CHANNEL_COUNT_STEREO ? 2 : 1;
+
+        // Start decoding everything, then write each one out as it's done
+        struct RecoveredPermutation {
+            std::filesystem::path path;
+            std::shared_ptr<const SoundDecoder::DecodedSound> pcm;
+        };
+        std::vector<RecoveredPermutation> permutations;
+        SoundDecoder::Decoder decoder(0);
+
+        for(auto &pitch_range : sound->pitch_ranges) {
+            // A single pitch range is just a directory of permutations
+            auto pitch_range_path = sound->pitch_ranges.size() == 1 ? sound_path : sound_path / pitch_range.name.string;
+
+            auto &all_permutations = pitch_range.permutations;
+            std::size_t actual_permutation_count = pitch_range.actual_permutation_count == 0 ? all_permutations.size() : pitch_range.actual_permutation_count;
+            if(actual_permutation_count > all_permutations.size()) {
+                eprintf_error("Pitch range %s has more actual permutations than permutations - tag is corrupt", pitch_range.name.string);
+                return false;
+            }
+
+            for(std::size_t a = 0; a < actual_permutation_count; a++) {
+                // Follow the chain of split permutations
+                std::vector<SoundDecoder::EncodedPart> parts;
+                for(std::size_t p = a; p < all_permutations.size(); p = all_permutations[p].next_permutation_index) {
+                    if(parts.size() == all_permutations.size()) {
+                        eprintf_error("Permutation %s loops forever - tag is corrupt", all_permutations[a].name.string);
+                        return false;
+                    }
+                    auto &permutation = all_permutations[p];
+                    parts.emplace_back(SoundDecoder::EncodedPart { permutation.format, permutation.samples.data(), permutation.samples.size() });
+                }
+
+                permutations.emplace_back(RecoveredPermutation { pitch_range_path / (std::string(all_permutations[a].name.string) + ".wav"), decoder.decode(parts, channel_count, sample_rate) });
+            }
+        }
+
+        for(std::size_t i = 0; i < permutations.size(); i++) {
+            auto &permutation = permutations[i];
+            if(ON_COLOR_TERM(stdout)) {
+                oprintf("\r    %zu / %zu", i, permutations.size());
+                oflush();
+            }
+
+            const std::vector<std::byte> *pcm;
+            try {
+                pcm = &permutation.pcm->wait();
+            }
+            catch(std::exception &) {
+                if(ON_COLOR_TERM(stdout)) {
+                    oprintf("\r\x1B[K");
+                }
+                eprintf_error("Failed to decode %s: %s", permutation.path.filename().string().c_str(), permutation.pcm->get_error().value_or("unknown error").c_str());
+                return false;
+            }
+
+            if(!create_directories_save_and_quit(permutation.path, SoundEncoder::convert_to_pcm_wav(*pcm, 16, channel_count, sample_rate))) {
+                return false;
+            }
+        }
+        if(ON_COLOR_TERM(stdout)) {
+            oprintf("\r\x1B[K");
+        }
+
+        oprintf("Recovered %zu permutation%s to %s\n", permutations.size(), permutations.size() == 1 ? "" : "s", sound_path.string().c_str());
+        return true;
+    }
+
     bool recover(const Parser::ParserStruct &tag, const std::string &path, const std::filesystem::path &data, HEK::TagFourCC tag_fourcc, bool overwrite) {
         #define ATTEMPT_RECOVER(fn) if(!a.has_value()) { a = fn(tag, path, data, overwrite); }
         std::optional<bool> a;
@@ -684,6 +767,7 @@ namespace Invader::Recover {
         ATTEMPT_RECOVER(recover_string_list)
         ATTEMPT_RECOVER(recover_scripts)
         ATTEMPT_RECOVER(recover_hud_message_text)
+        ATTEMPT_RECOVER(recover_sound)
         if(!a.has_value()) {
             eprintf_warn("Data cannot be recovered from %s tags", HEK::tag_fourcc_to_extension(tag_fourcc));
             a = false;
@@ -1,55 +1,79 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <algorithm>
 #include <vector>
+#include <set>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <filesystem>
+#include <memory_resource>
+#include <stdexcept>
 #include <invader/printf.hpp>
 #include <invader/version.hpp>
 #include <invader/tag/hek/header.hpp>
 #include <invader/tag/hek/definition.hpp>
 #include "../command_line_option.hpp"
 #include <invader/tag/parser/parser.hpp>
+#include <invader/tag/parser/view.hpp>
 #include <invader/file/file.hpp>
+#include <invader/dependency/dependency_index.hpp>
+#include <invader/thread/thread_pool.hpp>
 
 using namespace Invader;
 using namespace Invader::File;
 
-std::size_t refactor_tags(const std::filesystem::path &file_path, const std::vector<std::pair<TagFilePath, TagFilePath>> &replacements, bool check_only, bool dry_run) {
-    // Open the tag
-    auto tag = open_file(file_path);
-    if(!tag.has_value()) {
-        eprintf_error("Failed to open %s", file_path.string().c_str());
-        std::exit(EXIT_FAILURE);
+// Paths of the tags being replaced and their classes, looked up without copying the paths read out of each tag
+using ReplacedPaths = std::unordered_map<std::string_view, std::vector<HEK::TagFourCC>>;
+
+static ReplacedPaths get_replaced_paths(const std::vector<std::pair<TagFilePath, TagFilePath>> &replacements) {
+    ReplacedPaths replaced_paths;
+    for(auto &r : replacements) {
+        replaced_paths[r.first.path].emplace_back(r.first.fourcc);
     }
+    return replaced_paths;
+}
 
-    // Get the header
-    std::vector<std::byte> file_data;
+// Count the references to replaced tags in a tag by reading just its dependencies rather than parsing the whole tag
+static std::size_t count_replaced_references(const std::vector<std::byte> &tag, const ReplacedPaths &replaced_paths) {
     std::size_t count = 0;
+    HEK::TagFileHeader::validate_header(reinterpret_cast<const HEK::TagFileHeader *>(tag.data()), tag.size());
+    Parser::View::for_each_dependency_in_tag_file(tag.data(), tag.size(), [&replaced_paths, &count](const Parser::View::Dependency &dependency) {
+        std::string_view path = dependency.path;
+        std::string deduplicated_path;
+        if(path.find("\\\\") != std::string_view::npos) {
+            deduplicated_path = remove_duplicate_slashes(std::string(path));
+            path = deduplicated_path;
+        }
+        auto replaced = replaced_paths.find(path);
+        if(replaced != replaced_paths.end() && std::find(replaced->second.begin(), replaced->second.end(), dependency.tag_fourcc) != replaced->second.end()) {
+            count++;
+        }
+    });
+    return count;
+}
 
-    try {
-        const auto *header = reinterpret_cast<const HEK::TagFileHeader *>(tag->data());
-        HEK::TagFileHeader::validate_header(header, tag->size());
+// Parse a tag, replace its references, and write it back, returning the number of references replaced
+static std::size_t refactor_tag(const std::filesystem::path &file_path, const std::vector<std::pair<TagFilePath, TagFilePath>> &replacements) {
+    auto tag = open_file(file_path);
+    if(!tag.has_value()) {
+        throw std::runtime_error("failed to open the tag");
+    }
 
-        auto tag_data = Parser::ParserStruct::parse_hek_tag_file(tag->data(), tag->size());
+    std::vector<std::byte> file_data;
+    std::size_t count;
+    {
+        std::pmr::monotonic_buffer_resource tag_arena;
+        auto tag_data = Parser::ParserStruct::parse_hek_tag_file(tag->data(), tag->size(), false, &tag_arena);
         count = tag_data->refactor_references(replacements);
-        if(count) {
-            file_data = tag_data->generate_hek_tag_data(header->tag_fourcc);
-        }
-        else {
+        if(count == 0) {
             return count;
         }
-    }
-    catch(std::exception &e) {
-        eprintf_error("Error: Failed to refactor in %s", file_path.string().c_str());
-        std::exit(EXIT_FAILURE);
+        file_data = tag_data->generate_hek_tag_data(reinterpret_cast<const HEK::TagFileHeader *>(tag->data())->tag_fourcc);
     }
 
-    if(!check_only) {
-        if(!dry_run && !save_file(file_path, file_data)) {
-            eprintf_error("Error: Failed to write to %s. This tag will need to be manually edited.", file_path.string().c_str());
-            return 0;
-        }
-        oprintf_success("Replaced %zu reference%s in %s", count, count == 1 ? "" : "s", file_path.string().c_str());
+    if(!save_file_atomically(file_path, file_data)) {
+        throw std::runtime_error("failed to write the tag; it will need to be manually edited");
     }
 
     return count;
@@ -76,7 +100,9 @@ int main(int argc, char * const *argv) {
         CommandLineOption("tag", 'T', 2, "Refactor an individual tag. This can be specified multiple times but cannot be used with --recursive.", "<f> <t>"),
         CommandLineOption("groups", 'g', 2, "Refactor all tags of a given group to another group. All tags in the destination group must exist. This can be specified multiple times but cannot be used with --recursive or -M move.", "<f> <t>"),
         CommandLineOption("single-tag", 's', 1, "Make changes to a single tag, only, rather than the whole tags directory.", "<path>"),
-        CommandLineOption("replace-string", 'R', 2, "Replaces all instances in a path of <a> with <b>. This can be used multiple times for multiple replacements. If --groups or --recursive are used, this applies to the output of those. Otherwise, it applies to all tags.", "<a> <b>")
+        CommandLineOption("replace-string", 'R', 2, "Replaces all instances in a path of <a> with <b>. This can be used multiple times for multiple replacements. If --groups or --recursive are used, this applies to the output of those. Otherwise, it applies to all tags.", "<a> <b>"),
+        CommandLineOption("index", 'I', 1, "Use a dependency index file to find the tags that reference the refactored tags instead of reading every tag, creating it if it doesn't exist and updating only the tags that changed since it was last used.", "<file>"),
+        CommandLineOption("threads", 'j', 1, "Set the number of threads to use for reading and rewriting tags. Default: CPU thread count", "<count>")
     };
 
     static constexpr char DESCRIPTION[] = "Find and replace tag references.";
@@ -88,6 +114,8 @@ int main(int argc, char * const *argv) {
         std::optional<RefactorMode> mode;
         const char *single_tag = nullptr;
         bool unsafe = false;
+        std::optional<std::filesystem::path> index;
+        std::size_t thread_count = 0;
 
         std::vector<std::pair<std::string, std::string>> string_replacements;
         std::vector<std::pair<TagFilePath, TagFilePath>> replacements;
@@ -156,6 +184,21 @@ int main(int argc, char * const *argv) {
             case 'R':
                 refactor_options.string_replacements.emplace_back(File::preferred_path_to_halo_path(arguments[0]), File::preferred_path_to_halo_path(arguments[1]));
                 return;
+            case 'I':
+                refactor_options.index = arguments[0];
+                return;
+            case 'j':
+                try {
+                    refactor_options.thread_count = std::stoul(arguments[0]);
+                    if(refactor_options.thread_count < 1) {
+                        throw std::exception();
+                    }
+                }
+                catch(std::exception &) {
+                    eprintf_error("Error: Invalid number of threads %s", arguments[0]);
+                    std::exit(EXIT_FAILURE);
+                }
+                return;
         }
     });
 
@@ -476,10 +519,41 @@ int main(int argc, char * const *argv) {
         all_tags = load_virtual_tag_folder(refactor_options.tags);
     }
 
+    // If we have an index, we only need to look at tags it says reference something we're replacing
+    std::optional<DependencyIndex> dependency_index;
+    std::set<TagFilePath> replaced_tags;
+    if(refactor_options.index.has_value()) {
+        dependency_index = DependencyIndex::load(*refactor_options.index, refactor_options.tags, refactor_options.thread_count);
+        if(dependency_index->is_modified() && !dependency_index->save(*refactor_options.index)) {
+            eprintf_warn("Failed to save the dependency index to %s", refactor_options.index->string().c_str());
+        }
+        for(auto &i : replacements) {
+            replaced_tags.insert(i.first);
+        }
+    }
+
+    auto may_reference_replaced_tags = [&dependency_index, &replaced_tags](const TagFile &tag) -> bool {
+        if(!dependency_index.has_value()) {
+            return true;
+        }
+
+        // If it isn't indexed or couldn't be read, let refactor_tags() deal with it
+        auto path = File::split_tag_class_extension(File::preferred_path_to_halo_path(tag.tag_path));
+        auto *entry = path.has_value() ? dependency_index->get_tag(*path) : nullptr;
+        if(entry == nullptr || !entry->valid) {
+            return true;
+        }
+
+        for(auto &d : entry->dependencies) {
+            if(replaced_tags.contains(d)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
     // Go through all the tags and see what needs edited
-    std::size_t total_tags = 0;
-    std::size_t total_replaced = 0;
-    std::vector<TagFile *> tags_to_do;
+    std::vector<TagFile *> tags_to_scan;
 
     for(auto &tag : *tag_to_modify) {
         bool skip = false;
@@ -519,15 +593,76 @@ int main(int argc, char * const *argv) {
                 break;
         }
         
-        if(!skip && refactor_tags(tag.full_path.string().c_str(), replacements, true, refactor_options.dry_run)) {
-            tags_to_do.emplace_back(&tag);
+        if(!skip && may_reference_replaced_tags(tag)) {
+            tags_to_scan.emplace_back(&tag);
+        }
+    }
+
+    // First, find the tags that actually reference something we're replacing. This only reads their dependencies, so
+    // nothing is written if any of them can't be read.
+    auto replaced_paths = get_replaced_paths(replacements);
+    std::vector<std::size_t> reference_counts(tags_to_scan.size());
+    std::vector<std::string> errors(tags_to_scan.size());
+    ThreadPool pool(refactor_options.thread_count);
+
+    for(std::size_t t = 0; t < tags_to_scan.size(); t++) {
+        pool.submit([&tags_to_scan, &replaced_paths, &reference_counts, &errors, t]() {
+            auto tag = open_file(tags_to_scan[t]->full_path);
+            if(!tag.has_value()) {
+                errors[t] = "failed to open the tag";
+                return;
+            }
+            try {
+                reference_counts[t] = count_replaced_references(*tag, replaced_paths);
+            }
+            catch(std::exception &e) {
+                errors[t] = e.what();
+            }
+        });
+    }
+    pool.wait();
+
+    bool failed = false;
+    std::vector<std::size_t> tags_to_do;
+    for(std::size_t t = 0; t < tags_to_scan.size(); t++) {
+        if(!errors[t].empty()) {
+            eprintf_error("Error: Failed to refactor in %s: %s", tags_to_scan[t]->full_path.string().c_str(), errors[t].c_str());
+            failed = true;
         }
+        else if(reference_counts[t]) {
+            tags_to_do.emplace_back(t);
+        }
+    }
+    if(failed) {
+        return EXIT_FAILURE;
+    }
+
+    // Now actually do it (unless this is a dry run, in which case we already know what would be replaced)
+    if(!refactor_options.dry_run) {
+        for(auto t : tags_to_do) {
+            pool.submit([&tags_to_scan, &replacements, &reference_counts, &errors, t]() {
+                try {
+                    reference_counts[t] = refactor_tag(tags_to_scan[t]->full_path, replacements);
+                }
+                catch(std::exception &e) {
+                    errors[t] = e.what();
+                }
+            });
+        }
+        pool.wait();
     }
 
-    // Now actually do it
-    for(auto *tag : tags_to_do) {
-        std::size_t count = refactor_tags(tag->full_path.string().c_str(), replacements, false, refactor_options.dry_run);
-        if(count) {
+    std::size_t total_tags = 0;
+    std::size_t total_replaced = 0;
+    for(auto t : tags_to_do) {
+        auto count = reference_counts[t];
+        auto file_path = tags_to_scan[t]->full_path.string();
+        if(!errors[t].empty()) {
+            eprintf_error("Error: Failed to refactor in %s: %s", file_path.c_str(), errors[t].c_str());
+            failed = true;
+        }
+        else if(count) {
+            oprintf_success("Replaced %zu reference%s in %s", count, count == 1 ? "" : "s", file_path.c_str());
             total_replaced += count;
             total_tags++;
         }
@@ -539,6 +674,11 @@ int main(int argc, char * const *argv) {
         oprintf("Dry run complete\n");
     }
 
+    // Don't move anything if some references couldn't be replaced, since they would then be broken
+    if(failed) {
+        return EXIT_FAILURE;
+    }
+
     // Move things if needed
     perform_move();
 }
@@ -4,14 +4,20 @@
 #include "../command_line_option.hpp"
 #include <invader/printf.hpp>
 #include <invader/file/file.hpp>
+#include <invader/file/content_cache.hpp>
 #include <invader/tag/parser/parser.hpp>
 #include <invader/sound/sound_encoder.hpp>
 #include <invader/sound/sound_reader.hpp>
 #include <invader/version.hpp>
 #include <vorbis/vorbisenc.h>
-#include <samplerate.h>
+#include <algorithm>
 #include <atomic>
-#include <thread>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <iterator>
+#include <map>
+#include <invader/thread/thread_pool.hpp>
 
 using namespace Invader;
 using namespace Invader::HEK;
@@ -27,24 +33,118 @@ struct SoundOptions {
     std::optional<SoundClass> sound_class;
     std::optional<std::uint32_t> sample_rate;
     std::optional<std::uint16_t> bitrate;
-    std::size_t max_threads = std::thread::hardware_concurrency() < 1 ? 1 : std::thread::hardware_concurrency();
+    std::size_t max_threads = ThreadPool::default_thread_count();
+    bool adpcm_high_quality = false;
+    std::vector<std::string> search;
+    std::vector<std::string> search_exclude;
+    bool batch = false;
+    std::optional<std::filesystem::path> cache;
+    std::uintmax_t cache_size = 2048;
 };
 
-static void populate_pitch_range(std::vector<SoundReader::Sound> &permutations, const std::filesystem::path &directory, std::uint32_t &highest_sample_rate, std::uint16_t &highest_channel_count);
-static void process_permutation_thread(SoundReader::Sound *permutation, std::uint16_t highest_sample_rate, SoundFormat format, std::uint16_t highest_channel_count, std::atomic<std::size_t> *thread_count, bool fit_adpcm_block_size);
+static bool populate_pitch_range(std::vector<SoundReader::Sound> &permutations, const std::filesystem::path &directory, std::uint32_t &highest_sample_rate, std::uint16_t &highest_channel_count);
+static void process_permutation(SoundReader::Sound *permutation, std::uint16_t highest_sample_rate, SoundFormat format, std::uint16_t highest_channel_count, bool fit_adpcm_block_size);
 
-template<typename T> static std::vector<std::byte> make_sound_tag(const std::filesystem::path &tag_path, const std::filesystem::path &data_path, SoundOptions &sound_options) {
-    static constexpr std::size_t XBOX_ADPCM_SPLIT_SIZE = 65520;
-    static constexpr std::size_t SPLIT_BUFFER_SIZE = 0x38E00;
-    static constexpr std::size_t MAX_PERMUTATIONS = UINT16_MAX - 1;
+// Wait for everything in a phase to finish (showing progress if we're on a terminal), then say how long it took
+static void finish_phase(ThreadPool &pool, const char *verb, const char *noun, std::size_t count, std::size_t bytes, std::chrono::steady_clock::time_point start) {
+    pool.wait([](std::size_t finished, std::size_t submitted) {
+        if(ON_COLOR_TERM(stdout)) {
+            oprintf("\r    %zu / %zu", finished, submitted);
+            oflush();
+        }
+    });
+    if(ON_COLOR_TERM(stdout)) {
+        oprintf("\r\x1B[K");
+    }
+
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    oprintf("%s %zu %s%s in %.03f seconds (%.03f MiB/s)\n", verb, count, noun, count == 1 ? "" : "s", seconds, seconds > 0.0 ? bytes / 1024.0 / 1024.0 / seconds : 0.0);
+    oflush();
+}
+
+// Encoded permutations are put into the tag once everything is done, so the encoders don't touch the tag while we're adding permutations to it
+struct EncodedPermutation {
+    std::vector<std::byte> samples;
+    std::size_t buffer_size = 0;
+    std::vector<std::byte> mouth_data;
+};
+
+struct PendingPermutation {
+    std::size_t pitch_range;
+    std::size_t permutation;
+    std::future<EncodedPermutation> encoded;
+};
+
+// A permutation (or part of a split permutation) that is ready to be encoded
+struct EncodeTask {
+    std::size_t job;
+    std::size_t pitch_range;
+    std::size_t permutation;
+    const SoundReader::Sound *source;
+    std::vector<std::byte> pcm;
+};
+
+// Everything needed to make one sound tag. Each step is done for every sound tag before moving onto the next one, so a
+// batch of sound tags can share one pool and keep it busy.
+template<typename T> struct SoundJob {
+    std::string halo_tag_path;
+    std::filesystem::path tag_path;
+    std::filesystem::path data_path;
+    SoundOptions sound_options;
+
+    // Size of the input files (only used for reporting)
+    std::uintmax_t input_size = 0;
+
+    // Prepended to the output line; in batch mode, this is the tag path since a lot of tags are being made at once
+    std::string output_prefix;
+
+    // List each permutation as it's encoded
+    bool verbose = true;
 
-    // Parse the sound tag
     T sound_tag = {};
+    bool split = false;
+    bool is_dialogue = false;
+    std::uint16_t highest_channel_count = 0;
+    std::uint32_t highest_sample_rate = 0;
+    std::vector<std::pair<std::vector<SoundReader::Sound>, std::string>> pitch_ranges;
+    std::vector<std::size_t> pitch_range_index;
+    std::vector<PendingPermutation> pending_permutations;
+
+    std::vector<std::byte> sound_tag_data;
+    bool failed = false;
+};
+
+static const char *format_output_name(SoundFormat format) {
+    switch(format) {
+        case SoundFormat::SOUND_FORMAT_16_BIT_PCM:
+            return "16-bit PCM";
+        case SoundFormat::SOUND_FORMAT_IMA_ADPCM:
+            return "IMA ADPCM";
+        case SoundFormat::SOUND_FORMAT_XBOX_ADPCM:
+            return "Xbox ADPCM";
+        case SoundFormat::SOUND_FORMAT_OGG_VORBIS:
+            return "Ogg Vorbis";
+        //case SoundFormat::SOUND_FORMAT_FLAC:
+        //    return "Free Lossless Audio Codec";
+        case SoundFormat::SOUND_FORMAT_ENUM_COUNT:
+            break;
+    }
+    eprintf_error("Invalid format output name. What?");
+    std::terminate();
+}
 
+// Load the tag and the data, and figure out the sample rate and channel count to use
+template<typename T> static bool load_sound(SoundJob<T> &job) {
+    auto &sound_tag = job.sound_tag;
+    auto &sound_options = job.sound_options;
+    auto &tag_path = job.tag_path;
+    auto &data_path = job.data_path;
+
+    // Parse the sound tag
     if(std::filesystem::exists(tag_path)) {
         if(std::filesystem::is_directory(tag_path)) {
             eprintf_error("A directory exists at %s where a file was expected", tag_path.string().c_str());
-            std::exit(EXIT_FAILURE);
+            return false;
         }
         auto sound_file = File::open_file(tag_path);
         if(sound_file.has_value()) {
@@ -54,7 +154,7 @@ template<typename T> static std::vector<std::byte> make_sound_tag(const std::fil
             }
             catch(std::exception &e) {
                 eprintf_error("An error occurred while attempting to read %s", tag_path.string().c_str());
-                std::exit(EXIT_FAILURE);
+                return false;
             }
         }
         if(sound_options.sound_class.has_value()) {
@@ -67,38 +167,30 @@ template<typename T> static std::vector<std::byte> make_sound_tag(const std::fil
     else {
         if(!sound_options.sound_class.has_value()) {
             eprintf_error("A sound class is required when generating new sound tags");
-            std::exit(EXIT_FAILURE);
+            return false;
         }
         sound_tag.sound_class = *sound_options.sound_class;
     }
 
-    // Hold onto this
-    auto sound_class = sound_tag.sound_class;
-
     // If a format is defined, use it
     if(sound_options.format.has_value()) {
         sound_tag.format = *sound_options.format;
     }
-    else {
-        sound_options.format = SoundFormat::SOUND_FORMAT_16_BIT_PCM;
-    }
 
     // Make sure we support the format
-    switch(*sound_options.format) {
+    switch(sound_tag.format) {
         case SoundFormat::SOUND_FORMAT_16_BIT_PCM:
         case SoundFormat::SOUND_FORMAT_XBOX_ADPCM:
         case SoundFormat::SOUND_FORMAT_OGG_VORBIS:
             break;
         case SoundFormat::SOUND_FORMAT_IMA_ADPCM:
             eprintf_error("IMA ADPCM is unsupported");
-            std::exit(EXIT_FAILURE);
+            return false;
         default:
             eprintf_error("Unsupported audio codec");
-            std::exit(EXIT_FAILURE);
+            return false;
     }
 
-    auto &format = sound_tag.format;
-
     // Set a default level
     if(!sound_options.compression_level.has_value()) {
         sound_options.compression_level = 0.8F;
@@ -107,7 +199,7 @@ template<typename T> static std::vector<std::byte> make_sound_tag(const std::fil
     // Error if bullshit compression levels were given
     if(sound_options.compression_level > 1.0F || sound_options.compression_level < 0.0F) {
         eprintf_error("Compression level (%.05f) is outside of the allowed range of 0.0 to 1.0", *sound_options.compression_level);
-        std::exit(EXIT_FAILURE);
+        return false;
     }
 
     // Clear the old one
@@ -126,7 +218,24 @@ template<typename T> static std::vector<std::byte> make_sound_tag(const std::fil
             sound_tag.flags &= ~HEK::SoundFlagsFlag::SOUND_FLAGS_FLAG_SPLIT_LONG_SOUND_INTO_PERMUTATIONS;
         }
     }
-    bool split = sound_tag.flags & HEK::SoundFlagsFlag::SOUND_FLAGS_FLAG_SPLIT_LONG_SOUND_INTO_PERMUTATIONS;
+    job.split = sound_tag.flags & HEK::SoundFlagsFlag::SOUND_FLAGS_FLAG_SPLIT_LONG_SOUND_INTO_PERMUTATIONS;
+
+    // Check if this is dialogue
+    switch(sound_tag.sound_class) {
+        case SoundClass::SOUND_CLASS_UNIT_DIALOG:
+        case SoundClass::SOUND_CLASS_SCRIPTED_DIALOG_PLAYER:
+        case SoundClass::SOUND_CLASS_SCRIPTED_DIALOG_OTHER:
+        case SoundClass::SOUND_CLASS_SCRIPTED_DIALOG_FORCE_UNSPATIALIZED:
+            job.is_dialogue = true;
+            break;
+        default:
+            job.is_dialogue = false;
+    }
+
+    if(job.is_dialogue && job.split) {
+        eprintf_error("Split dialogue is unsupported.");
+        return false;
+    }
 
     // Check to see if we have either just directories (so multiple pitch ranges) or just files (one pitch range)
     bool contains_files = false;
@@ -143,24 +252,23 @@ template<typename T> static std::vector<std::byte> make_sound_tag(const std::fil
     // Is it bullshit?
     if(contains_files && contains_directories) {
         eprintf_error("Data directory must have only directories or only files");
-        std::exit(EXIT_FAILURE);
+        return false;
     }
     if(!contains_files && !contains_directories) {
         eprintf_error("Data directory is empty");
-        std::exit(EXIT_FAILURE);
+        return false;
     }
 
-    std::uint16_t highest_channel_count = 0;
-    std::uint32_t highest_sample_rate = 0;
-    std::vector<std::pair<std::vector<SoundReader::Sound>, std::string>> pitch_ranges;
-
-    oprintf("Loading sounds...\n");
-    oflush();
+    auto &highest_channel_count = job.highest_channel_count;
+    auto &highest_sample_rate = job.highest_sample_rate;
+    auto &pitch_ranges = job.pitch_ranges;
 
     // Load the sounds
     if(contains_files) {
         auto &pitch_range = pitch_ranges.emplace_back(std::vector<SoundReader::Sound>(), "default");
-        populate_pitch_range(pitch_range.first, data_path, highest_sample_rate, highest_channel_count);
+        if(!populate_pitch_range(pitch_range.first, data_path, highest_sample_rate, highest_channel_count)) {
+            return false;
+        }
     }
     else if(contains_directories) {
         std::size_t i = 0;
@@ -168,19 +276,21 @@ template<typename T> static std::vector<std::byte> make_sound_tag(const std::fil
             auto &path = f.path();
             if(!f.is_directory()) {
                 eprintf_error("Unexpected file %s", path.string().c_str());
-                std::exit(EXIT_FAILURE);
+                return false;
             }
             auto &pitch_range = pitch_ranges.emplace_back(std::vector<SoundReader::Sound>(), path.filename().string());
-            populate_pitch_range(pitch_range.first, path, highest_sample_rate, highest_channel_count);
+            if(!populate_pitch_range(pitch_range.first, path, highest_sample_rate, highest_channel_count)) {
+                return false;
+            }
             if(i == NULL_INDEX) {
                 eprintf_error("%u or more pitch ranges are present", NULL_INDEX);
-                std::exit(EXIT_FAILURE);
+                return false;
             }
 
             // Make sure we have stuff
             if(pitch_range.first.size() == 0) {
                 eprintf_error("No permutations found in %s", path.string().c_str());
-                std::exit(EXIT_FAILURE);
+                return false;
             }
         }
     }
@@ -212,7 +322,7 @@ template<typename T> static std::vector<std::byte> make_sound_tag(const std::fil
     }
     else {
         eprintf_error("Unsupported sample rate %u", highest_sample_rate);
-        std::exit(EXIT_FAILURE);
+        return false;
     }
 
     // Sound tags currently only support single and dual channels
@@ -224,41 +334,19 @@ template<typename T> static std::vector<std::byte> make_sound_tag(const std::fil
     }
     else {
         eprintf_error("Unsupported channel count %u", highest_channel_count);
-        std::exit(EXIT_FAILURE);
+        return false;
     }
 
-    // Resample permutations when needed
-    oprintf("Processing sounds...\n");
-    oflush();
-    std::size_t total_sound_count = 0;
-    std::atomic<std::size_t> thread_count = 0;
-
-    // Wait until we have 0 threads working
-    auto wait_until_threads_are_done = [&thread_count]() {
-        while(thread_count > 0) {
-            std::this_thread::sleep_for(std::chrono::microseconds(1000));
-        }
-    };
-
-    // Wait until we have room for more threads
-    auto wait_until_threads_are_open = [&thread_count, &sound_options]() {
-        while(thread_count >= sound_options.max_threads) {
-            std::this_thread::sleep_for(std::chrono::microseconds(1000));
-        }
-    };
+    return true;
+}
 
-    // Process things!
-    for(auto &pitch_range : pitch_ranges) {
-        for(auto &permutation : pitch_range.first) {
-            total_sound_count++;
-            wait_until_threads_are_open();
-            thread_count++;
-            std::thread(process_permutation_thread, &permutation, highest_sample_rate, format, highest_channel_count, &thread_count, sound_tag.flags & SoundFlagsFlag::SOUND_FLAGS_FLAG_FIT_TO_ADPCM_BLOCKSIZE).detach();
-        }
-    }
+// Match the pitch ranges we loaded to the ones in the tag, and split the processed permutations into things to encode
+template<typename T> static bool prepare_encoding(SoundJob<T> &job, std::size_t job_index, std::vector<EncodeTask> &encode_tasks) {
+    static constexpr std::size_t SPLIT_BUFFER_SIZE = 0x38E00;
+    static constexpr std::size_t MAX_PERMUTATIONS = UINT16_MAX - 1;
 
-    // Wait until done
-    wait_until_threads_are_done();
+    auto &sound_tag = job.sound_tag;
+    auto &pitch_ranges = job.pitch_ranges;
 
     // Remove pitch ranges that are present in the tag but not in what we found
     while(true) {
@@ -290,7 +378,8 @@ template<typename T> static std::vector<std::byte> make_sound_tag(const std::fil
 
     // Index read pitch ranges to output pitch range
     std::size_t pitch_range_count = pitch_ranges.size();
-    std::vector<std::size_t> pitch_range_index(pitch_range_count);
+    auto &pitch_range_index = job.pitch_range_index;
+    pitch_range_index.resize(pitch_range_count);
     for(std::size_t i = 0; i < pitch_range_count; i++) {
         auto &index = pitch_range_index[i];
         std::size_t old_pitch_range_count = sound_tag.pitch_ranges.size();
@@ -312,64 +401,26 @@ template<typename T> static std::vector<std::byte> make_sound_tag(const std::fil
         }
     }
 
-    // Make the sound tag
-    const char *output_name = nullptr;
-    bool enable_threading_split_permutation_encoding = true;
-    switch(format) {
-        case SoundFormat::SOUND_FORMAT_16_BIT_PCM:
-            output_name = "16-bit PCM";
-            enable_threading_split_permutation_encoding = false;
-            break;
-        case SoundFormat::SOUND_FORMAT_IMA_ADPCM:
-            output_name = "IMA ADPCM";
-            enable_threading_split_permutation_encoding = false;
-            break;
-        case SoundFormat::SOUND_FORMAT_XBOX_ADPCM:
-            output_name = "Xbox ADPCM";
-            enable_threading_split_permutation_encoding = false;
-            break;
-        case SoundFormat::SOUND_FORMAT_OGG_VORBIS:
-            output_name = "Ogg Vorbis";
-            break;
-        //case SoundFormat::SOUND_FORMAT_FLAC:
-        //    output_name = "Free Lossless Audio Codec";
-        //    break;
-        case SoundFormat::SOUND_FORMAT_ENUM_COUNT:
-            eprintf_error("Invalid format output name. What?");
-            std::terminate();
-    }
-    oprintf("Found %zu sound%s:\n", total_sound_count, total_sound_count == 1 ? "" : "s");
-
-    // Check if this is dialogue
-    bool is_dialogue;
-    switch(sound_class) {
-        case SoundClass::SOUND_CLASS_UNIT_DIALOG:
-        case SoundClass::SOUND_CLASS_SCRIPTED_DIALOG_PLAYER:
-        case SoundClass::SOUND_CLASS_SCRIPTED_DIALOG_OTHER:
-        case SoundClass::SOUND_CLASS_SCRIPTED_DIALOG_FORCE_UNSPATIALIZED:
-            is_dialogue = true;
-            break;
-        default:
-            is_dialogue = false;
-    }
+    // Vorbis can't be split after encoding, so split it beforehand
+    bool split_before_encoding = job.split && sound_tag.format == SoundFormat::SOUND_FORMAT_OGG_VORBIS;
 
-    if(is_dialogue && split) {
-        eprintf_error("Split dialogue is unsupported.");
-        std::exit(EXIT_FAILURE);
+    if(job.verbose) {
+        std::size_t total_sound_count = 0;
+        for(auto &pitch_range : pitch_ranges) {
+            total_sound_count += pitch_range.first.size();
+        }
+        oprintf("Found %zu sound%s:\n", total_sound_count, total_sound_count == 1 ? "" : "s");
     }
 
-    // Make sure we don't completely blow things up
-    std::mutex encoding_mutex;
+    // Don't add anything unless the whole tag is good
+    std::vector<EncodeTask> job_encode_tasks;
 
-    // Encode this
     for(std::size_t pr = 0; pr < pitch_range_count; pr++) {
-        encoding_mutex.lock();
         auto &pitch_range = sound_tag.pitch_ranges[pitch_range_index[pr]];
         auto &permutations = pitch_ranges[pr].first;
         auto actual_permutation_count = permutations.size();
         pitch_range.actual_permutation_count = actual_permutation_count;
         pitch_range.permutations.resize(actual_permutation_count);
-        encoding_mutex.unlock();
 
         for(auto &p : pitch_range.permutations) {
             p.format = sound_tag.format;
@@ -385,219 +436,258 @@ template<typename T> static std::vector<std::byte> make_sound_tag(const std::fil
             std::size_t bytes_per_sample_one_channel = permutation.bits_per_sample / 8;
             std::size_t bytes_per_sample_all_channels = bytes_per_sample_one_channel * permutation.channel_count;
 
-            // Encode a permutation
-            auto encode_permutation = [](auto *sound_tag, std::size_t pitch_range, std::size_t pitch_range_permutation, std::mutex *mutex, std::vector<std::byte> pcm, const SoundReader::Sound *permutation, bool is_dialogue, SoundFormat format, SoundOptions *sound_options, std::atomic<std::size_t> *thread_count) {
-                auto generate_mouth_data = [&permutation](const std::vector<std::uint8_t> &pcm_8_bit) -> std::vector<std::byte> {
-                    // Basically, take the sample rate, multiply by channel count, divide by tick rate (30 Hz), and round the result
-                    std::size_t samples_per_tick = static_cast<std::size_t>((permutation->sample_rate * permutation->channel_count) / TICK_RATE + 0.5);
-                    std::size_t sample_count = pcm_8_bit.size();
-
-                    // Generate samples, adding an extra tick for incomplete ticks
-                    std::size_t tick_count = (sample_count + samples_per_tick - 1) / samples_per_tick;
-                    std::vector<std::byte> mouth_data = std::vector<std::byte>(tick_count);
-                    auto *pcm_data = pcm_8_bit.data();
-
-                    // Get max and total
-                    std::uint8_t max = 0;
-                    double mouth_total = 0;
-                    for(std::size_t t = 0; t < tick_count; t++) {
-                        // Get the sample range, accounting for when there aren't enough ticks
-                        std::size_t first_sample = t * samples_per_tick;
-                        std::size_t sample_count_to_check = sample_count - first_sample;
-                        if(sample_count_to_check > samples_per_tick) {
-                            sample_count_to_check = samples_per_tick;
-                        }
-                        std::size_t last_sample = first_sample + sample_count_to_check;
-                        double total = 0;
-                        for(std::size_t s = first_sample; s < last_sample; s++) {
-                            total += pcm_data[s];
-                        }
-
-                        // Divide by samples per tick
-                        double average = total / samples_per_tick;
-                        mouth_total += average;
-                        mouth_data[t] = static_cast<std::byte>(average);
-
-                        if(average > max) {
-                            max = average;
-                        }
-                    }
-
-                    // Get average and min, clamping min to 0-255
-                    double average = mouth_total / tick_count;
-                    double min = 2.0 * average - max;
-                    if(min > UINT8_MAX) {
-                        min = UINT8_MAX;
-                    }
-                    else if(min < 0) {
-                        min = 0;
-                    }
-
-                    // Get range
-                    double range = static_cast<double>(max + average) / 2 - min;
-
-                    // Do nothing if there's no range
-                    if(range == 0) {
-                        return mouth_data;
-                    }
-
-                    // Go through each sample
-                    for(std::size_t t = 0; t < tick_count; t++) {
-                        double sample = (static_cast<std::uint8_t>(mouth_data[t]) - min) / range;
-
-                        // Clamp to 0 - 255
-                        if(sample >= 1.0) {
-                            mouth_data[t] = static_cast<std::byte>(UINT8_MAX);
-                        }
-                        else if(sample <= 0.0) {
-                            mouth_data[t] = static_cast<std::byte>(0);
-                        }
-                        else {
-                            mouth_data[t] = static_cast<std::byte>(sample * UINT8_MAX);
-                        }
-                    }
-
-                    return mouth_data;
-                };
-
-                // Generate mouth data if needed
-                std::vector<std::byte> mouth_data;
-                if(is_dialogue) {
-                    // Convert samples to 8-bit unsigned so we can use it to generate mouth data
-                    auto samples_float = SoundEncoder::convert_int_to_float(pcm, permutation->bits_per_sample);
-                    std::vector<std::uint8_t> pcm_8_bit;
-                    pcm_8_bit.reserve(samples_float.size());
-                    for(auto &f : samples_float) {
-                        float ff = f;
-                        if(ff < 0.0F) {
-                            ff *= -1.0F;
-                        }
-                        pcm_8_bit.emplace_back(static_cast<std::uint8_t>(ff * UINT8_MAX));
-                    }
-                    samples_float = {};
-                    mouth_data = generate_mouth_data(pcm_8_bit);
-                }
-
-                // Do the encoding thing
-                std::vector<std::byte> samples;
-                std::size_t buffer_size = 0;
-
-                switch(format) {
-                    // Basically, just make it 16-bit big endian
-                    case SoundFormat::SOUND_FORMAT_16_BIT_PCM:
-                        samples = Invader::SoundEncoder::convert_to_16_bit_pcm_big_endian(pcm, permutation->bits_per_sample);
-                        buffer_size = samples.size();
-                        break;
-
-                    // Encode to Vorbis in an Ogg container
-                    case SoundFormat::SOUND_FORMAT_OGG_VORBIS: {
-                        if(sound_options->compression_level > 1.0F) {
-                            sound_options->compression_level = 1.0F;
-                        }
-                        else if(sound_options->compression_level < 0.0F) {
-                            sound_options->compression_level = 0.0F;
-                        }
-                        if(sound_options->bitrate.has_value()) {
-                            samples = Invader::SoundEncoder::encode_to_ogg_vorbis_cbr(pcm, permutation->bits_per_sample, permutation->channel_count, permutation->sample_rate, *sound_options->bitrate);
-                        }
-                        else {
-                            samples = Invader::SoundEncoder::encode_to_ogg_vorbis_vbr(pcm, permutation->bits_per_sample, permutation->channel_count, permutation->sample_rate, *sound_options->compression_level);
-                        }
-                        buffer_size = pcm.size() / (permutation->bits_per_sample / 8) * sizeof(std::int16_t);
-                        break;
-                    }
-
-                    // Encode to Xbox ADPCMeme
-                    case SoundFormat::SOUND_FORMAT_XBOX_ADPCM:
-                        samples = Invader::SoundEncoder::encode_to_xbox_adpcm(pcm, permutation->bits_per_sample, permutation->channel_count);
-                        break;
-
-                    default:
-                        eprintf_error("Invalid format. What?");
-                        std::terminate();
-                }
-
-                // Set the default stuff
-                mutex->lock();
-                auto &p = sound_tag->pitch_ranges[pitch_range].permutations[pitch_range_permutation];
-                p.gain = 1.0F;
-                p.samples = samples;
-                p.buffer_size = buffer_size;
-                p.samples.shrink_to_fit();
-                p.mouth_data = mouth_data;
-                mutex->unlock();
-
-                // Finish up
-                (*thread_count)--;
-            };
-
             // Split things we can't trivially split losslessly
-            if(split && enable_threading_split_permutation_encoding) {
+            if(split_before_encoding) {
                 std::size_t max_split_size = SPLIT_BUFFER_SIZE - (SPLIT_BUFFER_SIZE % bytes_per_sample_all_channels);
 
                 std::size_t digested = 0;
-                while(permutation.pcm.size() > 0) {
+                std::size_t total_size = permutation.pcm.size();
+                while(digested < total_size) {
                     // Basically, if we haven't encoded anything, use the i-th permutation, otherwise make a new one as a copy
-                    encoding_mutex.lock();
                     auto &p = digested == 0 ? pitch_range.permutations[i] : pitch_range.permutations.emplace_back(pitch_range.permutations[i]);
-                    encoding_mutex.unlock();
-                    std::size_t remaining_size = permutation.pcm.size();
+                    std::size_t remaining_size = total_size - digested;
                     std::size_t permutation_size = remaining_size > max_split_size ? max_split_size : remaining_size;
 
                     // Encode it
-                    auto *sample_data_start = permutation.pcm.data();
+                    auto *sample_data_start = permutation.pcm.data() + digested;
                     auto sample_data = std::vector<std::byte>(sample_data_start, sample_data_start + permutation_size);
-                    permutation.pcm = std::vector<std::byte>(permutation.pcm.begin() + permutation_size, permutation.pcm.end());
-                    permutation.pcm.shrink_to_fit();
                     digested += permutation_size;
 
-                    if(permutation.pcm.size() == 0) {
+                    if(digested == total_size) {
                         p.next_permutation_index = NULL_INDEX;
                     }
                     else {
                         std::size_t next_permutation = pitch_range.permutations.size();
                         if(next_permutation > MAX_PERMUTATIONS) {
-                            encoding_mutex.lock();
                             eprintf_error("Maximum number of total permutations (%zu > %zu) exceeded", next_permutation, MAX_PERMUTATIONS);
-                            std::exit(EXIT_FAILURE);
+                            return false;
                         }
                         p.next_permutation_index = static_cast<Index>(next_permutation);
                     }
 
-                    // Wait until we have threads cleared up
-                    wait_until_threads_are_open();
-
-                    // Punch it
-                    thread_count++;
-                    std::thread(encode_permutation, &sound_tag, pr, &p - pitch_range.permutations.data(), &encoding_mutex, std::move(sample_data), &permutation, is_dialogue, format, &sound_options, &thread_count).detach();
+                    job_encode_tasks.emplace_back(EncodeTask { job_index, pr, static_cast<std::size_t>(&p - pitch_range.permutations.data()), &permutation, std::move(sample_data) });
                 }
             }
             else {
-                // Wait until we have threads cleared up
-                wait_until_threads_are_open();
-
-                // Punch it
-                thread_count++;
                 auto &p = pitch_range.permutations[i];
                 p.next_permutation_index = NULL_INDEX;
-                std::thread(encode_permutation, &sound_tag, pr, &p - pitch_range.permutations.data(), &encoding_mutex, std::move(permutation.pcm), &permutation, is_dialogue, format, &sound_options, &thread_count).detach();
+                job_encode_tasks.emplace_back(EncodeTask { job_index, pr, i, &permutation, std::move(permutation.pcm) });
             }
 
             // Print sound info
-            encoding_mutex.lock();
-            oprintf("    %-32s%2zu:%06.3f (%2zu-bit %6s %5zu Hz)\n", permutation.name.c_str(), static_cast<std::size_t>(seconds) / 60, std::fmod(seconds, 60.0), static_cast<std::size_t>(permutation.input_bits_per_sample), permutation.input_channel_count == 1 ? "mono" : "stereo", static_cast<std::size_t>(permutation.input_sample_rate));
+            if(job.verbose) {
+                oprintf("    %-32s%2zu:%06.3f (%2zu-bit %6s %5zu Hz)\n", permutation.name.c_str(), static_cast<std::size_t>(seconds) / 60, std::fmod(seconds, 60.0), static_cast<std::size_t>(permutation.input_bits_per_sample), permutation.input_channel_count == 1 ? "mono" : "stereo", static_cast<std::size_t>(permutation.input_sample_rate));
+            }
             permutation.pcm = std::vector<std::byte>();
-            encoding_mutex.unlock();
         }
     }
 
-    // Wait until we have 0 threads left
-    wait_until_threads_are_done();
+    std::move(job_encode_tasks.begin(), job_encode_tasks.end(), std::back_inserter(encode_tasks));
+    return true;
+}
+
+static std::vector<std::byte> generate_mouth_data(const std::vector<std::uint8_t> &pcm_8_bit, const SoundReader::Sound *permutation) {
+    // Basically, take the sample rate, multiply by channel count, divide by tick rate (30 Hz), and round the result
+    std::size_t samples_per_tick = static_cast<std::size_t>((permutation->sample_rate * permutation->channel_count) / TICK_RATE + 0.5);
+    std::size_t sample_count = pcm_8_bit.size();
+
+    // Generate samples, adding an extra tick for incomplete ticks
+    std::size_t tick_count = (sample_count + samples_per_tick - 1) / samples_per_tick;
+    std::vector<std::byte> mouth_data = std::vector<std::byte>(tick_count);
+    auto *pcm_data = pcm_8_bit.data();
+
+    // Get max and total
+    std::uint8_t max = 0;
+    double mouth_total = 0;
+    for(std::size_t t = 0; t < tick_count; t++) {
+        // Get the sample range, accounting for when there aren't enough ticks
+        std::size_t first_sample = t * samples_per_tick;
+        std::size_t sample_count_to_check = sample_count - first_sample;
+        if(sample_count_to_check > samples_per_tick) {
+            sample_count_to_check = samples_per_tick;
+        }
+        std::size_t last_sample = first_sample + sample_count_to_check;
+        double total = 0;
+        for(std::size_t s = first_sample; s < last_sample; s++) {
+            total += pcm_data[s];
+        }
+
+        // Divide by samples per tick
+        double average = total / samples_per_tick;
+        mouth_total += average;
+        mouth_data[t] = static_cast<std::byte>(average);
+
+        if(average > max) {
+            max = average;
+        }
+    }
+
+    // Get average and min, clamping min to 0-255
+    double average = mouth_total / tick_count;
+    double min = 2.0 * average - max;
+    if(min > UINT8_MAX) {
+        min = UINT8_MAX;
+    }
+    else if(min < 0) {
+        min = 0;
+    }
+
+    // Get range
+    double range = static_cast<double>(max + average) / 2 - min;
+
+    // Do nothing if there's no range
+    if(range == 0) {
+        return mouth_data;
+    }
+
+    // Go through each sample
+    for(std::size_t t = 0; t < tick_count; t++) {
+        double sample = (static_cast<std::uint8_t>(mouth_data[t]) - min) / range;
+
+        // Clamp to 0 - 255
+        if(sample >= 1.0) {
+            mouth_data[t] = static_cast<std::byte>(UINT8_MAX);
+        }
+        else if(sample <= 0.0) {
+            mouth_data[t] = static_cast<std::byte>(0);
+        }
+        else {
+            mouth_data[t] = static_cast<std::byte>(sample * UINT8_MAX);
+        }
+    }
+
+    return mouth_data;
+}
+
+// Encode a permutation
+static EncodedPermutation encode_permutation(std::vector<std::byte> pcm, const SoundReader::Sound *permutation, bool is_dialogue, SoundFormat format, float compression_level, std::optional<std::uint16_t> bitrate, std::size_t adpcm_thread_count, bool adpcm_high_quality) {
+    // Generate mouth data if needed
+    std::vector<std::byte> mouth_data;
+    if(is_dialogue) {
+        // Convert samples to 8-bit unsigned so we can use it to generate mouth data
+        static constexpr std::size_t BLOCK_SAMPLE_COUNT = 16384;
+        std::size_t bytes_per_sample = permutation->bits_per_sample / 8;
+        std::size_t sample_count = pcm.size() / bytes_per_sample;
+        std::vector<std::uint8_t> pcm_8_bit(sample_count);
+        std::vector<float> samples_float(BLOCK_SAMPLE_COUNT);
+        for(std::size_t s = 0; s < sample_count; s += BLOCK_SAMPLE_COUNT) {
+            std::size_t block_sample_count = sample_count - s;
+            if(block_sample_count > BLOCK_SAMPLE_COUNT) {
+                block_sample_count = BLOCK_SAMPLE_COUNT;
+            }
+            SoundEncoder::convert_int_to_float(pcm.data() + s * bytes_per_sample, block_sample_count, permutation->bits_per_sample, samples_float.data());
+            for(std::size_t i = 0; i < block_sample_count; i++) {
+                float ff = samples_float[i];
+                if(ff < 0.0F) {
+                    ff *= -1.0F;
+                }
+                pcm_8_bit[s + i] = static_cast<std::uint8_t>(ff * UINT8_MAX);
+            }
+        }
+        samples_float = {};
+        mouth_data = generate_mouth_data(pcm_8_bit, permutation);
+    }
+
+    // Do the encoding thing
+    std::vector<std::byte> samples;
+    std::size_t buffer_size = 0;
+
+    switch(format) {
+        // Basically, just make it 16-bit big endian
+        case SoundFormat::SOUND_FORMAT_16_BIT_PCM:
+            samples = Invader::SoundEncoder::convert_to_16_bit_pcm_big_endian(pcm, permutation->bits_per_sample);
+            buffer_size = samples.size();
+            break;
+
+        // Encode to Vorbis in an Ogg container
+        case SoundFormat::SOUND_FORMAT_OGG_VORBIS: {
+            if(bitrate.has_value()) {
+                samples = Invader::SoundEncoder::encode_to_ogg_vorbis_cbr(pcm, permutation->bits_per_sample, permutation->channel_count, permutation->sample_rate, *bitrate);
+            }
+            else {
+                samples = Invader::SoundEncoder::encode_to_ogg_vorbis_vbr(pcm, permutation->bits_per_sample, permutation->channel_count, permutation->sample_rate, compression_level);
+            }
+            buffer_size = pcm.size() / (permutation->bits_per_sample / 8) * sizeof(std::int16_t);
+            break;
+        }
+
+        // Encode to Xbox ADPCMeme
+        case SoundFormat::SOUND_FORMAT_XBOX_ADPCM:
+            samples = Invader::SoundEncoder::encode_to_xbox_adpcm(pcm, permutation->bits_per_sample, permutation->channel_count, adpcm_thread_count, adpcm_high_quality);
+            break;
+
+        default:
+            eprintf_error("Invalid format. What?");
+            std::terminate();
+    }
+
+    samples.shrink_to_fit();
+    return EncodedPermutation { std::move(samples), buffer_size, std::move(mouth_data) };
+}
+
+// Hash the PCM we're encoding along with everything that affects how it's encoded (thread count does not)
+static ContentHash hash_encode_parameters(const std::vector<std::byte> &pcm, const SoundReader::Sound *permutation, bool is_dialogue, SoundFormat format, float compression_level, std::optional<std::uint16_t> bitrate, bool adpcm_high_quality) {
+    auto hash = hash_string(full_version(), hash_data(pcm));
+    hash = hash_value(permutation->bits_per_sample, hash);
+    hash = hash_value(permutation->channel_count, hash);
+    hash = hash_value(permutation->sample_rate, hash);
+    hash = hash_value(is_dialogue, hash);
+    hash = hash_value(format, hash);
+    hash = hash_value(compression_level, hash);
+    hash = hash_value(bitrate.has_value(), hash);
+    hash = hash_value(bitrate.value_or(0), hash);
+    hash = hash_value(adpcm_high_quality, hash);
+    return hash;
+}
+
+// Cached permutations are stored as the buffer size, sample count, and mouth data size (64-bit each), followed by the samples and mouth data
+static std::vector<std::byte> serialize_encoded_permutation(const EncodedPermutation &encoded) {
+    std::uint64_t header[3] = { encoded.buffer_size, encoded.samples.size(), encoded.mouth_data.size() };
+    std::vector<std::byte> data(sizeof(header) + encoded.samples.size() + encoded.mouth_data.size());
+    std::memcpy(data.data(), header, sizeof(header));
+    std::copy(encoded.samples.begin(), encoded.samples.end(), data.begin() + sizeof(header));
+    std::copy(encoded.mouth_data.begin(), encoded.mouth_data.end(), data.begin() + sizeof(header) + encoded.samples.size());
+    return data;
+}
+
+static std::optional<EncodedPermutation> deserialize_encoded_permutation(const std::vector<std::byte> &data) {
+    std::uint64_t header[3];
+    if(data.size() < sizeof(header)) {
+        return std::nullopt;
+    }
+    std::memcpy(header, data.data(), sizeof(header));
+    if(header[1] > data.size() - sizeof(header) || header[2] != data.size() - sizeof(header) - header[1]) {
+        return std::nullopt;
+    }
+
+    auto *samples = data.data() + sizeof(header);
+    auto *mouth_data = samples + header[1];
+    return EncodedPermutation { std::vector<std::byte>(samples, mouth_data), static_cast<std::size_t>(header[0]), std::vector<std::byte>(mouth_data, data.data() + data.size()) };
+}
+
+// Put the encoded permutations in the tag, split anything we can split losslessly, and generate the tag data
+template<typename T> static void finish_sound(SoundJob<T> &job) {
+    static constexpr std::size_t XBOX_ADPCM_SPLIT_SIZE = 65520;
+    static constexpr std::size_t SPLIT_BUFFER_SIZE = 0x38E00;
+
+    auto &sound_tag = job.sound_tag;
+    auto format = sound_tag.format;
+
+    for(auto &pending : job.pending_permutations) {
+        auto encoded = pending.encoded.get();
+        auto &p = sound_tag.pitch_ranges[job.pitch_range_index[pending.pitch_range]].permutations[pending.permutation];
+        p.gain = 1.0F;
+        p.samples = std::move(encoded.samples);
+        p.buffer_size = encoded.buffer_size;
+        p.mouth_data = std::move(encoded.mouth_data);
+    }
+    job.pending_permutations.clear();
 
     // Next, if we can split losslessly, do it
-    if(split && !enable_threading_split_permutation_encoding) {
+    if(job.split && format != SoundFormat::SOUND_FORMAT_OGG_VORBIS) {
         auto split_size = format == SoundFormat::SOUND_FORMAT_XBOX_ADPCM ? XBOX_ADPCM_SPLIT_SIZE : SPLIT_BUFFER_SIZE;
 
+        std::size_t pitch_range_count = job.pitch_ranges.size();
         for(std::size_t pr = 0; pr < pitch_range_count; pr++) {
             auto &pitch_range = sound_tag.pitch_ranges[pr];
             for(std::size_t ap = 0; ap < pitch_range.actual_permutation_count; ap++) {
@@ -635,11 +725,266 @@ template<typename T> static std::vector<std::byte> make_sound_tag(const std::fil
         }
     }
 
-    auto sound_tag_data = sound_tag.generate_hek_tag_data(TagFourCC::TAG_FOURCC_SOUND, true);
+    job.sound_tag_data = sound_tag.generate_hek_tag_data(TagFourCC::TAG_FOURCC_SOUND, true);
+
+    oprintf("%sOutput: %s, %s, %zu Hz%s, %s, %.03f MiB\n", job.output_prefix.c_str(), format_output_name(format), job.highest_channel_count == 1 ? "mono" : "stereo", static_cast<std::size_t>(job.highest_sample_rate), job.split ? ", split" : "", SoundClass_to_string(sound_tag.sound_class), job.sound_tag_data.size() / 1024.0 / 1024.0);
+
+    // We don't need any of this anymore
+    job.sound_tag = {};
+    job.pitch_ranges = {};
+}
+
+// Make each sound tag, sharing one pool between all of them. Sounds are loaded, processed, and encoded largest first
+// (regardless of which tag they belong to) so that one long sound doesn't end up running by itself at the end. If a tag
+// fails, it's marked as failed and the others keep going.
+template<typename T> static void make_sound_tags(std::vector<SoundJob<T>> &jobs, const SoundOptions &sound_options, bool batch) {
+    auto max_threads = sound_options.max_threads;
+
+    // Keep the queue short so we aren't holding onto much more than we're working on
+    ThreadPool pool(max_threads, max_threads * 2);
+
+    auto largest_first = [](std::size_t a, std::size_t b) { return a > b; };
+
+    // Load the sounds
+    oprintf("Loading sounds...\n");
+    oflush();
+    auto loading_start = std::chrono::steady_clock::now();
+    std::uintmax_t input_size = 0;
+    std::vector<std::future<bool>> loaded_jobs;
+    loaded_jobs.reserve(jobs.size());
+    for(auto &job : jobs) {
+        input_size += job.input_size;
+        loaded_jobs.emplace_back(pool.submit([&job]() { return load_sound(job); }));
+    }
+    if(batch) {
+        finish_phase(pool, "Loaded", "sound tag", jobs.size(), input_size, loading_start);
+    }
+    else {
+        pool.wait();
+    }
+    for(std::size_t j = 0; j < jobs.size(); j++) {
+        try {
+            jobs[j].failed = !loaded_jobs[j].get();
+        }
+        catch(std::exception &e) {
+            eprintf_error("Failed to load %s: %s", jobs[j].data_path.string().c_str(), e.what());
+            jobs[j].failed = true;
+        }
+    }
+
+    // Resample permutations when needed
+    oprintf("Processing sounds...\n");
+    oflush();
+    auto processing_start = std::chrono::steady_clock::now();
+
+    struct ProcessTask {
+        std::size_t job;
+        SoundReader::Sound *permutation;
+    };
+    std::vector<ProcessTask> process_tasks;
+    std::size_t total_pcm_size = 0;
+    for(std::size_t j = 0; j < jobs.size(); j++) {
+        if(jobs[j].failed) {
+            continue;
+        }
+        for(auto &pitch_range : jobs[j].pitch_ranges) {
+            for(auto &permutation : pitch_range.first) {
+                total_pcm_size += permutation.pcm.size();
+                process_tasks.emplace_back(ProcessTask { j, &permutation });
+            }
+        }
+    }
+    std::stable_sort(process_tasks.begin(), process_tasks.end(), [&largest_first](const ProcessTask &a, const ProcessTask &b) { return largest_first(a.permutation->pcm.size(), b.permutation->pcm.size()); });
+
+    // Process things!
+    std::vector<std::future<void>> processed_permutations;
+    processed_permutations.reserve(process_tasks.size());
+    for(auto &task : process_tasks) {
+        auto &job = jobs[task.job];
+        bool fit_adpcm_block_size = job.sound_tag.flags & SoundFlagsFlag::SOUND_FLAGS_FLAG_FIT_TO_ADPCM_BLOCKSIZE;
+        processed_permutations.emplace_back(pool.submit([permutation = task.permutation, highest_sample_rate = job.highest_sample_rate, format = job.sound_tag.format, highest_channel_count = job.highest_channel_count, fit_adpcm_block_size]() {
+            process_permutation(permutation, highest_sample_rate, format, highest_channel_count, fit_adpcm_block_size);
+        }));
+    }
+
+    // Wait until done (and find anything that failed)
+    finish_phase(pool, "Processed", "sound", process_tasks.size(), total_pcm_size, processing_start);
+    for(std::size_t p = 0; p < process_tasks.size(); p++) {
+        try {
+            processed_permutations[p].get();
+        }
+        catch(std::exception &e) {
+            eprintf_error("Failed to process %s: %s", process_tasks[p].permutation->name.c_str(), e.what());
+            jobs[process_tasks[p].job].failed = true;
+        }
+    }
+
+    // Figure out what to encode
+    std::vector<EncodeTask> encode_tasks;
+    for(std::size_t j = 0; j < jobs.size(); j++) {
+        if(!jobs[j].failed && !prepare_encoding(jobs[j], j, encode_tasks)) {
+            jobs[j].failed = true;
+        }
+    }
+    std::stable_sort(encode_tasks.begin(), encode_tasks.end(), [&largest_first](const EncodeTask &a, const EncodeTask &b) { return largest_first(a.pcm.size(), b.pcm.size()); });
+
+    // If there are fewer sounds than threads, let each Xbox ADPCM stream use the spare threads to encode its blocks in parallel
+    std::size_t adpcm_thread_count = std::max<std::size_t>(1, max_threads / std::max<std::size_t>(1, encode_tasks.size()));
+
+    // If we're caching, anything encoded the same way from the same PCM before can be reused
+    std::optional<File::ContentCache> cache;
+    if(sound_options.cache.has_value()) {
+        cache.emplace(*sound_options.cache, ".permutation");
+    }
+    std::atomic<std::size_t> cached_count = 0;
+
+    // Punch it
+    auto encoding_start = std::chrono::steady_clock::now();
+    std::size_t encoding_pcm_size = 0;
+    for(auto &task : encode_tasks) {
+        auto &job = jobs[task.job];
+        encoding_pcm_size += task.pcm.size();
+        auto encoded = pool.submit([pcm = std::move(task.pcm), permutation = task.source, is_dialogue = job.is_dialogue, format = job.sound_tag.format, compression_level = *job.sound_options.compression_level, bitrate = job.sound_options.bitrate, adpcm_thread_count, adpcm_high_quality = job.sound_options.adpcm_high_quality, &cache, &cached_count]() mutable {
+            std::optional<ContentHash> cache_key;
+            if(cache.has_value()) {
+                cache_key = hash_encode_parameters(pcm, permutation, is_dialogue, format, compression_level, bitrate, adpcm_high_quality);
+                auto cached_data = cache->load(*cache_key);
+                if(cached_data.has_value()) {
+                    auto cached = deserialize_encoded_permutation(*cached_data);
+                    if(cached.has_value()) {
+                        cached_count++;
+                        return std::move(*cached);
+                    }
+                    eprintf_warn("Ignoring unreadable cache entry for %s", permutation->name.c_str());
+                }
+            }
+
+            auto encoded = encode_permutation(std::move(pcm), permutation, is_dialogue, format, compression_level, bitrate, adpcm_thread_count, adpcm_high_quality);
+            if(cache_key.has_value()) {
+                cache->store(*cache_key, serialize_encoded_permutation(encoded));
+            }
+            return encoded;
+        });
+        job.pending_permutations.emplace_back(PendingPermutation { task.pitch_range, task.permutation, std::move(encoded) });
+    }
+
+    // Wait until everything is encoded, then put it all in the tags
+    finish_phase(pool, "Encoded", "permutation", encode_tasks.size(), encoding_pcm_size, encoding_start);
+    if(cache.has_value()) {
+        oprintf("Reused %zu cached permutation%s\n", cached_count.load(), cached_count == 1 ? "" : "s");
+        cache->trim(sound_options.cache_size * 1024 * 1024);
+    }
+    for(auto &job : jobs) {
+        if(job.failed) {
+            continue;
+        }
+        try {
+            finish_sound(job);
+        }
+        catch(std::exception &e) {
+            eprintf_error("Failed to create %s: %s", job.tag_path.string().c_str(), e.what());
+            job.failed = true;
+        }
+    }
+}
+
+static bool is_supported_sound_file(const std::filesystem::path &path) {
+    auto extension = path.extension().string();
+    for(auto &c : extension) {
+        c = std::tolower(c);
+    }
+    return extension == ".wav" || extension == ".wave" || extension == ".flac";
+}
+
+static int perform_batch(const SoundOptions &sound_options) {
+    // Find every directory in the data directory with sounds in it. If its parent directory is an existing sound tag
+    // (and it isn't one itself), it's a pitch range of that sound tag instead.
+    std::map<std::string, std::uintmax_t> found_sounds;
+    try {
+        for(auto &entry : std::filesystem::recursive_directory_iterator(sound_options.data)) {
+            if(!entry.is_regular_file() || !is_supported_sound_file(entry.path())) {
+                continue;
+            }
 
-    oprintf("Output: %s, %s, %zu Hz%s, %s, %.03f MiB\n", output_name, highest_channel_count == 1 ? "mono" : "stereo", static_cast<std::size_t>(highest_sample_rate), split ? ", split" : "", SoundClass_to_string(sound_class), sound_tag_data.size() / 1024.0 / 1024.0);
+            auto tag_directory = entry.path().parent_path().lexically_relative(sound_options.data);
+            if(tag_directory.empty() || tag_directory == ".") {
+                continue;
+            }
+
+            auto sound_tag_exists = [&sound_options](const std::filesystem::path &path) {
+                return std::filesystem::is_regular_file(std::filesystem::path(sound_options.tags) / (path.string() + ".sound"));
+            };
+            if(tag_directory.has_parent_path() && !sound_tag_exists(tag_directory) && sound_tag_exists(tag_directory.parent_path())) {
+                tag_directory = tag_directory.parent_path();
+            }
+
+            auto halo_tag_path = tag_directory.string();
+            if(!File::path_matches(halo_tag_path.c_str(), sound_options.search, sound_options.search_exclude)) {
+                continue;
+            }
 
-    return sound_tag_data;
+            found_sounds[halo_tag_path] += entry.file_size();
+        }
+    }
+    catch(std::filesystem::filesystem_error &e) {
+        eprintf_error("Failed to search %s: %s", sound_options.data.string().c_str(), e.what());
+        return EXIT_FAILURE;
+    }
+
+    if(found_sounds.empty()) {
+        eprintf_error("No sounds in %s matched", sound_options.data.string().c_str());
+        return EXIT_FAILURE;
+    }
+
+    // Each tag gets its own options since the existing tag fills in anything not set on the command line
+    std::vector<SoundJob<Parser::Sound>> jobs(found_sounds.size());
+    std::size_t j = 0;
+    for(auto &i : found_sounds) {
+        auto &job = jobs[j++];
+        job.halo_tag_path = i.first;
+        job.tag_path = std::filesystem::path(sound_options.tags) / (i.first + ".sound");
+        job.data_path = std::filesystem::path(sound_options.data) / i.first;
+        job.sound_options = sound_options;
+        job.input_size = i.second;
+        job.output_prefix = i.first + ": ";
+        job.verbose = false;
+    }
+
+    // Load the biggest sound tags first, too
+    std::stable_sort(jobs.begin(), jobs.end(), [](const SoundJob<Parser::Sound> &a, const SoundJob<Parser::Sound> &b) { return a.input_size > b.input_size; });
+
+    auto start = std::chrono::steady_clock::now();
+    make_sound_tags(jobs, sound_options, true);
+
+    // Write everything at the end
+    std::size_t success = 0;
+    std::vector<std::string> failed;
+    for(auto &job : jobs) {
+        if(!job.failed) {
+            std::error_code ec;
+            std::filesystem::create_directories(job.tag_path.parent_path(), ec);
+            if(Invader::File::save_file(job.tag_path.string().c_str(), job.sound_tag_data)) {
+                success++;
+                continue;
+            }
+            eprintf_error("Failed to save %s", job.tag_path.string().c_str());
+        }
+        failed.emplace_back(job.halo_tag_path);
+    }
+
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if(!failed.empty()) {
+        std::sort(failed.begin(), failed.end());
+        eprintf_error("Failed to generate %zu sound tag%s:", failed.size(), failed.size() == 1 ? "" : "s");
+        for(auto &i : failed) {
+            eprintf("    %s\n", i.c_str());
+        }
+    }
+
+    oprintf("Generated %zu out of %zu sound tag%s in %.03f seconds\n", success, jobs.size(), jobs.size() == 1 ? "" : "s", seconds);
+
+    return failed.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int main(int argc, const char **argv) {
@@ -660,13 +1005,18 @@ int main(int argc, const char **argv) {
         CommandLineOption("compress-level", 'l', 1, "Set the compression level. This can be between 0.0 and 1.0. For Ogg Vorbis, higher levels result in better quality but worse sizes. Default: 0.8", "<lvl>"),
         CommandLineOption("bitrate", 'R', 1, "Set the bitrate in kilobits per second. This only applies to vorbis.", "<br>"),
         CommandLineOption("class", 'c', 1, "Set the class. This is required when generating new sounds. Can be: ambient_computers, ambient_machinery, ambient_nature, device_computers, device_door, device_force_field, device_machinery, device_nature, first_person_damage, game_event, music, object_impacts, particle_impacts, projectile_impact, projectile_detonation, scripted_dialog_force_unspatialized, scripted_dialog_other, scripted_dialog_player, scripted_effect, slow_particle_impacts, unit_dialog, unit_footsteps, vehicle_collision, vehicle_engine, weapon_charge, weapon_empty, weapon_fire, weapon_idle, weapon_overheat, weapon_ready, weapon_reload", "<class>"),
-        CommandLineOption("threads", 'j', 1, "Set the number of threads to use for parallel resampling and encoding. Default: CPU thread count")
+        CommandLineOption("threads", 'j', 1, "Set the number of threads to use for parallel resampling and encoding. Default: CPU thread count"),
+        CommandLineOption("adpcm-hq", 'H', 0, "Look further ahead when encoding Xbox ADPCM. This is slightly more accurate but much slower."),
+        CommandLineOption::from_preset(CommandLineOption::PRESET_COMMAND_LINE_OPTION_BATCH),
+        CommandLineOption::from_preset(CommandLineOption::PRESET_COMMAND_LINE_OPTION_BATCH_EXCLUDE),
+        CommandLineOption("cache", 'k', 1, "Cache encoded permutations in this directory, keyed by their PCM and encoding options, and reuse them if nothing changed.", "<dir>"),
+        CommandLineOption("cache-size", 'K', 1, "Set the maximum size of the cache in MiB. The least recently used permutations are deleted when it gets bigger. Default: 2048", "<MiB>")
     };
 
     static constexpr char DESCRIPTION[] = "Create or modify a sound tag.";
-    static constexpr char USAGE[] = "[options] <sound-tag>";
+    static constexpr char USAGE[] = "[options] <-b [expr] | <sound-tag>>";
 
-    auto remaining_arguments = CommandLineOption::parse_arguments<SoundOptions &>(argc, argv, options, USAGE, DESCRIPTION, 1, 1, sound_options, [](char opt, const std::vector<const char *> &arguments, auto &sound_options) {
+    auto remaining_arguments = CommandLineOption::parse_arguments<SoundOptions &>(argc, argv, options, USAGE, DESCRIPTION, 0, 1, sound_options, [](char opt, const std::vector<const char *> &arguments, auto &sound_options) {
         switch(opt) {
             case 'd':
                 sound_options.data = arguments[0];
@@ -698,6 +1048,34 @@ int main(int argc, const char **argv) {
                 sound_options.split = false;
                 break;
 
+            case 'H':
+                sound_options.adpcm_high_quality = true;
+                break;
+
+            case 'b':
+                sound_options.search.emplace_back(File::preferred_path_to_halo_path(arguments[0]));
+                sound_options.batch = true;
+                break;
+
+            case 'e':
+                sound_options.search_exclude.emplace_back(File::preferred_path_to_halo_path(arguments[0]));
+                sound_options.batch = true;
+                break;
+
+            case 'k':
+                sound_options.cache = arguments[0];
+                break;
+
+            case 'K':
+                try {
+                    sound_options.cache_size = std::stoull(arguments[0]);
+                }
+                catch(std::exception &) {
+                    eprintf_error("Invalid cache size %s", arguments[0]);
+                    std::exit(EXIT_FAILURE);
+                }
+                break;
+
             case 'R':
                 try {
                     sound_options.bitrate = static_cast<std::uint16_t>(std::stol(arguments[0]));
@@ -767,6 +1145,18 @@ int main(int argc, const char **argv) {
         return EXIT_FAILURE;
     }
 
+    if(sound_options.batch) {
+        if(!remaining_arguments.empty()) {
+            eprintf_error("A sound tag cannot be given when using --batch. Use -h for more information.");
+            return EXIT_FAILURE;
+        }
+        return perform_batch(sound_options);
+    }
+    else if(remaining_arguments.size() != 1) {
+        eprintf_error("A sound tag was expected. Use -h for more information.");
+        return EXIT_FAILURE;
+    }
+
     // Get our paths and make sure a data directory exists
     std::string halo_tag_path;
     if(sound_options.fs_path) {
@@ -789,35 +1179,36 @@ int main(int argc, const char **argv) {
     }
 
     // Generate sound tag
-    std::vector<std::byte> sound_tag_data;
-    auto tag_path = std::filesystem::path(sound_options.tags) / (halo_tag_path + ".sound");
-
-    try {
-        sound_tag_data = make_sound_tag<Parser::Sound>(tag_path, data_path, sound_options);
-    }
-    catch(std::exception &e) {
-        eprintf_error("Failed to create sound tag due to an exception error: %s", e.what());
+    std::vector<SoundJob<Parser::Sound>> jobs(1);
+    auto &job = jobs[0];
+    job.halo_tag_path = halo_tag_path;
+    job.tag_path = std::filesystem::path(sound_options.tags) / (halo_tag_path + ".sound");
+    job.data_path = data_path;
+    job.sound_options = sound_options;
+
+    make_sound_tags(jobs, sound_options, false);
+    if(job.failed) {
         return EXIT_FAILURE;
     }
 
     // Create missing directories if needed
     std::error_code ec;
-    std::filesystem::create_directories(tag_path.parent_path(), ec);
+    std::filesystem::create_directories(job.tag_path.parent_path(), ec);
 
     // Save
-    if(!Invader::File::save_file(tag_path.string().c_str(), sound_tag_data)) {
-        eprintf_error("Failed to save %s", tag_path.string().c_str());
+    if(!Invader::File::save_file(job.tag_path.string().c_str(), job.sound_tag_data)) {
+        eprintf_error("Failed to save %s", job.tag_path.string().c_str());
         return EXIT_FAILURE;
     }
 }
 
-static void populate_pitch_range(std::vector<SoundReader::Sound> &permutations, const std::filesystem::path &directory, std::uint32_t &highest_sample_rate, std::uint16_t &highest_channel_count) {
+static bool populate_pitch_range(std::vector<SoundReader::Sound> &permutations, const std::filesystem::path &directory, std::uint32_t &highest_sample_rate, std::uint16_t &highest_channel_count) {
     for(auto &wav : std::filesystem::directory_iterator(directory)) {
         // Skip directories
         auto path = wav.path();
         if(wav.is_directory()) {
             eprintf_error("Unexpected directory %s", path.string().c_str());
-            std::exit(EXIT_FAILURE);
+            return false;
         }
         auto extension = path.extension().string();
         for(auto &c : extension) {
@@ -835,12 +1226,12 @@ static void populate_pitch_range(std::vector<SoundReader::Sound> &permutations,
             }
             else {
                 eprintf_error("Unsupported input file %s.\nSupported input formats are Free Lossless Audio Codec (.flac) or Waveform Audio (.wav, .wave).", path.string().c_str());
-                std::exit(EXIT_FAILURE);
+                return false;
             }
         }
         catch(std::exception &e) {
             eprintf_error("Failed to load %s: %s", path.string().c_str(), e.what());
-            std::exit(EXIT_FAILURE);
+            return false;
         }
 
         // Get the permutation name
@@ -848,7 +1239,7 @@ static void populate_pitch_range(std::vector<SoundReader::Sound> &permutations,
         sound.name = filename.substr(0, filename.size() - extension.size());
         if(sound.name.size() >= sizeof(HEK::TagString)) {
             eprintf_error("Permutation name %s exceeds the maximum permutation name size (%zu >= %zu)", sound.name.c_str(), sound.name.size(), sizeof(HEK::TagString));
-            std::exit(EXIT_FAILURE);
+            return false;
         }
 
         // Lowercase it
@@ -867,11 +1258,11 @@ static void populate_pitch_range(std::vector<SoundReader::Sound> &permutations,
         // Make sure we can actually work with this
         if(sound.channel_count > 2 || sound.channel_count < 1) {
             eprintf_error("Unsupported channel count %u in %s", static_cast<unsigned int>(sound.channel_count), path.string().c_str());
-            std::exit(EXIT_FAILURE);
+            return false;
         }
         if(sound.bits_per_sample % 8 != 0 || sound.bits_per_sample < 8 || sound.bits_per_sample > 24) {
             eprintf_error("Bits per sample (%u) is not divisible by 8 in %s (or is too small or too big)", static_cast<unsigned int>(sound.bits_per_sample), path.string().c_str());
-            std::exit(EXIT_FAILURE);
+            return false;
         }
 
         // Make it small
@@ -885,21 +1276,20 @@ static void populate_pitch_range(std::vector<SoundReader::Sound> &permutations,
             }
             else if(sound.name == permutations[i].name) {
                 eprintf_error("Multiple permutations with the same name (%s) cannot be added", permutations[i].name.c_str());
-                std::exit(EXIT_FAILURE);
+                return false;
             }
         }
         permutations.insert(permutations.begin() + i, std::move(sound));
     }
+
+    return true;
 }
 
-static void process_permutation_thread(SoundReader::Sound *permutation, std::uint16_t highest_sample_rate, SoundFormat format, std::uint16_t highest_channel_count, std::atomic<std::size_t> *thread_count, bool fit_adpcm_block_size) {
+static void process_permutation(SoundReader::Sound *permutation, std::uint16_t highest_sample_rate, SoundFormat format, std::uint16_t highest_channel_count, bool fit_adpcm_block_size) {
     // Calculate some stuff
     std::size_t bytes_per_sample = permutation->bits_per_sample / 8;
     std::size_t sample_count = permutation->pcm.size() / bytes_per_sample;
 
-    // Mutex for errors
-    static std::mutex error_mutex;
-
     // Bits per sample doesn't match; we can fix that though
     if(bytes_per_sample != sizeof(std::uint16_t) && (format == SoundFormat::SOUND_FORMAT_16_BIT_PCM || format == SoundFormat::SOUND_FORMAT_XBOX_ADPCM)) {
         std::size_t new_bytes_per_sample = sizeof(std::uint16_t);
@@ -910,75 +1300,39 @@ static void process_permutation_thread(SoundReader::Sound *permutation, std::uin
 
     // Mono -> Stereo (just duplicate the channels)
     if(permutation->channel_count == 1 && highest_channel_count == 2) {
-        std::vector<std::byte> new_samples(sample_count * 2 * bytes_per_sample);
-        const std::byte *old_sample = permutation->pcm.data();
-        const std::byte *old_sample_end = permutation->pcm.data() + permutation->pcm.size();
-        std::byte *new_sample = new_samples.data();
-
-        while(old_sample < old_sample_end) {
-            std::memcpy(new_sample, old_sample, bytes_per_sample);
-            std::memcpy(new_sample + bytes_per_sample, old_sample, bytes_per_sample);
-            old_sample += bytes_per_sample;
-            new_sample += bytes_per_sample * 2;
-        }
-
-        permutation->pcm = std::move(new_samples);
-        permutation->pcm.shrink_to_fit();
+        permutation->pcm = SoundEncoder::convert_mono_to_stereo(permutation->pcm, permutation->bits_per_sample);
         permutation->channel_count = 2;
     }
 
     // Stereo -> Mono (mixdown)
     else if(permutation->channel_count == 2 && highest_channel_count == 1) {
-        std::vector<std::byte> new_samples(sample_count * bytes_per_sample / 2);
-        std::byte *new_sample = new_samples.data();
-        const std::byte *old_sample = permutation->pcm.data();
-        const std::byte *old_sample_end = permutation->pcm.data() + permutation->pcm.size();
-
-        while(old_sample < old_sample_end) {
-            std::int32_t a = Invader::SoundEncoder::read_sample(old_sample, permutation->bits_per_sample);
-            std::int32_t b = Invader::SoundEncoder::read_sample(old_sample + bytes_per_sample, permutation->bits_per_sample);
-            std::int64_t ab = a + b;
-            Invader::SoundEncoder::write_sample(static_cast<std::int32_t>(ab / 2), new_sample, permutation->bits_per_sample);
-
-            old_sample += bytes_per_sample * 2;
-            new_sample += bytes_per_sample;
-        }
-
-        permutation->pcm = std::move(new_samples);
-        permutation->pcm.shrink_to_fit();
+        permutation->pcm = SoundEncoder::convert_stereo_to_mono(permutation->pcm, permutation->bits_per_sample);
         permutation->channel_count = 1;
     }
 
     // Sample rate doesn't match; this can be fixed with resampling
     if(static_cast<double>(highest_sample_rate) != permutation->sample_rate) {
         double ratio = static_cast<double>(highest_sample_rate) / permutation->sample_rate;
-        std::vector<float> float_samples = SoundEncoder::convert_int_to_float(permutation->pcm, permutation->bits_per_sample);
-        std::vector<float> new_samples(float_samples.size() * ratio);
-        permutation->sample_rate = highest_sample_rate;
-
-        // Resample it
-        SRC_DATA data = {};
-        data.data_in = float_samples.data();
-        data.data_out = new_samples.data();
-        data.input_frames = float_samples.size() / permutation->channel_count;
-        data.output_frames = new_samples.size() / permutation->channel_count;
-        data.src_ratio = ratio;
-        int res = src_simple(&data, SRC_SINC_BEST_QUALITY, permutation->channel_count);
-        if(res) {
-            error_mutex.lock();
-            eprintf_error("Failed to resample: %s", src_strerror(res));
-            std::exit(EXIT_FAILURE);
-        }
-        new_samples.resize(data.output_frames_gen * permutation->channel_count);
+        std::size_t input_sample_count = permutation->pcm.size() / bytes_per_sample;
+        std::size_t new_sample_count = static_cast<std::size_t>(input_sample_count * ratio) / permutation->channel_count * permutation->channel_count;
 
         // Set stuff
         if(format == SoundFormat::SOUND_FORMAT_16_BIT_PCM) {
             bytes_per_sample = sizeof(std::uint16_t);
         }
+
+        // Resample it
+        try {
+            permutation->pcm = SoundEncoder::resample_int(permutation->pcm.data(), input_sample_count, permutation->bits_per_sample, bytes_per_sample * 8, permutation->channel_count, ratio, new_sample_count);
+        }
+        catch(std::exception &) {
+            eprintf_error("Failed to resample %s", permutation->name.c_str());
+            throw;
+        }
+
         permutation->sample_rate = highest_sample_rate;
         permutation->bits_per_sample = bytes_per_sample * 8;
-        sample_count = new_samples.size();
-        permutation->pcm = SoundEncoder::convert_float_to_int(new_samples, permutation->bits_per_sample);
+        sample_count = permutation->pcm.size() / bytes_per_sample;
     }
 
 
@@ -991,34 +1345,24 @@ static void process_permutation_thread(SoundReader::Sound *permutation, std::uin
         std::size_t delta = trip_adpcm_block_size + (adpcm_block_size - (sample_count % adpcm_block_size));
         if(delta > 0) {
             double ratio = delta / static_cast<double>(quad_adpcm_block_size);
-            std::vector<float> float_samples = SoundEncoder::convert_int_to_float(permutation->pcm, permutation->bits_per_sample);
-            std::vector<float> new_samples(float_samples.size() * ratio);
             auto new_quad = static_cast<std::size_t>(quad_adpcm_block_size * ratio);
 
-            // Resample it
-            SRC_DATA data = {};
-            data.data_in = float_samples.data();
-            data.data_out = new_samples.data();
-            data.input_frames = float_samples.size() / permutation->channel_count;
-            data.output_frames = new_samples.size() / permutation->channel_count;
-            data.src_ratio = ratio;
-            int res = src_simple(&data, SRC_SINC_BEST_QUALITY, permutation->channel_count);
-            if(res) {
-                error_mutex.lock();
-                eprintf_error("Failed to resample: %s", src_strerror(res));
-                std::exit(EXIT_FAILURE);
+            // Resample it, stopping once we have the first new_quad samples (no need to go through the rest of the sound)
+            std::vector<std::byte> new_int_samples;
+            try {
+                new_int_samples = SoundEncoder::resample_int(permutation->pcm.data(), permutation->pcm.size() / bytes_per_sample, permutation->bits_per_sample, permutation->bits_per_sample, permutation->channel_count, ratio, new_quad);
             }
-
-            new_samples.resize(data.output_frames_gen * permutation->channel_count);
-            auto new_int_samples = SoundEncoder::convert_float_to_int(new_samples, permutation->bits_per_sample);
+            catch(std::exception &) {
+                eprintf_error("Failed to resample %s", permutation->name.c_str());
+                throw;
+            }
+            new_quad = new_int_samples.size() / bytes_per_sample;
 
             permutation->pcm.erase(permutation->pcm.begin(), permutation->pcm.begin() + quad_adpcm_block_size * bytes_per_sample);
-            permutation->pcm.insert(permutation->pcm.begin(), new_int_samples.begin(), new_int_samples.begin() + new_quad * bytes_per_sample);
+            permutation->pcm.insert(permutation->pcm.begin(), new_int_samples.begin(), new_int_samples.end());
 
             sample_count -= quad_adpcm_block_size;
             sample_count += new_quad;
         }
     }
-
-    (*thread_count)--;
 }
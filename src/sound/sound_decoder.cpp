@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cstring>
+
+#include <invader/sound/sound_decoder.hpp>
+#include <invader/sound/sound_encoder.hpp>
+#include <invader/sound/sound_reader.hpp>
+#include <invader/error.hpp>
+
+namespace Invader::SoundDecoder {
+    static constexpr std::size_t OUTPUT_BITS_PER_SAMPLE = 16;
+
+    DecodedSound::DecodedSound(std::size_t part_count, std::size_t channel_count, std::size_t sample_rate) : channel_count(channel_count), sample_rate(sample_rate), parts(part_count) {}
+
+    void DecodedSound::get_progress(std::size_t &decoded, std::size_t &total) const {
+        std::scoped_lock lock(this->mutex);
+        decoded = this->decoded_parts;
+        total = this->parts.size();
+    }
+
+    bool DecodedSound::is_finished() const {
+        std::scoped_lock lock(this->mutex);
+        return this->error.has_value() || this->contiguous_parts == this->parts.size();
+    }
+
+    std::optional<std::string> DecodedSound::get_error() const {
+        std::scoped_lock lock(this->mutex);
+        return this->error;
+    }
+
+    std::size_t DecodedSound::get_available_size() const {
+        std::scoped_lock lock(this->mutex);
+        return this->pcm.size();
+    }
+
+    std::size_t DecodedSound::read(std::size_t offset, std::byte *output, std::size_t size) const {
+        std::scoped_lock lock(this->mutex);
+        if(offset >= this->pcm.size()) {
+            return 0;
+        }
+        size = std::min(size, this->pcm.size() - offset);
+        std::memcpy(output, this->pcm.data() + offset, size);
+        return size;
+    }
+
+    const std::vector<std::byte> &DecodedSound::wait() const {
+        std::unique_lock lock(this->mutex);
+        this->updated.wait(lock, [this]() { return this->error.has_value() || this->contiguous_parts == this->parts.size(); });
+        if(this->error.has_value()) {
+            throw InvalidInputSoundException();
+        }
+
+        // Nothing touches the PCM once everything is decoded, so this is safe to hold onto
+        return this->pcm;
+    }
+
+    void DecodedSound::finish_part(std::size_t part, std::vector<std::byte> &&part_pcm) {
+        {
+            std::scoped_lock lock(this->mutex);
+            this->parts[part] = std::move(part_pcm);
+            this->decoded_parts++;
+
+            // Append everything we can to the end, since anything reading it can only read what comes before a part still being decoded
+            while(this->contiguous_parts < this->parts.size() && this->parts[this->contiguous_parts].has_value()) {
+                auto &next = *this->parts[this->contiguous_parts];
+                this->pcm.insert(this->pcm.end(), next.begin(), next.end());
+                this->parts[this->contiguous_parts] = std::nullopt;
+                this->contiguous_parts++;
+            }
+        }
+        this->updated.notify_all();
+    }
+
+    void DecodedSound::fail(const std::string &error) {
+        {
+            std::scoped_lock lock(this->mutex);
+            if(!this->error.has_value() && this->contiguous_parts != this->parts.size()) {
+                this->error = error;
+            }
+        }
+        this->updated.notify_all();
+    }
+
+    static std::vector<std::byte> decode_part(HEK::SoundFormat format, const std::vector<std::byte> &data, std::size_t channel_count, std::size_t sample_rate, std::size_t thread_count) {
+        SoundReader::Sound sound;
+        switch(format) {
+            case HEK::SoundFormat::SOUND_FORMAT_16_BIT_PCM:
+                sound = SoundReader::sound_from_16_bit_pcm_big_endian(data.data(), data.size(), channel_count, sample_rate);
+                break;
+            case HEK::SoundFormat::SOUND_FORMAT_OGG_VORBIS:
+                sound = SoundReader::sound_from_ogg(data.data(), data.size());
+                break;
+            case HEK::SoundFormat::SOUND_FORMAT_XBOX_ADPCM:
+                sound = SoundReader::sound_from_xbox_adpcm(data.data(), data.size(), channel_count, sample_rate, thread_count);
+                break;
+            default:
+                throw InvalidInputSoundException();
+        }
+
+        if(sound.bits_per_sample != OUTPUT_BITS_PER_SAMPLE) {
+            return SoundEncoder::convert_int_to_int(sound.pcm, sound.bits_per_sample, OUTPUT_BITS_PER_SAMPLE);
+        }
+        return std::move(sound.pcm);
+    }
+
+    std::shared_ptr<const DecodedSound> Decoder::decode(const std::vector<EncodedPart> &parts, std::size_t channel_count, std::size_t sample_rate) {
+        // Key it by everything we're decoding
+        auto key = hash_value(channel_count, hash_value(sample_rate));
+        for(auto &part : parts) {
+            key = hash_data(part.data, part.size, hash_value(part.size, hash_value(part.format, key)));
+        }
+
+        // Move it to the front if we have it (unless it failed, in which case try again)
+        auto cached = this->cache_index.find(key);
+        if(cached != this->cache_index.end()) {
+            if(!cached->second->second->get_error().has_value()) {
+                this->cache.splice(this->cache.begin(), this->cache, cached->second);
+                return cached->second->second;
+            }
+            this->cache.erase(cached->second);
+            this->cache_index.erase(cached);
+        }
+
+        auto sound = std::make_shared<DecodedSound>(parts.size(), channel_count, sample_rate);
+        if(parts.empty()) {
+            return sound;
+        }
+
+        // Forget anything that's done, then keep track of this so it can be failed if we're destroyed before it's done
+        this->in_progress.erase(std::remove_if(this->in_progress.begin(), this->in_progress.end(), [](const std::weak_ptr<DecodedSound> &s) {
+            auto locked = s.lock();
+            return !locked || locked->is_finished();
+        }), this->in_progress.end());
+        this->in_progress.emplace_back(sound);
+
+        // If there's just one part, let it use more threads (this only helps Xbox ADPCM)
+        std::size_t part_thread_count = parts.size() == 1 ? this->pool.get_thread_count() : 1;
+
+        for(std::size_t p = 0; p < parts.size(); p++) {
+            auto &part = parts[p];
+            this->pool.submit([sound, p, format = part.format, data = std::vector<std::byte>(part.data, part.data + part.size), channel_count, sample_rate, part_thread_count]() {
+                // No point in decoding the rest if something already failed
+                if(sound->get_error().has_value()) {
+                    return;
+                }
+                try {
+                    sound->finish_part(p, decode_part(format, data, channel_count, sample_rate, part_thread_count));
+                }
+                catch(std::exception &e) {
+                    sound->fail(e.what());
+                }
+            });
+        }
+
+        if(this->max_cache_size > 0) {
+            this->cache.emplace_front(key, sound);
+            this->cache_index.emplace(key, this->cache.begin());
+            this->trim_cache();
+        }
+
+        return sound;
+    }
+
+    void Decoder::trim_cache() {
+        // Sounds still being decoded are counted by what's been decoded so far, so they may go over a little
+        std::size_t total_size = 0;
+        for(auto i = this->cache.begin(); i != this->cache.end(); i++) {
+            total_size += i->second->get_available_size();
+
+            // Always keep the most recent one
+            if(total_size > this->max_cache_size && i != this->cache.begin()) {
+                while(i != this->cache.end()) {
+                    this->cache_index.erase(i->first);
+                    i = this->cache.erase(i);
+                }
+                break;
+            }
+        }
+    }
+
+    Decoder::Decoder(std::size_t max_cache_size, std::size_t thread_count) : max_cache_size(max_cache_size), pool(thread_count) {}
+
+    Decoder::~Decoder() {
+        this->pool.cancel();
+        for(auto &s : this->in_progress) {
+            auto locked = s.lock();
+            if(locked) {
+                locked->fail("decoding was cancelled");
+            }
+        }
+    }
+}
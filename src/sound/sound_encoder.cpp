@@ -5,6 +5,8 @@
 #include <invader/version.hpp>
 #include <invader/error.hpp>
 #include <vorbis/vorbisenc.h>
+#include <bit>
+#include <cstring>
 #include <memory>
 #include <cstdint>
 #include <samplerate.h>
@@ -14,6 +16,160 @@ extern "C" {
 }
 
 namespace Invader::SoundEncoder {
+    // Fast paths for whole-byte sample sizes. These are plain loops over fixed-size samples with no branches in them, so
+    // the compiler can vectorize them; anything else goes through read_sample()/write_sample().
+    template <std::size_t bytes_per_sample> static inline std::int32_t load_sample(const std::byte *pcm) noexcept {
+        if constexpr(bytes_per_sample == 1) {
+            return static_cast<std::int8_t>(pcm[0]);
+        }
+        else if constexpr(bytes_per_sample == 3) {
+            auto sample = static_cast<std::uint32_t>(pcm[0]) << 8 | static_cast<std::uint32_t>(pcm[1]) << 16 | static_cast<std::uint32_t>(pcm[2]) << 24;
+            return static_cast<std::int32_t>(sample) >> 8;
+        }
+        else if constexpr(std::endian::native == std::endian::little) {
+            std::conditional_t<bytes_per_sample == 2, std::int16_t, std::int32_t> sample;
+            std::memcpy(&sample, pcm, sizeof(sample));
+            return sample;
+        }
+        else {
+            return read_sample(pcm, bytes_per_sample * 8);
+        }
+    }
+
+    template <std::size_t bytes_per_sample> static inline void store_sample(std::int32_t sample, std::byte *pcm) noexcept {
+        if constexpr(bytes_per_sample == 1) {
+            pcm[0] = static_cast<std::byte>(sample);
+        }
+        else if constexpr(bytes_per_sample == 3) {
+            pcm[0] = static_cast<std::byte>(sample);
+            pcm[1] = static_cast<std::byte>(sample >> 8);
+            pcm[2] = static_cast<std::byte>(sample >> 16);
+        }
+        else if constexpr(std::endian::native == std::endian::little) {
+            auto truncated = static_cast<std::conditional_t<bytes_per_sample == 2, std::int16_t, std::int32_t>>(sample);
+            std::memcpy(pcm, &truncated, sizeof(truncated));
+        }
+        else {
+            write_sample(sample, pcm, bytes_per_sample * 8);
+        }
+    }
+
+    // Call function.template operator()<bytes_per_sample>() if there's a fast path for the given sample size; return false if not
+    template <typename F> static inline bool dispatch_sample_size(std::size_t bits_per_sample, F &&function) {
+        switch(bits_per_sample) {
+            case 8:
+                function.template operator()<1>();
+                return true;
+            case 16:
+                function.template operator()<2>();
+                return true;
+            case 24:
+                function.template operator()<3>();
+                return true;
+            case 32:
+                function.template operator()<4>();
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Rescale a sample from one size to another (scaled up exactly, or scaled down rounding toward zero)
+    template <std::size_t from, std::size_t to> static inline std::int32_t rescale_sample(std::int32_t sample) noexcept {
+        if constexpr(from < to) {
+            return static_cast<std::int32_t>(static_cast<std::uint32_t>(sample) << ((to - from) * 8));
+        }
+        else if constexpr(from > to) {
+            return sample / (static_cast<std::int32_t>(1) << ((from - to) * 8));
+        }
+        else {
+            return sample;
+        }
+    }
+
+    template <std::size_t from, std::size_t to> static void convert_int_to_int_kernel(const std::byte *pcm, std::size_t sample_count, std::byte *output) noexcept {
+        for(std::size_t i = 0; i < sample_count; i++) {
+            store_sample<to>(rescale_sample<from, to>(load_sample<from>(pcm + i * from)), output + i * to);
+        }
+    }
+
+    template <std::size_t from> static void convert_to_16_bit_big_endian_kernel(const std::byte *pcm, std::size_t sample_count, std::byte *output) noexcept {
+        for(std::size_t i = 0; i < sample_count; i++) {
+            auto sample = static_cast<std::uint16_t>(rescale_sample<from, 2>(load_sample<from>(pcm + i * from)));
+            output[i * 2] = static_cast<std::byte>(sample >> 8);
+            output[i * 2 + 1] = static_cast<std::byte>(sample);
+        }
+    }
+
+    // Odd-sized samples keep the compiler from vectorizing the arithmetic when it's in the same loop as the loads/stores,
+    // so int <-> float goes through a small block of 32-bit ints
+    static constexpr std::size_t KERNEL_BLOCK_SIZE = 256;
+
+    template <std::size_t from> static void convert_int_to_float_kernel(const std::byte *pcm, std::size_t sample_count, float *output) noexcept {
+        constexpr float divide_by = static_cast<float>(static_cast<std::uint64_t>(1) << (from * 8)) / 2.0F;
+        constexpr float divide_by_minus_one = divide_by - 1;
+        std::int32_t block[KERNEL_BLOCK_SIZE];
+        for(std::size_t b = 0; b < sample_count; b += KERNEL_BLOCK_SIZE) {
+            std::size_t block_sample_count = sample_count - b < KERNEL_BLOCK_SIZE ? sample_count - b : KERNEL_BLOCK_SIZE;
+            for(std::size_t i = 0; i < block_sample_count; i++) {
+                block[i] = load_sample<from>(pcm + (b + i) * from);
+            }
+            for(std::size_t i = 0; i < block_sample_count; i++) {
+                output[b + i] = static_cast<float>(block[i]) / (divide_by_minus_one + static_cast<float>(block[i] < 0));
+            }
+        }
+    }
+
+    template <std::size_t to> static void convert_float_to_int_kernel(const float *pcm, std::size_t sample_count, std::byte *output) noexcept {
+        constexpr std::int64_t multiply_by = static_cast<std::int64_t>(1) << (to * 8 - 1);
+        constexpr std::int64_t multiply_by_minus_one = multiply_by - 1;
+        std::int32_t block[KERNEL_BLOCK_SIZE];
+        for(std::size_t b = 0; b < sample_count; b += KERNEL_BLOCK_SIZE) {
+            std::size_t block_sample_count = sample_count - b < KERNEL_BLOCK_SIZE ? sample_count - b : KERNEL_BLOCK_SIZE;
+            for(std::size_t i = 0; i < block_sample_count; i++) {
+                float sample = pcm[b + i] * static_cast<float>(pcm[b + i] < 0 ? multiply_by : multiply_by_minus_one);
+
+                // Clamp. Anything up to 24 bits can be clamped while still a float (both bounds are exactly representable),
+                // but 32-bit needs the wider integer.
+                if constexpr(to < 4) {
+                    constexpr float max = static_cast<float>(multiply_by_minus_one);
+                    constexpr float min = -static_cast<float>(multiply_by);
+                    sample = sample >= max ? max : sample;
+                    sample = sample <= min ? min : sample;
+                    block[i] = static_cast<std::int32_t>(sample);
+                }
+                else {
+                    auto sample_int = static_cast<std::int64_t>(sample);
+                    sample_int = sample_int >= multiply_by_minus_one ? multiply_by_minus_one : sample_int;
+                    sample_int = sample_int <= -multiply_by ? -multiply_by : sample_int;
+                    block[i] = static_cast<std::int32_t>(sample_int);
+                }
+            }
+            for(std::size_t i = 0; i < block_sample_count; i++) {
+                store_sample<to>(block[i], output + (b + i) * to);
+            }
+        }
+    }
+
+    template <std::size_t bytes_per_sample> static void convert_mono_to_stereo_kernel(const std::byte *pcm, std::size_t sample_count, std::byte *output) noexcept {
+        for(std::size_t i = 0; i < sample_count; i++) {
+            std::byte sample[bytes_per_sample];
+            std::memcpy(sample, pcm + i * bytes_per_sample, bytes_per_sample);
+            std::memcpy(output + i * bytes_per_sample * 2, sample, bytes_per_sample);
+            std::memcpy(output + i * bytes_per_sample * 2 + bytes_per_sample, sample, bytes_per_sample);
+        }
+    }
+
+    template <std::size_t bytes_per_sample> static void convert_stereo_to_mono_kernel(const std::byte *pcm, std::size_t frame_count, std::byte *output) noexcept {
+        // 32-bit samples can overflow when added together
+        using sum_t = std::conditional_t<bytes_per_sample < 4, std::int32_t, std::int64_t>;
+        for(std::size_t i = 0; i < frame_count; i++) {
+            sum_t a = load_sample<bytes_per_sample>(pcm + i * bytes_per_sample * 2);
+            sum_t b = load_sample<bytes_per_sample>(pcm + i * bytes_per_sample * 2 + bytes_per_sample);
+            store_sample<bytes_per_sample>(static_cast<std::int32_t>((a + b) / 2), output + i * bytes_per_sample);
+        }
+    }
+
     std::int32_t read_sample(const std::byte *pcm, std::size_t bits_per_sample) noexcept {
         std::size_t bytes_per_sample = bits_per_sample / 8;
         std::int32_t sample_value = 0;
@@ -33,6 +189,13 @@ namespace Invader::SoundEncoder {
     }
 
     std::vector<std::byte> convert_to_16_bit_pcm_big_endian(const std::vector<std::byte> &pcm, std::size_t bits_per_sample) {
+        // Convert and swap in one pass if we can
+        std::size_t sample_count = pcm.size() / (bits_per_sample / 8);
+        std::vector<std::byte> output(sample_count * sizeof(std::uint16_t));
+        if(dispatch_sample_size(bits_per_sample, [&]<std::size_t from>() { convert_to_16_bit_big_endian_kernel<from>(pcm.data(), sample_count, output.data()); })) {
+            return output;
+        }
+
         // Convert to 16 bits per sample if needed
         std::vector<std::byte> pcm_to_use;
         if(bits_per_sample != 16) {
@@ -44,7 +207,7 @@ namespace Invader::SoundEncoder {
 
         // Swap endianness
         std::uint16_t *samples = reinterpret_cast<std::uint16_t *>(pcm_to_use.data());
-        std::size_t sample_count = pcm_to_use.size() / sizeof(*samples);
+        sample_count = pcm_to_use.size() / sizeof(*samples);
         for(std::size_t i = 0; i < sample_count; i++) {
             auto sample = samples[i];
             auto *sample_bytes = reinterpret_cast<std::byte *>(samples + i);
@@ -62,6 +225,15 @@ namespace Invader::SoundEncoder {
         std::size_t sample_count = pcm.size() / bytes_per_sample;
         std::vector<std::byte> samples(sample_count * new_bytes_per_sample);
 
+        // Use a fast path if we have one for both sizes
+        bool converted = false;
+        dispatch_sample_size(bits_per_sample, [&]<std::size_t from>() {
+            converted = dispatch_sample_size(new_bits_per_sample, [&]<std::size_t to>() { convert_int_to_int_kernel<from, to>(pcm.data(), sample_count, samples.data()); });
+        });
+        if(converted) {
+            return samples;
+        }
+
         // Calculate what we divide by
         std::int64_t divide_by = 1 << bits_per_sample;
 
@@ -86,32 +258,42 @@ namespace Invader::SoundEncoder {
     }
 
     std::vector<float> convert_int_to_float(const std::vector<std::byte> &pcm, std::size_t bits_per_sample) {
-        std::vector<float> samples;
+        std::vector<float> samples(pcm.size() / (bits_per_sample / 8));
+        convert_int_to_float(pcm.data(), samples.size(), bits_per_sample, samples.data());
+        return samples;
+    }
+
+    void convert_int_to_float(const std::byte *pcm, std::size_t sample_count, std::size_t bits_per_sample, float *output) noexcept {
+        if(dispatch_sample_size(bits_per_sample, [&]<std::size_t from>() { convert_int_to_float_kernel<from>(pcm, sample_count, output); })) {
+            return;
+        }
+
         std::size_t bytes_per_sample = bits_per_sample / 8;
-        std::size_t sample_count = pcm.size() / bytes_per_sample;
-        samples.reserve(sample_count);
 
         // Calculate what we divide by
         float divide_by = (1 << bits_per_sample) / 2.0F;
         float divide_by_minus_one = divide_by - 1;
         float divide_by_arr[2] = { divide_by_minus_one, divide_by };
 
-        auto *pcm_data = pcm.data();
-
         for(std::size_t i = 0; i < sample_count; i++) {
-            std::int64_t sample = read_sample(pcm_data, bits_per_sample);
-            samples.emplace_back(sample / divide_by_arr[sample < 0]);
-            pcm_data += bytes_per_sample;
+            std::int64_t sample = read_sample(pcm, bits_per_sample);
+            output[i] = sample / divide_by_arr[sample < 0];
+            pcm += bytes_per_sample;
         }
+    }
 
+    std::vector<std::byte> convert_float_to_int(const std::vector<float> &pcm, std::size_t new_bits_per_sample) {
+        std::vector<std::byte> samples(pcm.size() * (new_bits_per_sample / 8));
+        convert_float_to_int(pcm.data(), pcm.size(), new_bits_per_sample, samples.data());
         return samples;
     }
 
-    std::vector<std::byte> convert_float_to_int(const std::vector<float> &pcm, std::size_t new_bits_per_sample) {
-        std::size_t sample_count = pcm.size();
+    void convert_float_to_int(const float *pcm, std::size_t sample_count, std::size_t new_bits_per_sample, std::byte *output) noexcept {
+        if(dispatch_sample_size(new_bits_per_sample, [&]<std::size_t to>() { convert_float_to_int_kernel<to>(pcm, sample_count, output); })) {
+            return;
+        }
+
         std::size_t bytes_per_sample = new_bits_per_sample / 8;
-        std::vector<std::byte> samples(sample_count * bytes_per_sample);
-        auto *sample_data = samples.data();
 
         // Calculate what we multiply by
         std::int64_t multiply_by = (1 << new_bits_per_sample) / 2.0;
@@ -129,11 +311,145 @@ namespace Invader::SoundEncoder {
                 sample = -multiply_by;
             }
 
-            write_sample(static_cast<std::int32_t>(sample), sample_data, new_bits_per_sample);
-            sample_data += bytes_per_sample;
+            write_sample(static_cast<std::int32_t>(sample), output, new_bits_per_sample);
+            output += bytes_per_sample;
         }
+    }
 
-        return samples;
+    std::vector<std::byte> convert_mono_to_stereo(const std::vector<std::byte> &pcm, std::size_t bits_per_sample) {
+        std::size_t bytes_per_sample = bits_per_sample / 8;
+        std::size_t sample_count = pcm.size() / bytes_per_sample;
+        std::vector<std::byte> output(sample_count * bytes_per_sample * 2);
+        if(dispatch_sample_size(bits_per_sample, [&]<std::size_t size>() { convert_mono_to_stereo_kernel<size>(pcm.data(), sample_count, output.data()); })) {
+            return output;
+        }
+
+        // Just duplicate the channels
+        const std::byte *old_sample = pcm.data();
+        const std::byte *old_sample_end = pcm.data() + sample_count * bytes_per_sample;
+        std::byte *new_sample = output.data();
+        while(old_sample < old_sample_end) {
+            std::memcpy(new_sample, old_sample, bytes_per_sample);
+            std::memcpy(new_sample + bytes_per_sample, old_sample, bytes_per_sample);
+            old_sample += bytes_per_sample;
+            new_sample += bytes_per_sample * 2;
+        }
+
+        return output;
+    }
+
+    std::vector<std::byte> convert_stereo_to_mono(const std::vector<std::byte> &pcm, std::size_t bits_per_sample) {
+        std::size_t bytes_per_sample = bits_per_sample / 8;
+        std::size_t frame_count = pcm.size() / bytes_per_sample / 2;
+        std::vector<std::byte> output(frame_count * bytes_per_sample);
+        if(dispatch_sample_size(bits_per_sample, [&]<std::size_t size>() { convert_stereo_to_mono_kernel<size>(pcm.data(), frame_count, output.data()); })) {
+            return output;
+        }
+
+        // Mix down by averaging the two channels
+        const std::byte *old_sample = pcm.data();
+        std::byte *new_sample = output.data();
+        for(std::size_t i = 0; i < frame_count; i++) {
+            std::int64_t a = read_sample(old_sample, bits_per_sample);
+            std::int64_t b = read_sample(old_sample + bytes_per_sample, bits_per_sample);
+            write_sample(static_cast<std::int32_t>((a + b) / 2), new_sample, bits_per_sample);
+            old_sample += bytes_per_sample * 2;
+            new_sample += bytes_per_sample;
+        }
+
+        return output;
+    }
+
+    Resampler::Resampler(std::size_t channel_count, double ratio) : channel_count(channel_count), ratio(ratio) {
+        int error = 0;
+        this->state = src_new(SRC_SINC_BEST_QUALITY, static_cast<int>(channel_count), &error);
+        if(this->state == nullptr) {
+            eprintf_error("Failed to initialize the resampler: %s", src_strerror(error));
+            throw SoundEncodeFailureException();
+        }
+    }
+
+    Resampler::~Resampler() {
+        src_delete(reinterpret_cast<SRC_STATE *>(this->state));
+    }
+
+    void Resampler::process(const float *input, std::size_t frame_count, bool end_of_input, std::vector<float> &output) {
+        SRC_DATA data = {};
+        data.data_in = input;
+        data.input_frames = static_cast<long>(frame_count);
+        data.src_ratio = this->ratio;
+        data.end_of_input = end_of_input;
+
+        // Leave a little extra room for whatever is still buffered from the last block
+        std::size_t output_room = static_cast<std::size_t>(frame_count * this->ratio) + 256;
+
+        while(true) {
+            std::size_t offset = output.size();
+            output.resize(offset + output_room * this->channel_count);
+            data.data_out = output.data() + offset;
+            data.output_frames = static_cast<long>(output_room);
+
+            int res = src_process(reinterpret_cast<SRC_STATE *>(this->state), &data);
+            if(res) {
+                output.resize(offset);
+                eprintf_error("Failed to resample: %s", src_strerror(res));
+                throw SoundEncodeFailureException();
+            }
+            output.resize(offset + static_cast<std::size_t>(data.output_frames_gen) * this->channel_count);
+
+            data.data_in += data.input_frames_used * this->channel_count;
+            data.input_frames -= data.input_frames_used;
+
+            // Keep going until the input is used up (and, at the end, until nothing more comes out)
+            if(data.input_frames == 0 && (!end_of_input || data.output_frames_gen == 0)) {
+                break;
+            }
+        }
+    }
+
+    std::vector<std::byte> resample_int(const std::byte *pcm, std::size_t sample_count, std::size_t bits_per_sample, std::size_t new_bits_per_sample, std::size_t channel_count, double ratio, std::size_t max_sample_count) {
+        static constexpr std::size_t BLOCK_FRAME_COUNT = 16384;
+
+        std::size_t bytes_per_sample = bits_per_sample / 8;
+        std::size_t new_bytes_per_sample = new_bits_per_sample / 8;
+        std::size_t frame_count = sample_count / channel_count;
+        std::size_t expected_sample_count = static_cast<std::size_t>(sample_count * ratio) + channel_count;
+
+        std::vector<std::byte> output;
+        output.reserve((expected_sample_count < max_sample_count ? expected_sample_count : max_sample_count) * new_bytes_per_sample);
+
+        // Only one block of float samples is held at a time on either side of the resampler
+        Resampler resampler(channel_count, ratio);
+        std::vector<float> float_input(BLOCK_FRAME_COUNT * channel_count);
+        std::vector<float> float_output;
+        std::size_t output_sample_count = 0;
+
+        for(std::size_t f = 0; f < frame_count || frame_count == 0;) {
+            std::size_t block_frame_count = frame_count - f;
+            if(block_frame_count > BLOCK_FRAME_COUNT) {
+                block_frame_count = BLOCK_FRAME_COUNT;
+            }
+            bool end_of_input = f + block_frame_count == frame_count;
+
+            convert_int_to_float(pcm + f * channel_count * bytes_per_sample, block_frame_count * channel_count, bits_per_sample, float_input.data());
+            float_output.clear();
+            resampler.process(float_input.data(), block_frame_count, end_of_input, float_output);
+
+            std::size_t samples_to_write = float_output.size();
+            if(samples_to_write > max_sample_count - output_sample_count) {
+                samples_to_write = max_sample_count - output_sample_count;
+            }
+            output.resize((output_sample_count + samples_to_write) * new_bytes_per_sample);
+            convert_float_to_int(float_output.data(), samples_to_write, new_bits_per_sample, output.data() + output_sample_count * new_bytes_per_sample);
+            output_sample_count += samples_to_write;
+            f += block_frame_count;
+
+            if(end_of_input || output_sample_count == max_sample_count) {
+                break;
+            }
+        }
+
+        return output;
     }
 
     void write_sample(std::int32_t sample, std::byte *pcm, std::size_t bits_per_sample) noexcept {
@@ -16,7 +16,6 @@ namespace Invader::SoundEncoder {
         std::size_t bytes_per_sample_one_channel = bits_per_sample / 8;
         std::size_t split_sample_count = pcm.size() / bytes_per_sample_one_channel;
         std::size_t split_effective_sample_count = split_sample_count / channel_count;
-        std::vector<float> float_samples = SoundEncoder::convert_int_to_float(pcm, bytes_per_sample_one_channel * 8);
 
         vorbis_info vi;
         vorbis_info_init(&vi);
@@ -82,6 +81,9 @@ namespace Invader::SoundEncoder {
         static constexpr std::size_t SPLIT_COUNT = 1024;
         std::size_t encoded_count = 0;
 
+        // Convert to float one split at a time rather than holding a float copy of the whole thing
+        std::vector<float> float_samples(SPLIT_COUNT * channel_count);
+
         // Loop until we're done
         bool eos = false;
         std::size_t samples_read = 0;
@@ -96,8 +98,9 @@ namespace Invader::SoundEncoder {
             }
 
             // Load each sample
+            SoundEncoder::convert_int_to_float(pcm.data() + encoded_count * channel_count * bytes_per_sample_one_channel, sample_count_to_encode * channel_count, bits_per_sample, float_samples.data());
             for(std::size_t i = 0; i < sample_count_to_encode; i++) {
-                auto *sample = float_samples.data() + (i + encoded_count) * channel_count;
+                auto *sample = float_samples.data() + i * channel_count;
                 for(std::size_t c = 0; c < channel_count; c++) {
                     buffer[c][i] = sample[c];
                 }
@@ -1,10 +1,14 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
 #include <invader/sound/sound_encoder.hpp>
+#include <invader/thread/thread_pool.hpp>
 #include <invader/printf.hpp>
 #include <invader/error.hpp>
+#include <algorithm>
 #include <memory>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 
 extern "C" {
 #include "adpcm_xq/adpcm-lib.h"
@@ -13,6 +17,13 @@ extern "C" {
 namespace Invader::SoundEncoder {
     static constexpr std::size_t code_chunks_count = 8;
 
+    // Streams are encoded in parallel in segments of this many blocks
+    static constexpr std::size_t SEGMENT_BLOCK_COUNT = 1024;
+
+    // Number of blocks encoded and thrown away before each segment so the encoder's step index settles on about where it
+    // would be if we had encoded everything before it
+    static constexpr std::size_t WARM_UP_BLOCK_COUNT = 8;
+
     static std::size_t calculate_samples_per_block() noexcept {
         return code_chunks_count * 8;
     }
@@ -21,8 +32,96 @@ namespace Invader::SoundEncoder {
         return calculate_samples_per_block() * channel_count;
     }
 
+    namespace {
+        struct AdpcmStream {
+            const std::int16_t *pcm;
+            std::size_t frame_count;
+            std::size_t channel_count;
+            std::size_t block_count;
+            std::size_t pcm_block_size;
+            std::size_t adpcm_block_size;
+            int lookahead;
+        };
+
+        struct AdpcmSegment {
+            std::size_t first_block;
+            std::size_t end_block;
+
+            // Step index of each channel after the last block, if there is a block after it
+            std::uint8_t next_index[MAX_AUDIO_CHANNEL_COUNT];
+        };
+    }
+
+    // Calculate initial adpcm predictors using decaying average
+    static void calculate_initial_deltas(const AdpcmStream &stream, std::size_t block, std::int32_t *average_deltas) noexcept {
+        auto *pcm_stream = stream.pcm + block * stream.pcm_block_size;
+        auto channel_count = stream.channel_count;
+        for(std::size_t c = 0; c < channel_count; c++) {
+            average_deltas[c] = 0;
+            for(std::size_t i = c + stream.pcm_block_size - channel_count; i >= channel_count; i -= channel_count) {
+                average_deltas[c] = (average_deltas[c] / 8) + std::abs(static_cast<std::int32_t>(pcm_stream[i]) - pcm_stream[i - channel_count]);
+            }
+            average_deltas[c] /= 8;
+        }
+    }
+
+    // Get a delta that adpcm_create_context() will turn into exactly this step index
+    static std::int32_t delta_for_step_index(std::uint8_t index) noexcept {
+        return index == 0 ? 0 : (static_cast<std::int32_t>(step_table[index - 1]) + step_table[index]) / 2;
+    }
+
+    // Encode one block. Each block also reads the first frame of the next block, so if that's past the end of the stream,
+    // the last frame is repeated.
+    static void encode_block(void *adpcm_context, const AdpcmStream &stream, std::size_t block, std::uint8_t *output) {
+        std::size_t samples_per_block = calculate_samples_per_block();
+        auto *pcm_block = stream.pcm + block * stream.pcm_block_size;
+        std::size_t num_bytes_encoded = 0;
+
+        if((block + 1) * samples_per_block < stream.frame_count) {
+            adpcm_encode_block(adpcm_context, output, &num_bytes_encoded, pcm_block, static_cast<int>(samples_per_block));
+        }
+        else {
+            std::int16_t padded_block[(code_chunks_count * 8 + 1) * MAX_AUDIO_CHANNEL_COUNT];
+            std::memcpy(padded_block, pcm_block, stream.pcm_block_size * sizeof(*pcm_block));
+            std::memcpy(padded_block + stream.pcm_block_size, pcm_block + stream.pcm_block_size - stream.channel_count, stream.channel_count * sizeof(*pcm_block));
+            adpcm_encode_block(adpcm_context, output, &num_bytes_encoded, padded_block, static_cast<int>(samples_per_block));
+        }
+    }
+
+    // Encode a segment starting from the given deltas. If warm_up is set, some blocks before the segment are encoded first.
+    static void encode_segment(const AdpcmStream &stream, AdpcmSegment &segment, const std::int32_t *initial_deltas, bool warm_up, std::uint8_t *output) {
+        std::vector<std::uint8_t> scratch(stream.adpcm_block_size);
+        std::int32_t deltas[MAX_AUDIO_CHANNEL_COUNT];
+        std::size_t first_block = segment.first_block;
+
+        if(warm_up) {
+            first_block = segment.first_block > WARM_UP_BLOCK_COUNT ? segment.first_block - WARM_UP_BLOCK_COUNT : 0;
+            calculate_initial_deltas(stream, first_block, deltas);
+        }
+        else {
+            std::copy(initial_deltas, initial_deltas + stream.channel_count, deltas);
+        }
+
+        void *adpcm_context = adpcm_create_context(static_cast<int>(stream.channel_count), stream.lookahead, NOISE_SHAPING_OFF, deltas);
+        for(std::size_t b = first_block; b < segment.first_block; b++) {
+            encode_block(adpcm_context, stream, b, scratch.data());
+        }
+        for(std::size_t b = segment.first_block; b < segment.end_block; b++) {
+            encode_block(adpcm_context, stream, b, output + b * stream.adpcm_block_size);
+        }
+
+        // Encode the next block, too, so we know what its step index should be
+        if(segment.end_block < stream.block_count) {
+            encode_block(adpcm_context, stream, segment.end_block, scratch.data());
+            for(std::size_t c = 0; c < stream.channel_count; c++) {
+                segment.next_index[c] = scratch[c * 4 + 2];
+            }
+        }
+        adpcm_free_context(adpcm_context);
+    }
+
     // From the MEK - I have no clue how to do this
-    std::vector<std::byte> encode_to_xbox_adpcm(const std::vector<std::byte> &pcm, std::size_t bits_per_sample, std::size_t channel_count) {
+    std::vector<std::byte> encode_to_xbox_adpcm(const std::vector<std::byte> &pcm, std::size_t bits_per_sample, std::size_t channel_count, std::size_t thread_count, bool high_quality) {
         // Set some parameters
         std::unique_ptr<std::vector<std::byte>> pcm_16_bit_data_ptr;
         const std::int16_t *pcm_stream;
@@ -38,40 +137,82 @@ namespace Invader::SoundEncoder {
             pcm_stream = reinterpret_cast<const std::int16_t *>(pcm.data());
         }
 
+        AdpcmStream stream;
+        stream.pcm = pcm_stream;
+        stream.frame_count = sample_count;
+        stream.channel_count = channel_count;
+        stream.block_count = sample_count / calculate_samples_per_block();
+        stream.pcm_block_size = calculate_adpcm_pcm_block_size(channel_count);  // number of pcm sint16 per block
+        stream.adpcm_block_size = (code_chunks_count * 4 + 4) * channel_count;  // number of adpcm bytes per block
+        stream.lookahead = high_quality ? 5 : 3;
+
         // Set our output
-        std::vector<std::byte> adpcm_stream_buffer(sample_count * bytes_per_sample);
+        std::vector<std::byte> adpcm_stream_buffer(stream.block_count * stream.adpcm_block_size);
         std::uint8_t *adpcm_stream = reinterpret_cast<std::uint8_t *>(adpcm_stream_buffer.data());
+        if(stream.block_count == 0) {
+            return adpcm_stream_buffer;
+        }
 
-        std::size_t samples_per_block = code_chunks_count * 8;
-        std::size_t block_count = sample_count / samples_per_block;
-        std::size_t num_bytes_decoded = 0;
+        std::int32_t average_deltas[MAX_AUDIO_CHANNEL_COUNT];
+        calculate_initial_deltas(stream, 0, average_deltas);
 
-        std::size_t pcm_block_size   = calculate_adpcm_pcm_block_size(channel_count);  // number of pcm sint16 per block
-        std::size_t adpcm_block_size = (code_chunks_count * 4 + 4) * channel_count;  // number of adpcm bytes per block
+        // Split into segments
+        std::vector<AdpcmSegment> segments;
+        for(std::size_t b = 0; b < stream.block_count; b += SEGMENT_BLOCK_COUNT) {
+            segments.emplace_back(AdpcmSegment { b, std::min(b + SEGMENT_BLOCK_COUNT, stream.block_count), {} });
+        }
 
-        std::int32_t average_deltas[2];
-        void *adpcm_context = NULL;
+        if(thread_count == 0) {
+            thread_count = ThreadPool::default_thread_count();
+        }
 
-        // calculate initial adpcm predictors using decaying average
-        for (std::size_t c = 0; c < channel_count; c++) {
-            average_deltas[c] = 0;
-            for (std::size_t i = c + pcm_block_size - channel_count; i >= channel_count; i -= channel_count) {
-                average_deltas[c] = (average_deltas[c] / 8) + std::abs(static_cast<std::int32_t>(pcm_stream[i]) - pcm_stream[i - channel_count]);
+        // Encode it all in one go if we aren't going to use threads
+        if(thread_count == 1 || segments.size() == 1) {
+            AdpcmSegment whole = { 0, stream.block_count, {} };
+            encode_segment(stream, whole, average_deltas, false, adpcm_stream);
+            return adpcm_stream_buffer;
+        }
+
+        // Encode each segment in parallel, guessing its starting state by warming up on the blocks before it
+        {
+            ThreadPool pool(std::min(thread_count, segments.size()));
+            std::vector<std::future<void>> results;
+            results.reserve(segments.size());
+            for(auto &segment : segments) {
+                results.emplace_back(pool.submit([&stream, &segment, &average_deltas, adpcm_stream]() {
+                    encode_segment(stream, segment, average_deltas, segment.first_block != 0, adpcm_stream);
+                }));
+            }
+            pool.wait();
+            for(auto &r : results) {
+                r.get();
             }
-            average_deltas[c] /= 8;
         }
 
-        // Encode!
-        adpcm_context = adpcm_create_context(channel_count, 3, 0, average_deltas);
-        for (std::size_t b = 0; b < block_count; b++) {
-            adpcm_encode_block(adpcm_context, adpcm_stream, &num_bytes_decoded, pcm_stream, samples_per_block);
-            adpcm_stream += adpcm_block_size;
-            pcm_stream += pcm_block_size;
+        // Without noise shaping, the step index is the only state carried from one block to the next, and it's stored in
+        // each block's header. So if a segment started from the same step index the previous segment ended on, it's
+        // identical to what encoding the whole stream in one go would have given us. If not, re-encode it from the right
+        // step index. In practice the warm-up blocks almost always land on the same index.
+        for(std::size_t s = 1; s < segments.size(); s++) {
+            auto &previous = segments[s - 1];
+            auto &segment = segments[s];
+            auto *header = adpcm_stream + segment.first_block * stream.adpcm_block_size;
+
+            bool matches = true;
+            for(std::size_t c = 0; c < channel_count; c++) {
+                matches = matches && header[c * 4 + 2] == previous.next_index[c];
+            }
+            if(matches) {
+                continue;
+            }
+
+            std::int32_t deltas[MAX_AUDIO_CHANNEL_COUNT];
+            for(std::size_t c = 0; c < channel_count; c++) {
+                deltas[c] = delta_for_step_index(previous.next_index[c]);
+            }
+            encode_segment(stream, segment, deltas, false, adpcm_stream);
         }
-        adpcm_free_context(adpcm_context);
 
-        // Resize to fit the buffer
-        adpcm_stream_buffer.resize(reinterpret_cast<std::byte *>(adpcm_stream) - adpcm_stream_buffer.data());
         return adpcm_stream_buffer;
     }
 }
@@ -3,6 +3,8 @@
 #include <invader/printf.hpp>
 #include <invader/error.hpp>
 #include <invader/sound/sound_reader.hpp>
+#include <invader/thread/thread_pool.hpp>
+#include <algorithm>
 
 extern "C" {
 #include "adpcm_xq/adpcm-lib.h"
@@ -12,10 +14,13 @@ const static int ADPCM_STEP_TABLE_MAX_INDEX = sizeof(step_table) / sizeof(step_t
 const static int XBOX_ADPCM_ENCODED_BLOCKSIZE = 36;
 const static int XBOX_ADPCM_DECODED_BLOCKSIZE = 128;
 
+// Blocks are independent of each other, so long streams are split into ranges of at least this many blocks per thread
+const static std::size_t XBOX_ADPCM_MIN_BLOCKS_PER_THREAD = 4096;
+
 namespace Invader::SoundReader {
     static void decode_xbadpcm_stream(std::byte *pcm_stream_buf, const std::byte *adpcm_stream_buf, std::size_t adpcm_stream_buf_len, std::uint8_t channel_count, std::uint32_t code_chunks_count);
 
-    Sound sound_from_xbox_adpcm(const std::byte *data, std::size_t data_length, std::size_t channel_count, std::size_t sample_rate) {
+    Sound sound_from_xbox_adpcm(const std::byte *data, std::size_t data_length, std::size_t channel_count, std::size_t sample_rate, std::size_t thread_count) {
         Sound result = {};
 
         if(channel_count > 2 || channel_count < 1) {
@@ -40,7 +45,34 @@ namespace Invader::SoundReader {
         // Do it!
         std::size_t block_count = static_cast<std::size_t>(data_length / (channel_count * XBOX_ADPCM_ENCODED_BLOCKSIZE));
         result.pcm = std::vector<std::byte>(block_count * XBOX_ADPCM_DECODED_BLOCKSIZE * channel_count);
-        decode_xbadpcm_stream(result.pcm.data(), data, data_length, static_cast<std::uint8_t>(channel_count), 8);
+
+        if(thread_count == 0) {
+            thread_count = ThreadPool::default_thread_count();
+        }
+        thread_count = std::min(thread_count, block_count / XBOX_ADPCM_MIN_BLOCKS_PER_THREAD);
+
+        if(thread_count <= 1) {
+            decode_xbadpcm_stream(result.pcm.data(), data, data_length, static_cast<std::uint8_t>(channel_count), 8);
+        }
+        else {
+            // Each block has its own initial sample and step index, so each range can be decoded on its own
+            std::size_t encoded_block_size = channel_count * XBOX_ADPCM_ENCODED_BLOCKSIZE;
+            std::size_t decoded_block_size = channel_count * XBOX_ADPCM_DECODED_BLOCKSIZE;
+            std::size_t blocks_per_thread = (block_count + thread_count - 1) / thread_count;
+
+            ThreadPool pool(thread_count);
+            std::vector<std::future<void>> results;
+            for(std::size_t b = 0; b < block_count; b += blocks_per_thread) {
+                std::size_t range_block_count = std::min(blocks_per_thread, block_count - b);
+                results.emplace_back(pool.submit([&result, data, b, range_block_count, encoded_block_size, decoded_block_size, channel_count]() {
+                    decode_xbadpcm_stream(result.pcm.data() + b * decoded_block_size, data + b * encoded_block_size, range_block_count * encoded_block_size, static_cast<std::uint8_t>(channel_count), 8);
+                }));
+            }
+            pool.wait();
+            for(auto &r : results) {
+                r.get();
+            }
+        }
 
         // Return the result
         return result;
@@ -0,0 +1,111 @@
+# SPDX-License-Identifier: GPL-3.0-only
+
+# Sizes of the fields each compound type is made of
+compound_field_sizes = {
+    "ColorARGB": [4] * 4,
+    "ColorRGB": [4] * 3,
+    "Euler2D": [4] * 2,
+    "Euler3D": [4] * 3,
+    "Matrix": [4] * 9,
+    "Plane2D": [4] * 3,
+    "Plane3D": [4] * 4,
+    "Point2D": [4] * 2,
+    "Point2DInt": [2] * 2,
+    "Point3D": [4] * 3,
+    "Quaternion": [4] * 4,
+    "Rectangle2D": [2] * 4,
+    "TagString": [1] * 32,
+    "Vector2D": [4] * 2,
+    "Vector3D": [4] * 3
+}
+
+primitive_sizes = {
+    "int8": 1,
+    "uint8": 1,
+    "int16": 2,
+    "uint16": 2,
+    "Index": 2,
+    "int32": 4,
+    "uint32": 4,
+    "float": 4,
+    "Angle": 4,
+    "Fraction": 4,
+    "Pointer": 4,
+    "TagID": 4,
+    "TagFourCC": 4,
+    "ColorARGBInt": 4
+}
+
+# Get the layout of a struct for swapping arrays of it in bulk: a positive number is a field of that many bytes to swap,
+# and a negative number is that many bytes to leave alone. Returns None if the struct points to anything else or has a
+# field we don't know the layout of, in which case arrays of it are converted one struct at a time.
+def get_swap_layout(struct, all_structs, all_enums, all_bitfields):
+    if ("postprocess_hek_data" in struct and struct["postprocess_hek_data"]) or ("post_cache_deformat" in struct and struct["post_cache_deformat"]):
+        return None
+
+    enum_names = set(e["name"] for e in all_enums)
+    bitfield_widths = {}
+    for b in all_bitfields:
+        bitfield_widths[b["name"]] = b["width"] // 8
+
+    field_sizes = []
+    def add_fields(struct):
+        if "inherits" in struct:
+            parent = None
+            for s in all_structs:
+                if s["name"] == struct["inherits"]:
+                    parent = s
+                    break
+            if parent is None or not add_fields(parent):
+                return False
+
+        for f in struct["fields"]:
+            field_type = f["type"]
+            if field_type == "pad":
+                field_sizes.append(-f["size"])
+                continue
+
+            if field_type in compound_field_sizes:
+                sizes = compound_field_sizes[field_type]
+            elif field_type in primitive_sizes:
+                sizes = [primitive_sizes[field_type]]
+            elif field_type in enum_names:
+                sizes = [2]
+            elif field_type in bitfield_widths:
+                sizes = [bitfield_widths[field_type]]
+            else:
+                return False
+
+            # Fields that aren't big endian are left alone
+            if "endian" in f and f["endian"] != "big":
+                sizes = [-sum(abs(s) for s in sizes)]
+
+            if "bounds" in f and f["bounds"]:
+                sizes = sizes * 2
+            if "count" in f:
+                sizes = sizes * f["count"]
+
+            field_sizes.extend(sizes)
+        return True
+
+    if not add_fields(struct):
+        return None
+
+    # Single bytes don't need swapping, so merge them with everything else that's left alone
+    layout = []
+    for s in field_sizes:
+        if s == 1:
+            s = -1
+        if s < 0 and len(layout) > 0 and layout[-1] < 0:
+            layout[-1] += s
+        else:
+            layout.append(s)
+
+    return layout
+
+def make_swap_layout(struct_name, layout, hpp, cpp):
+    hpp.write("\n        /**\n")
+    hpp.write("         * Layout of the struct for swapping arrays of it in bulk (see HEK::swap_endian_struct_array())\n")
+    hpp.write("         */\n")
+    hpp.write("        static constexpr std::int16_t SWAP_LAYOUT[] = {{ {} }};\n".format(", ".join(str(s) for s in layout)))
+    cpp.write("    static_assert(HEK::swap_layout_size({}::SWAP_LAYOUT) == sizeof({}::struct_big));\n".format(struct_name, struct_name))
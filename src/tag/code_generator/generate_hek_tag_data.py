@@ -1,16 +1,75 @@
 # SPDX-License-Identifier: GPL-3.0-only
 
-def make_cpp_save_hek_data(all_bitfields, all_used_structs, struct_name, hpp, cpp_save_hek_data):
+def make_cpp_save_hek_data(all_bitfields, all_used_structs, struct_name, swap_layouts, hpp, cpp_save_hek_data):
+    def is_saved(struct):
+        return not (("cache_only" in struct and struct["cache_only"]) or ("unused" in struct and struct["unused"]) or ("drop_on_extract_hidden" in struct and struct["drop_on_extract_hidden"]))
+
+    # Write a field that doesn't point to anything from the struct at source to b
+    def write_value(struct, source, indent):
+        name = struct["member_name"]
+        if "drop_on_extract_hidden" in struct and struct["drop_on_extract_hidden"]:
+            cpp_save_hek_data.write("{}b.{} = {{}};\n".format(indent, name))
+        elif "bounds" in struct and struct["bounds"]:
+            cpp_save_hek_data.write("{}b.{}.from = {}{}.from;\n".format(indent, name, source, name))
+            cpp_save_hek_data.write("{}b.{}.to = {}{}.to;\n".format(indent, name, source, name))
+        elif "count" in struct and struct["count"] > 1:
+            cpp_save_hek_data.write("{}std::copy({}{}, {}{} + {}, b.{});\n".format(indent, source, name, source, name, struct["count"], name))
+        else:
+            negate = ""
+            for b in all_bitfields:
+                if b["name"] == struct["type"]:
+                    if "cache_only" in b:
+                        for c in b["cache_only"]:
+                            for i in range(0,len(b["fields"])):
+                                if b["fields"][i] == c:
+                                    negate = "{} & ~static_cast<std::uint{}_t>(0x{:X})".format(negate, b["width"], 1 << i)
+                                    break
+                    if "__excluded" in struct and struct["__excluded"] is not None:
+                        negate = "{} & ~static_cast<std::uint{}_t>(0x{:X})".format(negate, b["width"], struct["__excluded"])
+            cpp_save_hek_data.write("{}b.{} = {}{}{};\n".format(indent, name, source, name, negate))
+
     hpp.write("        std::vector<std::byte> generate_hek_tag_data(std::optional<TagFourCC> generate_header_class = std::nullopt, bool clear_on_save = false) override;\n")
+    hpp.write("        std::size_t hek_tag_data_size() override;\n")
+    hpp.write("        void write_hek_tag_data(std::byte *struct_output, std::byte *&data_output, bool clear_on_save = false) override;\n")
+
+    # Serialize into one buffer that's allocated up front
     cpp_save_hek_data.write("    std::vector<std::byte> {}::generate_hek_tag_data(std::optional<TagFourCC> generate_header_class, bool clear_on_save) {{\n".format(struct_name))
-    cpp_save_hek_data.write("        this->cache_deformat();\n")
-    cpp_save_hek_data.write("        std::vector<std::byte> converted_data(sizeof(struct_big));\n")
-    cpp_save_hek_data.write("        std::size_t tag_header_offset = 0;\n")
+    cpp_save_hek_data.write("        std::size_t tag_header_offset = generate_header_class.has_value() ? sizeof(HEK::TagFileHeader) : 0;\n")
+    cpp_save_hek_data.write("        std::vector<std::byte> converted_data(tag_header_offset + this->hek_tag_data_size());\n")
+    cpp_save_hek_data.write("        auto *data_output = converted_data.data() + tag_header_offset + sizeof(struct_big);\n")
+    cpp_save_hek_data.write("        this->write_hek_tag_data(converted_data.data() + tag_header_offset, data_output, clear_on_save);\n")
     cpp_save_hek_data.write("        if(generate_header_class.has_value()) {\n")
-    cpp_save_hek_data.write("            HEK::TagFileHeader header(*generate_header_class);\n")
-    cpp_save_hek_data.write("            tag_header_offset = sizeof(header);\n")
-    cpp_save_hek_data.write("            converted_data.insert(converted_data.begin(), reinterpret_cast<std::byte *>(&header), reinterpret_cast<std::byte *>(&header + 1));\n")
+    cpp_save_hek_data.write("            *reinterpret_cast<HEK::TagFileHeader *>(converted_data.data()) = HEK::TagFileHeader(*generate_header_class);\n")
+    cpp_save_hek_data.write("            reinterpret_cast<HEK::TagFileHeader *>(converted_data.data())->crc32 = ~crc32(0, reinterpret_cast<const void *>(converted_data.data() + tag_header_offset), converted_data.size() - tag_header_offset);\n")
     cpp_save_hek_data.write("        }\n")
+    cpp_save_hek_data.write("        return converted_data;\n")
+    cpp_save_hek_data.write("    }\n")
+
+    # Size of the struct and everything it points to
+    cpp_save_hek_data.write("    std::size_t {}::hek_tag_data_size() {{\n".format(struct_name))
+    cpp_save_hek_data.write("        this->cache_deformat();\n")
+    cpp_save_hek_data.write("        std::size_t size = sizeof(struct_big);\n")
+    for struct in all_used_structs:
+        if not is_saved(struct):
+            continue
+        name = struct["member_name"]
+        if struct["type"] == "TagDependency":
+            cpp_save_hek_data.write("        if(!this->{}.path.empty()) {{\n".format(name))
+            cpp_save_hek_data.write("            size += this->{}.path.size() + 1;\n".format(name))
+            cpp_save_hek_data.write("        }\n")
+        elif struct["type"] == "TagReflexive" and struct["struct"] in swap_layouts:
+            cpp_save_hek_data.write("        size += this->{}.size() * sizeof({}::struct_big);\n".format(name, struct["struct"]))
+        elif struct["type"] == "TagReflexive":
+            cpp_save_hek_data.write("        for(auto &i : this->{}) {{\n".format(name))
+            cpp_save_hek_data.write("            size += i.hek_tag_data_size();\n")
+            cpp_save_hek_data.write("        }\n")
+        elif struct["type"] == "TagDataOffset":
+            cpp_save_hek_data.write("        size += this->{}.size();\n".format(name))
+    cpp_save_hek_data.write("        return size;\n")
+    cpp_save_hek_data.write("    }\n")
+
+    # Write the struct, then everything it points to (in the same order hek_tag_data_size() counted it)
+    cpp_save_hek_data.write("    void {}::write_hek_tag_data(std::byte *struct_output, [[maybe_unused]] std::byte *&data_output, [[maybe_unused]] bool clear_on_save) {{\n".format(struct_name))
     if len(all_used_structs) > 0:
         cpp_save_hek_data.write("        struct_big b = {};\n")
         for struct in all_used_structs:
@@ -27,8 +86,8 @@ def make_cpp_save_hek_data(all_bitfields, all_used_structs, struct_name, hpp, cp
                 cpp_save_hek_data.write("        b.{}.tag_fourcc = this->{}.tag_fourcc;\n".format(name, name))
                 cpp_save_hek_data.write("        if({}_size > 0) {{\n".format(name))
                 cpp_save_hek_data.write("            b.{}.path_size = static_cast<std::uint32_t>({}_size);\n".format(name, name))
-                cpp_save_hek_data.write("            const auto *path_str = reinterpret_cast<const std::byte *>(this->{}.path.c_str());\n".format(name))
-                cpp_save_hek_data.write("            converted_data.insert(converted_data.end(), path_str, path_str + {}_size + 1);\n".format(name))
+                cpp_save_hek_data.write("            std::memcpy(data_output, this->{}.path.c_str(), {}_size + 1);\n".format(name, name))
+                cpp_save_hek_data.write("            data_output += {}_size + 1;\n".format(name))
                 cpp_save_hek_data.write("            if(clear_on_save) {\n")
                 cpp_save_hek_data.write("                this->{}.path = std::string();\n".format(name))
                 cpp_save_hek_data.write("            }\n")
@@ -43,47 +102,49 @@ def make_cpp_save_hek_data(all_bitfields, all_used_structs, struct_name, hpp, cp
                 cpp_save_hek_data.write("        if(ref_{}_size > 0) {{\n".format(name))
                 cpp_save_hek_data.write("            b.{}.count = static_cast<std::uint32_t>(ref_{}_size);\n".format(name, name))
                 cpp_save_hek_data.write("            constexpr std::size_t STRUCT_SIZE = sizeof({}::struct_big);\n".format(struct["struct"]))
-                cpp_save_hek_data.write("            auto total_size = STRUCT_SIZE * ref_{}_size;\n".format(name))
-                cpp_save_hek_data.write("            const std::size_t FIRST_STRUCT_OFFSET = converted_data.size();\n")
-                cpp_save_hek_data.write("            converted_data.insert(converted_data.end(), total_size, std::byte());\n")
-                cpp_save_hek_data.write("            for(std::size_t i = 0; i < ref_{}_size; i++) {{\n".format(name))
-                cpp_save_hek_data.write("                const auto converted_struct = this->{}[i].generate_hek_tag_data(std::nullopt, clear_on_save);\n".format(name))
-                cpp_save_hek_data.write("                const auto *struct_data = converted_struct.data();\n")
-                cpp_save_hek_data.write("                std::copy(struct_data, struct_data + STRUCT_SIZE, converted_data.data() + FIRST_STRUCT_OFFSET + STRUCT_SIZE * i);\n")
-                cpp_save_hek_data.write("                converted_data.insert(converted_data.end(), struct_data + STRUCT_SIZE, struct_data + converted_struct.size());\n")
-                cpp_save_hek_data.write("            }\n")
+                cpp_save_hek_data.write("            auto *first_struct = data_output;\n")
+                cpp_save_hek_data.write("            data_output += STRUCT_SIZE * ref_{}_size;\n".format(name))
+                if struct["struct"] in swap_layouts:
+                    cpp_save_hek_data.write("            {}::write_hek_tag_data_array(this->{}.data(), ref_{}_size, first_struct);\n".format(struct["struct"], name, name))
+                else:
+                    cpp_save_hek_data.write("            for(std::size_t i = 0; i < ref_{}_size; i++) {{\n".format(name))
+                    cpp_save_hek_data.write("                this->{}[i].write_hek_tag_data(first_struct + STRUCT_SIZE * i, data_output, clear_on_save);\n".format(name))
+                    cpp_save_hek_data.write("            }\n")
                 cpp_save_hek_data.write("            if(clear_on_save) {\n")
-                cpp_save_hek_data.write("                this->{} = std::vector<{}>();\n".format(name, struct["struct"]))
+                cpp_save_hek_data.write("                this->{} = Vector<{}>();\n".format(name, struct["struct"]))
                 cpp_save_hek_data.write("            }\n")
                 cpp_save_hek_data.write("        }\n")
             elif struct["type"] == "TagDataOffset":
                 cpp_save_hek_data.write("        b.{}.size = static_cast<std::uint32_t>(this->{}.size());\n".format(name, name))
-                cpp_save_hek_data.write("        converted_data.insert(converted_data.end(), this->{}.begin(), this->{}.end());\n".format(name, name, name))
+                cpp_save_hek_data.write("        data_output = std::copy(this->{}.begin(), this->{}.end(), data_output);\n".format(name, name))
                 cpp_save_hek_data.write("        if(clear_on_save) {\n")
                 cpp_save_hek_data.write("            this->{} = std::vector<std::byte>();\n".format(name))
                 cpp_save_hek_data.write("        }\n")
-            elif "bounds" in struct and struct["bounds"]:
-                cpp_save_hek_data.write("        b.{}.from = this->{}.from;\n".format(name, name))
-                cpp_save_hek_data.write("        b.{}.to = this->{}.to;\n".format(name, name))
-            elif "count" in struct and struct["count"] > 1:
-                cpp_save_hek_data.write("        std::copy(this->{}, this->{} + {}, b.{});\n".format(name, name, struct["count"], name))
             else:
-                negate = ""
-                for b in all_bitfields:
-                    if b["name"] == struct["type"]:
-                        if "cache_only" in b:
-                            added = True
-                            for c in b["cache_only"]:
-                                for i in range(0,len(b["fields"])):
-                                    if b["fields"][i] == c:
-                                        negate = "{} & ~static_cast<std::uint{}_t>(0x{:X})".format(negate, b["width"], 1 << i)
-                                        break
-                        if "__excluded" in struct and struct["__excluded"] is not None:
-                            negate = "{} & ~static_cast<std::uint{}_t>(0x{:X})".format(negate, b["width"], struct["__excluded"])
-                cpp_save_hek_data.write("        b.{} = this->{}{};\n".format(name, name, negate))
-        cpp_save_hek_data.write("        *reinterpret_cast<struct_big *>(converted_data.data() + tag_header_offset) = b;\n")
-    cpp_save_hek_data.write("        if(generate_header_class.has_value()) {\n")
-    cpp_save_hek_data.write("            reinterpret_cast<HEK::TagFileHeader *>(converted_data.data())->crc32 = ~crc32(clear_on_save ^ clear_on_save, reinterpret_cast<const void *>(converted_data.data() + tag_header_offset), converted_data.size() - tag_header_offset);\n")
-    cpp_save_hek_data.write("        }\n")
-    cpp_save_hek_data.write("        return converted_data;\n")
+                write_value(struct, "this->", "        ")
+        cpp_save_hek_data.write("        *reinterpret_cast<struct_big *>(struct_output) = b;\n")
+    else:
+        cpp_save_hek_data.write("        std::fill(struct_output, struct_output + sizeof(struct_big), std::byte());\n")
     cpp_save_hek_data.write("    }\n")
+
+    # Arrays of structs that don't point to anything are written in native endian, then swapped all at once
+    if struct_name in swap_layouts:
+        hpp.write("\n        /**\n")
+        hpp.write("         * Write an array of structs as HEK tag data all at once.\n")
+        hpp.write("         * @param input  structs to write\n")
+        hpp.write("         * @param count  number of structs\n")
+        hpp.write("         * @param output where to write the structs\n")
+        hpp.write("         */\n")
+        hpp.write("        static void write_hek_tag_data_array(const {} *input, std::size_t count, std::byte *output);\n".format(struct_name))
+        cpp_save_hek_data.write("    void {}::write_hek_tag_data_array([[maybe_unused]] const {} *input, std::size_t count, std::byte *output) {{\n".format(struct_name, struct_name))
+        cpp_save_hek_data.write("        std::fill(output, output + sizeof(struct_little) * count, std::byte());\n")
+        saved = [struct for struct in all_used_structs if not (("cache_only" in struct and struct["cache_only"]) or ("unused" in struct and struct["unused"]))]
+        if len(saved) > 0:
+            cpp_save_hek_data.write("        auto *array = reinterpret_cast<struct_little *>(output);\n")
+            cpp_save_hek_data.write("        for(std::size_t i = 0; i < count; i++) {\n")
+            cpp_save_hek_data.write("            auto &b = array[i];\n")
+            for struct in saved:
+                write_value(struct, "input[i].", "            ")
+            cpp_save_hek_data.write("        }\n")
+            cpp_save_hek_data.write("        HEK::swap_endian_struct_array(output, count, SWAP_LAYOUT);\n")
+        cpp_save_hek_data.write("    }\n")
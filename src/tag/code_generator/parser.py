@@ -13,8 +13,10 @@ from check_invalid_ranges import make_check_invalid_ranges
 from check_invalid_indices import make_check_invalid_indices
 from check_normalize import make_normalize
 from scan_padding import make_scan_padding
+from view import make_view_header, make_view_source, make_view, make_view_end
+from endian_swap import get_swap_layout, make_swap_layout
 
-def make_parser(all_enums, all_bitfields, all_structs_arranged, all_structs, hpp, cpp_save_hek_data, cpp_read_hek_data, cpp_read_cache_file_data, cpp_cache_format_data, cpp_cache_deformat_data, cpp_refactor_reference, cpp_struct_value, cpp_check_invalid_ranges, cpp_check_invalid_indices, cpp_normalize, cpp_read_hek_file, cpp_scan_padding):
+def make_parser(all_enums, all_bitfields, all_structs_arranged, all_structs, hpp, cpp_save_hek_data, cpp_read_hek_data, cpp_read_cache_file_data, cpp_cache_format_data, cpp_cache_deformat_data, cpp_refactor_reference, cpp_struct_value, cpp_check_invalid_ranges, cpp_check_invalid_indices, cpp_normalize, cpp_read_hek_file, cpp_scan_padding, hpp_view, cpp_view):
     def write_for_all_cpps(what):
         cpp_save_hek_data.write(what)
         cpp_read_cache_file_data.write(what)
@@ -51,8 +53,18 @@ def make_parser(all_enums, all_bitfields, all_structs_arranged, all_structs, hpp
     cpp_cache_format_data.write("#include <invader/build/build_workload.hpp>\n")
     cpp_read_cache_file_data.write("#include <invader/file/file.hpp>\n")
     cpp_read_hek_data.write("#include <invader/file/file.hpp>\n")
+    cpp_save_hek_data.write("#include <cstring>\n")
     cpp_save_hek_data.write("extern \"C\" std::uint32_t crc32(std::uint32_t crc, const void *buf, std::size_t size) noexcept;\n")
     write_for_all_cpps("namespace Invader::Parser {\n")
+    make_view_header(all_structs_arranged, hpp_view)
+    make_view_source(cpp_view)
+
+    # Find which structs can have arrays of them swapped in bulk
+    swap_layouts = {}
+    for struct in all_structs_arranged:
+        layout = get_swap_layout(struct, all_structs, all_enums, all_bitfields)
+        if layout is not None:
+            swap_layouts[struct["name"]] = layout
 
     for struct in all_structs_arranged:
         struct_name = struct["name"]
@@ -97,7 +109,7 @@ def make_parser(all_enums, all_bitfields, all_structs_arranged, all_structs, hpp
                     type_to_write = "Dependency"
                     non_type = True
                 elif type_to_write == "TagReflexive":
-                    type_to_write = "std::vector<{}>".format(t["struct"])
+                    type_to_write = "Vector<{}>".format(t["struct"])
                     non_type = True
                 elif type_to_write == "TagDataOffset":
                     type_to_write = "std::vector<std::byte>"
@@ -183,15 +195,18 @@ def make_parser(all_enums, all_bitfields, all_structs_arranged, all_structs, hpp
         make_scan_padding(all_used_structs, struct_name, all_bitfields, hpp, cpp_scan_padding)
         make_cache_deformat(post_cache_deformat, all_used_structs, struct_name, hpp, cpp_cache_deformat_data)
         make_cache_format_data(struct_name, struct, pre_compile, post_compile, all_used_structs, hpp, cpp_cache_format_data, all_enums, all_structs_arranged)
-        make_cpp_save_hek_data(all_bitfields, all_used_structs, struct_name, hpp, cpp_save_hek_data)
+        if struct_name in swap_layouts:
+            make_swap_layout(struct_name, swap_layouts[struct_name], hpp, cpp_read_hek_data)
+        make_cpp_save_hek_data(all_bitfields, all_used_structs, struct_name, swap_layouts, hpp, cpp_save_hek_data)
         make_parse_cache_file_data(post_cache_parse, all_bitfields, all_used_structs, struct_name, hpp, cpp_read_cache_file_data)
-        make_parse_hek_tag_data(postprocess_hek_data, all_bitfields, struct_name, all_used_structs, hpp, cpp_read_hek_data)
+        make_parse_hek_tag_data(postprocess_hek_data, all_bitfields, struct_name, all_used_structs, swap_layouts, hpp, cpp_read_hek_data)
         make_parse_hek_tag_file(struct_name, hpp, cpp_read_hek_file)
         make_refactor_reference(all_used_structs, struct_name, hpp, cpp_refactor_reference)
         make_parser_struct(cpp_struct_value, all_enums, all_bitfields, all_used_structs, all_used_groups, hpp, struct_name, read_only, title)
         make_check_invalid_ranges(all_used_structs, struct_name, hpp, cpp_check_invalid_ranges)
         make_check_invalid_indices(all_used_structs, struct_name, hpp, cpp_check_invalid_indices, all_structs_arranged)
         make_normalize(all_used_structs, struct_name, hpp, cpp_normalize, normalize)
+        make_view(all_used_structs, struct_name, hpp_view, cpp_view)
 
         hpp.write("        ~{}() override = default;\n".format(struct_name))
 
@@ -214,4 +229,5 @@ def make_parser(all_enums, all_bitfields, all_structs_arranged, all_structs, hpp
     hpp.write("}\n")
     hpp.write("#endif\n")
     write_for_all_cpps("}\n")
+    make_view_end(hpp_view, cpp_view)
     hpp.close()
@@ -57,7 +57,7 @@ def make_parser_struct(cpp_struct_value, all_enums, all_bitfields, all_used_stru
             elif "maximum" in struct:
                 maximum = struct["maximum"]
 
-            vstruct = "std::vector<{}>".format(struct["struct"])
+            vstruct = "Vector<{}>".format(struct["struct"])
             cpp_struct_value.write("    values.emplace_back({}, ParserStructValue::get_object_in_array_template<{}>, ParserStructValue::get_array_size_template<{}>, ParserStructValue::delete_objects_in_array_template<{}>, ParserStructValue::insert_object_in_array_template<{}>, ParserStructValue::duplicate_object_in_array_template<{}>, ParserStructValue::swap_object_in_array_template<{}>, static_cast<std::size_t>({}), static_cast<std::size_t>({}), {});\n".format(first_arguments, vstruct, vstruct, vstruct, vstruct, vstruct, vstruct, minimum, maximum, struct_read_only))
         elif type == "TagDataOffset" or type == "TagString":
             cpp_struct_value.write("    values.emplace_back({}, {});\n".format(first_arguments, struct_read_only))
@@ -5,13 +5,15 @@ def make_parse_cache_file_data(post_cache_parse, all_bitfields, all_used_structs
     hpp.write("         * Parse the cache file tag data.\n")
     hpp.write("         * @param tag     Tag to read data from\n")
     hpp.write("         * @param pointer Pointer to read from; if none is given, then the start of the tag will be used\n")
+    hpp.write("         * @param resource If set, allocate the tag's reflexives from this (see ScopedAllocationResource)\n")
     hpp.write("         * @return parsed tag data\n")
     hpp.write("         */\n")
-    hpp.write("        static {} parse_cache_file_data(const Invader::Tag &tag, std::optional<HEK::Pointer> pointer = std::nullopt);\n".format(struct_name))
+    hpp.write("        static {} parse_cache_file_data(const Invader::Tag &tag, std::optional<HEK::Pointer> pointer = std::nullopt, std::pmr::memory_resource *resource = nullptr);\n".format(struct_name))
     if len(all_used_structs) > 0 or post_cache_parse:
-        cpp_read_cache_file_data.write("    {} {}::parse_cache_file_data(const Invader::Tag &tag, std::optional<HEK::Pointer> pointer) {{\n".format(struct_name, struct_name))
+        cpp_read_cache_file_data.write("    {} {}::parse_cache_file_data(const Invader::Tag &tag, std::optional<HEK::Pointer> pointer, std::pmr::memory_resource *resource) {{\n".format(struct_name, struct_name))
+        cpp_read_cache_file_data.write("        ScopedAllocationResource scope(resource);\n")
     else:
-        cpp_read_cache_file_data.write("    {} {}::parse_cache_file_data(const Invader::Tag &, std::optional<HEK::Pointer>) {{\n".format(struct_name, struct_name))
+        cpp_read_cache_file_data.write("    {} {}::parse_cache_file_data(const Invader::Tag &, std::optional<HEK::Pointer>, std::pmr::memory_resource *) {{\n".format(struct_name, struct_name))
     cpp_read_cache_file_data.write("        {} r = {{}};\n".format(struct_name))
     cpp_read_cache_file_data.write("        r.cache_formatted = true;\n")
     if len(all_used_structs) > 0:
@@ -1,6 +1,83 @@
 # SPDX-License-Identifier: GPL-3.0-only
 
-def make_parse_hek_tag_data(postprocess_hek_data, all_bitfields, struct_name, all_used_structs, hpp, cpp_read_hek_data):
+import io
+
+def make_parse_hek_tag_data(postprocess_hek_data, all_bitfields, struct_name, all_used_structs, swap_layouts, hpp, cpp_read_hek_data):
+    # Read a field that doesn't point to anything from h into r
+    def read_value(struct, out):
+        name = struct["member_name"]
+        default_sign = "<=" if "default_sign" in struct and struct["default_sign"] else "=="
+        if struct["type"] == "ColorRGB":
+            out.write("        r.{} = h.{};\n".format(name, name))
+            if "default" in struct:
+                default = struct["default"]
+                suffix = "F" if isinstance(default[0], float) else ""
+                out.write("        if(postprocess && r.{}.red {} 0 && r.{}.green {} 0 && r.{}.blue {} 0) {{\n".format(name,default_sign,name,default_sign,name,default_sign))
+                out.write("            r.{}.red = {}{};\n".format(name, default[0], suffix))
+                out.write("            r.{}.green = {}{};\n".format(name, default[1], suffix))
+                out.write("            r.{}.blue = {}{};\n".format(name, default[2], suffix))
+                out.write("        }\n")
+        elif struct["type"] == "ColorARGB" or struct["type"] == "ColorARGBInt":
+            out.write("        r.{} = h.{};\n".format(name, name))
+            if "default" in struct:
+                default = struct["default"]
+                suffix = "F" if isinstance(default[0], float) else ""
+                out.write("        if(postprocess && r.{}.alpha {} 0 && r.{}.red {} 0 && r.{}.green {} 0 && r.{}.blue {} 0) {{\n".format(name,default_sign,name,default_sign,name,default_sign,name,default_sign))
+                out.write("            r.{}.alpha = {}{};\n".format(name, default[0], suffix))
+                out.write("            r.{}.red = {}{};\n".format(name, default[1], suffix))
+                out.write("            r.{}.green = {}{};\n".format(name, default[2], suffix))
+                out.write("            r.{}.blue = {}{};\n".format(name, default[3], suffix))
+                out.write("        }\n")
+        elif struct["type"] == "TagID":
+            out.write("        r.{} = HEK::TagID::null_tag_id();\n".format(name))
+        elif "bounds" in struct and struct["bounds"]:
+            out.write("        r.{}.from = h.{}.from;\n".format(name, name))
+            out.write("        r.{}.to = h.{}.to;\n".format(name, name))
+            if "default" in struct:
+                default = struct["default"]
+                suffix = "F" if isinstance(default[0], float) else ""
+                out.write("        if(postprocess && r.{}.from {} 0 && r.{}.to {} 0) {{\n".format(name, default_sign, name, default_sign))
+                out.write("            r.{}.from = {}{};\n".format(name, default[0], suffix))
+                out.write("            r.{}.to = {}{};\n".format(name, default[1], suffix))
+                out.write("        }\n")
+        elif "count" in struct and struct["count"] > 1:
+            out.write("        std::copy(h.{}, h.{} + {}, r.{});\n".format(name, name, struct["count"], name))
+            if "default" in struct:
+                default = struct["default"]
+                suffix = "F" if isinstance(default[0], float) else ""
+                for q in range(struct["count"]):
+                    out.write("        if(postprocess && r.{}[{}] {} 0) {{\n".format(name, q, default_sign))
+                    out.write("            r.{}[{}] = {}{};\n".format(name, q, default[q], suffix))
+                    out.write("        }\n")
+        else:
+            added = False
+            for b in all_bitfields:
+                if b["name"] == struct["type"]:
+                    added = True
+                    negate = ""
+                    if "cache_only" in b:
+                        added = True
+                        negate = ""
+                        for c in b["cache_only"]:
+                            for i in range(0,len(b["fields"])):
+                                if b["fields"][i] == c:
+                                    negate = "{} & ~static_cast<std::uint{}_t>(0x{:X})".format(negate, b["width"], 1 << i)
+                                    break
+                    if "__excluded" in struct and struct["__excluded"] is not None:
+                        negate = "{} & ~static_cast<std::uint{}_t>(0x{:X})".format(negate, b["width"], struct["__excluded"])
+                        
+                    out.write("        r.{} = static_cast<std::uint{}_t>(h.{}) & static_cast<std::uint{}_t>(0x{:X}){};\n".format(name, b["width"], name, b["width"], (1 << len(b["fields"])) - 1, negate))
+                    
+                    break
+            if not added:
+                out.write("        r.{} = h.{};\n".format(name, name))
+                if "default" in struct:
+                    default = struct["default"]
+                    suffix = "F" if isinstance(default, float) else ""
+                    out.write("        if(postprocess && r.{} {} 0) {{\n".format(name, default_sign))
+                    out.write("            r.{} = {}{};\n".format(name, default, suffix))
+                    out.write("        }\n")
+
     hpp.write("\n        /**\n")
     hpp.write("         * Parse the HEK tag data.\n")
     hpp.write("         * @param data        Data to read from for structs, tag references, and reflexives; if data_this is nullptr, this must point to the struct\n")
@@ -74,6 +151,12 @@ def make_parse_hek_tag_data(postprocess_hek_data, all_bitfields, struct_name, al
                 cpp_read_hek_data.write("            data_size -= total_size;\n")
                 cpp_read_hek_data.write("            data_read += total_size;\n")
                 cpp_read_hek_data.write("            data += total_size;\n")
+                if struct["struct"] in swap_layouts:
+                    # Nothing else to read after these structs, so swap all of them at once
+                    if not unread:
+                        cpp_read_hek_data.write("            {}::parse_hek_tag_data_array(reinterpret_cast<const std::byte *>(array), h_{}_count, postprocess, r.{});\n".format(struct["struct"], name, name))
+                    cpp_read_hek_data.write("        }\n")
+                    continue
                 if not unread:
                     cpp_read_hek_data.write("            r.{}.reserve(h_{}_count);\n".format(name, name))
                 cpp_read_hek_data.write("            for(std::size_t ref = 0; ref < h_{}_count; ref++) {{\n".format(name))
@@ -99,79 +182,44 @@ def make_parse_hek_tag_data(postprocess_hek_data, all_bitfields, struct_name, al
                 cpp_read_hek_data.write("        data_size -= h_{}_size;\n".format(name))
                 cpp_read_hek_data.write("        data_read += h_{}_size;\n".format(name))
                 cpp_read_hek_data.write("        data += h_{}_size;\n".format(name))
-            elif struct["type"] == "ColorRGB":
-                cpp_read_hek_data.write("        r.{} = h.{};\n".format(name, name))
-                if "default" in struct:
-                    default = struct["default"]
-                    suffix = "F" if isinstance(default[0], float) else ""
-                    cpp_read_hek_data.write("        if(postprocess && r.{}.red {} 0 && r.{}.green {} 0 && r.{}.blue {} 0) {{\n".format(name,default_sign,name,default_sign,name,default_sign))
-                    cpp_read_hek_data.write("            r.{}.red = {}{};\n".format(name, default[0], suffix))
-                    cpp_read_hek_data.write("            r.{}.green = {}{};\n".format(name, default[1], suffix))
-                    cpp_read_hek_data.write("            r.{}.blue = {}{};\n".format(name, default[2], suffix))
-                    cpp_read_hek_data.write("        }\n")
-            elif struct["type"] == "ColorARGB" or struct["type"] == "ColorARGBInt":
-                cpp_read_hek_data.write("        r.{} = h.{};\n".format(name, name))
-                if "default" in struct:
-                    default = struct["default"]
-                    suffix = "F" if isinstance(default[0], float) else ""
-                    cpp_read_hek_data.write("        if(postprocess && r.{}.alpha {} 0 && r.{}.red {} 0 && r.{}.green {} 0 && r.{}.blue {} 0) {{\n".format(name,default_sign,name,default_sign,name,default_sign,name,default_sign))
-                    cpp_read_hek_data.write("            r.{}.alpha = {}{};\n".format(name, default[0], suffix))
-                    cpp_read_hek_data.write("            r.{}.red = {}{};\n".format(name, default[1], suffix))
-                    cpp_read_hek_data.write("            r.{}.green = {}{};\n".format(name, default[2], suffix))
-                    cpp_read_hek_data.write("            r.{}.blue = {}{};\n".format(name, default[3], suffix))
-                    cpp_read_hek_data.write("        }\n")
-            elif struct["type"] == "TagID":
-                cpp_read_hek_data.write("        r.{} = HEK::TagID::null_tag_id();\n".format(name))
-            elif "bounds" in struct and struct["bounds"]:
-                cpp_read_hek_data.write("        r.{}.from = h.{}.from;\n".format(name, name))
-                cpp_read_hek_data.write("        r.{}.to = h.{}.to;\n".format(name, name))
-                if "default" in struct:
-                    default = struct["default"]
-                    suffix = "F" if isinstance(default[0], float) else ""
-                    cpp_read_hek_data.write("        if(postprocess && r.{}.from {} 0 && r.{}.to {} 0) {{\n".format(name, default_sign, name, default_sign))
-                    cpp_read_hek_data.write("            r.{}.from = {}{};\n".format(name, default[0], suffix))
-                    cpp_read_hek_data.write("            r.{}.to = {}{};\n".format(name, default[1], suffix))
-                    cpp_read_hek_data.write("        }\n")
-            elif "count" in struct and struct["count"] > 1:
-                cpp_read_hek_data.write("        std::copy(h.{}, h.{} + {}, r.{});\n".format(name, name, struct["count"], name))
-                if "default" in struct:
-                    default = struct["default"]
-                    suffix = "F" if isinstance(default[0], float) else ""
-                    for q in range(struct["count"]):
-                        cpp_read_hek_data.write("        if(postprocess && r.{}[{}] {} 0) {{\n".format(name, q, default_sign))
-                        cpp_read_hek_data.write("            r.{}[{}] = {}{};\n".format(name, q, default[q], suffix))
-                        cpp_read_hek_data.write("        }\n")
             else:
-                added = False
-                for b in all_bitfields:
-                    if b["name"] == struct["type"]:
-                        added = True
-                        negate = ""
-                        if "cache_only" in b:
-                            added = True
-                            negate = ""
-                            for c in b["cache_only"]:
-                                for i in range(0,len(b["fields"])):
-                                    if b["fields"][i] == c:
-                                        negate = "{} & ~static_cast<std::uint{}_t>(0x{:X})".format(negate, b["width"], 1 << i)
-                                        break
-                        if "__excluded" in struct and struct["__excluded"] is not None:
-                            negate = "{} & ~static_cast<std::uint{}_t>(0x{:X})".format(negate, b["width"], struct["__excluded"])
-                            
-                        cpp_read_hek_data.write("        r.{} = static_cast<std::uint{}_t>(h.{}) & static_cast<std::uint{}_t>(0x{:X}){};\n".format(name, b["width"], name, b["width"], (1 << len(b["fields"])) - 1, negate))
-                        
-                        break
-                if not added:
-                    cpp_read_hek_data.write("        r.{} = h.{};\n".format(name, name))
-                    if "default" in struct:
-                        default = struct["default"]
-                        suffix = "F" if isinstance(default, float) else ""
-                        cpp_read_hek_data.write("        if(postprocess && r.{} {} 0) {{\n".format(name, default_sign))
-                        cpp_read_hek_data.write("            r.{} = {}{};\n".format(name, default, suffix))
-                        cpp_read_hek_data.write("        }\n")
+                read_value(struct, cpp_read_hek_data)
     if postprocess_hek_data:
         cpp_read_hek_data.write("        if(postprocess) {\n")
         cpp_read_hek_data.write("            r.postprocess_hek_data();\n")
         cpp_read_hek_data.write("        }\n")
     cpp_read_hek_data.write("        return r;\n")
     cpp_read_hek_data.write("    }\n")
+
+    # Arrays of structs that don't point to anything can be swapped all at once, then read in native endian
+    if struct_name in swap_layouts:
+        hpp.write("\n        /**\n")
+        hpp.write("         * Parse an array of structs from HEK tag data all at once.\n")
+        hpp.write("         * @param data        pointer to the first struct\n")
+        hpp.write("         * @param count       number of structs (the caller must check these are in bounds)\n")
+        hpp.write("         * @param postprocess do post-processing on data, such as default values\n")
+        hpp.write("         * @param output      vector to append the parsed structs to\n")
+        hpp.write("         */\n")
+        hpp.write("        static void parse_hek_tag_data_array(const std::byte *data, std::size_t count, bool postprocess, Vector<{}> &output);\n".format(struct_name))
+        cpp_read_hek_data.write("    void {}::parse_hek_tag_data_array(const std::byte *data, std::size_t count, [[maybe_unused]] bool postprocess, Vector<{}> &output) {{\n".format(struct_name, struct_name))
+        cpp_read_hek_data.write("        constexpr std::size_t CHUNK_SIZE = std::max<std::size_t>(1, 16384 / sizeof(struct_big));\n")
+        cpp_read_hek_data.write("        std::byte swapped[CHUNK_SIZE * sizeof(struct_big)];\n")
+        cpp_read_hek_data.write("        output.reserve(output.size() + count);\n")
+        cpp_read_hek_data.write("        for(std::size_t c = 0; c < count; c += CHUNK_SIZE) {\n")
+        cpp_read_hek_data.write("            std::size_t chunk_count = std::min(count - c, CHUNK_SIZE);\n")
+        cpp_read_hek_data.write("            std::copy(data + c * sizeof(struct_big), data + (c + chunk_count) * sizeof(struct_big), swapped);\n")
+        cpp_read_hek_data.write("            HEK::swap_endian_struct_array(swapped, chunk_count, SWAP_LAYOUT);\n")
+        cpp_read_hek_data.write("            const auto *array = reinterpret_cast<const struct_little *>(swapped);\n")
+        cpp_read_hek_data.write("            for(std::size_t i = 0; i < chunk_count; i++) {\n")
+        cpp_read_hek_data.write("                [[maybe_unused]] auto &r = output.emplace_back();\n")
+        cpp_read_hek_data.write("                [[maybe_unused]] const auto &h = array[i];\n")
+        for struct in all_used_structs:
+            if ("cache_only" in struct and struct["cache_only"]) or ("unused" in struct and struct["unused"]):
+                continue
+            value = io.StringIO()
+            read_value(struct, value)
+            for line in value.getvalue().splitlines():
+                cpp_read_hek_data.write("        {}\n".format(line))
+        cpp_read_hek_data.write("            }\n")
+        cpp_read_hek_data.write("        }\n")
+        cpp_read_hek_data.write("    }\n")
@@ -6,10 +6,12 @@ def make_parse_hek_tag_file(struct_name, hpp, cpp_read_hek_data):
     hpp.write("         * @param data        Tag file data to read from\n")
     hpp.write("         * @param data_size   Size of the tag file\n")
     hpp.write("         * @param postprocess Do post-processing on data, such as default values\n")
+    hpp.write("         * @param resource    If set, allocate the tag's reflexives from this (see ScopedAllocationResource)\n")
     hpp.write("         * @return parsed tag data\n")
     hpp.write("         */\n")
-    hpp.write("        static {} parse_hek_tag_file(const std::byte *data, std::size_t data_size, bool postprocess = false);\n".format(struct_name))
-    cpp_read_hek_data.write("    {} {}::parse_hek_tag_file(const std::byte *data, std::size_t data_size, bool postprocess) {{\n".format(struct_name, struct_name))
+    hpp.write("        static {} parse_hek_tag_file(const std::byte *data, std::size_t data_size, bool postprocess = false, std::pmr::memory_resource *resource = nullptr);\n".format(struct_name))
+    cpp_read_hek_data.write("    {} {}::parse_hek_tag_file(const std::byte *data, std::size_t data_size, bool postprocess, std::pmr::memory_resource *resource) {{\n".format(struct_name, struct_name))
+    cpp_read_hek_data.write("        ScopedAllocationResource scope(resource);\n")
     cpp_read_hek_data.write("        HEK::TagFileHeader::validate_header(reinterpret_cast<const HEK::TagFileHeader *>(data), data_size);\n")
     cpp_read_hek_data.write("        std::size_t data_read = 0;\n")
     cpp_read_hek_data.write("        std::size_t expected_data_read = data_size - sizeof(HEK::TagFileHeader);\n")
@@ -0,0 +1,123 @@
+# SPDX-License-Identifier: GPL-3.0-only
+
+def make_view_header(all_structs_arranged, hpp):
+    hpp.write("// SPDX-License-Identifier: GPL-3.0-only\n\n// This file was auto-generated.\n// If you want to edit this, edit the .json definitions and rerun the generator script, instead.\n\n")
+    header_name = "INVADER__TAG__PARSER__VIEW_HPP"
+    hpp.write("#ifndef {}\n".format(header_name))
+    hpp.write("#define {}\n\n".format(header_name))
+    hpp.write("#include \"view_struct.hpp\"\n\n")
+    hpp.write("namespace Invader::Parser::View {\n")
+    for struct in all_structs_arranged:
+        hpp.write("    class {};\n".format(struct["name"]))
+
+def make_view_source(cpp):
+    cpp.write("// SPDX-License-Identifier: GPL-3.0-only\n\n// This file was auto-generated.\n// If you want to edit this, edit the .json definitions and rerun the generator script, instead.\n\n")
+    cpp.write("#include <invader/tag/parser/view.hpp>\n")
+    cpp.write("namespace Invader::Parser::View {\n")
+
+def make_view_end(hpp, cpp):
+    hpp.write("}\n")
+    hpp.write("#endif\n")
+    cpp.write("}\n")
+
+def make_view(all_used_structs, struct_name, hpp, cpp):
+    # Only fields that point to data affect where everything after them is
+    pointer_fields = []
+    for struct in all_used_structs:
+        if struct["type"] == "TagDependency" or struct["type"] == "TagReflexive" or struct["type"] == "TagDataOffset":
+            pointer_fields.append(struct)
+
+    def is_read(struct):
+        return not (("cache_only" in struct and struct["cache_only"]) or ("unused" in struct and struct["unused"]))
+
+    hpp.write("\n    class {} : public ViewStruct {{\n".format(struct_name))
+    hpp.write("    public:\n")
+    hpp.write("        using struct_big = HEK::{}<HEK::BigEndian>;\n\n".format(struct_name))
+    hpp.write("        /**\n")
+    hpp.write("         * Get the struct (fields are converted from big endian when read)\n")
+    hpp.write("         * @return struct\n")
+    hpp.write("         */\n")
+    hpp.write("        const struct_big &get() const noexcept {\n")
+    hpp.write("            return *reinterpret_cast<const struct_big *>(this->struct_data);\n")
+    hpp.write("        }\n\n")
+    hpp.write("        const struct_big *operator->() const noexcept {\n")
+    hpp.write("            return &this->get();\n")
+    hpp.write("        }\n\n")
+    hpp.write("        /**\n")
+    hpp.write("         * Get the size of everything the struct points to, checking that it's all in bounds\n")
+    hpp.write("         * @return size in bytes\n")
+    hpp.write("         */\n")
+    hpp.write("        std::size_t get_data_size() const;\n\n")
+    hpp.write("        /**\n")
+    hpp.write("         * Call a function for every dependency in the struct and everything it points to\n")
+    hpp.write("         * @param  callback function to call for each non-null dependency\n")
+    hpp.write("         * @return          size of everything the struct points to in bytes\n")
+    hpp.write("         */\n")
+    hpp.write("        std::size_t for_each_dependency(const DependencyCallback &callback) const;\n\n")
+
+    for struct in pointer_fields:
+        if not is_read(struct):
+            continue
+        name = struct["member_name"]
+        if struct["type"] == "TagDependency":
+            hpp.write("        Dependency {}() const;\n".format(name))
+        elif struct["type"] == "TagReflexive":
+            hpp.write("        Reflexive<{}> {}() const;\n".format(struct["struct"], name))
+        elif struct["type"] == "TagDataOffset":
+            hpp.write("        std::span<const std::byte> {}() const;\n".format(name))
+
+    hpp.write("\n        /**\n")
+    hpp.write("         * View a struct\n")
+    hpp.write("         * @param struct_data pointer to the struct\n")
+    hpp.write("         * @param data        pointer to the data after the struct\n")
+    hpp.write("         * @param data_size   size of the data available after the struct\n")
+    hpp.write("         */\n")
+    hpp.write("        {}(const std::byte *struct_data, const std::byte *data, std::size_t data_size) noexcept : ViewStruct(struct_data, data, data_size) {{}}\n\n".format(struct_name))
+    hpp.write("    private:\n")
+    hpp.write("        std::size_t walk(std::size_t field_count, const DependencyCallback *callback) const;\n")
+    hpp.write("    };\n")
+
+    # Walk the data of the first field_count pointer fields
+    cpp.write("    std::size_t {}::walk([[maybe_unused]] std::size_t field_count, [[maybe_unused]] const DependencyCallback *callback) const {{\n".format(struct_name))
+    cpp.write("        std::size_t offset = 0;\n")
+    for i in range(len(pointer_fields)):
+        struct = pointer_fields[i]
+        name = struct["member_name"]
+        callback = "callback" if is_read(struct) else "nullptr"
+        cpp.write("        if(field_count == {}) {{\n".format(i))
+        cpp.write("            return offset;\n")
+        cpp.write("        }\n")
+        if struct["type"] == "TagDependency":
+            cpp.write("        offset += this->walk_dependency(this->get().{}.tag_fourcc, this->get().{}.path_size, offset, {}, \"{}::{}\");\n".format(name, name, callback, struct_name, name))
+        elif struct["type"] == "TagReflexive":
+            cpp.write("        offset += this->walk_reflexive<{}>(this->get().{}.count, offset, {}, \"{}::{}\");\n".format(struct["struct"], name, callback, struct_name, name))
+        elif struct["type"] == "TagDataOffset":
+            cpp.write("        offset += this->walk_data(this->get().{}.size, offset, \"{}::{}\");\n".format(name, struct_name, name))
+    cpp.write("        return offset;\n")
+    cpp.write("    }\n")
+
+    cpp.write("    std::size_t {}::get_data_size() const {{\n".format(struct_name))
+    cpp.write("        return this->walk({}, nullptr);\n".format(len(pointer_fields)))
+    cpp.write("    }\n")
+    cpp.write("    std::size_t {}::for_each_dependency(const DependencyCallback &callback) const {{\n".format(struct_name))
+    cpp.write("        return this->walk({}, &callback);\n".format(len(pointer_fields)))
+    cpp.write("    }\n")
+
+    for i in range(len(pointer_fields)):
+        struct = pointer_fields[i]
+        if not is_read(struct):
+            continue
+        name = struct["member_name"]
+        if struct["type"] == "TagDependency":
+            cpp.write("    Dependency {}::{}() const {{\n".format(struct_name, name))
+            cpp.write("        return this->get_dependency(this->get().{}.tag_fourcc, this->get().{}.path_size, this->walk({}, nullptr), \"{}::{}\");\n".format(name, name, i, struct_name, name))
+        elif struct["type"] == "TagReflexive":
+            cpp.write("    Reflexive<{}> {}::{}() const {{\n".format(struct["struct"], struct_name, name))
+            cpp.write("        auto offset = this->walk({}, nullptr);\n".format(i))
+            cpp.write("        std::size_t count = this->get().{}.count;\n".format(name))
+            cpp.write("        this->check_array(count, sizeof({}::struct_big), offset, \"{}::{}\");\n".format(struct["struct"], struct_name, name))
+            cpp.write("        return Reflexive<{}>(this->data + offset, this->data_size - offset, count);\n".format(struct["struct"]))
+        elif struct["type"] == "TagDataOffset":
+            cpp.write("    std::span<const std::byte> {}::{}() const {{\n".format(struct_name, name))
+            cpp.write("        return this->get_data(this->get().{}.size, this->walk({}, nullptr), \"{}::{}\");\n".format(name, i, struct_name, name))
+        cpp.write("    }\n")
@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <invader/tag/parser/allocator.hpp>
+
+namespace Invader::Parser {
+    static thread_local std::pmr::memory_resource *current_resource = nullptr;
+
+    std::pmr::memory_resource *get_allocation_resource() noexcept {
+        return current_resource != nullptr ? current_resource : std::pmr::get_default_resource();
+    }
+
+    ScopedAllocationResource::ScopedAllocationResource(std::pmr::memory_resource *resource) noexcept : previous(current_resource) {
+        if(resource != nullptr) {
+            current_resource = resource;
+        }
+    }
+
+    ScopedAllocationResource::~ScopedAllocationResource() noexcept {
+        current_resource = this->previous;
+    }
+}
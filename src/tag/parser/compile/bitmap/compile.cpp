@@ -353,8 +353,9 @@ namespace Invader::Parser {
 
                         // Insert it
                         if(needs_swizzled) {
-                            auto swizzled = Invader::Swizzle::swizzle(input, bits_per_pixel, mipmap_width, mipmap_height, mipmap_depth, false);
-                            raw_data.insert(raw_data.end(), swizzled.begin(), swizzled.end());
+                            auto offset = raw_data.size();
+                            raw_data.resize(offset + mipmap_size);
+                            Invader::Swizzle::swizzle(input, raw_data.data() + offset, bits_per_pixel, mipmap_width, mipmap_height, mipmap_depth, false);
                         }
                         else {
                             raw_data.insert(raw_data.end(), input, input + mipmap_size);
@@ -160,8 +160,7 @@ namespace Invader::Parser {
 
                             // Swizzle that stuff!
                             if(swizzled) {
-                                auto swizzled_data = Invader::Swizzle::swizzle(input, bits_per_pixel, mipmap_width, mipmap_height, mipmap_depth, true);
-                                std::memcpy(output, swizzled_data.data(), mipmap_size);
+                                Invader::Swizzle::swizzle(input, output, bits_per_pixel, mipmap_width, mipmap_height, mipmap_depth, true);
                             }
                             else {
                                 std::memcpy(output, input, mipmap_size);
@@ -770,7 +770,7 @@ namespace Invader::Parser {
         pre_compile_model(*this, workload, tag_index);
     }
 
-    template<class P, class PartVertex, class CacheVertex> static void pre_compile_model_geometry_part(P &what, BuildWorkload &workload, std::size_t tag_index, std::size_t struct_index, std::size_t struct_offset, const std::vector<PartVertex> &part_vertices, std::vector<CacheVertex> &workload_vertices) {
+    template<class P, class PartVertex, class CacheVertex> static void pre_compile_model_geometry_part(P &what, BuildWorkload &workload, std::size_t tag_index, std::size_t struct_index, std::size_t struct_offset, const Vector<PartVertex> &part_vertices, std::vector<CacheVertex> &workload_vertices) {
         auto uncompressed_vertices = sizeof(CacheVertex) == sizeof(Parser::ModelVertexUncompressed::struct_little);
 
         std::vector<HEK::Index> triangle_indices;
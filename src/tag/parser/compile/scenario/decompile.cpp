@@ -299,7 +299,7 @@ namespace Invader::Parser {
                     return str + "\r\n";
                 };
                 
-                std::vector<Parser::ScenarioSourceFile> new_sources;
+                Parser::Vector<Parser::ScenarioSourceFile> new_sources;
                 auto add_empty_source = [&new_sources]() -> Parser::ScenarioSourceFile & {
                     auto &new_source = new_sources.emplace_back();
                     std::snprintf(new_source.name.string, sizeof(new_source.name.string), "extracted_%04zu", new_sources.size() - 1);
@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cstring>
+
+#include <invader/tag/parser/view.hpp>
+#include <invader/tag/parser/parser_struct.hpp>
+#include <invader/tag/hek/header.hpp>
+#include <invader/printf.hpp>
+
+namespace Invader::Parser::View {
+    std::size_t ViewStruct::walk_dependency(TagFourCC tag_fourcc, std::size_t path_size, std::size_t offset, const DependencyCallback *callback, const char *name) const {
+        if(path_size == 0) {
+            return 0;
+        }
+        auto dependency = this->get_dependency(tag_fourcc, path_size, offset, name);
+        if(callback != nullptr) {
+            (*callback)(dependency);
+        }
+        return path_size + 1;
+    }
+
+    Dependency ViewStruct::get_dependency(TagFourCC tag_fourcc, std::size_t path_size, std::size_t offset, const char *name) const {
+        if(path_size == 0) {
+            return Dependency { tag_fourcc, std::string_view() };
+        }
+
+        std::size_t available = this->data_size - offset;
+        if(path_size + 1 > available) {
+            eprintf_error("Failed to read dependency %s: %zu bytes needed > %zu bytes available", name, path_size, available);
+            throw OutOfBoundsException();
+        }
+
+        const auto *path = reinterpret_cast<const char *>(this->data + offset);
+        if(std::memchr(path, 0, path_size) != nullptr) {
+            eprintf_error("Failed to read dependency %s: size is smaller than expected (%zu expected > %zu actual)", name, path_size, std::strlen(path));
+            throw InvalidTagDataException();
+        }
+        if(path[path_size] != 0) {
+            eprintf_error("Failed to read dependency %s: missing null terminator", name);
+            throw InvalidTagDataException();
+        }
+
+        return Dependency { tag_fourcc, std::string_view(path, path_size) };
+    }
+
+    std::size_t ViewStruct::walk_data(std::size_t size, std::size_t offset, const char *name) const {
+        this->get_data(size, offset, name);
+        return size;
+    }
+
+    std::span<const std::byte> ViewStruct::get_data(std::size_t size, std::size_t offset, const char *name) const {
+        std::size_t available = this->data_size - offset;
+        if(size > available) {
+            eprintf_error("Failed to read tag data block %s: %zu bytes needed > %zu bytes available", name, size, available);
+            throw OutOfBoundsException();
+        }
+        return std::span<const std::byte>(this->data + offset, size);
+    }
+
+    std::size_t ViewStruct::check_array(std::size_t count, std::size_t struct_size, std::size_t offset, const char *name) const {
+        std::size_t available = this->data_size - offset;
+        if(count > available / struct_size) {
+            eprintf_error("Failed to read reflexive %s: %zu bytes needed > %zu bytes available", name, count * struct_size, available);
+            throw OutOfBoundsException();
+        }
+        return count * struct_size;
+    }
+
+    void for_each_dependency_in_tag_file(const std::byte *data, std::size_t data_size, const DependencyCallback &callback) {
+        const auto *header = reinterpret_cast<const HEK::TagFileHeader *>(data);
+        HEK::TagFileHeader::validate_header(header, data_size);
+
+        const auto *tag_data = data + sizeof(*header);
+        std::size_t tag_data_size = data_size - sizeof(*header);
+        std::size_t data_read;
+
+        #define DO_TAG_CLASS(class_struct, fourcc) case TagFourCC::fourcc: { \
+            using view = Invader::Parser::View::class_struct; \
+            if(sizeof(view::struct_big) > tag_data_size) { \
+                eprintf_error("Failed to read " #class_struct " base struct: %zu bytes needed > %zu bytes available", sizeof(view::struct_big), tag_data_size); \
+                throw OutOfBoundsException(); \
+            } \
+            data_read = sizeof(view::struct_big) + view(tag_data, tag_data + sizeof(view::struct_big), tag_data_size - sizeof(view::struct_big)).for_each_dependency(callback); \
+            break; \
+        }
+
+        switch(header->tag_fourcc) {
+            DO_BASED_ON_TAG_CLASS
+
+            case Invader::HEK::TagFourCC::TAG_FOURCC_NONE:
+            case Invader::HEK::TagFourCC::TAG_FOURCC_NULL:
+            case Invader::HEK::TagFourCC::TAG_FOURCC_SPHEROID:
+            default:
+                eprintf_error("Unknown tag class %s", tag_fourcc_to_extension(header->tag_fourcc));
+                throw InvalidTagDataException();
+        }
+
+        #undef DO_TAG_CLASS
+
+        if(data_read != tag_data_size) {
+            eprintf_error("invalid tag file; tag data was left over");
+            throw InvalidTagDataException();
+        }
+    }
+}
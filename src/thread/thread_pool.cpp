@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <invader/thread/thread_pool.hpp>
+
+namespace Invader {
+    std::size_t ThreadPool::default_thread_count() noexcept {
+        auto count = std::thread::hardware_concurrency();
+        return count < 1 ? 1 : count;
+    }
+
+    ThreadPool::ThreadPool(std::size_t thread_count, std::size_t max_queued) : max_queued(max_queued) {
+        if(thread_count == 0) {
+            thread_count = default_thread_count();
+        }
+        this->threads.reserve(thread_count);
+        for(std::size_t i = 0; i < thread_count; i++) {
+            this->threads.emplace_back(&ThreadPool::work, this);
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::scoped_lock lock(this->mutex);
+            this->stopping = true;
+        }
+        this->task_available.notify_all();
+        for(auto &t : this->threads) {
+            t.join();
+        }
+    }
+
+    void ThreadPool::enqueue(std::function<void ()> &&task) {
+        {
+            std::unique_lock lock(this->mutex);
+            if(this->max_queued != 0) {
+                this->queue_not_full.wait(lock, [this]() { return this->queue.size() < this->max_queued; });
+            }
+            this->queue.emplace_back(std::move(task));
+            this->submitted++;
+        }
+        this->task_available.notify_one();
+    }
+
+    void ThreadPool::work() {
+        while(true) {
+            std::function<void ()> task;
+            {
+                std::unique_lock lock(this->mutex);
+                this->task_available.wait(lock, [this]() { return this->stopping || !this->queue.empty(); });
+
+                // Only stop once everything queued is done
+                if(this->queue.empty()) {
+                    return;
+                }
+
+                task = std::move(this->queue.front());
+                this->queue.pop_front();
+            }
+            this->queue_not_full.notify_one();
+
+            // Exceptions are held in the task's future, so this won't throw
+            task();
+            task = nullptr;
+
+            {
+                std::scoped_lock lock(this->mutex);
+                this->finished++;
+            }
+            this->task_finished.notify_all();
+        }
+    }
+
+    void ThreadPool::wait(const ProgressFunction &progress) {
+        std::unique_lock lock(this->mutex);
+        std::size_t last_finished = SIZE_MAX;
+        while(true) {
+            // Report outside of the lock so the callback can take its time (or even submit more tasks)
+            if(progress && this->finished != last_finished) {
+                last_finished = this->finished;
+                auto submitted = this->submitted;
+                lock.unlock();
+                progress(last_finished, submitted);
+                lock.lock();
+            }
+
+            if(this->finished == this->submitted) {
+                break;
+            }
+
+            this->task_finished.wait(lock, [this, &last_finished, &progress]() { return this->finished == this->submitted || (progress && this->finished != last_finished); });
+        }
+
+        this->finished = 0;
+        this->submitted = 0;
+    }
+
+    void ThreadPool::cancel() {
+        std::deque<std::function<void ()>> discarded;
+        {
+            std::scoped_lock lock(this->mutex);
+            this->cancelled = true;
+            discarded = std::move(this->queue);
+            this->queue.clear();
+            this->submitted -= discarded.size();
+        }
+        this->queue_not_full.notify_all();
+        this->task_finished.notify_all();
+
+        // Destroying the tasks breaks their promises, so anything waiting on their futures wakes up
+        discarded.clear();
+    }
+}